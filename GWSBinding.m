@@ -159,6 +159,7 @@
 - (void) removeOperationNamed: (NSString*)name
 {
   [_operations removeObjectForKey: name];
+  [_document _invalidate];
 }
 
 - (void) setDocumentation: (GWSElement*)documentation
@@ -196,6 +197,7 @@
   m = [extensibility mutableCopy];
   [_extensibility release];
   _extensibility = m;
+  [_document _invalidate];
 }
 
 - (void) setTypeName: (NSString*)type
@@ -206,6 +208,7 @@
 
       _type = [type retain];
       [old release];
+      [_document _invalidate];
     }
 }
 
@@ -36,6 +36,7 @@
 extern "C" {
 #endif
 
+@class  NSInputStream;
 @class  NSTimeZone;
 @class  GWSBinding;
 @class  GWSElement;
@@ -94,6 +95,10 @@ extern "C" {
   unsigned              _level;         // Current indentation level.
   NSMutableString       *_ms;           // Not retained.
   id                    _delegate;      // Not retained.
+  NSUInteger            _b64Threshold;  // Size to decode base64 to file
+  NSString              *_b64Directory; // Where to decode base64 to file
+  void			*_allocStats;	// Allocation profiling data
+  BOOL			_pooled;	// YES while borrowed from a pool.
 }
 
 /** Creates and returns an autoreleased instance.<br />
@@ -102,6 +107,55 @@ extern "C" {
  */
 + (GWSCoder*) coder;
 
+/** Returns a coder of the receiver's class taken from a small pool
+ * private to the current thread, or a newly created coder if that pool
+ * is empty.<br />
+ * The caller owns the returned coder (just as if it had been created
+ * using +new) and should hand it back for reuse by calling -returnCoder
+ * rather than releasing it.<br />
+ * A pooled coder has been reset (see -reset) and has no delegate, but
+ * any other settings (eg. -setCompact: or -setTimeZone:) are those left
+ * by its previous user, so callers should configure the coder as they
+ * need it.<br />
+ * Using pooled coders avoids allocating new coder internals (parse stack,
+ * namespace map and output buffer) for each message on busy paths.
+ */
++ (id) borrowCoder;
+
+/** Returns a dictionary of the allocations made while the receiver
+ * encoded or decoded messages, or nil if the library was not built with
+ * allocation profiling (GWS_ALLOC_STATS) enabled.<br />
+ * The Messages key gives the number of messages handled, and for each
+ * category of allocation (Elements, Strings, Dictionaries and Buffers)
+ * there is a key giving the total count and a key with a Bytes suffix
+ * (eg. StringsBytes) giving the approximate total size.  The Last key
+ * holds a dictionary of the same counts for the most recent message.
+ */
+- (NSDictionary*) allocationStatistics;
+
+/** Appends the base64 encoded form of source to the mutable string
+ * used by the receiver (see -mutableString) without creating an
+ * intermediate string holding the whole encoded data.
+ */
+- (void) appendBase64From: (NSData*)source;
+
+/** Reads the stream (opening it if necessary) in fixed size chunks and
+ * appends the base64 encoded form of the data read to the mutable string
+ * used by the receiver (see -mutableString), closing the stream at the
+ * end.  At no point is the whole of the data held in memory.<br />
+ * Since a stream can't be rewound, a message using a stream parameter
+ * can only be built once (so an RPC using one should not be retried or
+ * sent again).  Raises an exception if the stream has already been read
+ * to its end or closed, or if there is an error reading from it.
+ */
+- (void) appendBase64FromStream: (NSInputStream*)stream;
+
+/** Appends the hexBinary encoded form of source to the mutable string
+ * used by the receiver (see -mutableString) without creating an
+ * intermediate string holding the whole encoded data.
+ */
+- (void) appendHexBinaryFrom: (NSData*)source;
+
 /**
  * Return the value set by a prior call to -setCDATA: (or NO ... the default).
  */
@@ -122,6 +176,26 @@ extern "C" {
  */
 - (NSData*) decodeBase64From: (NSString*)str;
 
+/** Decodes length characters of base64 encoded data into the buffer
+ * supplied by the caller (which must have space for at least
+ * (length + 3) / 4 * 3 bytes) and returns the number of bytes written.
+ */
+- (NSUInteger) decodeBase64From: (const char*)chars
+			 length: (NSUInteger)length
+			   into: (void*)buffer;
+
+/** Decodes the supplied base64 encoded data in fixed size chunks,
+ * writing the result to the file at path, and returns the decoded data
+ * mapped from that file (so the decoded bytes are not held in the heap),
+ * or nil on failure (in which case the file is removed).<br />
+ * The data is written to a newly created temporary file which is then
+ * renamed to path, so any existing file (or symbolic link) at path is
+ * replaced rather than written to.<br />
+ * NB. The encoded string itself is already in memory, so this bounds
+ * only the memory used for the decoded data.
+ */
+- (NSData*) decodeBase64From: (NSString*)str toFile: (NSString*)path;
+
 /** Decode the supplied base64url encoded data and return the result.
  */
 - (NSData*) decodeBase64UrlFrom: (NSString*)str;
@@ -137,6 +211,15 @@ extern "C" {
  */
 - (NSString*) encodeBase64From: (NSData*)source;
 
+/** Encodes length bytes of data as base64 text into the buffer supplied
+ * by the caller (which must have space for at least
+ * (length + 2) / 3 * 4 characters) and returns the number of characters
+ * written.  The buffer is not nul terminated.
+ */
+- (NSUInteger) encodeBase64From: (const void*)bytes
+			 length: (NSUInteger)length
+			   into: (char*)buffer;
+
 /** Take the supplied data and convert it to base64url encoded text.
  */
 - (NSString*) encodeBase64UrlFrom: (NSData*)source;
@@ -199,6 +282,18 @@ extern "C" {
  */
 - (id) parseXSI: (NSString*)type string: (NSString*)value;
 
+/** Sets up the receiver so that, when parsing a message, any base64
+ * encoded value whose encoded size is greater than size characters is
+ * decoded into a temporary file in the specified directory (using
+ * -decodeBase64From:toFile:) rather than into memory.<br />
+ * The temporary file is removed as soon as it has been mapped (or as
+ * soon as decoding fails), so the disk space is released when the
+ * returned data object is deallocated.<br />
+ * A size of zero or a nil directory (the defaults) disables this.
+ */
+- (void) setBase64FileThreshold: (NSUInteger)size
+		      directory: (NSString*)path;
+
 /**
  * Whether characters that are illegal in xml 1.0 should be permitted in our
  * encoding.  This should be turned on for xml 1.1 use.
@@ -219,11 +314,21 @@ extern "C" {
 /**
  * Resets parsing and/or building, releasing any temporary
  * data stored during parse etc.<br />
+ * The internal buffers themselves are emptied but retained, so a
+ * coder may be reset and reused without reallocating them.<br />
  * This does not alter the effects of the -setCompact:
  * or -setCRLF: methods.
  */
 - (void) reset;
 
+/** Resets the receiver, removes its delegate, and hands it back to the
+ * pool of the current thread for reuse by a later call to +borrowCoder
+ * (the receiver is simply released if that pool is already full).<br />
+ * This must only be called by the owner of a coder obtained from
+ * +borrowCoder, and relinquishes ownership in the same way as -release.
+ */
+- (void) returnCoder;
+
 /** Specifies whether character data content of elements is output using
  * CDATA sections.  If this is NO, characters are individually escaped
  * using numeric entities when required.
@@ -634,6 +739,9 @@ typedef enum {
  * the local timezone rather than GMT), the millisecond part,
  * and (in the case that both milliseconds and 'Z' are omitted) also
  * tolerates omission of the hyphens and colons (YYYYMMDDTHHMMSS).<br />
+ * A timezone offset (+HH:MM, +HHMM or +HH) may be used in place of the Z,
+ * and the fractional seconds may have any number of digits (though only
+ * milliseconds are kept).<br />
  * Returns nil if the argument cannot be decoded.
  */
 - (NSCalendarDate*) decodeDateTimeFrom: (NSString*)source;
@@ -745,6 +853,7 @@ typedef enum {
 @protected
   NSString      *_style;        // Not retained
   BOOL          _useLiteral;
+  BOOL          _lazyBody;
 }
 
 /** Take the supplied data and return it in the format used for
@@ -755,6 +864,12 @@ typedef enum {
  */
 - (NSString*) encodeDateTimeFrom: (NSDate*)source;
 
+/** Returns YES if the receiver decodes message bodies lazily,
+ * NO otherwise (the default).<br />
+ * See -setLazyBody: for details.
+ */
+- (BOOL) lazyBody;
+
 /** Returns the style of message being used for encoding by the receiver.
  * One of
  * <ref type="constant" id="GWSSOAPBodyEncodingStyleDocument">
@@ -776,6 +891,25 @@ typedef enum {
  */
 - (void) setOperationStyle: (NSString*)style;
 
+/** Sets whether the receiver should decode message bodies lazily.<br />
+ * When this is set, -parseMessage: checks the envelope structure and
+ * decodes the SOAP Header eagerly (placing the simplified header in the
+ * result under the
+ * <ref type="constant" id="GWSSOAPMessageHeadersKey">
+ * GWSSOAPMessageHeadersKey</ref> key) and detects faults and the method
+ * name, but defers conversion of the body parameters until the
+ * <ref type="constant" id="GWSParametersKey">GWSParametersKey</ref> or
+ * <ref type="constant" id="GWSOrderKey">GWSOrderKey</ref> value is
+ * first asked for (or the result is enumerated/counted).<br />
+ * This allows routing and authentication decisions (and rejections)
+ * to be made from the header without spending time simplifying a large
+ * body which may never be used.<br />
+ * Any error encountered while decoding the body is stored in the result
+ * under the <ref type="constant" id="GWSErrorKey">GWSErrorKey</ref> key
+ * at the point where the body is decoded.
+ */
+- (void) setLazyBody: (BOOL)flag;
+
 /** Sets the encoding usage in operation to  be 'literal' (YES)
  * or encoded (NO).
  */
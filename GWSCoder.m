@@ -25,97 +25,926 @@
 
 #import <Foundation/Foundation.h>
 #import "GWSPrivate.h"
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
 
-static inline void
-decodebase64(unsigned char *dst, const unsigned char *src)
+/* Allow use of SSSE3 kernels (selected at runtime) for the codecs.
+ */
+#if	defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define	HAVE_SSSE3	1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/* Lookup tables for the base64, base64url and hexBinary codecs.
+ * The decode tables map each input byte to its value, or to one of the
+ * markers below.  The encode tables map each possible twelve bit value to
+ * the pair of base64 characters (or each byte to the pair of hex digits)
+ * representing it, so that we can encode with two lookups per three bytes.
+ */
+#define	CODEC_SKIP	0xfe	/* Character to be ignored.	*/
+#define	CODEC_STOP	0xff	/* Character ending the data.	*/
+
+static const char	*b64 =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char	*b64Url =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+static unsigned char	b64Dec[256];
+static unsigned char	b64UrlDec[256];
+static unsigned char	hexDec[256];
+static unsigned char	b64Pairs[4096][2];
+static unsigned char	b64UrlPairs[4096][2];
+static unsigned char	hexPairs[256][2];
+
+static BOOL		useSSSE3 = NO;
+
+#if	HAVE_SSSE3
+/* SSSE3 kernels for the codecs.  Each handles as much of the input as it
+ * can in blocks of sixteen bytes and returns the number of input bytes
+ * consumed, leaving the remainder (and any block containing anything but
+ * plain digits, such as white space or padding) to the table driven code.
+ * The encoders load sixteen bytes for each block, so they only consume
+ * input while at least that much is left.
+ */
+
+/* Encode twelve bytes as sixteen base64 characters at a time.
+ */
+__attribute__((target("ssse3")))
+static NSUInteger
+encodebase64SSSE3(unsigned char *dst, const unsigned char *src,
+  NSUInteger length, const char *alphabet)
+{
+  const __m128i	order = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+    7, 6, 8, 7, 10, 9, 11, 10);
+  const __m128i	offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+    '0' - 52, alphabet[62] - 62, alphabet[63] - 63, 'A', 0, 0);
+  NSUInteger	done = 0;
+
+  while (length - done >= 16)
+    {
+      __m128i	in = _mm_loadu_si128((const __m128i*)(src + done));
+      __m128i	idx;
+      __m128i	r;
+
+      /* Spread each group of three bytes over four bytes holding the
+       * six bit values, then map the values to characters by adding an
+       * offset chosen by the range each value lies in.
+       */
+      in = _mm_shuffle_epi8(in, order);
+      idx = _mm_or_si128(
+	_mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+	  _mm_set1_epi32(0x04000040)),
+	_mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+	  _mm_set1_epi32(0x01000010)));
+      r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+      r = _mm_or_si128(r, _mm_and_si128(
+	_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+      r = _mm_add_epi8(_mm_shuffle_epi8(offsets, r), idx);
+      _mm_storeu_si128((__m128i*)dst, r);
+      dst += 16;
+      done += 12;
+    }
+  return done;
+}
+
+/* Mask of the bytes in V within the range L to H (ASCII characters).
+ */
+#define	RANGE(V, L, H)	_mm_and_si128( \
+  _mm_cmpgt_epi8(V, _mm_set1_epi8((L) - 1)), \
+  _mm_cmplt_epi8(V, _mm_set1_epi8((H) + 1)))
+
+/* Decode sixteen base64 characters to twelve bytes at a time.
+ */
+__attribute__((target("ssse3")))
+static NSUInteger
+decodebase64SSSE3(unsigned char *dst, const unsigned char *src,
+  NSUInteger length, const char *alphabet)
+{
+  const __m128i	c62 = _mm_set1_epi8(alphabet[62]);
+  const __m128i	c63 = _mm_set1_epi8(alphabet[63]);
+  NSUInteger	done = 0;
+
+  while (length - done >= 16)
+    {
+      __m128i	in = _mm_loadu_si128((const __m128i*)(src + done));
+      __m128i	upper = RANGE(in, 'A', 'Z');
+      __m128i	lower = RANGE(in, 'a', 'z');
+      __m128i	digit = RANGE(in, '0', '9');
+      __m128i	p62 = _mm_cmpeq_epi8(in, c62);
+      __m128i	p63 = _mm_cmpeq_epi8(in, c63);
+      __m128i	v;
+      uint8_t	out[16];
+
+      v = _mm_or_si128(_mm_or_si128(upper, lower),
+	_mm_or_si128(digit, _mm_or_si128(p62, p63)));
+      if (_mm_movemask_epi8(v) != 0xffff)
+	{
+	  break;	// Not sixteen plain base64 digits
+	}
+      v = _mm_or_si128(
+	_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-65)),
+	  _mm_and_si128(lower, _mm_set1_epi8(-71))),
+	_mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(4)),
+	  _mm_or_si128(_mm_and_si128(p62, _mm_set1_epi8(62 - alphabet[62])),
+	    _mm_and_si128(p63, _mm_set1_epi8(63 - alphabet[63])))));
+
+      /* Merge the six bit values into 24 bits in each 32 bit lane, then
+       * gather the three bytes from each lane.
+       */
+      v = _mm_add_epi8(in, v);
+      v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+      v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+      v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+	14, 13, 12, -1, -1, -1, -1));
+      _mm_storeu_si128((__m128i*)out, v);
+      memcpy(dst, out, 12);
+      dst += 12;
+      done += 16;
+    }
+  return done;
+}
+
+/* Encode sixteen bytes as thirty two hex digits at a time.
+ */
+__attribute__((target("ssse3")))
+static NSUInteger
+encodehexSSSE3(unsigned char *dst, const unsigned char *src, NSUInteger length)
+{
+  const __m128i	digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6',
+    '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+  const __m128i	mask = _mm_set1_epi8(0x0f);
+  NSUInteger	done = 0;
+
+  while (length - done >= 16)
+    {
+      __m128i	in = _mm_loadu_si128((const __m128i*)(src + done));
+      __m128i	hi;
+      __m128i	lo;
+
+      hi = _mm_shuffle_epi8(digits,
+	_mm_and_si128(_mm_srli_epi16(in, 4), mask));
+      lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, mask));
+      _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi8(hi, lo));
+      _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+      dst += 32;
+      done += 16;
+    }
+  return done;
+}
+
+/* Decode sixteen hex digits (of either case) to eight bytes at a time.
+ */
+__attribute__((target("ssse3")))
+static NSUInteger
+decodehexSSSE3(unsigned char *dst, const unsigned char *src, NSUInteger length)
+{
+  NSUInteger	done = 0;
+
+  while (length - done >= 16)
+    {
+      __m128i	in = _mm_loadu_si128((const __m128i*)(src + done));
+      __m128i	low = _mm_or_si128(in, _mm_set1_epi8(0x20));
+      __m128i	digit = RANGE(in, '0', '9');
+      __m128i	alpha = RANGE(low, 'a', 'f');
+      __m128i	v;
+
+      if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xffff)
+	{
+	  break;	// Not sixteen plain hex digits
+	}
+      v = _mm_or_si128(
+	_mm_and_si128(digit, _mm_sub_epi8(in, _mm_set1_epi8('0'))),
+	_mm_and_si128(alpha, _mm_sub_epi8(low, _mm_set1_epi8('a' - 10))));
+      v = _mm_maddubs_epi16(v, _mm_set1_epi16(0x0110));
+      _mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(v, v));
+      dst += 8;
+      done += 16;
+    }
+  return done;
+}
+
+#undef	RANGE
+#endif	/* HAVE_SSSE3 */
+
+static void
+setupCodecTables()
 {
-  dst[0] =  (src[0]         << 2) | ((src[1] & 0x30) >> 4);
-  dst[1] = ((src[1] & 0x0F) << 4) | ((src[2] & 0x3C) >> 2);
-  dst[2] = ((src[2] & 0x03) << 6) |  (src[3] & 0x3F);
+  const char	*hex = "0123456789ABCDEF";
+  unsigned	i;
+
+#if	HAVE_SSSE3
+  {
+    unsigned	a, b, c, d;
+
+    if (0 != __get_cpuid(1, &a, &b, &c, &d) && 0 != (c & bit_SSSE3))
+      {
+	useSSSE3 = YES;
+      }
+  }
+#endif
+
+  for (i = 0; i < 256; i++)
+    {
+      b64Dec[i] = CODEC_SKIP;		// Standard base64 ignores junk
+      b64UrlDec[i] = CODEC_STOP;	// Base64url stops at junk
+      if (isspace(i))
+	{
+	  hexDec[i] = CODEC_SKIP;
+	}
+      else
+	{
+	  hexDec[i] = CODEC_STOP;
+	}
+      hexPairs[i][0] = hex[i >> 4];
+      hexPairs[i][1] = hex[i & 0x0f];
+    }
+  for (i = 0; i < 64; i++)
+    {
+      b64Dec[(unsigned char)b64[i]] = i;
+      b64UrlDec[(unsigned char)b64Url[i]] = i;
+    }
+  b64Dec['-'] = CODEC_STOP;
+  b64Dec[0] = CODEC_STOP;
+  b64UrlDec[0] = CODEC_STOP;
+  for (i = 0; i < 10; i++)
+    {
+      hexDec['0' + i] = i;
+    }
+  for (i = 0; i < 6; i++)
+    {
+      hexDec['A' + i] = 10 + i;
+      hexDec['a' + i] = 10 + i;
+    }
+  for (i = 0; i < 4096; i++)
+    {
+      b64Pairs[i][0] = b64[i >> 6];
+      b64Pairs[i][1] = b64[i & 077];
+      b64UrlPairs[i][0] = b64Url[i >> 6];
+      b64UrlPairs[i][1] = b64Url[i & 077];
+    }
 }
 
+/* Encode length bytes from src into dst using the supplied alphabet and
+ * table of character pairs, padding with '=' characters if pad is YES.
+ * Returns the number of characters written.
+ */
+static NSUInteger
+encodebase64(unsigned char *dst, const unsigned char *src, NSUInteger length,
+  const char *alphabet, unsigned char (*pairs)[2], BOOL pad)
+{
+  const unsigned char	*end = src + length - (length % 3);
+  unsigned char		*d = dst;
+  unsigned		v;
+
+#if	HAVE_SSSE3
+  if (YES == useSSSE3)
+    {
+      NSUInteger	n = encodebase64SSSE3(d, src, end - src, alphabet);
+
+      src += n;
+      d += n / 3 * 4;
+    }
+#endif
+  while (src < end)
+    {
+      v = (src[0] << 16) | (src[1] << 8) | src[2];
+      memcpy(d, pairs[v >> 12], 2);
+      memcpy(d + 2, pairs[v & 0xfff], 2);
+      src += 3;
+      d += 4;
+    }
+
+  /* If len was not a multiple of 3, we must encode the final one or two
+   * bytes.  Standard base64 encoding pads to a multiple of four characters
+   * using '=' while base64url simply omits the excess characters.
+   */
+  if (length % 3 == 2)
+    {
+      v = (src[0] << 16) | (src[1] << 8);
+      *d++ = alphabet[v >> 18];
+      *d++ = alphabet[(v >> 12) & 077];
+      *d++ = alphabet[(v >> 6) & 077];
+      if (YES == pad)
+	{
+	  *d++ = '=';
+	}
+    }
+  else if (length % 3 == 1)
+    {
+      v = src[0] << 16;
+      *d++ = alphabet[v >> 18];
+      *d++ = alphabet[(v >> 12) & 077];
+      if (YES == pad)
+	{
+	  *d++ = '=';
+	  *d++ = '=';
+	}
+    }
+  return d - dst;
+}
+
+static NSUInteger
+encodehex(unsigned char *dst, const unsigned char *src, NSUInteger length)
+{
+  NSUInteger	i = 0;
+
+#if	HAVE_SSSE3
+  if (YES == useSSSE3)
+    {
+      i = encodehexSSSE3(dst, src, length);
+      dst += i * 2;
+    }
+#endif
+  for (; i < length; i++)
+    {
+      memcpy(dst, hexPairs[src[i]], 2);
+      dst += 2;
+    }
+  return length * 2;
+}
+
+/* State carried between successive chunks of data being decoded.
+ */
+typedef struct {
+  const unsigned char	*table;	// Decode table in use
+  unsigned		val;	// Accumulated bits
+  unsigned		pos;	// Number of digits accumulated in val
+  BOOL			done;	// Reached the end of the data
+} codecState;
+
+/* Decode base64 characters from src into dst, returning the number of
+ * bytes written.  Complete groups of four valid characters are handled
+ * directly, anything else goes through the slower per-character path.
+ */
+static NSUInteger
+decodebase64(codecState *s, unsigned char *dst, const unsigned char *src,
+  NSUInteger length)
+{
+  const unsigned char	*table = s->table;
+  const unsigned char	*end = src + length;
+  unsigned char		*d = dst;
+
+  while (src < end && NO == s->done)
+    {
+      unsigned	c;
+
+      if (0 == s->pos)
+	{
+#if	HAVE_SSSE3
+	  if (YES == useSSSE3 && end - src >= 16)
+	    {
+	      NSUInteger	n;
+
+	      n = decodebase64SSSE3(d, src, end - src,
+		(b64Dec == table) ? b64 : b64Url);
+	      src += n;
+	      d += n / 4 * 3;
+	    }
+#endif
+	  while (end - src >= 4)
+	    {
+	      unsigned	c0 = table[src[0]];
+	      unsigned	c1 = table[src[1]];
+	      unsigned	c2 = table[src[2]];
+	      unsigned	c3 = table[src[3]];
+	      unsigned	v;
+
+	      if ((c0 | c1 | c2 | c3) & 0xc0)
+		{
+		  break;	// Not four plain base64 digits
+		}
+	      v = (c0 << 18) | (c1 << 12) | (c2 << 6) | c3;
+	      d[0] = v >> 16;
+	      d[1] = v >> 8;
+	      d[2] = v;
+	      d += 3;
+	      src += 4;
+	    }
+	  if (src == end)
+	    {
+	      break;
+	    }
+	}
+      c = table[*src++];
+      if (c < 64)
+	{
+	  s->val = (s->val << 6) | c;
+	  if (++s->pos == 4)
+	    {
+	      d[0] = s->val >> 16;
+	      d[1] = s->val >> 8;
+	      d[2] = s->val;
+	      d += 3;
+	      s->val = 0;
+	      s->pos = 0;
+	    }
+	}
+      else if (CODEC_STOP == c)
+	{
+	  s->done = YES;
+	}
+    }
+  return d - dst;
+}
+
+/* Write out any bytes from a final partial group of base64 characters.
+ */
+static NSUInteger
+decodebase64Tail(codecState *s, unsigned char *dst)
+{
+  NSUInteger	count = 0;
+
+  if (s->pos > 1)
+    {
+      unsigned	v = s->val << (6 * (4 - s->pos));
+
+      dst[count++] = v >> 16;
+      if (s->pos > 2)
+	{
+	  dst[count++] = v >> 8;
+	}
+    }
+  s->val = 0;
+  s->pos = 0;
+  return count;
+}
+
+/* Decode hex digits (ignoring white space) from src into dst, returning
+ * the number of bytes written.  Sets s->done and leaves s->pos non-zero
+ * if a character other than a hex digit or white space is found.
+ */
+static NSUInteger
+decodehex(codecState *s, unsigned char *dst, const unsigned char *src,
+  NSUInteger length)
+{
+  const unsigned char	*end = src + length;
+  unsigned char		*d = dst;
+
+  while (src < end && NO == s->done)
+    {
+      unsigned	c;
+
+      if (0 == s->pos)
+	{
+#if	HAVE_SSSE3
+	  if (YES == useSSSE3 && end - src >= 16)
+	    {
+	      NSUInteger	n = decodehexSSSE3(d, src, end - src);
+
+	      src += n;
+	      d += n / 2;
+	    }
+#endif
+	  while (end - src >= 2)
+	    {
+	      unsigned	hi = hexDec[src[0]];
+	      unsigned	lo = hexDec[src[1]];
+
+	      if ((hi | lo) & 0xf0)
+		{
+		  break;	// Not two plain hex digits
+		}
+	      *d++ = (hi << 4) | lo;
+	      src += 2;
+	    }
+	  if (src == end)
+	    {
+	      break;
+	    }
+	}
+      c = hexDec[*src++];
+      if (c < 16)
+	{
+	  if (0 == s->pos)
+	    {
+	      s->val = c << 4;
+	      s->pos = 1;
+	    }
+	  else
+	    {
+	      *d++ = s->val | c;
+	      s->pos = 0;
+	    }
+	}
+      else if (CODEC_STOP == c)
+	{
+	  s->done = YES;
+	  if (src[-1] != '\0')
+	    {
+	      s->pos = 1;		// Indicate problem
+	    }
+	}
+    }
+  return d - dst;
+}
+
+/* Decode the ASCII characters of str in fixed size chunks using the
+ * supplied function, so that we don't need an intermediate copy of the
+ * whole string.  The result buffer is allocated to hold declen bytes.
+ * Sets *bytes to the allocated buffer and returns the number of bytes
+ * decoded, or returns NSNotFound (freeing the buffer) if the string
+ * contains non-ASCII characters.
+ */
+static NSUInteger
+decodeString(NSString *str, codecState *s, NSUInteger declen,
+  NSUInteger (*func)(codecState*, unsigned char*, const unsigned char*,
+  NSUInteger), unsigned char **bytes)
+{
+  unsigned char	chunk[4096];
+  unsigned char	*result;
+  NSUInteger	count = 0;
+  NSRange	r = NSMakeRange(0, [str length]);
+
+  result = (unsigned char*)NSZoneMalloc(NSDefaultMallocZone(), declen + 3);
+  GWS_ALLOC(GWSAllocBuffers, declen + 3);
+  while (r.length > 0 && NO == s->done)
+    {
+      NSUInteger	used = 0;
+
+      [str getBytes: chunk
+	  maxLength: sizeof(chunk)
+	 usedLength: &used
+	   encoding: NSASCIIStringEncoding
+	    options: 0
+	      range: r
+     remainingRange: &r];
+      if (0 == used)
+	{
+	  NSZoneFree(NSDefaultMallocZone(), result);
+	  *bytes = 0;
+	  return NSNotFound;	// Not an ASCII string
+	}
+      count += (*func)(s, result + count, chunk, used);
+    }
+  *bytes = result;
+  return count;
+}
+
+/* Append ASCII characters from a buffer to a mutable string without
+ * making an intermediate copy of the buffer.
+ */
+static void
+appendASCII(NSMutableString *ms, const unsigned char *buf, NSUInteger length)
+{
+  NSString	*str;
+
+  str = [[NSString alloc] initWithBytesNoCopy: (void*)buf
+				       length: length
+				     encoding: NSASCIIStringEncoding
+				 freeWhenDone: NO];
+  [ms appendString: str];
+  [str release];
+}
+
+
+/* Seconds from the unix epoch (1970) to the reference date (2001).
+ */
+#define	EPOCHOFFSET	978307200
+
+/* Timezones with a fixed offset from GMT are cached (indexed by offset
+ * in quarter hours) so that parsing a date/time does not need to look
+ * one up every time.  Other offsets are rare and are not cached.
+ */
+#define	ZONEMAX		(14 * 3600)
+#define	ZONESTEP	900
+
+static NSLock		*zoneLock = nil;
+static NSTimeZone	*zones[2 * ZONEMAX / ZONESTEP + 1];
+
+static NSTimeZone *
+zoneForOffset(int offset)
+{
+  NSTimeZone	*z;
+  int		i;
+
+  if (offset % ZONESTEP != 0 || offset < -ZONEMAX || offset > ZONEMAX)
+    {
+      return [NSTimeZone timeZoneForSecondsFromGMT: offset];
+    }
+  i = (offset + ZONEMAX) / ZONESTEP;
+  if (nil == (z = zones[i]))
+    {
+      [zoneLock lock];
+      if (nil == (z = zones[i]))
+	{
+	  z = [[NSTimeZone timeZoneForSecondsFromGMT: offset] retain];
+	  zones[i] = z;
+	}
+      [zoneLock unlock];
+    }
+  return z;
+}
+
+/* Convert between a proleptic gregorian calendar date and a count of
+ * days since 1970-01-01.
+ */
+static int64_t
+daysFromCivil(int64_t y, int m, int d)
+{
+  int64_t	era;
+  int64_t	yoe;
+  int64_t	doy;
+
+  y -= (m <= 2) ? 1 : 0;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+static void
+civilFromDays(int64_t z, GWSDateTime *dt)
+{
+  int64_t	era;
+  int64_t	doe;
+  int64_t	yoe;
+  int64_t	doy;
+  int64_t	mp;
+
+  z += 719468;
+  era = (z >= 0 ? z : z - 146096) / 146097;
+  doe = z - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  dt->day = (int)(doy - (153 * mp + 2) / 5 + 1);
+  dt->month = (int)(mp < 10 ? mp + 3 : mp - 9);
+  dt->year = (int)(yoe + era * 400 + (dt->month <= 2 ? 1 : 0));
+}
+
+/* Return the value of n decimal digits at s, or -1 if they are not all
+ * digits.
+ */
 static int
-encodebase64(unsigned char *dst, const unsigned char *src, int length)
-{
-  static char b64[]
-    = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-  int	dIndex = 0;
-  int	sIndex;
-
-  for (sIndex = 0; sIndex < length; sIndex += 3)
-    {
-      int	c0 = src[sIndex];
-      int	c1 = (sIndex+1 < length) ? src[sIndex+1] : 0;
-      int	c2 = (sIndex+2 < length) ? src[sIndex+2] : 0;
-
-      dst[dIndex++] = b64[(c0 >> 2) & 077];
-      dst[dIndex++] = b64[((c0 << 4) & 060) | ((c1 >> 4) & 017)];
-      dst[dIndex++] = b64[((c1 << 2) & 074) | ((c2 >> 6) & 03)];
-      dst[dIndex++] = b64[c2 & 077];
-    }
-
-   /* If len was not a multiple of 3, then we have encoded too
-    * many characters.  Standard base64 encoding pads, so we must
-    * overwrite the excess characters with the pad character ('=').
-    */
-   if (sIndex == length + 1)
-     {
-       /* There were only 2 bytes in that last group */
-       dst[dIndex - 1] = '=';
-     }
-   else if (sIndex == length + 2)
-     {
-       /* There was only 1 byte in that last group */
-       dst[dIndex - 1] = '=';
-       dst[dIndex - 2] = '=';
-     }
-  return dIndex;
+digits(const unsigned char *s, int n)
+{
+  int	v = 0;
+
+  while (n-- > 0)
+    {
+      if (*s < '0' || *s > '9')
+	{
+	  return -1;
+	}
+      v = v * 10 + *s++ - '0';
+    }
+  return v;
 }
 
+/* Return the value of the one or two decimal digits at *s (which must
+ * be followed by sep unless sep is zero) and step past them and the
+ * separator, or return -1 if there is no digit or separator.
+ */
 static int
-encodebase64Url(unsigned char *dst, const unsigned char *src, int length)
+field(const unsigned char **s, const unsigned char *e, unsigned char sep)
 {
-  static char b64[]
-    = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
-  int	dIndex = 0;
-  int	sIndex;
+  const unsigned char	*p = *s;
+  int			v;
 
-  for (sIndex = 0; sIndex < length; sIndex += 3)
+  if (p >= e || *p < '0' || *p > '9')
+    {
+      return -1;
+    }
+  v = *p++ - '0';
+  if (p < e && *p >= '0' && *p <= '9')
+    {
+      v = v * 10 + *p++ - '0';
+    }
+  if (sep != 0)
     {
-      int	c0 = src[sIndex];
-      int	c1 = (sIndex+1 < length) ? src[sIndex+1] : 0;
-      int	c2 = (sIndex+2 < length) ? src[sIndex+2] : 0;
+      if (p >= e || *p != sep)
+	{
+	  return -1;
+	}
+      p++;
+    }
+  *s = p;
+  return v;
+}
 
-      dst[dIndex++] = b64[(c0 >> 2) & 077];
-      dst[dIndex++] = b64[((c0 << 4) & 060) | ((c1 >> 4) & 017)];
-      dst[dIndex++] = b64[((c1 << 2) & 074) | ((c2 >> 6) & 03)];
-      dst[dIndex++] = b64[c2 & 077];
+/* Parse a date/time of the form [-]YYYY-MM-DDTHH:MM:SS (where either or
+ * both of the date and time may be in the basic format without separators)
+ * followed by optional fractional seconds and timezone.  In the extended
+ * format the fields after the year may have a single digit.
+ * A negative year is before year zero (1 BCE) as in XSD 1.1 and ISO 8601,
+ * and 24:00:00 (with no fraction) is the end of the day.
+ */
+static int
+parseDateTime(const unsigned char *s, int l, GWSDateTime *dt)
+{
+  const unsigned char	*e = s + l;
+  BOOL			negative = NO;
+  BOOL			fraction = NO;
+  int			n;
+  int			zone;
+
+  if (s < e && '-' == *s)
+    {
+      negative = YES;
+      s++;
+    }
+  for (n = 0; s + n < e && s[n] >= '0' && s[n] <= '9'; n++)
+    ;
+  if (8 == n)
+    {
+      dt->year = digits(s, 4);
+      dt->month = digits(s + 4, 2);
+      dt->day = digits(s + 6, 2);
+      s += 8;
+    }
+  else if (n >= 4 && n <= 9 && s + n < e && '-' == s[n])
+    {
+      dt->year = digits(s, n);
+      s += n + 1;
+      if ((dt->month = field(&s, e, '-')) < 0
+	|| (dt->day = field(&s, e, 0)) < 0)
+	{
+	  return -1;
+	}
+    }
+  else
+    {
+      return -1;
+    }
+  if (YES == negative)
+    {
+      dt->year = -dt->year;
+    }
+  if (s >= e || *s++ != 'T')
+    {
+      return -1;
+    }
+  for (n = 0; s + n < e && s[n] >= '0' && s[n] <= '9'; n++)
+    ;
+  if (6 == n)
+    {
+      dt->hour = digits(s, 2);
+      dt->minute = digits(s + 2, 2);
+      dt->second = digits(s + 4, 2);
+      s += 6;
+    }
+  else if ((dt->hour = field(&s, e, ':')) < 0
+    || (dt->minute = field(&s, e, ':')) < 0
+    || (dt->second = field(&s, e, 0)) < 0)
+    {
+      return -1;
+    }
+  if (dt->month < 1 || dt->month > 12 || dt->day < 1 || dt->day > 31
+    || dt->hour < 0 || dt->hour > 24 || dt->minute < 0 || dt->minute > 59
+    || dt->second < 0 || dt->second > 60)
+    {
+      return -1;
     }
 
-   /* If len was not a multiple of 3, then we have encoded too
-    * many characters.  Base64URL encoding uses no padding, so
-    * we simply remove the excess characters.
-    */
-   if (sIndex == length + 1)
-     {
-       /* There were only 2 bytes in that last group */
-       dst[--dIndex] = '\0';
-     }
-   else if (sIndex == length + 2)
-     {
-       /* There was only 1 byte in that last group */
-       dst[--dIndex] = '\0';
-       dst[--dIndex] = '\0';
-     }
-  return dIndex;
-}
+  dt->milli = 0;
+  if (s < e && '.' == *s)
+    {
+      int	scale = 100;
+
+      s++;
+      if (s >= e || *s < '0' || *s > '9')
+	{
+	  return -1;
+	}
+      while (s < e && *s >= '0' && *s <= '9')
+	{
+	  if (*s != '0')
+	    {
+	      fraction = YES;
+	    }
+	  dt->milli += (*s++ - '0') * scale;
+	  scale /= 10;
+	}
+    }
+  if (24 == dt->hour
+    && (dt->minute != 0 || dt->second != 0 || YES == fraction))
+    {
+      return -1;
+    }
 
+  dt->offset = 0;
+  if (s == e)
+    {
+      zone = 0;
+    }
+  else if ('Z' == *s && e - s == 1)
+    {
+      zone = 1;
+    }
+  else if ('+' == *s || '-' == *s)
+    {
+      int	h;
+      int	m;
+
+      l = e - s;
+      h = (l >= 3) ? digits(s + 1, 2) : -1;
+      if (3 == l)
+	{
+	  m = 0;			// HH (sloppy, just the hour)
+	}
+      else if (5 == l)
+	{
+	  m = digits(s + 3, 2);		// HHMM (sloppy, missing colon)
+	}
+      else if (6 == l && ':' == s[3])
+	{
+	  m = digits(s + 4, 2);		// HH:MM (standard format)
+	}
+      else
+	{
+	  return -1;
+	}
+      if (h < 0 || h > 23 || m < 0 || m > 59)
+	{
+	  return -1;
+	}
+      dt->offset = (h * 60 + m) * 60;
+      if ('-' == *s)
+	{
+	  dt->offset = -dt->offset;
+	}
+      zone = 1;
+    }
+  else
+    {
+      return -1;
+    }
+  return zone;
+}
 
 @class  GWSXMLRPCCoder;
 
 static Class _defaultParserClass;
 static Class _sloppyParserClass;
 
+/* Maximum number of coders of each class kept in a thread's pool.
+ */
+#define POOLMAX 8
+
+static NSString * const poolKey = @"GWSCoderPool";
+
+static NSMutableArray *
+threadPool(Class c)
+{
+  NSMutableDictionary   *d;
+  NSMutableArray        *a;
+
+  d = [[[NSThread currentThread] threadDictionary] objectForKey: poolKey];
+  if (nil == d)
+    {
+      d = [NSMutableDictionary new];
+      [[[NSThread currentThread] threadDictionary] setObject: d
+                                                      forKey: poolKey];
+      [d release];
+    }
+  a = [d objectForKey: NSStringFromClass(c)];
+  if (nil == a)
+    {
+      a = [[NSMutableArray alloc] initWithCapacity: POOLMAX];
+      [d setObject: a forKey: NSStringFromClass(c)];
+      [a release];
+    }
+  return a;
+}
+
+#if	defined(GWS_ALLOC_STATS) && GWS_ALLOC_STATS
+/* Allocation counts for the current thread, and the coder (if any) which
+ * is counting them for the message it is currently handling.
+ */
+__thread GWSAllocCounts		gwsAllocCounts;
+static __thread GWSCoder	*allocOwner = nil;
+static __thread unsigned	allocDepth = 0;		// Nested calls
+
+typedef struct {
+  uint64_t		messages;
+  GWSAllocCounts	start;	// Thread counts at start of message
+  GWSAllocCounts	last;	// Counts for most recent message
+  GWSAllocCounts	total;	// Counts for all messages
+} AllocStats;
+
+static NSMutableDictionary *
+allocInfo(GWSAllocCounts *c)
+{
+  static NSString	*names[GWSAllocCategories] = {
+    @"Elements", @"Strings", @"Dictionaries", @"Buffers"
+  };
+  NSMutableDictionary	*d;
+  unsigned		i;
+
+  d = [NSMutableDictionary dictionaryWithCapacity: GWSAllocCategories * 2];
+  for (i = 0; i < GWSAllocCategories; i++)
+    {
+      [d setObject: [NSNumber numberWithUnsignedLongLong: c->count[i]]
+	    forKey: names[i]];
+      [d setObject: [NSNumber numberWithUnsignedLongLong: c->bytes[i]]
+	    forKey: [names[i] stringByAppendingString: @"Bytes"]];
+    }
+  return d;
+}
+#endif
+
 @implementation	GWSCoder
 
 static id       boolN;
@@ -136,10 +965,32 @@ static id       boolY;
   return [coder autorelease];
 }
 
++ (id) borrowCoder
+{
+  NSMutableArray        *a;
+  GWSCoder              *coder;
+
+  a = threadPool(self);
+  coder = [a lastObject];
+  if (nil == coder)
+    {
+      coder = [self new];
+    }
+  else
+    {
+      [coder retain];
+      [a removeLastObject];
+    }
+  coder->_pooled = YES;
+  return coder;
+}
+
 + (void) initialize
 {
   if (self == [GWSCoder class])
     {
+      setupCodecTables();
+      zoneLock = [NSLock new];
       boolN = [[NSNumber numberWithBool: NO] retain];
       boolY = [[NSNumber numberWithBool: YES] retain];
       _defaultParserClass = [NSXMLParser class];
@@ -158,6 +1009,119 @@ static id       boolY;
     }
 }
 
+- (NSDictionary*) allocationStatistics
+{
+#if	defined(GWS_ALLOC_STATS) && GWS_ALLOC_STATS
+  AllocStats		*a = (AllocStats*)_allocStats;
+  NSMutableDictionary	*d;
+
+  if (0 == a)
+    {
+      return [NSDictionary dictionaryWithObject:
+	[NSNumber numberWithUnsignedInt: 0] forKey: @"Messages"];
+    }
+  d = allocInfo(&a->total);
+  [d setObject: [NSNumber numberWithUnsignedLongLong: a->messages]
+	forKey: @"Messages"];
+  [d setObject: allocInfo(&a->last) forKey: @"Last"];
+  return d;
+#else
+  return nil;
+#endif
+}
+
+- (void) appendBase64From: (NSData*)source
+{
+  const unsigned char	*src = (const unsigned char*)[source bytes];
+  NSUInteger		length = [source length];
+  unsigned char		chunk[4096];
+
+  /* Encode a multiple of three bytes at a time, so that padding can only
+   * be needed in the last chunk.
+   */
+  while (length > 0)
+    {
+      NSUInteger	len = (length > 3072) ? 3072 : length;
+
+      appendASCII(_ms, chunk,
+	encodebase64(chunk, src, len, b64, b64Pairs, YES));
+      src += len;
+      length -= len;
+    }
+}
+
+- (void) appendBase64FromStream: (NSInputStream*)stream
+{
+  unsigned char	buf[3072];
+  unsigned char	chunk[4096];
+  NSUInteger	have = 0;
+  NSInteger	got;
+
+  switch ([stream streamStatus])
+    {
+      case NSStreamStatusNotOpen:
+	[stream open];
+	break;
+      case NSStreamStatusAtEnd:
+      case NSStreamStatusClosed:
+	/* A stream can't be rewound, so once its data has been encoded
+	 * it can't be used to build another message.
+	 */
+	[NSException raise: NSInvalidArgumentException
+		    format: @"Base64 data stream has already been read"];
+	break;
+      default:
+	break;
+    }
+  while ((got = [stream read: buf + have maxLength: sizeof(buf) - have]) > 0)
+    {
+      NSUInteger	len;
+
+      /* Only encode complete groups of three bytes until the end of the
+       * stream, so that we don't add padding in the middle of the data.
+       */
+      have += got;
+      len = have - (have % 3);
+      if (len > 0)
+	{
+	  appendASCII(_ms, chunk,
+	    encodebase64(chunk, buf, len, b64, b64Pairs, YES));
+	  memmove(buf, buf + len, have - len);
+	  have -= len;
+	}
+    }
+  if (got < 0)
+    {
+      NSError	*e = [stream streamError];
+
+      [stream close];
+      [NSException raise: NSInvalidArgumentException
+		  format: @"Error reading base64 data stream: %@", e];
+    }
+  if (have > 0)
+    {
+      appendASCII(_ms, chunk,
+	encodebase64(chunk, buf, have, b64, b64Pairs, YES));
+    }
+  [stream close];
+}
+
+- (void) appendHexBinaryFrom: (NSData*)source
+{
+  const unsigned char	*src = (const unsigned char*)[source bytes];
+  NSUInteger		length = [source length];
+  unsigned char		chunk[4096];
+
+  while (length > 0)
+    {
+      NSUInteger	len = (length > 2048) ? 2048 : length;
+
+      appendASCII(_ms, chunk, encodehex(chunk, src, len));
+      src += len;
+      length -= len;
+    }
+}
+
 - (BOOL) cdata
 {
   return _cdata;
@@ -174,6 +1138,15 @@ static id       boolY;
   [_nmap release];
   [_ms release];
   [_tz release];
+  [_b64Directory release];
+#if	defined(GWS_ALLOC_STATS) && GWS_ALLOC_STATS
+  if (allocOwner == self)
+    {
+      allocOwner = nil;
+      allocDepth = 0;
+    }
+  free(_allocStats);
+#endif
   [super dealloc];
 }
 
@@ -184,272 +1157,220 @@ static id       boolY;
 
 - (NSData*) decodeBase64From: (NSString*)str
 {
-  NSData        *source = [str dataUsingEncoding: NSASCIIStringEncoding];
-  int		length;
-  int		declen;
-  const unsigned char	*src;
-  const unsigned char	*end;
-  unsigned char *result;
-  unsigned char	*dst;
-  unsigned char	buf[4];
-  unsigned	pos = 0;
+  codecState	s;
+  unsigned char	*result;
+  NSUInteger	length;
+  NSUInteger	count;
 
-  if (source == nil)
+  if (str == nil)
     {
       return nil;
     }
-  length = [source length];
+  length = [str length];
   if (length == 0)
     {
       return [NSData data];
     }
-  declen = ((length + 3) * 3)/4;
-  src = (const unsigned char*)[source bytes];
-  end = &src[length];
-
-  result = (unsigned char*)NSZoneMalloc(NSDefaultMallocZone(), declen);
-  dst = result;
-
-  while ((src != end) && *src != '\0')
+  memset(&s, '\0', sizeof(s));
+  s.table = b64Dec;
+  count = decodeString(str, &s, ((length + 3) * 3)/4, decodebase64, &result);
+  if (NSNotFound == count)
     {
-      int	c = *src++;
-
-      if (isupper(c))
-	{
-	  c -= 'A';
-	}
-      else if (islower(c))
-	{
-	  c = c - 'a' + 26;
-	}
-      else if (isdigit(c))
-	{
-	  c = c - '0' + 52;
-	}
-      else if (c == '/')
-	{
-	  c = 63;
-	}
-      else if (c == '+')
-	{
-	  c = 62;
-	}
-      else if  (c == '=')
-	{
-	  c = -1;
-	}
-      else if (c == '-')
-	{
-	  break;		/* end    */
-	}
-      else
-	{
-	  c = -1;		/* ignore */
-	}
+      return nil;
+    }
+  count += decodebase64Tail(&s, result + count);
+  return [[[NSData allocWithZone: NSDefaultMallocZone()]
+    initWithBytesNoCopy: result length: count] autorelease];
+}
 
-      if (c >= 0)
+- (NSData*) decodeBase64From: (NSString*)str toFile: (NSString*)path
+{
+  unsigned char	chunk[4096];
+  unsigned char	out[3075];
+  codecState	s;
+  NSRange	r;
+  const char	*dst;
+  char		*tmp;
+  FILE		*f;
+  int		fd;
+  volatile BOOL	ok = YES;
+
+  if (str == nil)
+    {
+      return nil;
+    }
+  /* Write to a new file which nobody else can have created (mkstemp()
+   * uses O_EXCL, so it will not follow a link planted in the directory)
+   * and rename it into place once complete, so that an existing file or
+   * symbolic link at path is replaced rather than written through.
+   */
+  dst = [path fileSystemRepresentation];
+  tmp = (char*)NSZoneMalloc(NSDefaultMallocZone(), strlen(dst) + 8);
+  strcpy(tmp, dst);
+  strcat(tmp, ".XXXXXX");
+  if ((fd = mkstemp(tmp)) < 0)
+    {
+      NSZoneFree(NSDefaultMallocZone(), tmp);
+      return nil;
+    }
+  if (0 == (f = fdopen(fd, "wb")))
+    {
+      close(fd);
+      unlink(tmp);
+      NSZoneFree(NSDefaultMallocZone(), tmp);
+      return nil;
+    }
+  memset(&s, '\0', sizeof(s));
+  s.table = b64Dec;
+  r = NSMakeRange(0, [str length]);
+  NS_DURING
+    {
+      while (YES == ok && r.length > 0 && NO == s.done)
 	{
-	  buf[pos++] = c;
-	  if (pos == 4)
+	  NSUInteger	used = 0;
+	  NSUInteger	count;
+
+	  [str getBytes: chunk
+	      maxLength: sizeof(chunk)
+	     usedLength: &used
+	       encoding: NSASCIIStringEncoding
+		options: 0
+		  range: r
+	 remainingRange: &r];
+	  if (0 == used)
 	    {
-	      pos = 0;
-	      decodebase64(dst, buf);
-	      dst += 3;
+	      ok = NO;	// Not an ASCII string
+	    }
+	  else
+	    {
+	      count = decodebase64(&s, out, chunk, used);
+	      if (count > 0 && fwrite(out, 1, count, f) != count)
+		{
+		  ok = NO;
+		}
 	    }
 	}
     }
-
-  if (pos > 0)
+  NS_HANDLER
+    {
+      fclose(f);
+      unlink(tmp);
+      NSZoneFree(NSDefaultMallocZone(), tmp);
+      [localException raise];
+    }
+  NS_ENDHANDLER
+  if (YES == ok)
     {
-      unsigned	i;
+      NSUInteger	count = decodebase64Tail(&s, out);
 
-      for (i = pos; i < 4; i++)
+      if (count > 0 && fwrite(out, 1, count, f) != count)
 	{
-	  buf[i] = '\0';
+	  ok = NO;
 	}
-      pos--;
-      if (pos > 0)
+    }
+  if (fclose(f) != 0)
+    {
+      ok = NO;
+    }
+  if (YES == ok && rename(tmp, dst) == 0)
+    {
+      NSData	*d;
+
+      NSZoneFree(NSDefaultMallocZone(), tmp);
+      d = [NSData dataWithContentsOfMappedFile: path];
+      if (nil != d)
 	{
-	  unsigned char	tail[3];
-	  decodebase64(tail, buf);
-	  memcpy(dst, tail, pos);
-	  dst += pos;
+	  return d;
 	}
+      unlink(dst);
+      return nil;
     }
-  return [[[NSData allocWithZone: NSDefaultMallocZone()]
-    initWithBytesNoCopy: result length: dst - result] autorelease];
+  unlink(tmp);
+  NSZoneFree(NSDefaultMallocZone(), tmp);
+  return nil;
+}
+
+- (NSUInteger) decodeBase64From: (const char*)chars
+			 length: (NSUInteger)length
+			   into: (void*)buffer
+{
+  codecState	s;
+  NSUInteger	count;
+
+  memset(&s, '\0', sizeof(s));
+  s.table = b64Dec;
+  count = decodebase64(&s, (unsigned char*)buffer,
+    (const unsigned char*)chars, length);
+  count += decodebase64Tail(&s, (unsigned char*)buffer + count);
+  return count;
 }
 
 - (NSData*) decodeBase64UrlFrom: (NSString*)str
 {
-  NSData        *source = [str dataUsingEncoding: NSASCIIStringEncoding];
-  int		length;
-  int		declen;
-  const unsigned char	*src;
-  const unsigned char	*end;
-  unsigned char *result;
-  unsigned char	*dst;
-  unsigned char	buf[4];
-  unsigned	pos = 0;
+  codecState	s;
+  unsigned char	*result;
+  NSUInteger	length;
+  NSUInteger	count;
 
-  if (source == nil)
+  if (str == nil)
     {
       return nil;
     }
-  length = [source length];
+  length = [str length];
   if (length == 0)
     {
       return [NSData data];
     }
-  declen = ((length + 3) * 3)/4;
-  src = (const unsigned char*)[source bytes];
-  end = &src[length];
-
-  result = (unsigned char*)NSZoneMalloc(NSDefaultMallocZone(), declen);
-  dst = result;
-
-  while ((src != end) && *src != '\0')
-    {
-      int	c = *src++;
-
-      if (isupper(c))
-	{
-	  c -= 'A';
-	}
-      else if (islower(c))
-	{
-	  c = c - 'a' + 26;
-	}
-      else if (isdigit(c))
-	{
-	  c = c - '0' + 52;
-	}
-      else if (c == '_')
-	{
-	  c = 63;
-	}
-      else if (c == '-')
-	{
-	  c = 62;
-	}
-      else
-	{
-	  break;		/* end */
-	}
-
-      if (c >= 0)
-	{
-	  buf[pos++] = c;
-	  if (pos == 4)
-	    {
-	      pos = 0;
-	      decodebase64(dst, buf);
-	      dst += 3;
-	    }
-	}
-    }
-
-  if (pos > 0)
+  memset(&s, '\0', sizeof(s));
+  s.table = b64UrlDec;
+  count = decodeString(str, &s, ((length + 3) * 3)/4, decodebase64, &result);
+  if (NSNotFound == count)
     {
-      unsigned	i;
-
-      for (i = pos; i < 4; i++)
-	{
-	  buf[i] = '\0';
-	}
-      pos--;
-      if (pos > 0)
-	{
-	  unsigned char	tail[3];
-	  decodebase64(tail, buf);
-	  memcpy(dst, tail, pos);
-	  dst += pos;
-	}
+      return nil;
     }
+  count += decodebase64Tail(&s, result + count);
   return [[[NSData allocWithZone: NSDefaultMallocZone()]
-    initWithBytesNoCopy: result length: dst - result] autorelease];
+    initWithBytesNoCopy: result length: count] autorelease];
 }
 
 - (NSData*) decodeHexBinaryFrom: (NSString*)str
 {
-  NSData        *source = [str dataUsingEncoding: NSASCIIStringEncoding];
-  int		length;
-  int		declen;
-  const unsigned char	*src;
-  const unsigned char	*end;
-  unsigned char *result;
-  unsigned char	*dst;
-  unsigned char	val = 0;
-  BOOL		hi = YES;
+  codecState	s;
+  unsigned char	*result;
+  NSUInteger	length;
+  NSUInteger	count;
 
-  if (source == nil)
+  if (str == nil)
     {
       return nil;
     }
-  length = [source length];
+  length = [str length];
   if (length == 0)
     {
       return [NSData data];
     }
-  declen = length/2;
-  src = (const unsigned char*)[source bytes];
-  end = &src[length];
-
-  result = (unsigned char*)NSZoneMalloc(NSDefaultMallocZone(), declen);
-  dst = result;
-
-  while ((src != end) && *src != '\0')
+  memset(&s, '\0', sizeof(s));
+  s.table = hexDec;
+  count = decodeString(str, &s, length/2, decodehex, &result);
+  if (NSNotFound == count)
     {
-      int	c = *src++;
-
-      if (isxdigit(c))
-	{
-	  if (isdigit(c))
-	    {
-	      c = c - '0';
-	    }
-	  else if (isupper(c))
-	    {
-	      c = c - 'A' + 0x0a;
-	    }
-	  else
-	    {
-	      c = c - 'a' + 0x0a;
-	    }
-	  if (hi == YES)
-	    {
-	      val = c << 4;
-	      hi = NO;
-	    }
-	  else
-	    {
-	      *dst++ = (0x0f & c) | val;
-	      hi = YES;
-	    }
-	}
-      else if (!isspace(c))
-	{
-	  hi = NO;	// Indicate problem
-	  break;
-	}
+      return nil;
     }
-
-  if (hi == NO)
+  if (s.pos != 0)
     {
       /* Bad number of hex digits, or non hex data */
       NSZoneFree(NSDefaultMallocZone(), result);
       return nil;
     }
   return [[[NSData allocWithZone: NSDefaultMallocZone()]
-    initWithBytesNoCopy: result length: dst - result] autorelease];
+    initWithBytesNoCopy: result length: count] autorelease];
 }
 
 - (NSString*) encodeBase64From: (NSData*)source
 {
   NSString      *str;
-  int		length;
-  int		destlen;
-  unsigned char *sBuf;
+  NSUInteger	length;
+  NSUInteger	destlen;
   unsigned char *dBuf;
 
   length = [source length];
@@ -458,10 +1379,11 @@ static id       boolY;
       return @"";
     }
   destlen = 4 * ((length + 2) / 3);
-  sBuf = (unsigned char*)[source bytes];
   dBuf = NSZoneMalloc(NSDefaultMallocZone(), destlen);
+  GWS_ALLOC(GWSAllocStrings, destlen);
 
-  destlen = encodebase64(dBuf, sBuf, length);
+  destlen = encodebase64(dBuf, (const unsigned char*)[source bytes], length,
+    b64, b64Pairs, YES);
 
   str = [[NSString alloc] initWithBytesNoCopy: dBuf
                                        length: destlen
@@ -470,12 +1392,19 @@ static id       boolY;
   return [str autorelease];
 }
 
+- (NSUInteger) encodeBase64From: (const void*)bytes
+			 length: (NSUInteger)length
+			   into: (char*)buffer
+{
+  return encodebase64((unsigned char*)buffer, (const unsigned char*)bytes,
+    length, b64, b64Pairs, YES);
+}
+
 - (NSString*) encodeBase64UrlFrom: (NSData*)source
 {
   NSString      *str;
-  int		length;
-  int		destlen;
-  unsigned char *sBuf;
+  NSUInteger	length;
+  NSUInteger	destlen;
   unsigned char *dBuf;
 
   length = [source length];
@@ -484,10 +1413,11 @@ static id       boolY;
       return @"";
     }
   destlen = 4 * ((length + 2) / 3);
-  sBuf = (unsigned char*)[source bytes];
   dBuf = NSZoneMalloc(NSDefaultMallocZone(), destlen);
+  GWS_ALLOC(GWSAllocStrings, destlen);
 
-  destlen = encodebase64Url(dBuf, sBuf, length);
+  destlen = encodebase64(dBuf, (const unsigned char*)[source bytes], length,
+    b64Url, b64UrlPairs, NO);
 
   str = [[NSString alloc] initWithBytesNoCopy: dBuf
                                        length: destlen
@@ -498,29 +1428,19 @@ static id       boolY;
 
 - (NSString*) encodeHexBinaryFrom: (NSData*)source
 {
-  const char	*hex = "0123456789ABCDEF";
   NSString      *str;
-  int		length;
-  int		destlen;
-  unsigned char *sBuf;
+  NSUInteger	length;
+  NSUInteger	destlen;
   unsigned char *dBuf;
-  unsigned	dpos;
-  unsigned	spos;
 
   length = [source length];
   if (length == 0)
     {
       return @"";
     }
-  destlen = length * 2;
-  sBuf = (unsigned char*)[source bytes];
-  dBuf = NSZoneMalloc(NSDefaultMallocZone(), destlen);
-  dpos = 0;
-  for (spos = 0; spos < length; spos++)
-    {
-      dBuf[dpos++] = hex[sBuf[spos] >> 4];
-      dBuf[dpos++] = hex[sBuf[spos] & 0x0f];
-    }
+  dBuf = NSZoneMalloc(NSDefaultMallocZone(), length * 2);
+  GWS_ALLOC(GWSAllocStrings, length * 2);
+  destlen = encodehex(dBuf, (const unsigned char*)[source bytes], length);
 
   str = [[NSString alloc] initWithBytesNoCopy: dBuf
                                        length: destlen
@@ -541,6 +1461,7 @@ static id       boolY;
       return str;
     }
   from = NSZoneMalloc(NSDefaultMallocZone(), sizeof(unichar) * length);
+  GWS_ALLOC(GWSAllocBuffers, sizeof(unichar) * length);
   [str getCharacters: from];
 
   for (i = 0; i < length; i++)
@@ -588,6 +1509,7 @@ static id       boolY;
       output = length + 12 + [a length];
 
       to = NSZoneMalloc(NSDefaultMallocZone(), sizeof(unichar) * output);
+      GWS_ALLOC(GWSAllocBuffers, sizeof(unichar) * output);
       to[j++] = '<';
       to[j++] = '!';
       to[j++] = '[';
@@ -617,6 +1539,7 @@ static id       boolY;
 	  j += [a length];
 	}
       str = [[NSString alloc] initWithCharacters: to length: j];
+      GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * j);
       NSZoneFree(NSDefaultMallocZone(), to);
       [str autorelease];
     }
@@ -637,6 +1560,7 @@ static id       boolY;
       return str;
     }
   from = NSZoneMalloc(NSDefaultMallocZone(), sizeof(unichar) * length);
+  GWS_ALLOC(GWSAllocBuffers, sizeof(unichar) * length);
   [str getCharacters: from];
 
   for (i = 0; i < length; i++)
@@ -711,6 +1635,7 @@ static id       boolY;
       unsigned	j = 0;
 
       to = NSZoneMalloc(NSDefaultMallocZone(), sizeof(unichar) * output);
+      GWS_ALLOC(GWSAllocBuffers, sizeof(unichar) * output);
 
       for (i = 0; i < length; i++)
 	{
@@ -815,6 +1740,7 @@ static id       boolY;
             }
 	}
       str = [[NSString alloc] initWithCharacters: to length: output];
+      GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * output);
       NSZoneFree(NSDefaultMallocZone(), to);
       [str autorelease];
     }
@@ -854,6 +1780,7 @@ static id       boolY;
       return str;
     }
   from = NSZoneMalloc(NSDefaultMallocZone(), sizeof(unichar) * length);
+  GWS_ALLOC(GWSAllocBuffers, sizeof(unichar) * length);
   [str getCharacters: from];
 
   for (i = 0; i < length; i++)
@@ -878,6 +1805,7 @@ static id       boolY;
       unsigned	j = 0;
 
       to = NSZoneMalloc(NSDefaultMallocZone(), sizeof(unichar) * output);
+      GWS_ALLOC(GWSAllocBuffers, sizeof(unichar) * output);
 
       for (i = 0; i < length; i++)
 	{
@@ -891,6 +1819,7 @@ static id       boolY;
             }
 	}
       str = [[NSString alloc] initWithCharacters: to length: output];
+      GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * output);
       NSZoneFree(NSDefaultMallocZone(), to);
       [str autorelease];
     }
@@ -952,6 +1881,7 @@ static id       boolY;
   NSXMLParser           *parser     = nil;
   Class                 parserClass = _defaultParserClass;
 
+  GWS_ALLOC_BEGIN(self);
   pool = [NSAutoreleasePool new];
   [self reset];
   if (_preferSloppyParser)
@@ -979,6 +1909,7 @@ static id       boolY;
 	}
     }
   [pool release];
+  GWS_ALLOC_END(self);
   return [_stack lastObject];
 }
 
@@ -1016,7 +1947,7 @@ static id       boolY;
     }
   else if ([type isEqualToString: @"xsd:base64Binary"] == YES)
     {
-      result = [self decodeBase64From: value];
+      result = [self _decodeBase64Value: value];
     }
   else if ([type isEqualToString: @"xsd:hexBinary"] == YES)
     {
@@ -1025,116 +1956,20 @@ static id       boolY;
   else if ([type isEqualToString: @"xsd:dateTime"] == YES
     || [type isEqualToString: @"xsd:timeInstant"] == YES)
     {
-      NSTimeZone        *tz;
-      const char	*s;
-      int		year;
-      int		month;
-      int		day;
-      int		hour;
-      int		minute;
-      int		second;
-      int               milli;
-
-      s = [value UTF8String];
-      if (0 == s)
-	{
-	  s = "";
-	}
-      else if (*s == '-')
-	{
-	  s++;          // Leading '-' in year is ignored.
-	}
-      if (sscanf(s, "%d-%d-%dT%d:%d:%d",
-	&year, &month, &day, &hour, &minute, &second) != 6)
-	{
-	  return nil;
-	}
-      s = strchr(s, ':');
-      s++;
-      s = strchr(s, ':');
-      s++;
-      while (isdigit(*s)) s++;
-      if ('.' == *s)
-        {
-          s++;
-          milli = atoi(s);
-          while (isdigit(*s)) s++;
-        }
-      else
-        {
-          milli = 0;
-        }
-      if ('Z' == *s)
-	{
-	  tz = [NSTimeZone timeZoneForSecondsFromGMT: 0];
-	}
-      else if (*s == '+' || *s == '-')
-        {
-          int   zh;
-          int   zm;
-          int   zs;
-          int   l = strlen(s);
-
-          if (l < 3 || !isdigit(s[1]) || !isdigit(s[2]))
-            {
-              return nil;       //Bad timezone
-            }
-
-          zh = (s[1] - '0') * 10 + s[2] - '0';
-
-          if (3 == l)
-            {
-              // HH (sloppy parsing allow just hour)
-              zm = 0;
-            }
-          else if (5 == l && isdigit(s[3]) && isdigit(s[4]))
-            {
-              // HHMM (sloppy parsing allow missing colon)
-              zm = (s[3] - '0') * 10 + s[4] - '0';
-            }
-          else if (6 == l && ':' == s[3]
-            && isdigit(s[4]) && isdigit(s[5]))
-            {
-              // HH:MM (standard format)
-              zm = (s[4] - '0') * 10 + s[5] - '0';
-            }
-          else
-            {
-              return nil;
-            }
+      GWSDateTime	dt;
 
-          zs = ((zh * 60) + zm) * 60;
-
-          if (*s == '-')
-            {
-              zs = - zs;
-            }
-          tz = [NSTimeZone timeZoneForSecondsFromGMT: zs];
-        }
-      else if (0 == *s)
+      switch ([self _parseDateTime: value into: &dt])
 	{
-	  tz = [self timeZone];
+	  case 0:
+	    result = [self _newDateFrom: &dt timeZone: [self timeZone]];
+	    break;
+	  case 1:
+	    result = [self _newDateFrom: &dt timeZone: nil];
+	    break;
+	  default:
+	    return nil;
 	}
-      else
-        {
-          return nil;
-        }
-
-      result = [[[NSCalendarDate alloc] initWithYear: year
-					       month: month
-						 day: day
-					        hour: hour
-					      minute: minute
-					      second: second 
-					    timeZone: tz] autorelease]; 
-      if (0 != milli)
-        {
-          NSTimeInterval        ti = [result timeIntervalSinceReferenceDate];
-
-          ti += milli;
-          result = [NSCalendarDate dateWithTimeIntervalSinceReferenceDate: ti];
-          [result setTimeZone: tz];
-        }
+      [result autorelease];
     }
   else if ([type isEqualToString: @"xsd:double"] == YES)
     {
@@ -1166,6 +2001,7 @@ static id       boolY;
   NSString      *s;
 
   s = [[NSString alloc] initWithData: data encoding: NSUTF8StringEncoding];
+  GWS_ALLOC(GWSAllocStrings, [data length]);
   [[_stack lastObject] addContent: s];
   [s release];
 }
@@ -1173,6 +2009,7 @@ static id       boolY;
 - (void) parser: (NSXMLParser *)parser
   foundCharacters: (NSString *)string
 {
+  GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * [string length]);
   [[_stack lastObject] addContent: string];
 }
 
@@ -1224,6 +2061,8 @@ static id       boolY;
                   if (attr == nil)
                     {
                       attr = [[attributeDict mutableCopy] autorelease];
+                      GWS_ALLOC(GWSAllocDictionaries,
+                        2 * sizeof(id) * [attr count]);
                       attributeDict = attr;
                     }
                   uri = [attributeDict objectForKey: key];
@@ -1338,6 +2177,29 @@ static id       boolY;
   _level = 0;
 }
 
+- (void) returnCoder
+{
+  NSMutableArray        *a;
+
+  [self setDelegate: nil];
+  [self reset];
+  _fault = NO;
+  _pooled = NO;
+  a = threadPool([self class]);
+  if ([a count] < POOLMAX && [a indexOfObjectIdenticalTo: self] == NSNotFound)
+    {
+      [a addObject: self];
+    }
+  [self release];
+}
+
+- (void) setBase64FileThreshold: (NSUInteger)size
+		      directory: (NSString*)path
+{
+  _b64Threshold = size;
+  ASSIGN(_b64Directory, path);
+}
+
 - (void) setCDATA: (BOOL)flag
 {
   _cdata = (flag ? YES : NO);
@@ -1391,6 +2253,204 @@ static id       boolY;
 @end
 
 
+@implementation GWSCoder (Private)
+
+- (void) _allocAbandon
+{
+#if	defined(GWS_ALLOC_STATS) && GWS_ALLOC_STATS
+  if (allocOwner == self && 0 == --allocDepth)
+    {
+      allocOwner = nil;
+    }
+#endif
+}
+
+- (void) _allocBegin
+{
+#if	defined(GWS_ALLOC_STATS) && GWS_ALLOC_STATS
+  if (nil == allocOwner)
+    {
+      if (0 == _allocStats)
+	{
+	  _allocStats = calloc(1, sizeof(AllocStats));
+	}
+      allocOwner = self;
+      allocDepth = 1;
+      ((AllocStats*)_allocStats)->start = gwsAllocCounts;
+    }
+  else if (allocOwner == self)
+    {
+      allocDepth++;
+    }
+#endif
+}
+
+- (void) _allocEnd
+{
+#if	defined(GWS_ALLOC_STATS) && GWS_ALLOC_STATS
+  if (allocOwner == self && 0 == --allocDepth)
+    {
+      AllocStats	*a = (AllocStats*)_allocStats;
+      unsigned		i;
+
+      for (i = 0; i < GWSAllocCategories; i++)
+	{
+	  a->last.count[i] = gwsAllocCounts.count[i] - a->start.count[i];
+	  a->last.bytes[i] = gwsAllocCounts.bytes[i] - a->start.bytes[i];
+	  a->total.count[i] += a->last.count[i];
+	  a->total.bytes[i] += a->last.bytes[i];
+	}
+      a->messages++;
+      allocOwner = nil;
+    }
+#endif
+}
+
+- (void) _breakDate: (NSDate*)date
+	   timeZone: (NSTimeZone*)tz
+	       into: (GWSDateTime*)dt
+{
+  NSTimeInterval	ti;
+  int64_t		us;
+  int64_t		ms;
+  int64_t		days;
+
+  if (nil == tz)
+    {
+      tz = [self timeZone];
+    }
+  ti = [date timeIntervalSinceReferenceDate];
+  dt->offset = [tz secondsFromGMTForDate: date];
+
+  /* Work in local milliseconds since 1970, truncating any fraction.
+   * The interval is first rounded to whole microseconds (about as precise
+   * as it can be for current dates) so that a fraction stored just below
+   * the value it was made from (eg. .123 as .12299999) is not truncated
+   * to the millisecond below.
+   */
+  ti += dt->offset + EPOCHOFFSET;
+  us = llround(ti * 1000000.0);
+  ms = (us >= 0) ? us / 1000 : -((999 - us) / 1000);
+  days = ms / 86400000;
+  ms -= days * 86400000;
+  if (ms < 0)
+    {
+      ms += 86400000;
+      days--;
+    }
+  civilFromDays(days, dt);
+  dt->milli = (int)(ms % 1000);
+  ms /= 1000;
+  dt->second = (int)(ms % 60);
+  ms /= 60;
+  dt->minute = (int)(ms % 60);
+  dt->hour = (int)(ms / 60);
+}
+
+- (void) _configureFrom: (GWSCoder*)coder
+{
+  ASSIGN(_tz, coder->_tz);
+  _compact = coder->_compact;
+  _debug = coder->_debug;
+  _crlf = coder->_crlf;
+  _preferSloppyParser = coder->_preferSloppyParser;
+  _preserveSpace = coder->_preserveSpace;
+  _allUnicode = coder->_allUnicode;
+  _cdata = coder->_cdata;
+  _b64Threshold = coder->_b64Threshold;
+  ASSIGN(_b64Directory, coder->_b64Directory);
+}
+
+- (NSData*) _decodeBase64Value: (NSString*)str
+{
+  if (_b64Threshold > 0 && nil != _b64Directory
+    && [str length] > _b64Threshold)
+    {
+      NSString	*path;
+      NSData	*d = nil;
+
+      path = [NSString stringWithFormat: @"GWSBase64-%@",
+	[[NSProcessInfo processInfo] globallyUniqueString]];
+      path = [_b64Directory stringByAppendingPathComponent: path];
+      NS_DURING
+	{
+	  d = [self decodeBase64From: str toFile: path];
+	}
+      NS_HANDLER
+	{
+	  unlink([path fileSystemRepresentation]);
+	  [localException raise];
+	}
+      NS_ENDHANDLER
+      /* Once mapped (or if decoding failed), the file is no longer
+       * needed in the filesystem.
+       */
+      unlink([path fileSystemRepresentation]);
+      if (nil != d)
+	{
+	  return d;
+	}
+    }
+  return [self decodeBase64From: str];
+}
+
+- (NSCalendarDate*) _newDateFrom: (GWSDateTime*)dt timeZone: (NSTimeZone*)tz
+{
+  NSCalendarDate	*d;
+  NSTimeInterval	ti;
+  int			offset;
+
+  ti = (NSTimeInterval)(daysFromCivil(dt->year, dt->month, dt->day) * 86400
+    + dt->hour * 3600 + dt->minute * 60 + dt->second - EPOCHOFFSET);
+  ti += dt->milli / 1000.0;
+  if (nil == tz)
+    {
+      offset = dt->offset;
+      tz = zoneForOffset(offset);
+      d = [[NSCalendarDate alloc]
+	initWithTimeIntervalSinceReferenceDate: ti - offset];
+    }
+  else
+    {
+      int	t;
+
+      /* The offset of a zone may depend on the date (daylight savings),
+       * so guess using the current offset and correct it if necessary.
+       */
+      offset = [tz secondsFromGMT];
+      d = [[NSCalendarDate alloc]
+	initWithTimeIntervalSinceReferenceDate: ti - offset];
+      t = [tz secondsFromGMTForDate: d];
+      if (t != offset)
+	{
+	  [d release];
+	  d = [[NSCalendarDate alloc]
+	    initWithTimeIntervalSinceReferenceDate: ti - t];
+	}
+    }
+  [d setTimeZone: tz];
+  return d;
+}
+
+- (int) _parseDateTime: (NSString*)str into: (GWSDateTime*)dt
+{
+  unsigned char	buf[64];
+  NSUInteger	l;
+
+  l = [str length];
+  if (l >= sizeof(buf)
+    || NO == [str getCString: (char*)buf
+		   maxLength: sizeof(buf)
+		    encoding: NSASCIIStringEncoding])
+    {
+      return -1;
+    }
+  return parseDateTime(buf, (int)l, dt);
+}
+
+@end
+
+
 @implementation GWSCoder (RPC)
 
 - (NSData*) buildFaultWithParameters: (NSDictionary*)parameters
@@ -1479,7 +2539,7 @@ static id       boolY;
 {
   if (_tz == nil)
     {
-      _tz = [[NSTimeZone timeZoneForSecondsFromGMT: 0] retain];
+      _tz = [zoneForOffset(0) retain];
     }
   return _tz;
 }
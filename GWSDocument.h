@@ -35,6 +35,7 @@ extern "C" {
 @class  NSArray;
 @class  NSData;
 @class  NSString;
+@class  NSMapTable;
 @class  NSMutableDictionary;
 @class  NSRecursiveLock;
 @class  NSURL;
@@ -68,9 +69,16 @@ extern "C" {
   NSMutableDictionary   *_types;
   NSDictionary		*_ext;
   NSMutableArray	*_extensibility;
+  NSMutableDictionary	*_reverse;	// Namespace to prefix
+  NSString		*_qualifier;	// Prefix and colon
+  NSMapTable		*_index;	// Port to resolved operations
+  NSMutableDictionary	*_methods;	// Service to resolved methods
+  NSUInteger		_changes;	// Element changes since resolved
+  BOOL			_snapshot;	// Tree is from a validated snapshot
 }
 
-/** Return a previously registered extensibility object.
+/** Return a previously registered extensibility object.<br />
+ * This does not lock, so it may be called freely from any thread.
  */
 + (GWSExtensibility*) extensibilityForNamespace: (NSString*)namespaceURL;
 
@@ -78,12 +86,22 @@ extern "C" {
  * elements with the specified namespace.<br />
  * New registrations replace older ones for the same namespace URL.<br />
  * Registering a nil object removes registrations for the namespace URL.<br />
+ * Each change copies the registry (so that lookups need no locking), so
+ * registrations should normally be made once, at startup.<br />
  * NB. Changes to the registered extensibilities do not effect any
  * document instances created bnefore the change took place.
  */
 + (void) registerExtensibility: (GWSExtensibility*)extensibility
 		  forNamespace: (NSString*)namespaceURL;
 
+/** Parses the WSDL document specified and, if it is valid, returns a
+ * compact binary snapshot of the parsed tree (including a checksum of
+ * the WSDL document) which may later be used to initialise a document
+ * much more quickly using -initWithSnapshot:source:<br />
+ * Returns nil if the WSDL could not be parsed or is not valid.
+ */
++ (NSData*) snapshotWithData: (NSData*)xml;
+
 /** Returns the names of all WSDL bindings currently defined in this document.
  */
 - (NSArray*) bindingNames;
@@ -121,6 +139,14 @@ extern "C" {
  */
 - (id) initWithContentsOfFile: (NSString*)file;
 
+/** Initialises the receiver from the WSDL file, using the binary snapshot
+ * at path if it exists and was made from the current contents of the file.
+ * Otherwise the WSDL is parsed and (if the document is valid) a new
+ * snapshot is written to path for use next time.<br />
+ * If path is nil this is equivalent to -initWithContentsOfFile:
+ */
+- (id) initWithContentsOfFile: (NSString*)file snapshot: (NSString*)path;
+
 /** Initialises the receiver by parsing the WSDL file at the url.
  */
 - (id) initWithContentsOfURL: (NSURL*)url;
@@ -129,6 +155,16 @@ extern "C" {
  */
 - (id) initWithData: (NSData*)xml;
 
+/** Initialises the receiver from a binary snapshot produced by the
+ * +snapshotWithData: method (or by -initWithContentsOfFile:snapshot:).<br />
+ * If xml is not nil, the snapshot is only used if it was made from that
+ * WSDL document.  Returns nil if the snapshot can not be used.<br />
+ * The elements in a snapshot were validated when it was produced, so
+ * they are not validated again (the snapshot should be discarded if the
+ * registered extensibility objects change).
+ */
+- (id) initWithSnapshot: (NSData*)snapshot source: (NSData*)xml;
+
 /** Initialises the receiver by traversing the WSDL document in the
  * supplied tree.
  */
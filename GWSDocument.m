@@ -26,11 +26,442 @@
 #import <Foundation/Foundation.h>
 #import "GWSPrivate.h"
 
-static NSMutableDictionary	*extDict = nil;
+#include <string.h>
+
+/* The registered extensibility objects are held in an immutable dictionary
+ * which is replaced (while holding extLock) when a registration changes,
+ * so that lookups need only load the pointer to the current dictionary.
+ * Replaced dictionaries are kept in extOld rather than released, since
+ * other threads may still be using them (registrations are expected to
+ * be rare and to happen at startup).
+ */
+static NSDictionary		*extDict = nil;
+static NSMutableArray		*extOld = nil;
 static NSLock			*extLock = nil;
 
+static inline NSDictionary*
+extCurrent(void)
+{
+  return __atomic_load_n(&extDict, __ATOMIC_ACQUIRE);
+}
+
+@implementation	GWSResolvedOperation
+
+- (void) dealloc
+{
+  if (0 != steps)
+    {
+      while (count-- > 0)
+	{
+	  [steps[count].element release];
+	  [steps[count].section release];
+	  [steps[count].extensibility release];
+	}
+      NSZoneFree(NSDefaultMallocZone(), steps);
+    }
+  [operation release];
+  [port release];
+  [binding release];
+  [order release];
+  [super dealloc];
+}
+
+@end
+
+/* Add a setup step for each element which has an extensibility object.
+ */
+static void
+addSteps(GWSDocument *doc, NSMutableArray *steps, NSEnumerator *e, id section)
+{
+  GWSElement	*elem;
+
+  while ((elem = [e nextObject]) != nil)
+    {
+      GWSExtensibility	*x = [doc _extensibilityFor: elem];
+
+      if (nil != x)
+	{
+	  [steps addObject: elem];
+	  [steps addObject: section];
+	  [steps addObject: x];
+	}
+    }
+}
+
+/* A binary snapshot of a parsed WSDL tree consists of a header (magic,
+ * version, SHA-1 checksum of the WSDL source, number of strings), a table
+ * of the distinct strings used in the tree (each a length followed by
+ * UTF-8 bytes), and then the elements in document order.  Each element
+ * is its name, namespace and qualified name, its attributes and namespace
+ * declarations as counts followed by key/value pairs, its content, and a
+ * count of children (which follow it).  Strings in elements are indexes
+ * into the table (zero for nil) and all integers are 32bit big-endian.
+ */
+#define	SNAP_MAGIC	"GWSSNAP"
+#define	SNAP_VERSION	1
+#define	SNAP_HEADER	(8 + 4 + 20 + 4)
+#define	SNAP_DEPTH	1000
+
+typedef struct {
+  NSMutableData		*elements;
+  NSMutableArray	*strings;
+  NSMutableDictionary	*indexes;
+} SnapWriter;
+
+typedef struct {
+  const uint8_t		*bytes;
+  NSUInteger		length;
+  NSUInteger		pos;
+  NSMutableArray	*strings;
+} SnapReader;
+
+static void
+snapChecksum(NSData *xml, uint8_t checksum[20])
+{
+  GWSDigestContext	c;
+
+  GWSDigestInit(&c, GWSDigestSHA1);
+  GWSDigestUpdate(&c, [xml bytes], [xml length]);
+  GWSDigestFinal(&c, checksum);
+}
+
+static void
+snapPut(NSMutableData *d, uint32_t v)
+{
+  v = NSSwapHostIntToBig(v);
+  [d appendBytes: &v length: 4];
+}
+
+static void
+snapPutString(SnapWriter *w, NSString *s)
+{
+  NSNumber	*n;
+
+  if (nil == s)
+    {
+      snapPut(w->elements, 0);
+      return;
+    }
+  n = [w->indexes objectForKey: s];
+  if (nil == n)
+    {
+      [w->strings addObject: s];
+      n = [NSNumber numberWithUnsignedInt: [w->strings count]];
+      [w->indexes setObject: n forKey: s];
+    }
+  snapPut(w->elements, [n unsignedIntValue]);
+}
+
+static void
+snapPutDictionary(SnapWriter *w, NSDictionary *d)
+{
+  NSEnumerator	*e = [d keyEnumerator];
+  NSString	*k;
+
+  snapPut(w->elements, [d count]);
+  while ((k = [e nextObject]) != nil)
+    {
+      snapPutString(w, k);
+      snapPutString(w, [d objectForKey: k]);
+    }
+}
+
+static void
+snapPutElement(SnapWriter *w, GWSElement *elem)
+{
+  GWSElement	*child;
+  NSString	*content;
+
+  snapPutString(w, [elem name]);
+  snapPutString(w, [elem namespace]);
+  snapPutString(w, [elem qualified]);
+  snapPutDictionary(w, [elem attributes]);
+  snapPutDictionary(w, [elem namespaces]);
+  content = [elem content];
+  snapPutString(w, [content length] > 0 ? content : nil);
+  snapPut(w->elements, [elem countChildren]);
+  for (child = [elem firstChild]; child != nil; child = [child sibling])
+    {
+      snapPutElement(w, child);
+    }
+}
+
+/* Return a snapshot of the tree parsed from the xml.
+ */
+static NSData*
+snapData(GWSElement *root, NSData *xml)
+{
+  NSMutableData		*d;
+  SnapWriter		w;
+  uint8_t		checksum[20];
+  NSUInteger		count;
+  NSUInteger		i;
+
+  w.elements = [NSMutableData dataWithCapacity: 4 * [xml length]];
+  w.strings = [NSMutableArray arrayWithCapacity: 1024];
+  w.indexes = [NSMutableDictionary dictionaryWithCapacity: 1024];
+  snapPutElement(&w, root);
+
+  d = [NSMutableData dataWithCapacity: [w.elements length] + [xml length]];
+  [d appendBytes: SNAP_MAGIC length: 8];
+  snapPut(d, SNAP_VERSION);
+  snapChecksum(xml, checksum);
+  [d appendBytes: checksum length: 20];
+  count = [w.strings count];
+  snapPut(d, count);
+  for (i = 0; i < count; i++)
+    {
+      NSData	*s;
+
+      s = [[w.strings objectAtIndex: i] dataUsingEncoding: NSUTF8StringEncoding];
+      snapPut(d, [s length]);
+      [d appendData: s];
+    }
+  [d appendData: w.elements];
+  return d;
+}
+
+static uint32_t
+snapGet(SnapReader *r)
+{
+  uint32_t	v;
+
+  if (r->length - r->pos < 4)
+    {
+      [NSException raise: NSInvalidArgumentException
+		  format: @"snapshot truncated"];
+    }
+  memcpy(&v, r->bytes + r->pos, 4);
+  r->pos += 4;
+  return NSSwapBigIntToHost(v);
+}
+
+static NSString*
+snapGetString(SnapReader *r)
+{
+  uint32_t	i = snapGet(r);
+
+  if (0 == i)
+    {
+      return nil;
+    }
+  if (i > [r->strings count])
+    {
+      [NSException raise: NSInvalidArgumentException
+		  format: @"snapshot string index out of range"];
+    }
+  return [r->strings objectAtIndex: i - 1];
+}
+
+static NSMutableDictionary*
+snapGetDictionary(SnapReader *r)
+{
+  NSMutableDictionary	*d;
+  uint32_t		count = snapGet(r);
+
+  if (0 == count)
+    {
+      return nil;
+    }
+  if (count > (r->length - r->pos) / 8)
+    {
+      [NSException raise: NSInvalidArgumentException
+		  format: @"snapshot truncated"];
+    }
+  d = [NSMutableDictionary dictionaryWithCapacity: count];
+  while (count-- > 0)
+    {
+      NSString	*k = snapGetString(r);
+      NSString	*v = snapGetString(r);
+
+      if (nil == k || nil == v)
+	{
+	  [NSException raise: NSInvalidArgumentException
+		      format: @"snapshot has nil key or value"];
+	}
+      [d setObject: v forKey: k];
+    }
+  return d;
+}
+
+static GWSElement*
+snapGetElement(SnapReader *r, unsigned depth)
+{
+  GWSElement		*elem;
+  NSString		*name;
+  NSString		*namespace;
+  NSString		*qualified;
+  NSDictionary		*attributes;
+  NSDictionary		*namespaces;
+  NSEnumerator		*e;
+  NSString		*k;
+  uint32_t		count;
+
+  if (depth > SNAP_DEPTH)
+    {
+      [NSException raise: NSInvalidArgumentException
+		  format: @"snapshot elements nested too deeply"];
+    }
+  name = snapGetString(r);
+  namespace = snapGetString(r);
+  qualified = snapGetString(r);
+  attributes = snapGetDictionary(r);
+  if ([name length] == 0
+    || (qualified != nil && [qualified hasSuffix: name] == NO))
+    {
+      [NSException raise: NSInvalidArgumentException
+		  format: @"snapshot has bad element name"];
+    }
+  elem = [[GWSElement alloc] initWithName: name
+				namespace: namespace
+				qualified: qualified
+			       attributes: attributes];
+  [elem autorelease];
+  namespaces = snapGetDictionary(r);
+  e = [namespaces keyEnumerator];
+  while ((k = [e nextObject]) != nil)
+    {
+      [elem setNamespace: [namespaces objectForKey: k] forPrefix: k];
+    }
+  [elem addContent: snapGetString(r)];
+  count = snapGet(r);
+  while (count-- > 0)
+    {
+      [elem addChild: snapGetElement(r, depth + 1)];
+    }
+  return elem;
+}
+
+/* Return the tree from a snapshot, or nil if the snapshot is not usable
+ * (made from different xml or by a different version of the library).
+ * Raises an exception if the snapshot is corrupt.
+ */
+static GWSElement*
+snapTree(NSData *snapshot, NSData *xml)
+{
+  SnapReader	r;
+  uint8_t	checksum[20];
+  uint32_t	count;
+
+  r.bytes = (const uint8_t*)[snapshot bytes];
+  r.length = [snapshot length];
+  r.pos = 0;
+  if (r.length < SNAP_HEADER || memcmp(r.bytes, SNAP_MAGIC, 8) != 0)
+    {
+      return nil;
+    }
+  r.pos = 8;
+  if (snapGet(&r) != SNAP_VERSION)
+    {
+      return nil;
+    }
+  if (nil != xml)
+    {
+      snapChecksum(xml, checksum);
+      if (memcmp(r.bytes + r.pos, checksum, 20) != 0)
+	{
+	  return nil;
+	}
+    }
+  r.pos += 20;
+
+  count = snapGet(&r);
+  if (count > (r.length - r.pos) / 4)
+    {
+      [NSException raise: NSInvalidArgumentException
+		  format: @"snapshot truncated"];
+    }
+  r.strings = [NSMutableArray arrayWithCapacity: count];
+  while (count-- > 0)
+    {
+      uint32_t	length = snapGet(&r);
+      NSString	*s;
+
+      if (length > r.length - r.pos)
+	{
+	  [NSException raise: NSInvalidArgumentException
+		      format: @"snapshot truncated"];
+	}
+      s = [[NSString alloc] initWithBytes: r.bytes + r.pos
+				   length: length
+				 encoding: NSUTF8StringEncoding];
+      if (nil == s)
+	{
+	  [NSException raise: NSInvalidArgumentException
+		      format: @"snapshot has bad string"];
+	}
+      [r.strings addObject: s];
+      [s release];
+      r.pos += length;
+    }
+  return snapGetElement(&r, 0);
+}
+
+/* As snapTree() but logs a problem and returns nil if the snapshot is
+ * corrupt.
+ */
+static GWSElement*
+snapLoad(NSData *snapshot, NSData *xml)
+{
+  GWSElement	*root = nil;
+
+  NS_DURING
+    {
+      root = snapTree(snapshot, xml);
+    }
+  NS_HANDLER
+    {
+      NSLog(@"Problem loading WSDL snapshot ... %@", localException);
+      root = nil;
+    }
+  NS_ENDHANDLER
+  return root;
+}
+
 @implementation GWSDocument (Private)
 
+- (void) _changed
+{
+  __atomic_add_fetch(&_changes, 1, __ATOMIC_RELEASE);
+}
+
+- (GWSExtensibility*) _extensibilityFor: (GWSElement*)element
+{
+  NSString	*n;
+
+  n = [element namespace];
+  if ([n length] == 0)
+    {
+      /* No namespace recorded directly in the element ... 
+       * See if the document has a namespace for the element's prefix.
+       */
+      n = [element prefix];
+      if (n == nil)
+	{
+	  n = @"";
+	}
+      n = [self namespaceForPrefix: n];
+    }
+  if (n != nil)
+    {
+      return [_ext objectForKey: n];
+    }
+  return nil;
+}
+
+- (void) _invalidate
+{
+  [_lock lock];
+  if (0 != _index)
+    {
+      NSFreeMapTable(_index);
+      _index = 0;
+    }
+  [_methods release];
+  _methods = nil;
+  [_lock unlock];
+}
+
 /* Make sure that a name is the local version without the target prefix.
  */
 - (NSString*) _local: (NSString*)name
@@ -45,10 +476,215 @@ static NSLock			*extLock = nil;
 }
 
 
+- (GWSResolvedOperation*) _resolved: (NSString*)operation port: (GWSPort*)port
+{
+  GWSResolvedOperation	*r;
+  NSMutableDictionary	*d;
+
+  if (nil == operation || nil == port)
+    {
+      return nil;
+    }
+  [_lock lock];
+  if (0 != __atomic_exchange_n(&_changes, 0, __ATOMIC_ACQ_REL))
+    {
+      [self _invalidate];
+    }
+  if (0 == _index)
+    {
+      _index = NSCreateMapTable(NSObjectMapKeyCallBacks,
+	NSObjectMapValueCallBacks, 0);
+    }
+  d = (NSMutableDictionary*)NSMapGet(_index, (void*)port);
+  if (nil == d)
+    {
+      d = [NSMutableDictionary new];
+      NSMapInsert(_index, (void*)port, (void*)d);
+      [d release];
+    }
+  r = [d objectForKey: operation];
+  if (nil == r)
+    {
+      NSMutableArray	*steps = [NSMutableArray arrayWithCapacity: 24];
+      GWSBinding	*binding = [port binding];
+      GWSElement	*elem;
+      unsigned		i;
+
+      r = [GWSResolvedOperation new];
+      r->operation = [operation copy];
+      r->port = [port retain];
+      r->binding = [binding retain];
+
+      /* Extensibility for the port (with SOAP this supplies the URL that
+       * we should send to) and the binding (the encoding style and the
+       * transport to use).
+       */
+      addSteps(self, steps, [[port extensibility] objectEnumerator], port);
+      addSteps(self, steps, [[binding extensibility] objectEnumerator],
+	binding);
+      r->split = [steps count] / 3;
+
+      /* Operation specific parameter ordering defined in the abstract
+       * operation in the portType.
+       */
+      elem = [[binding type] operationWithName: operation create: NO];
+      r->order = [[[[elem attributes] objectForKey: @"parameterOrder"]
+	componentsSeparatedByString: @" "] retain];
+      [elem _watchFor: self];
+
+      /* The specific operation binding information up to the input
+       * or output, then the input binding information.
+       */
+      elem = [binding operationWithName: operation create: NO];
+      [elem _watchFor: self];
+      elem = [elem firstChild];
+      while (elem != nil
+	&& [[elem name] isEqualToString: @"input"] == NO
+	&& [[elem name] isEqualToString: @"output"] == NO)
+	{
+	  addSteps(self, steps, [[NSArray arrayWithObject: elem]
+	    objectEnumerator], binding);
+	  elem = [elem sibling];
+	}
+      if ([[elem name] isEqualToString: @"input"] == YES)
+	{
+	  NSMutableArray	*a = [NSMutableArray array];
+
+	  elem = [elem firstChild];
+	  while (elem != nil)
+	    {
+	      [a addObject: elem];
+	      elem = [elem sibling];
+	    }
+	  addSteps(self, steps, [a objectEnumerator], binding);
+	}
+
+      r->count = [steps count] / 3;
+      if (r->count > 0)
+	{
+	  r->steps = (GWSSetupStep*)NSZoneMalloc(NSDefaultMallocZone(),
+	    r->count * sizeof(GWSSetupStep));
+	  for (i = 0; i < r->count; i++)
+	    {
+	      r->steps[i].element = [[steps objectAtIndex: i * 3] retain];
+	      [r->steps[i].element _watchFor: self];
+	      r->steps[i].section = [[steps objectAtIndex: i * 3 + 1] retain];
+	      r->steps[i].extensibility
+		= [[steps objectAtIndex: i * 3 + 2] retain];
+	    }
+	}
+      [d setObject: r forKey: operation];
+      [r release];
+    }
+  [r retain];
+  [_lock unlock];
+  return [r autorelease];
+}
+
+- (GWSResolvedOperation*) _resolvedMethod: (NSString*)method
+				  service: (GWSService*)service
+{
+  GWSResolvedOperation	*r;
+  NSMutableDictionary	*d;
+  NSString		*name = [service name];
+
+  if (nil == method || nil == name)
+    {
+      return nil;
+    }
+  [_lock lock];
+  if (0 != __atomic_exchange_n(&_changes, 0, __ATOMIC_ACQ_REL))
+    {
+      [self _invalidate];
+    }
+  if (nil == _methods)
+    {
+      _methods = [NSMutableDictionary new];
+    }
+  d = [_methods objectForKey: name];
+  if (nil == d)
+    {
+      d = [NSMutableDictionary new];
+      [_methods setObject: d forKey: name];
+      [d release];
+    }
+  r = [d objectForKey: method];
+  if (nil == r)
+    {
+      NSEnumerator	*enumerator;
+      NSString		*portName;
+      NSString		*operation;
+      GWSPortType	*portType;
+      GWSPort		*port;
+      GWSPort		*found;
+      NSRange		range;
+
+      /* Look through the ports declared in the service for one with an
+       * operation uniquely matching the method.  Get details by looking up
+       * bindings, since we can't actually use a port/operation if there
+       * is no binding for it.
+       */
+      found = nil;
+      portName = nil;
+      operation = method;
+      enumerator = [[service _ports] objectEnumerator];
+      while ((port = [enumerator nextObject]) != nil)
+	{
+	  portType = [[port binding] type];
+	  if ([portType operationWithName: method create: NO] != nil)
+	    {
+	      if (nil == portName)
+		{
+		  portName = [portType name];	// matched
+		  found = port;
+		}
+	      else
+		{
+		  found = nil;			// not unique
+		  break;
+		}
+	    }
+	}
+
+      if (nil == found && 1 == (range = [method rangeOfString: @"."]).length)
+	{
+	  /* No unique operation ... but the method name uses dot
+	   * syntax to specify port type and operation.
+	   */
+	  portName = [method substringToIndex: range.location];
+	  operation = [method substringFromIndex: NSMaxRange(range)];
+	  enumerator = [[service _ports] objectEnumerator];
+	  while ((port = [enumerator nextObject]) != nil)
+	    {
+	      portType = [[port binding] type];
+	      if ([portType operationWithName: operation create: NO] != nil
+		&& [portName isEqual: [portType name]])
+		{
+		  found = port;	// matched
+		  break;
+		}
+	    }
+	}
+
+      if (nil != found)
+	{
+	  r = [self _resolved: operation port: found];
+	  [d setObject: r forKey: method];
+	}
+    }
+  [r retain];
+  [_lock unlock];
+  return [r autorelease];
+}
+
 - (NSString*) _validate: (GWSElement*)element in: (id)section
 {
   NSString		*n;
 
+  if (YES == _snapshot)
+    {
+      return nil;	// Validated when the snapshot was made.
+    }
   n = [element namespace];
   if (n != nil)
     {
@@ -72,7 +708,8 @@ static NSLock			*extLock = nil;
       GWSSOAPExtensibility	*e;
 
       extLock = [NSLock new];
-      extDict = [NSMutableDictionary new];
+      extOld = [NSMutableArray new];
+      extDict = [NSDictionary new];
       e = [GWSSOAPExtensibility	new];
       [self registerExtensibility: e forNamespace:
         @"http://schemas.xmlsoap.org/wsdl/soap/"];
@@ -82,19 +719,11 @@ static NSLock			*extLock = nil;
 
 + (GWSExtensibility*) extensibilityForNamespace: (NSString*)namespaceURL
 {
-  GWSExtensibility	*e;
-
   if (namespaceURL == nil)
     {
-      e = nil;
+      return nil;
     }
-  else
-    {
-      [extLock lock];
-      e = [[extDict objectForKey: namespaceURL] retain];
-      [extLock unlock];
-    }
-  return [e autorelease];
+  return [extCurrent() objectForKey: namespaceURL];
 }
 
 + (void) registerExtensibility: (GWSExtensibility*)extensibility
@@ -102,19 +731,67 @@ static NSLock			*extLock = nil;
 {
   if (namespaceURL != nil)
     {
+      NSMutableDictionary	*m;
+      NSDictionary		*d;
+
       [extLock lock];
+      m = [extDict mutableCopy];
       if (extensibility == nil)
 	{
-	  [extDict removeObjectForKey: namespaceURL];
+	  [m removeObjectForKey: namespaceURL];
 	}
       else
 	{
-	  [extDict setObject: extensibility forKey: namespaceURL];
+	  [m setObject: extensibility forKey: namespaceURL];
 	}
+      d = [m copy];
+      [m release];
+      [extOld addObject: extDict];
+      [extDict release];
+      __atomic_store_n(&extDict, d, __ATOMIC_RELEASE);
       [extLock unlock];
     }
 }
 
++ (NSData*) snapshotWithData: (NSData*)xml
+{
+  GWSElement	*root = nil;
+  NSData	*snap = nil;
+
+  NS_DURING
+    {
+      GWSCoder	*parser;
+
+      parser = [[GWSCoder new] autorelease];
+      [parser setDebug: YES];
+      root = [parser parseXML: xml];
+      if (root != nil)
+	{
+	  snap = snapData(root, xml);
+	}
+    }
+  NS_HANDLER
+    {
+      NSLog(@"Problem parsing WSDL ... %@", localException);
+      snap = nil;
+    }
+  NS_ENDHANDLER
+  if (snap != nil)
+    {
+      GWSDocument	*doc;
+
+      /* Only produce a snapshot of a valid document.
+       */
+      doc = [[self alloc] initWithTree: root];
+      if (nil == doc)
+	{
+	  snap = nil;
+	}
+      [doc release];
+    }
+  return snap;
+}
+
 - (NSArray*) bindingNames
 {
   NSArray       *result;
@@ -137,6 +814,7 @@ static NSLock			*extLock = nil;
     {
       binding = [[GWSBinding alloc] _initWithName: name document: self];
       [_bindings setObject: binding forKey: name];
+      [self _invalidate];
     }
   else
     {
@@ -170,6 +848,7 @@ static NSLock			*extLock = nil;
   NSEnumerator  *e;
   id            o;
 
+  [GWSElement _unwatch: self];
   [_ext release];
   [_name release];
   [_prefix release];
@@ -192,6 +871,13 @@ static NSLock			*extLock = nil;
   while ((o = [e nextObject]) != nil) [o _remove];
   [_types release];
   [_namespaces release];
+  [_reverse release];
+  [_qualifier release];
+  if (0 != _index)
+    {
+      NSFreeMapTable(_index);
+    }
+  [_methods release];
   [_lock release];
   [super dealloc];
 }
@@ -226,11 +912,10 @@ static NSLock			*extLock = nil;
       _services = [NSMutableDictionary new];
       _messages = [NSMutableDictionary new];
       _namespaces = [NSMutableDictionary new];
+      _reverse = [NSMutableDictionary new];
       _types = [NSMutableDictionary new];
       _extensibility = [NSMutableArray new];
-      [extLock lock];
-      _ext = [extDict copy];
-      [extLock unlock];
+      _ext = [extCurrent() retain];
     }
   return self;
 }
@@ -247,6 +932,68 @@ static NSLock			*extLock = nil;
   return [self initWithData: data];
 }
 
+- (id) initWithContentsOfFile: (NSString*)file snapshot: (NSString*)path
+{
+  NSData	*xml = [NSData dataWithContentsOfFile: file];
+  NSData	*snap;
+  GWSElement	*root;
+
+  if (nil == path || [xml length] == 0)
+    {
+      return [self initWithData: xml];
+    }
+
+  snap = [NSData dataWithContentsOfMappedFile: path];
+  if (snap != nil && (root = snapLoad(snap, xml)) != nil)
+    {
+      _snapshot = YES;
+      self = [self initWithTree: root];
+      if (self != nil)
+	{
+	  _snapshot = NO;
+	}
+      return self;
+    }
+
+  /* No usable snapshot ... parse the WSDL, taking a snapshot of the tree
+   * before it is consumed by -initWithTree: and writing it out if the
+   * document turns out to be valid.
+   */
+  root = nil;
+  snap = nil;
+  NS_DURING
+    {
+      GWSCoder	*parser;
+
+      parser = [[GWSCoder new] autorelease];
+      [parser setDebug: YES];
+      root = [parser parseXML: xml];
+      if (root != nil)
+	{
+	  snap = snapData(root, xml);
+	}
+    }
+  NS_HANDLER
+    {
+      NSLog(@"Problem parsing WSDL ... %@", localException);
+      root = nil;
+    }
+  NS_ENDHANDLER
+  if (root == nil)
+    {
+      NSLog(@"Data could not be parsed as XML in"
+	@" -initWithContentsOfFile:snapshot:");
+      [self release];
+      return nil;
+    }
+  self = [self initWithTree: root];
+  if (self != nil && [snap writeToFile: path atomically: YES] == NO)
+    {
+      NSLog(@"Unable to write WSDL snapshot to '%@'", path);
+    }
+  return self;
+}
+
 - (id) initWithContentsOfURL: (NSURL*)url
 {
   NSData        *data = [NSData dataWithContentsOfURL: url];
@@ -294,6 +1041,24 @@ static NSLock			*extLock = nil;
   return self;
 }
 
+- (id) initWithSnapshot: (NSData*)snapshot source: (NSData*)xml
+{
+  GWSElement	*root = snapLoad(snapshot, xml);
+
+  if (root == nil)
+    {
+      [self release];
+      return nil;
+    }
+  _snapshot = YES;
+  self = [self initWithTree: root];
+  if (self != nil)
+    {
+      _snapshot = NO;
+    }
+  return self;
+}
+
 - (id) initWithTree: (GWSElement*)tree
 {
   if (tree == nil)
@@ -305,6 +1070,8 @@ static NSLock			*extLock = nil;
     {
       NS_DURING
         {
+          NSEnumerator  *e;
+          GWSService    *service;
           NSString      *name;
 
           if ([[tree name] isEqualToString: @"definitions"] == NO)
@@ -316,7 +1083,6 @@ static NSLock			*extLock = nil;
           else
             {
               NSDictionary      *d;
-              NSEnumerator      *e;
               NSString          *k;
 
               k = [tree qualified];
@@ -378,6 +1144,25 @@ static NSLock			*extLock = nil;
                   [_namespaces setObject: @"http://schemas.xmlsoap.org/wsdl/"
                                   forKey: @""];
                 }
+
+              /* Index prefixes by namespace (the first found for each
+               * namespace) and precompute the prefix for qualified names.
+               */
+              e = [_namespaces keyEnumerator];
+              while ((k = [e nextObject]) != nil)
+                {
+                  NSString      *v = [_namespaces objectForKey: k];
+
+                  if ([_reverse objectForKey: v] == nil)
+                    {
+                      [_reverse setObject: k forKey: v];
+                    }
+                }
+              if (_prefix != nil)
+                {
+                  _qualifier = [[_prefix stringByAppendingString: @":"]
+                    retain];
+                }
             }
           _elem = [tree firstChild];
 
@@ -465,8 +1250,6 @@ static NSLock			*extLock = nil;
 
           while ([(name = [_elem name]) isEqualToString: @"service"])
             {
-              GWSService   *service;
-
               name = [[_elem attributes] objectForKey: @"name"];
               service = [[GWSService alloc] _initWithName: name
                                                  document: self];
@@ -493,6 +1276,31 @@ static NSLock			*extLock = nil;
               _elem = [_elem sibling];
               [[_extensibility lastObject] remove];
             }
+
+          /* Resolve the setup for each operation of each service port,
+           * so that services can find it with a single lookup per call.
+           */
+          e = [_services objectEnumerator];
+          while ((service = [e nextObject]) != nil)
+            {
+              NSEnumerator      *pe = [[service _ports] objectEnumerator];
+              GWSPort           *port;
+
+              while ((port = [pe nextObject]) != nil)
+                {
+                  GWSPortType   *portType = [[port binding] type];
+                  NSEnumerator  *oe = [[portType operations] keyEnumerator];
+                  NSString      *op;
+
+                  while ((op = [oe nextObject]) != nil)
+                    {
+                      [self _resolved: op port: port];
+                      [self _resolvedMethod: op service: service];
+                      [self _resolvedMethod: [NSString stringWithFormat:
+                        @"%@.%@", [portType name], op] service: service];
+                    }
+                }
+            }
         }
       NS_HANDLER
         {
@@ -575,6 +1383,7 @@ static NSLock			*extLock = nil;
     {
       portType = [[GWSPortType alloc] _initWithName: name document: self];
       [_portTypes setObject: portType forKey: name];
+      [self _invalidate];
     }
   else
     {
@@ -586,15 +1395,25 @@ static NSLock			*extLock = nil;
 
 - (NSString*) prefixForNamespace: (NSString*)url
 {
-  NSEnumerator	*e = [_namespaces keyEnumerator];
-  NSString	*k;
+  NSString	*k = [_reverse objectForKey: url];
 
-  while ((k = [e nextObject]) != nil)
+  if (nil == k && [_namespaces count] > 0)
     {
-      if ([[_namespaces objectForKey: k] isEqual: url])
+      NSEnumerator	*e;
+
+      /* Not indexed when the document was parsed ... search.
+       */
+      [_lock lock];
+      e = [_namespaces keyEnumerator];
+      while ((k = [e nextObject]) != nil)
 	{
-	  break;
+	  if ([[_namespaces objectForKey: k] isEqual: url])
+	    {
+	      break;
+	    }
 	}
+      [[k retain] autorelease];
+      [_lock unlock];
     }
   return k;
 }
@@ -604,6 +1423,7 @@ static NSLock			*extLock = nil;
   [_lock lock];
   [[_bindings objectForKey: name] _remove];
   [_bindings removeObjectForKey: name];
+  [self _invalidate];
   [_lock unlock];
 }
 
@@ -612,6 +1432,7 @@ static NSLock			*extLock = nil;
   [_lock lock];
   [[_bindings objectForKey: name] _remove];
   [_messages removeObjectForKey: name];
+  [self _invalidate];
   [_lock unlock];
 }
 
@@ -620,6 +1441,7 @@ static NSLock			*extLock = nil;
   [_lock lock];
   [[_bindings objectForKey: name] _remove];
   [_portTypes removeObjectForKey: name];
+  [self _invalidate];
   [_lock unlock];
 }
 
@@ -628,6 +1450,7 @@ static NSLock			*extLock = nil;
   [_lock lock];
   [[_bindings objectForKey: name] _remove];
   [_services removeObjectForKey: name];
+  [self _invalidate];
   [_lock unlock];
 }
 
@@ -636,11 +1459,16 @@ static NSLock			*extLock = nil;
   [_lock lock];
   [[_bindings objectForKey: name] _remove];
   [_types removeObjectForKey: name];
+  [self _invalidate];
   [_lock unlock];
 }
 
 - (NSString*) qualify: (NSString*)name
 {
+  if (_qualifier != nil)
+    {
+      return [_qualifier stringByAppendingString: name];
+    }
   if (_prefix != nil)
     {
       return [NSString stringWithFormat: @"%@:%@", _prefix, name];
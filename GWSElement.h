@@ -260,7 +260,10 @@ extern "C" {
  */
 - (GWSElement*) lastChild;
 
-/** Perform a deep copy of the receiver.
+/** Perform a deep copy of the receiver.<br />
+ * Any literal value is copied, as is the cached serialised form of the
+ * start of each element, so a copy of a tree which has already been
+ * encoded may be encoded again without rebuilding its start elements.
  */
 - (id) mutableCopyWithZone: (NSZone*)aZone;
 
@@ -33,11 +33,57 @@ static SEL 		cimSel = 0;
 static BOOL		(*cimImp)(id, SEL, unichar) = 0;
 static Class		GWSElementClass = Nil;
 
+/* Elements which documents use in their cached lookups of operations
+ * (see -_watchFor:) are recorded in a table (held outside the elements
+ * so that their ivars are unchanged) mapping each to its document, so
+ * that a change to the element makes only that document discard its
+ * cache.  Since most elements are never watched, a bitmap indexed by
+ * element address lets a change to an element which cannot be in the
+ * table be ignored without locking (bits are never cleared, so a set
+ * bit just means the table must be checked).
+ */
+#define	WATCHBITS	65536
+static uint32_t		watchBits[WATCHBITS / 32];
+static NSMapTable	*watched = 0;
+static NSLock		*watchLock = nil;
+
+static inline NSUInteger
+watchBit(GWSElement *e)
+{
+  return (((uintptr_t)e) >> 4) % WATCHBITS;
+}
+
+static inline BOOL
+mayBeWatched(GWSElement *e)
+{
+  NSUInteger	b = watchBit(e);
+
+  return (__atomic_load_n(&watchBits[b / 32], __ATOMIC_ACQUIRE)
+    & (1U << (b % 32))) ? YES : NO;
+}
+
+static void
+elementChanged(GWSElement *e)
+{
+  GWSDocument	*d;
+
+  [watchLock lock];
+  d = (GWSDocument*)NSMapGet(watched, (void*)e);
+  [d _changed];
+  [watchLock unlock];
+}
+
+#define	CHANGED(E)	do { if (YES == mayBeWatched(E)) \
+  elementChanged(E); } while (0)
+
 + (void) initialize
 {
   if ([GWSElement class] == self)
     {
       GWSElementClass = self;
+      watched = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks,
+	NSNonOwnedPointerMapValueCallBacks, 0);
+      watchLock = [NSLock new];
       ws = [[NSCharacterSet whitespaceAndNewlineCharacterSet] retain];
       cimSel = @selector(characterIsMember:);
       cimImp = (BOOL(*)(id,SEL,unichar))[ws methodForSelector: cimSel]; 
@@ -52,9 +98,11 @@ static Class		GWSElementClass = Nil;
 
   if (length > 0)
     {
+      CHANGED(self);
       if (_content == nil)
         {
           _content = [content mutableCopyWithZone: 0];
+          GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * length);
         }
       else
         {
@@ -78,6 +126,7 @@ static Class		GWSElementClass = Nil;
     }
 #endif
 
+  CHANGED(self);
   [child retain];
   if (child->_parent)
     {
@@ -242,6 +291,7 @@ static Class		GWSElementClass = Nil;
       unichar	(*caiImp)(NSString*, SEL, NSUInteger);
       unichar	letter;
 
+      CHANGED(self);
       caiImp = (unichar (*)())[_content methodForSelector: caiSel];
 
       while (end > 0)
@@ -326,6 +376,12 @@ static Class		GWSElementClass = Nil;
 
 - (void) dealloc
 {
+  if (YES == mayBeWatched(self))
+    {
+      [watchLock lock];
+      NSMapRemove(watched, (void*)self);
+      [watchLock unlock];
+    }
   [_attributes release];
   [_content release];
   if (nil != _first)
@@ -653,6 +709,7 @@ static Class		GWSElementClass = Nil;
     {
       NSZone    *z = [self zone];
 
+      GWS_ALLOC(GWSAllocElements, class_getInstanceSize([self class]));
       _next = _prev = self;
       _name = [name copyWithZone: z];
       _namespace = [namespace copyWithZone: z];
@@ -669,6 +726,7 @@ static Class		GWSElementClass = Nil;
       if ([attributes count] > 0)
         {
           _attributes = [attributes mutableCopyWithZone: z];
+          GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * [attributes count]);
         }
     }
   return self;
@@ -702,6 +760,7 @@ static Class		GWSElementClass = Nil;
     }
 #endif
 
+  CHANGED(self);
   [child retain];
   if (child->_parent)
     {
@@ -809,6 +868,8 @@ static Class		GWSElementClass = Nil;
                  attributes: _attributes];
   copy->_content = [_content mutableCopyWithZone: aZone];
   copy->_namespaces = [_namespaces mutableCopyWithZone: aZone];
+  copy->_literal = [_literal retain];
+  copy->_start = [_start retain];	// Cached start element is still valid
   if (_children > 0)
     {
       NSUInteger	count = _children - 1;
@@ -996,6 +1057,8 @@ static Class		GWSElementClass = Nil;
 {
   if (_parent != nil)
     {
+      CHANGED(self);
+      CHANGED(_parent);
       _parent->_children--;
       if (0 == _parent->_children)
 	{
@@ -1018,6 +1081,7 @@ static Class		GWSElementClass = Nil;
 
 - (void) setAttribute: (NSString*)attribute forKey: (NSString*)key
 {
+  CHANGED(self);
   if (key == nil)
     {
       [_attributes removeAllObjects];
@@ -1034,6 +1098,7 @@ static Class		GWSElementClass = Nil;
       if (_attributes == nil)
         {
           _attributes = [[NSMutableDictionary alloc] initWithCapacity: 1];
+          GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id));
         }
       [_attributes setObject: attribute forKey: key];
     }
@@ -1045,6 +1110,7 @@ static Class		GWSElementClass = Nil;
 {
   if (_content != content)
     {
+      CHANGED(self);
       [_content release];
       _content = nil;
       [self addContent: content];
@@ -1057,6 +1123,7 @@ static Class		GWSElementClass = Nil;
     {
       id        o = _literal;
 
+      CHANGED(self);
       _literal = [xml retain];
       [o release];
     }
@@ -1071,6 +1138,7 @@ static Class		GWSElementClass = Nil;
   NSAssert([name length] > 0, NSInvalidArgumentException);
   r = [name rangeOfString: @":" options: NSLiteralSearch];
   NSAssert(0 == r.length, NSInvalidArgumentException);
+  CHANGED(self);
   name = [name copyWithZone: 0];
   [_name release];
   _name = name;
@@ -1082,6 +1150,7 @@ static Class		GWSElementClass = Nil;
   else
     {
       _qualified = [[NSString alloc] initWithFormat: @"%@:%@", _prefix, _name];
+      GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * [_qualified length]);
     }
   [_start release];	// Discard any cached start element
   _start = nil;
@@ -1097,6 +1166,7 @@ static Class		GWSElementClass = Nil;
     }
   r = [prefix rangeOfString: @":" options: NSLiteralSearch];
   NSAssert(0 == r.length, NSInvalidArgumentException);
+  CHANGED(self);
   if ([uri length] == 0)
     {
       if (_namespaces != nil)
@@ -1109,6 +1179,7 @@ static Class		GWSElementClass = Nil;
       if (_namespaces == nil)
         {
           _namespaces = [[NSMutableDictionary alloc] initWithCapacity: 1];
+          GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id));
         }
       uri = [uri copyWithZone: 0];
       [_namespaces setObject: uri forKey: prefix];
@@ -1135,6 +1206,7 @@ static Class		GWSElementClass = Nil;
     }
   r = [prefix rangeOfString: @":" options: NSLiteralSearch];
   NSAssert(0 == r.length, NSInvalidArgumentException);
+  CHANGED(self);
   empty = (0 == [prefix length]) ? YES : NO;
 
   ns = [self namespaceForPrefix: prefix];
@@ -1207,3 +1279,53 @@ static Class		GWSElementClass = Nil;
 
 @end
 
+@implementation GWSElement (Private)
+
++ (void) _unwatch: (GWSDocument*)document
+{
+  NSMapEnumerator	e;
+  NSMutableArray	*a = nil;
+  void			*k;
+  void			*v;
+
+  [watchLock lock];
+  e = NSEnumerateMapTable(watched);
+  while (NSNextMapEnumeratorPair(&e, &k, &v))
+    {
+      if (v == (void*)document)
+	{
+	  if (nil == a)
+	    {
+	      a = [NSMutableArray new];
+	    }
+	  [a addObject: [NSValue valueWithPointer: k]];
+	}
+    }
+  NSEndMapTableEnumeration(&e);
+  while ([a count] > 0)
+    {
+      NSMapRemove(watched, [[a lastObject] pointerValue]);
+      [a removeLastObject];
+    }
+  [watchLock unlock];
+  [a release];
+}
+
+- (void) _watchFor: (GWSDocument*)document
+{
+  GWSElement	*child = _first;
+  NSUInteger	count = _children;
+  NSUInteger	b = watchBit(self);
+
+  [watchLock lock];
+  NSMapInsert(watched, (void*)self, (void*)document);
+  __atomic_or_fetch(&watchBits[b / 32], 1U << (b % 32), __ATOMIC_RELEASE);
+  [watchLock unlock];
+  while (count-- > 0)
+    {
+      [child _watchFor: document];
+      child = child->_next;
+    }
+}
+
+@end
@@ -36,6 +36,7 @@
 #import <Foundation/NSDebug.h>
 #import <Foundation/NSException.h>
 #import <Foundation/NSLocale.h>
+#import <Foundation/NSLock.h>
 #import <Foundation/NSNull.h>
 #import <Foundation/NSScanner.h>
 #import <Foundation/NSString.h>
@@ -48,6 +49,14 @@
 #include "config.h"
 #include <unistd.h>
 #include <fcntl.h>
+#ifndef __MINGW__
+#include <pthread.h>
+#endif
+#if defined(__GLIBC__) \
+  && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 25))
+#define HAVE_GETRANDOM  1
+#include <sys/random.h>
+#endif
 
 #if  USE_GNUTLS == 1
 #include <gnutls/gnutls.h>
@@ -66,8 +75,15 @@ NSString* const kGWSHashSSHA1 = @"SSHA";
 NSString* const kGWSHashMD5 = @"MD5";
 NSString* const kGWSHashSMD5 = @"SMD5";
 
+typedef struct HashSink HashSink;
+
+@interface      GWSHMACKey (Private)
+- (NSData*) _key;
+- (void*) _stateFor: (NSString*)hashAlgorithm;
+@end
+
 static BOOL
-writeObject(id obj, NSMutableString *output);
+writeObject(id obj, HashSink *output);
 
 static NSArray* algorithms = nil;
 
@@ -99,11 +115,15 @@ static NSArray* algorithms = nil;
 #define END_FOR_IN(collection) }
 #endif
 
+static Class GWSHMACKeyClass;
 static Class NSArrayClass;
 static Class NSDateClass;
 static Class NSDataClass;
 static Class NSDictionaryClass;
+static Class NSMutableArrayClass;
+static Class NSMutableDataClass;
 static Class NSMutableDictionaryClass;
+static Class NSMutableStringClass;
 static Class NSNullClass;
 static Class NSNumberClass;
 static Class NSStringClass;
@@ -122,11 +142,228 @@ static inline BOOL isSalted(NSString *method)
    || [method isEqualToString: kGWSHashSSHA512]);
 }
 
+/* The canonical serialisation is not built as a string, but is converted
+ * to UTF-8 in a fixed size buffer which is passed to an incremental digest
+ * (or HMAC) context each time it fills, so hashing uses a constant amount
+ * of memory however large the parameters are.  Without gnutls the digest
+ * contexts used by WSSUsernameToken are used (with the keyed state of a
+ * GWSHMACKey for an HMAC), and only for an algorithm they do not provide
+ * (eg MD5) are the UTF-8 bytes collected and hashed at the end.
+ */
+#define	SINKSIZE	4096
+
+struct HashSink {
+  uint8_t		buf[SINKSIZE];
+  unsigned		pos;
+  NSMutableData		*capture;	// Collects output for the cache
+  unsigned		capStart;	// Start of uncaptured data in buf
+  unsigned		capDepth;	// Number of objects being captured
+  BOOL			uncacheable;	// Mutable object written
+#if USE_GNUTLS == 1
+  BOOL			isHMAC;
+  unsigned		length;
+  gnutls_hash_hd_t	hash;
+  gnutls_hmac_hd_t	hmac;
+#else
+  BOOL			isHMAC;
+  BOOL			incremental;
+  GWSDigestContext	digest;		// Inner digest for an HMAC
+  GWSDigestContext	outer;
+  NSMutableData		*data;		// Collected if not incremental
+#endif
+};
+
+static void
+sinkFlush(HashSink *s)
+{
+  if (s->pos > 0)
+    {
+      if (s->capDepth > 0)
+        {
+          [s->capture appendBytes: s->buf + s->capStart
+                           length: s->pos - s->capStart];
+          s->capStart = 0;
+        }
+#if USE_GNUTLS == 1
+      if (s->isHMAC)
+        {
+          gnutls_hmac(s->hmac, s->buf, s->pos);
+        }
+      else
+        {
+          gnutls_hash(s->hash, s->buf, s->pos);
+        }
+#else
+      if (s->incremental)
+        {
+          GWSDigestUpdate(&s->digest, s->buf, s->pos);
+        }
+      else
+        {
+          [s->data appendBytes: s->buf length: s->pos];
+        }
+#endif
+      s->pos = 0;
+    }
+}
+
+static void
+sinkBytes(HashSink *s, const void *data, unsigned length)
+{
+  const uint8_t	*bytes = (const uint8_t*)data;
+
+  while (length > 0)
+    {
+      unsigned  n = SINKSIZE - s->pos;
+
+      if (n > length)
+        {
+          n = length;
+        }
+      memcpy(s->buf + s->pos, bytes, n);
+      s->pos += n;
+      bytes += n;
+      length -= n;
+      if (SINKSIZE == s->pos)
+        {
+          sinkFlush(s);
+        }
+    }
+}
+
+static inline void
+sinkByte(HashSink *s, uint8_t c)
+{
+  if (SINKSIZE == s->pos)
+    {
+      sinkFlush(s);
+    }
+  s->buf[s->pos++] = c;
+}
+
+static inline void
+sinkUTF8(HashSink *s, uint32_t u)
+{
+  if (s->pos > SINKSIZE - 4)
+    {
+      sinkFlush(s);
+    }
+  if (u < 0x80)
+    {
+      s->buf[s->pos++] = u;
+    }
+  else if (u < 0x800)
+    {
+      s->buf[s->pos++] = 0xc0 | (u >> 6);
+      s->buf[s->pos++] = 0x80 | (u & 0x3f);
+    }
+  else if (u < 0x10000)
+    {
+      s->buf[s->pos++] = 0xe0 | (u >> 12);
+      s->buf[s->pos++] = 0x80 | ((u >> 6) & 0x3f);
+      s->buf[s->pos++] = 0x80 | (u & 0x3f);
+    }
+  else
+    {
+      s->buf[s->pos++] = 0xf0 | (u >> 18);
+      s->buf[s->pos++] = 0x80 | ((u >> 12) & 0x3f);
+      s->buf[s->pos++] = 0x80 | ((u >> 6) & 0x3f);
+      s->buf[s->pos++] = 0x80 | (u & 0x3f);
+    }
+}
+
+/* Write a string as UTF-8, optionally as a quoted and escaped JSON string.
+ * The characters are fetched in small chunks rather than being copied
+ * as a whole.  Unpaired surrogates are written as U+FFFD.
+ */
+static void
+sinkString(HashSink *s, NSString *str, BOOL quoted)
+{
+  unichar	chars[256];
+  NSUInteger	length = [str length];
+  NSUInteger	done = 0;
+  unichar	high = 0;
+
+  if (quoted)
+    {
+      sinkByte(s, '"');
+    }
+  while (done < length)
+    {
+      NSUInteger	n = length - done;
+      NSUInteger	i;
+
+      if (n > 256)
+        {
+          n = 256;
+        }
+      [str getCharacters: chars range: NSMakeRange(done, n)];
+      done += n;
+      for (i = 0; i < n; i++)
+        {
+          unichar	c = chars[i];
+
+          if (high != 0)
+            {
+              if (c >= 0xdc00 && c <= 0xdfff)
+                {
+                  sinkUTF8(s, 0x10000 + ((high - 0xd800) << 10) + c - 0xdc00);
+                  high = 0;
+                  continue;
+                }
+              sinkUTF8(s, 0xfffd);
+              high = 0;
+            }
+          if (c >= 0xd800 && c <= 0xdbff)
+            {
+              high = c;
+            }
+          else if (c >= 0xdc00 && c <= 0xdfff)
+            {
+              sinkUTF8(s, 0xfffd);
+            }
+          else if (NO == quoted || (c >= 0x20 && c != '"' && c != '\\'))
+            {
+              sinkUTF8(s, c);
+            }
+          else
+            {
+              sinkByte(s, '\\');
+              switch (c)
+                {
+                  case '\\': sinkByte(s, '\\'); break;
+                  case '\b': sinkByte(s, 'b'); break;
+                  case '\f': sinkByte(s, 'f'); break;
+                  case '\n': sinkByte(s, 'n'); break;
+                  case '\r': sinkByte(s, 'r'); break;
+                  case '\t': sinkByte(s, 't'); break;
+                  case '"': sinkByte(s, '"'); break;
+                  default:
+                    {
+                      char	buf[6];
+
+                      sprintf(buf, "u%04x", c);
+                      sinkBytes(s, buf, 5);
+                    }
+                }
+            }
+        }
+    }
+  if (high != 0)
+    {
+      sinkUTF8(s, 0xfffd);
+    }
+  if (quoted)
+    {
+      sinkByte(s, '"');
+    }
+}
+
 static BOOL
-writeJSON(id obj, NSMutableString *output, NSArray* order);
+writeJSON(id obj, HashSink *output, NSArray* order);
 
 static inline BOOL
-writeDictionary(NSDictionary* dict, NSMutableString *output, NSArray* order)
+writeDictionary(NSDictionary* dict, HashSink *output, NSArray* order)
 {
   if (nil == order)
     {
@@ -143,7 +380,7 @@ writeDictionary(NSDictionary* dict, NSMutableString *output, NSArray* order)
       [(NSMutableDictionary*)dict setObject: order forKey: GWSOrderKey];
     }
   BOOL writeComma = NO;
-  [output appendString: @"{"];
+  sinkByte(output, '{');
   FOR_IN(id, o, order)
     // Keys in dictionaries must be strings
     if (![o isKindOfClass: NSStringClass]) { return NO; }
@@ -154,39 +391,39 @@ writeDictionary(NSDictionary* dict, NSMutableString *output, NSArray* order)
       }
     if (writeComma)
       {
-        [output appendString: @","];
+        sinkByte(output, ',');
       }
     writeComma = YES;
     writeObject(o, output);
-    [output appendString: @":"];
+    sinkByte(output, ':');
     writeObject([dict objectForKey: o], output);
   END_FOR_IN(obj)
-  [output appendString: @"}"];
+  sinkByte(output, '}');
   return YES;
 }
 
 static BOOL
-writeObject(id obj, NSMutableString *output)
+writeObject(id obj, HashSink *output)
 {
   return writeJSON(obj, output, nil);
 }
 
 static BOOL
-writeJSON(id obj, NSMutableString *output, NSArray* order)
+writeValue(id obj, HashSink *output, NSArray* order)
 {
   if ([obj isKindOfClass: NSArrayClass])
     {
       BOOL writeComma = NO;
-      [output appendString: @"["];
+      sinkByte(output, '[');
       FOR_IN(id, o, obj)
         if (writeComma)
           {
-            [output appendString: @","];
+            sinkByte(output, ',');
           }
         writeComma = YES;
         writeObject(o, output);
       END_FOR_IN(obj)
-      [output appendString: @"]"];
+      sinkByte(output, ']');
     }
   else if ([obj isKindOfClass: NSDictionaryClass])
     {
@@ -194,158 +431,555 @@ writeJSON(id obj, NSMutableString *output, NSArray* order)
     }
   else if ([obj isKindOfClass: NSStringClass])
     {
-      NSString  *str = (NSString*)obj;
-      unsigned	length = [str length];
+      sinkString(output, obj, YES);
+    }
+  else if (obj == boolN) 
+    {
+      sinkBytes(output, "false", 5);
+    }
+  else if (obj == boolY) 
+    {
+      sinkBytes(output, "true", 4);
+    }
+  else if ([obj isKindOfClass: NSNumberClass])
+    {
+      char	buf[32];
 
-      if (length == 0)
+      sinkBytes(output, buf,
+        snprintf(buf, sizeof(buf), "%g", [obj doubleValue]));
+    }
+  else if ([obj isKindOfClass: NSNullClass])
+    {
+      sinkBytes(output, "null", 4);
+    }
+  else if ([obj isKindOfClass: NSDateClass])
+    {
+      static NSDateFormatter* formatter = nil;
+ 
+      if (nil == formatter) 
         {
-          [output appendString: @"\"\""];
+          formatter = [[NSDateFormatter alloc] init];
+          [formatter setTimeStyle: NSDateFormatterFullStyle];
+          [formatter setDateFormat: @"yyyy-MM-dd'T'HH:mm:ssZ"];
         }
-      else
+      sinkString(output, [formatter stringFromDate: obj], NO);
+    }
+  else if ([obj isKindOfClass: NSDataClass])
+    {
+      const uint8_t	*bytes = [obj bytes];
+      NSUInteger	length = [obj length];
+      GWSCoder		*coder = [GWSCoder coder];
+      char		buf[1024];
+
+      /* Base64 text needs no escaping, so we can encode it straight
+       * into the output a chunk at a time.
+       */
+      sinkByte(output, '"');
+      while (length > 0)
         {
-          unsigned	size = 2;
-          unichar	*from;
-          unsigned	i = 0;
-          unichar	*to;
-          unsigned	j = 0;
+          NSUInteger	n = (length > 768) ? 768 : length;
 
-          from = NSZoneMalloc (NSDefaultMallocZone(), sizeof(unichar) * length);
-          [str getCharacters: from];
+          sinkBytes(output, buf,
+            [coder encodeBase64From: bytes length: n into: buf]);
+          bytes += n;
+          length -= n;
+        }
+      sinkByte(output, '"');
+    }
+  else
+    {
+      // Mimick GWSCoder behaviour
+      output->uncacheable = YES;
+      return writeObject([obj description], output);
+    }
+  return YES;
+}
 
-          for (i = 0; i < length; i++)
-            {
-              unichar	c = from[i];
+/* The canonical serialisations of immutable arrays and dictionaries may
+ * be cached (keyed on the identity of the object), so that signing or
+ * verifying the same sub-trees again just copies the cached bytes.
+ * Objects are only cached if nothing inside them is mutable.
+ * The output is captured in a single buffer for all the objects being
+ * serialised (each nested object noting where its output starts), so
+ * that bytes are only copied once into the buffer and once into the
+ * cache entry for each object, however deeply the objects are nested.
+ * When the cache is full it is simply emptied (rather than evicting the
+ * least recently used entries), which keeps lookups cheap and suits the
+ * expected use of hashing the same few sub-trees in quick succession.
+ */
+static NSUInteger	cacheLimit = 0;
+static NSMapTable	*cache = 0;
+static NSLock		*cacheLock = nil;
+
+static NSUInteger
+cacheHash(NSMapTable *t, const void *k)
+{
+  return ((NSUInteger)(uintptr_t)k) >> 4;
+}
 
-              if (c == '"' || c == '\\' || c == '\b'
-                || c == '\f' || c == '\n' || c == '\r' || c == '\t')
-                {
-                  size += 2;
-                }
-              else if (c < 0x20)
-                {
-                  size += 6;
-                }
-              else
-                {
-                  size++;
-                }
+static BOOL
+cacheEqual(NSMapTable *t, const void *k1, const void *k2)
+{
+  return (k1 == k2) ? YES : NO;
+}
+
+static void
+cacheRetain(NSMapTable *t, const void *k)
+{
+  [(id)k retain];
+}
+
+static void
+cacheRelease(NSMapTable *t, void *k)
+{
+  [(id)k release];
+}
+
+static NSString *
+cacheDescribe(NSMapTable *t, const void *k)
+{
+  return [(id)k description];
+}
+
+static const NSMapTableKeyCallBacks cacheKeyCallBacks = {
+  cacheHash,
+  cacheEqual,
+  cacheRetain,
+  cacheRelease,
+  cacheDescribe,
+  NULL
+};
+
+static BOOL
+writeJSON(id obj, HashSink *output, NSArray* order)
+{
+  NSData	*d;
+  NSUInteger	start;
+  BOOL		uncacheable;
+  BOOL		ok;
+
+  if (0 == cacheLimit || nil != order)
+    {
+      return writeValue(obj, output, order);
+    }
+  if ([obj isKindOfClass: NSArrayClass])
+    {
+      if ([obj isKindOfClass: NSMutableArrayClass])
+        {
+          output->uncacheable = YES;
+          return writeValue(obj, output, order);
+        }
+    }
+  else if ([obj isKindOfClass: NSDictionaryClass])
+    {
+      if ([obj isKindOfClass: NSMutableDictionaryClass])
+        {
+          output->uncacheable = YES;
+          return writeValue(obj, output, order);
+        }
+    }
+  else
+    {
+      if ([obj isKindOfClass: NSMutableStringClass]
+        || [obj isKindOfClass: NSMutableDataClass])
+        {
+          output->uncacheable = YES;
+        }
+      return writeValue(obj, output, order);
+    }
+
+  [cacheLock lock];
+  d = (0 == cache) ? nil : [(NSData*)NSMapGet(cache, obj) retain];
+  [cacheLock unlock];
+  if (nil != d)
+    {
+      sinkBytes(output, [d bytes], [d length]);
+      [d release];
+      return YES;
+    }
+
+  /* Start capturing output for this object (bringing the capture up to
+   * date if we are within an enclosing object), and serialise it.
+   */
+  if (0 == output->capDepth)
+    {
+      if (nil == output->capture)
+        {
+          output->capture = [NSMutableData dataWithCapacity: 256];
+        }
+      [output->capture setLength: 0];
+    }
+  else
+    {
+      [output->capture appendBytes: output->buf + output->capStart
+                            length: output->pos - output->capStart];
+    }
+  output->capStart = output->pos;
+  output->capDepth++;
+  start = [output->capture length];
+  uncacheable = output->uncacheable;
+  output->uncacheable = NO;
+
+  ok = writeValue(obj, output, order);
+
+  [output->capture appendBytes: output->buf + output->capStart
+                        length: output->pos - output->capStart];
+  output->capStart = output->pos;
+  output->capDepth--;
+  if (YES == ok && NO == output->uncacheable)
+    {
+      [cacheLock lock];
+      if (cacheLimit > 0)
+        {
+          if (0 == cache)
+            {
+              cache = NSCreateMapTable(cacheKeyCallBacks,
+                NSObjectMapValueCallBacks, cacheLimit);
+            }
+          else if (NSCountMapTable(cache) >= cacheLimit)
+            {
+              NSResetMapTable(cache);
             }
+          d = [[NSData alloc] initWithBytes:
+            (const uint8_t*)[output->capture bytes] + start
+            length: [output->capture length] - start];
+          NSMapInsert(cache, obj, d);
+          [d release];
+        }
+      [cacheLock unlock];
+    }
+  output->uncacheable = (uncacheable || output->uncacheable) ? YES : NO;
+  return ok;
+}
+
+/* Random data for salts and nonces is generated by a ChaCha20 based
+ * generator with a buffer per thread, so that we don't need a system
+ * call (let alone opening a device) for each salt.  The key is replaced
+ * from the generator output whenever the buffer is refilled (so earlier
+ * output can't be recovered from the state) and is reseeded from the
+ * operating system periodically and after a fork.
+ */
+#define RNG_BLOCKS      8
+#define RNG_RESEED      (1024 * 1024)
+
+typedef struct {
+  uint32_t      key[8];
+  uint32_t      nonce[3];
+  uint8_t       buf[64 * RNG_BLOCKS];
+  unsigned      avail;          // Unused bytes at the end of buf
+  unsigned      produced;       // Bytes produced since seeding
+  unsigned      generation;     // Value of forkGeneration when seeded
+} RNGState;
+
+static __thread RNGState        rngState;
+static volatile unsigned        forkGeneration = 1;
+
+#ifndef __MINGW__
+static void
+rngForked(void)
+{
+  forkGeneration++;
+}
+#endif
 
-          to = NSZoneMalloc (NSDefaultMallocZone(), sizeof(unichar) * size);
-          to[j++] = '"';
-          for (i = 0; i < length; i++)
+/* Get random data from the operating system, returning the number of
+ * bytes obtained.
+ */
+static unsigned
+systemRandom(uint8_t *buffer, unsigned length)
+{
+  unsigned      pos = 0;
+
+#if HAVE_GETRANDOM
+  while (pos < length)
+    {
+      ssize_t result = getrandom(buffer + pos, length - pos, 0);
+
+      if (result < 0)
+        {
+          break;    // Failed to get random data
+        }
+      pos += (unsigned)result;
+    }
+#endif
+
+  if (pos < length)
+    {
+      int       desc;
+
+      /* Try to read random data from /dev/urandom ... the preferred
+       * source for cryptographically random data.
+       */
+      if ((desc = open("/dev/urandom", O_RDONLY)) > 0)
+        {
+          while (pos < length)
             {
-              unichar	c = from[i];
+              ssize_t result = read(desc, buffer + pos, length - pos);
 
-              if (c == '"' || c == '\\' || c == '\b'
-                || c == '\f' || c == '\n' || c == '\r' || c == '\t')
-                {
-                  to[j++] = '\\';
-                  switch (c)
-                    {
-                      case '\\': to[j++] = '\\'; break;
-                      case '\b': to[j++] = 'b'; break;
-                      case '\f': to[j++] = 'f'; break;
-                      case '\n': to[j++] = 'n'; break;
-                      case '\r': to[j++] = 'r'; break;
-                      case '\t': to[j++] = 't'; break;
-                      default: to[j++] = '"'; break;
-                    }
-                }
-              else if (c < 0x20)
-                {
-                  char	buf[5];
-
-                  to[j++] = '\\';
-                  to[j++] = 'u';
-                  sprintf(buf, "%04x", c);
-                  to[j++] = buf[0];
-                  to[j++] = buf[1];
-                  to[j++] = buf[2];
-                  to[j++] = buf[3];
-                }
-              else
+              if (result < 0)
                 {
-                  to[j++] = c;
+                  break;    // Failed to read random data
                 }
+              pos += (unsigned)result;
             }
-          to[j] = '"';
-          str = [[NSStringClass alloc] initWithCharacters: to length: size];
-          NSZoneFree (NSDefaultMallocZone (), to);
-          NSZoneFree (NSDefaultMallocZone (), from);
-          [output appendString: str];
-          [str release];
+          close(desc);
         }
     }
-  else if (obj == boolN) 
+  return pos;
+}
+
+#define ROTL(X,N)       (((X) << (N)) | ((X) >> (32 - (N))))
+#define QR(A,B,C,D) \
+  A += B; D ^= A; D = ROTL(D, 16); \
+  C += D; B ^= C; B = ROTL(B, 12); \
+  A += B; D ^= A; D = ROTL(D, 8); \
+  C += D; B ^= C; B = ROTL(B, 7);
+
+/* Generate one 64 byte ChaCha20 block from the key, counter and nonce.
+ */
+static void
+chachaBlock(const uint32_t key[8], uint32_t counter, const uint32_t nonce[3],
+  uint8_t *output)
+{
+  uint32_t      in[16];
+  uint32_t      x[16];
+  int           i;
+
+  in[0] = 0x61707865;
+  in[1] = 0x3320646e;
+  in[2] = 0x79622d32;
+  in[3] = 0x6b206574;
+  for (i = 0; i < 8; i++)
     {
-      [output appendString: @"false"];
+      in[4 + i] = key[i];
     }
-  else if (obj == boolY) 
+  in[12] = counter;
+  in[13] = nonce[0];
+  in[14] = nonce[1];
+  in[15] = nonce[2];
+  memcpy(x, in, sizeof(x));
+  for (i = 0; i < 10; i++)
     {
-      [output appendString: @"true"];
+      QR(x[0], x[4], x[8], x[12])
+      QR(x[1], x[5], x[9], x[13])
+      QR(x[2], x[6], x[10], x[14])
+      QR(x[3], x[7], x[11], x[15])
+      QR(x[0], x[5], x[10], x[15])
+      QR(x[1], x[6], x[11], x[12])
+      QR(x[2], x[7], x[8], x[13])
+      QR(x[3], x[4], x[9], x[14])
     }
-  else if ([obj isKindOfClass: NSNumberClass])
+  for (i = 0; i < 16; i++)
     {
-      [output appendFormat: @"%g", [obj doubleValue]];
+      uint32_t  v = x[i] + in[i];
+
+      output[i * 4] = (uint8_t)v;
+      output[i * 4 + 1] = (uint8_t)(v >> 8);
+      output[i * 4 + 2] = (uint8_t)(v >> 16);
+      output[i * 4 + 3] = (uint8_t)(v >> 24);
     }
-  else if ([obj isKindOfClass: NSNullClass])
+}
+
+#undef  QR
+#undef  ROTL
+
+/* Mix fresh system random data into the key and nonce.  Returns NO if
+ * the system could not supply the data.
+ */
+static BOOL
+rngSeed(RNGState *s)
+{
+  uint32_t      seed[11];
+  int           i;
+
+  if (systemRandom((uint8_t*)seed, sizeof(seed)) < sizeof(seed))
     {
-      [output appendString: @"null"];
+      return NO;
     }
-  else if ([obj isKindOfClass: NSDateClass])
+  for (i = 0; i < 8; i++)
     {
-      static NSDateFormatter* formatter = nil;
- 
-      if (nil == formatter) 
+      s->key[i] ^= seed[i];
+    }
+  for (i = 0; i < 3; i++)
+    {
+      s->nonce[i] ^= seed[8 + i];
+    }
+  memset(seed, 0, sizeof(seed));
+  memset(s->buf, 0, sizeof(s->buf));
+  s->avail = 0;
+  s->produced = 0;
+  s->generation = forkGeneration;
+  return YES;
+}
+
+/* Fill the buffer and replace the key with the first 32 bytes of it.
+ */
+static void
+rngRefill(RNGState *s)
+{
+  uint32_t      counter;
+
+  for (counter = 0; counter < RNG_BLOCKS; counter++)
+    {
+      chachaBlock(s->key, counter, s->nonce, s->buf + 64 * counter);
+    }
+  memcpy(s->key, s->buf, sizeof(s->key));
+  memset(s->buf, 0, sizeof(s->key));
+  s->avail = sizeof(s->buf) - sizeof(s->key);
+}
+
+/* Fill the buffer with random data from the current thread's generator.
+ * Returns NO if the generator could not be seeded.
+ */
+static BOOL
+rngBytes(uint8_t *buffer, unsigned length)
+{
+  RNGState      *s = &rngState;
+
+  if (s->generation != forkGeneration || s->produced >= RNG_RESEED)
+    {
+      if (NO == rngSeed(s))
         {
-          formatter = [[NSDateFormatter alloc] init];
-          [formatter setTimeStyle: NSDateFormatterFullStyle];
-          [formatter setDateFormat: @"yyyy-MM-dd'T'HH:mm:ssZ"];
+          return NO;
         }
-      [output appendString: [formatter stringFromDate: obj]];
     }
-  else if ([obj isKindOfClass: NSDataClass])
+  s->produced += length;
+  while (length > 0)
+    {
+      uint8_t   *src;
+      unsigned  n;
+
+      if (0 == s->avail)
+        {
+          rngRefill(s);
+        }
+      n = (length < s->avail) ? length : s->avail;
+      src = s->buf + sizeof(s->buf) - s->avail;
+      memcpy(buffer, src, n);
+      memset(src, 0, n);        // Never hand out the same bytes twice
+      s->avail -= n;
+      buffer += n;
+      length -= n;
+    }
+  return YES;
+}
+
+static inline NSString* generateSalt(NSUInteger length)
+{
+  static const char     hex[] = "0123456789abcdef";
+  uint8_t               stack[96];
+  uint8_t               *buffer;
+  NSString              *salt;
+  NSUInteger            i;
+
+  if (length <= 32)
+    {
+      // Use the stack as a buffer
+      buffer = &stack[0];
+    }
+  else 
+    {
+      buffer = malloc(length * 3);
+      if (NULL == buffer)
+	{
+	  [NSException raise: NSMallocException
+	              format: @"Out of memory when allocating buffer for RNG"];
+	}
+    }
+
+  /* Generate the random data at the end of the buffer and encode it as
+   * lowercase hex from the start.
+   */
+  [GWSHash salt: buffer + length * 2 size: length];
+  for (i = 0; i < length; i++)
+    {
+      uint8_t   b = buffer[length * 2 + i];
+
+      buffer[i * 2] = hex[b >> 4];
+      buffer[i * 2 + 1] = hex[b & 0x0f];
+    }
+  salt = [[NSString alloc] initWithBytes: buffer
+                                  length: length * 2
+                                encoding: NSASCIIStringEncoding];
+  if (length > 32)
+    {
+      free(buffer);
+    }
+  return [salt autorelease];
+}
+
+
+/* The precomputed state of an HMAC key.  With gnutls we keep a keyed
+ * HMAC handle which is copied for each message (if gnutls is new enough
+ * to support that), otherwise we keep the digest contexts after the inner
+ * and outer key pads have been processed.
+ */
+#if USE_GNUTLS == 1 && GNUTLS_VERSION_NUMBER >= 0x030609
+#define HAVE_HMAC_COPY  1
+#endif
+
+typedef struct {
+#if USE_GNUTLS == 1
+  gnutls_mac_algorithm_t        alg;
+  unsigned                      length;
+#if HAVE_HMAC_COPY
+  gnutls_hmac_hd_t              hmac;
+#endif
+#else
+  GWSDigestContext              inner;
+  GWSDigestContext              outer;
+#endif
+} HMACState;
+
+#if USE_GNUTLS == 1
+static BOOL
+macAlgorithm(NSString *algorithm, gnutls_mac_algorithm_t *alg)
+{
+  if (IS_METHOD(algorithm, SHA256))
+    {
+      *alg = GNUTLS_MAC_SHA256;
+    }
+  else if (IS_METHOD(algorithm, SHA512))
+    {
+      *alg = GNUTLS_MAC_SHA512;
+    }
+  else if (IS_METHOD(algorithm, SHA1))
+    {
+      *alg = GNUTLS_MAC_SHA1;
+    }
+  else if (IS_METHOD(algorithm, MD5))
     {
-      writeObject([[GWSCoder coder] encodeBase64From: obj], output);
+      *alg = GNUTLS_MAC_MD5;
     }
   else
     {
-      // Mimick GWSCoder behaviour
-      return writeObject([obj description], output);
+      return NO;
     }
   return YES;
 }
-
-static inline NSString* generateSalt(NSUInteger length)
+#else
+static BOOL
+digestAlgorithm(NSString *algorithm, GWSDigestAlgorithm *alg)
 {
-  uint8_t stack[32];
-  void *buffer;
-
-  if (length <= 32)
+  if (IS_METHOD(algorithm, SHA256))
     {
-      // Use the stack as a buffer
-      buffer = &stack[0];
+      *alg = GWSDigestSHA2_256;
     }
-  else 
+  else if (IS_METHOD(algorithm, SHA512))
     {
-      buffer = malloc(length);
-      if (NULL == buffer)
-	{
-	  [NSException raise: NSMallocException
-	              format: @"Out of memory when allocating buffer for RNG"];
-	}
+      *alg = GWSDigestSHA2_512;
     }
-  [GWSHash salt: buffer size: length];
-  NSString *salt = [[GWSCoder coder] encodeHexBinaryFrom: 
-    [NSData dataWithBytesNoCopy: buffer length: length freeWhenDone: NO]];
-  if (length > 32)
+  else if (IS_METHOD(algorithm, SHA1))
     {
-      free(buffer);
+      *alg = GWSDigestSHA1;
+    }
+  else
+    {
+      return NO;
     }
-  return [salt lowercaseString];
+  return (GWSDigestBlockSize(*alg) > 0) ? YES : NO;
 }
-
+#endif
 
 #if USE_GNUTLS == 1
 #define computeDigest(alg, dataToHash)\
@@ -395,15 +1029,26 @@ computeDigestGnuTLS(NSString *algorithm, NSData *data)
 
 
 static NSData*
-computeHMACGnuTLS(NSString *algorithm, NSData *data, NSData *key)
+computeHMACGnuTLS(NSString *algorithm, NSData *data, id key)
 {
   const void* input = [data bytes];
   NSUInteger length = [data length];
-  const void* inKey = [key bytes];
-  NSUInteger keyLen = [key length];
+  const void* inKey;
+  NSUInteger keyLen;
   NSData *hash = nil;
   uint8_t buffer[64]; // 64 bytes is the largest size we need.
 
+  if ([key isKindOfClass: GWSHMACKeyClass])
+    {
+      if (0 != [key _stateFor: algorithm])
+        {
+          return [key computeHMACFrom: data];
+        }
+      key = [key _key];
+    }
+  inKey = [key bytes];
+  keyLen = [key length];
+
   if (IS_METHOD(algorithm, SHA256))
     {
       if (gnutls_hmac_fast(GNUTLS_MAC_SHA256,
@@ -454,6 +1099,14 @@ computeDigestInternal(NSString *algorithm, NSData *data)
     {
       hash = [data SHA1];
     }
+  else if (IS_METHOD(algorithm, SHA256))
+    {
+      hash = [data SHA2_256];
+    }
+  else if (IS_METHOD(algorithm, SHA512))
+    {
+      hash = [data SHA2_512];	// nil unless built with nettle
+    }
   else if (IS_METHOD(algorithm, MD5))
     { 
 #ifdef GNUSTEP
@@ -468,49 +1121,265 @@ computeDigestInternal(NSString *algorithm, NSData *data)
 }
 
 static NSData*
-computeHMACInternal(NSString* algorithm, NSData* message, NSData* key)
+computeHMACInternal(NSString* algorithm, NSData* message, id key)
 {
-  [NSException raise: NSInvalidArgumentException
-              format: @"HMAC generation disabled."];
-  return nil;
+  GWSHMACKey    *k;
+  NSData        *hash;
+
+  if ([key isKindOfClass: GWSHMACKeyClass])
+    {
+      if (0 != [key _stateFor: algorithm])
+        {
+          return [key computeHMACFrom: message];
+        }
+      key = [key _key];
+    }
+  k = [[GWSHMACKey alloc] initWithAlgorithm: algorithm key: key];
+  hash = [k computeHMACFrom: message];
+  [k release];
+  return hash;
 } 
 #endif
 
-static NSString*
-getStringToHash(NSString *method, id rpcID, 
+/* Set up the sink to compute a digest using algorithm, or an HMAC if
+ * a key is supplied.  Returns NO if the algorithm is not supported.
+ */
+static BOOL
+sinkStart(HashSink *s, NSString *algorithm, id key)
+{
+  s->pos = 0;
+  s->capture = nil;
+  s->capStart = 0;
+  s->capDepth = 0;
+  s->uncacheable = NO;
+#if USE_GNUTLS == 1
+  if (nil != key)
+    {
+      gnutls_mac_algorithm_t	alg;
+
+      if ([key isKindOfClass: GWSHMACKeyClass])
+        {
+#if HAVE_HMAC_COPY
+          HMACState     *h = (HMACState*)[key _stateFor: algorithm];
+
+          /* Start from a copy of the keyed state if we can.
+           */
+          if (0 != h && 0 != h->hmac
+            && 0 != (s->hmac = gnutls_hmac_copy(h->hmac)))
+            {
+              s->isHMAC = YES;
+              s->length = h->length;
+              return YES;
+            }
+#endif
+          key = [key _key];
+        }
+      if (NO == macAlgorithm(algorithm, &alg))
+        {
+          return NO;
+        }
+      s->isHMAC = YES;
+      s->length = gnutls_hmac_get_len(alg);
+      return (gnutls_hmac_init(&s->hmac, alg,
+        [key bytes], [key length]) == 0) ? YES : NO;
+    }
+  else
+    {
+      gnutls_digest_algorithm_t	alg;
+
+      if (IS_METHOD(algorithm, SHA256))
+        {
+          alg = GNUTLS_DIG_SHA256;
+        }
+      else if (IS_METHOD(algorithm, SHA512))
+        {
+          alg = GNUTLS_DIG_SHA512;
+        }
+      else if (IS_METHOD(algorithm, SHA1))
+        {
+          alg = GNUTLS_DIG_SHA1;
+        }
+      else if (IS_METHOD(algorithm, MD5))
+        {
+          alg = GNUTLS_DIG_MD5;
+        }
+      else
+        {
+          return NO;
+        }
+      s->isHMAC = NO;
+      s->length = gnutls_hash_get_len(alg);
+      return (gnutls_hash_init(&s->hash, alg) == 0) ? YES : NO;
+    }
+#else
+  GWSDigestAlgorithm	alg;
+
+  s->isHMAC = NO;
+  s->incremental = NO;
+  s->data = nil;
+  if (YES == digestAlgorithm(algorithm, &alg))
+    {
+      if (nil != key)
+        {
+          HMACState     *h = 0;
+          GWSHMACKey    *k = nil;
+
+          /* Start from a copy of the keyed state, making a temporary
+           * key object to set that up if we don't have one.
+           */
+          if ([key isKindOfClass: GWSHMACKeyClass])
+            {
+              h = (HMACState*)[key _stateFor: algorithm];
+              if (0 == h)
+                {
+                  key = [key _key];
+                }
+            }
+          if (0 == h)
+            {
+              k = [[GWSHMACKey alloc] initWithAlgorithm: algorithm key: key];
+              h = (HMACState*)[k _stateFor: algorithm];
+            }
+          if (0 == h)
+            {
+              [k release];
+              return NO;
+            }
+          s->digest = h->inner;
+          s->outer = h->outer;
+          s->isHMAC = YES;
+          [k release];
+        }
+      else
+        {
+          GWSDigestInit(&s->digest, alg);
+        }
+      s->incremental = YES;
+      return YES;
+    }
+  s->data = [NSMutableData dataWithCapacity: SINKSIZE];
+  return YES;
+#endif
+}
+
+/* Release any resources used by the sink and, if the serialisation
+ * succeeded, return the digest or HMAC of everything written to it.
+ */
+static NSData*
+sinkFinish(HashSink *s, NSString *algorithm, id key, BOOL ok)
+{
+#if USE_GNUTLS == 1
+  uint8_t	buffer[64]; // 64 bytes is the largest size we need.
+
+  sinkFlush(s);
+  if (s->isHMAC)
+    {
+      gnutls_hmac_deinit(s->hmac, &buffer[0]);
+    }
+  else
+    {
+      gnutls_hash_deinit(s->hash, &buffer[0]);
+    }
+  if (NO == ok)
+    {
+      return nil;
+    }
+  return [NSData dataWithBytes: &buffer[0] length: s->length];
+#else
+  sinkFlush(s);
+  if (s->incremental)
+    {
+      uint8_t	buffer[64]; // 64 bytes is the largest size we need.
+      unsigned	length;
+
+      length = GWSDigestFinal(&s->digest, &buffer[0]);
+      if (s->isHMAC)
+        {
+          GWSDigestUpdate(&s->outer, &buffer[0], length);
+          length = GWSDigestFinal(&s->outer, &buffer[0]);
+        }
+      memset(&s->digest, 0, sizeof(s->digest));
+      memset(&s->outer, 0, sizeof(s->outer));
+      if (NO == ok)
+        {
+          return nil;
+        }
+      return [NSData dataWithBytes: &buffer[0] length: length];
+    }
+  if (NO == ok)
+    {
+      return nil;
+    }
+  if (nil != key)
+    {
+      return computeHMAC(algorithm, s->data, key);
+    }
+  return computeDigest(algorithm, s->data);
+#endif
+}
+
+/* Serialise the salt, method, rpcID, parameters and extra string into
+ * a digest (or HMAC) context in a single pass, returning the result.
+ */
+static NSData*
+hashParameters(NSString *algorithm, id key, NSString *method, id rpcID, 
   NSDictionary *parameters, NSArray* order, NSString *extra, NSString *salt)
 {
-  NSMutableString *output = [NSMutableString string];
+  HashSink	sink;
+  BOOL		ok = NO;
 
-  if (nil != salt)
+  if (NO == sinkStart(&sink, algorithm, key))
     {
-      [output appendString: salt];
+      return nil;
     }
-  [output appendString: method];
-  if (nil != rpcID)
+  NS_DURING
     {
-      if ([rpcID isKindOfClass: NSNumberClass])
+      if (nil != salt)
+        {
+          sinkString(&sink, salt, NO);
+        }
+      sinkString(&sink, method, NO);
+      if (nil != rpcID)
         {
-          [output appendFormat: @"%g", [rpcID doubleValue]];
+          if ([rpcID isKindOfClass: NSNumberClass])
+            {
+              char	buf[32];
+
+              sinkBytes(&sink, buf,
+                snprintf(buf, sizeof(buf), "%g", [rpcID doubleValue]));
+            }
+          else if ([rpcID isKindOfClass: NSStringClass])
+            {
+              sinkString(&sink, rpcID, NO);
+            }
+          else
+            {
+              sinkString(&sink, [rpcID description], NO);
+            }
         }
-      else if ([rpcID isKindOfClass: NSStringClass])
+      if (NO == writeJSON(parameters, &sink, order))
         {
-          [output appendString: rpcID];
+          NSLog(@"Could not serialise parameters");
         }
       else
         {
-          [output appendString: [rpcID description]];
+          NSDebugFLog(@"Serialised parameters to hash "
+            @"(plus %ld characters from secret string)",
+            (long int)[extra length]);
+          if (nil != extra)
+            {
+              sinkString(&sink, extra, NO);
+            }
+          ok = YES;
         }
     }
-  if (NO == writeJSON(parameters, output, order))
+  NS_HANDLER
     {
-       NSLog(@"Could not serialise parameters");
-       return nil;
+      sinkFinish(&sink, algorithm, key, NO);
+      [localException raise];
     }
-  NSDebugFLog(@"Created the following string to hash: %@ "
-              @"(plus %ld characters from secret string)", output, (long int)[extra length]);
-  [output appendString: extra];
-  return output;
+  NS_ENDHANDLER
+  return sinkFinish(&sink, algorithm, key, ok);
 }
 
 
@@ -537,16 +1406,24 @@ getStringToHash(NSString *method, id rpcID,
         kGWSHashSMD5, kGWSHashSHA1, kGWSHashSSHA1, 
         kGWSHashSHA256, kGWSHashSSHA256,
         kGWSHashSHA512, kGWSHashSSHA512, nil];
+      GWSHMACKeyClass = [GWSHMACKey class];
       NSNullClass = [NSNull class];
       NSArrayClass = [NSArray class];
       NSStringClass = [NSString class];
       NSDictionaryClass = [NSDictionary class];
+      NSMutableArrayClass = [NSMutableArray class];
+      NSMutableDataClass = [NSMutableData class];
       NSMutableDictionaryClass = [NSMutableDictionary class];
+      NSMutableStringClass = [NSMutableString class];
+      cacheLock = [NSLock new];
       NSNumberClass = [NSNumber class];
       NSDateClass = [NSDate class];
       NSDataClass = [NSData class];
       boolN = [[NSNumber alloc] initWithBool: NO];
       boolY = [[NSNumber alloc] initWithBool: YES];
+#ifndef __MINGW__
+      pthread_atfork(NULL, NULL, rngForked);
+#endif
     }
 }
 
@@ -746,20 +1623,16 @@ getStringToHash(NSString *method, id rpcID,
       o = order;
     }
    
-  NSString      *toHash = getStringToHash(rpcMethod, rpcID,
-    dict, o, (extraIsKey) ? nil : additionalValue, salt);
-  NSString      *hash = nil;
-  NSData        *data = [toHash dataUsingEncoding: NSUTF8StringEncoding];
-  if (extraIsKey)
-    {
-      hash = [[GWSCoder coder] encodeHexBinaryFrom:
-        computeHMAC(hashAlgorithm, data, additionalValue)];
-    }
-  else
+  NSData        *digest;
+  NSString      *hash;
+
+  digest = hashParameters(hashAlgorithm, (extraIsKey) ? additionalValue : nil,
+    rpcMethod, rpcID, dict, o, (extraIsKey) ? nil : additionalValue, salt);
+  if (nil == digest)
     {
-      hash = [[GWSCoder coder] encodeHexBinaryFrom:
-        computeDigest(hashAlgorithm, data)];
+      return nil;       // Unsupported algorithm or unserialisable parameters
     }
+  hash = [[GWSCoder coder] encodeHexBinaryFrom: digest];
   return [[[GWSHash alloc] initWithAlgorithm: hashAlgorithm
                                         hash: hash
                                         salt: salt] autorelease];
@@ -778,24 +1651,11 @@ getStringToHash(NSString *method, id rpcID,
 
   if (pos < length)
     {
-      int       desc;
-
-      /* Try to read random data from /dev/urandom ... the preferred
-       * source for cryptographically random data.
+      /* Use our buffered generator (seeded from the operating system).
        */
-      if ((desc = open("/dev/urandom", O_RDONLY)) > 0)
+      if (YES == rngBytes(buffer, length))
         {
-          while (pos < length)
-            {
-              ssize_t result = read(desc, buffer + pos, length - pos);
-
-              if (result < 0)
-                {
-                  break;    // Failed to read random data
-                }
-              pos += (unsigned)result;
-            }
-          close(desc);
+          pos = length;
         }
     }
 
@@ -829,6 +1689,18 @@ getStringToHash(NSString *method, id rpcID,
     }
 }
 
++ (void) setCanonicalCacheLimit: (NSUInteger)limit
+{
+  [cacheLock lock];
+  cacheLimit = limit;
+  if (0 != cache)
+    {
+      NSFreeMapTable(cache);
+      cache = 0;
+    }
+  [cacheLock unlock];
+}
+
 - (BOOL) verifyWithParameters: (NSDictionary*)parameters
                         order: (NSArray*)order
                         extra: (id)additionalValue
@@ -866,27 +1738,195 @@ getStringToHash(NSString *method, id rpcID,
     @" Method: %@, RPCID: %@, Dict: %@, Order: %@, Salt: %@",
     rpcMethod, rpcID, dict, o, salt);
 
-  NSString *toHash = getStringToHash(rpcMethod, rpcID,
-    dict, o, (extraIsKey) ? nil : additionalValue, salt);
-  
-  NSString *otherHash = nil;
-  NSData    *data = [toHash dataUsingEncoding: NSUTF8StringEncoding];
+  NSData *digest = hashParameters(method, (extraIsKey) ? additionalValue : nil,
+    rpcMethod, rpcID, dict, o, (extraIsKey) ? nil : additionalValue, salt);
 
-  if (extraIsKey)
-    { 
-      otherHash = [[GWSCoder coder] encodeHexBinaryFrom:
-        computeHMAC(method, data, additionalValue)];
-    }
-  else
+  if (nil == digest)
     {
-      otherHash = [[GWSCoder coder] encodeHexBinaryFrom:
-        computeDigest(method, data)];
+      return NO;        // Unsupported algorithm or unserialisable parameters
     }
+  NSString *otherHash = [[GWSCoder coder] encodeHexBinaryFrom: digest];
+
   return (NSOrderedSame
     == [[self hashValue] caseInsensitiveCompare: otherHash]);
 }
 @end
 
+
+@implementation GWSHMACKey
+
++ (GWSHMACKey*) keyWithAlgorithm: (NSString*)hashAlgorithm
+                             key: (NSData*)keyData
+{
+  return [[[self alloc] initWithAlgorithm: hashAlgorithm
+                                      key: keyData] autorelease];
+}
+
+- (NSString*) algorithm
+{
+  return algorithm;
+}
+
+- (NSData*) computeHMACFrom: (NSData*)data
+{
+  HMACState     *s = (HMACState*)state;
+  uint8_t       buffer[64]; // 64 bytes is the largest size we need.
+#if USE_GNUTLS == 1
+#if HAVE_HMAC_COPY
+  gnutls_hmac_hd_t      h;
+
+  if (0 != s->hmac && 0 != (h = gnutls_hmac_copy(s->hmac)))
+    {
+      gnutls_hmac(h, [data bytes], [data length]);
+      gnutls_hmac_deinit(h, &buffer[0]);
+      return [NSData dataWithBytes: &buffer[0] length: s->length];
+    }
+#endif
+  if (gnutls_hmac_fast(s->alg, [key bytes], [key length],
+    [data bytes], [data length], &buffer[0]) != 0)
+    {
+      return nil;
+    }
+  return [NSData dataWithBytes: &buffer[0] length: s->length];
+#else
+  GWSDigestContext      ctx;
+  unsigned              length;
+
+  ctx = s->inner;
+  GWSDigestUpdate(&ctx, [data bytes], [data length]);
+  length = GWSDigestFinal(&ctx, &buffer[0]);
+  ctx = s->outer;
+  GWSDigestUpdate(&ctx, &buffer[0], length);
+  length = GWSDigestFinal(&ctx, &buffer[0]);
+  return [NSData dataWithBytes: &buffer[0] length: length];
+#endif
+}
+
+- (void) dealloc
+{
+  if (0 != state)
+    {
+#if HAVE_HMAC_COPY
+      if (0 != ((HMACState*)state)->hmac)
+        {
+          gnutls_hmac_deinit(((HMACState*)state)->hmac, NULL);
+        }
+#endif
+      memset(state, 0, sizeof(HMACState));
+      NSZoneFree(NSDefaultMallocZone(), state);
+    }
+  [algorithm release];
+  [key release];
+  [super dealloc];
+}
+
+- (id) init
+{
+  [self release];
+  return nil;
+}
+
+- (id) initWithAlgorithm: (NSString*)hashAlgorithm
+                     key: (NSData*)keyData
+{
+  if (nil != (self = [super init]))
+    {
+      HMACState         *s;
+#if USE_GNUTLS == 0
+      GWSDigestAlgorithm        alg;
+      uint8_t           pad[128];
+      unsigned          size;
+      unsigned          i;
+#endif
+
+      algorithm = [hashAlgorithm copy];
+      key = [keyData copy];
+      s = (HMACState*)NSZoneCalloc(NSDefaultMallocZone(),
+        1, sizeof(HMACState));
+      state = (void*)s;
+#if USE_GNUTLS == 1
+      if (NO == macAlgorithm(algorithm, &s->alg))
+        {
+          [self release];
+          return nil;
+        }
+      s->length = gnutls_hmac_get_len(s->alg);
+#if HAVE_HMAC_COPY
+      if (gnutls_hmac_init(&s->hmac, s->alg, [key bytes], [key length]) != 0)
+        {
+          s->hmac = 0;  // Use gnutls_hmac_fast() for each message
+        }
+#endif
+#else
+      if (NO == digestAlgorithm(algorithm, &alg))
+        {
+          [self release];
+          return nil;
+        }
+
+      /* A key longer than the block size is replaced by its digest,
+       * then the key is padded to the block size and xored with the
+       * inner and outer pad values to start the two digests.
+       */
+      size = GWSDigestBlockSize(alg);
+      memset(pad, 0, size);
+      if ([key length] > size)
+        {
+          GWSDigestInit(&s->inner, alg);
+          GWSDigestUpdate(&s->inner, [key bytes], [key length]);
+          GWSDigestFinal(&s->inner, pad);
+        }
+      else
+        {
+          memcpy(pad, [key bytes], [key length]);
+        }
+      for (i = 0; i < size; i++)
+        {
+          pad[i] ^= 0x36;
+        }
+      GWSDigestInit(&s->inner, alg);
+      GWSDigestUpdate(&s->inner, pad, size);
+      for (i = 0; i < size; i++)
+        {
+          pad[i] ^= (0x36 ^ 0x5c);
+        }
+      GWSDigestInit(&s->outer, alg);
+      GWSDigestUpdate(&s->outer, pad, size);
+      memset(pad, 0, sizeof(pad));
+#endif
+    }
+  return self;
+}
+
+- (NSData*) _key
+{
+  return key;
+}
+
+- (void*) _stateFor: (NSString*)hashAlgorithm
+{
+#if USE_GNUTLS == 1
+  gnutls_mac_algorithm_t        alg;
+
+  if (YES == macAlgorithm(hashAlgorithm, &alg)
+    && alg == ((HMACState*)state)->alg)
+    {
+      return state;
+    }
+#else
+  GWSDigestAlgorithm    alg;
+
+  if (YES == digestAlgorithm(hashAlgorithm, &alg)
+    && alg == ((HMACState*)state)->inner.algorithm)
+    {
+      return state;
+    }
+#endif
+  return 0;
+}
+
+@end
+
 #if	defined(__cplusplus)
 }
 #endif
@@ -59,6 +59,7 @@ JSONQuote(NSString *str)
       return @"\"\"";
     }
   from = NSZoneMalloc (NSDefaultMallocZone(), sizeof(unichar) * length);
+  GWS_ALLOC(GWSAllocBuffers, sizeof(unichar) * length);
   [str getCharacters: from];
 
   for (i = 0; i < length; i++)
@@ -81,6 +82,7 @@ JSONQuote(NSString *str)
     }
 
   to = NSZoneMalloc (NSDefaultMallocZone(), sizeof(unichar) * output);
+  GWS_ALLOC(GWSAllocBuffers, sizeof(unichar) * output);
   to[j++] = '"';
   for (i = 0; i < length; i++)
     {
@@ -120,6 +122,7 @@ JSONQuote(NSString *str)
     }
   to[j] = '"';
   str = [[NSStringClass alloc] initWithCharacters: to length: output];
+  GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * output);
   NSZoneFree (NSDefaultMallocZone (), to);
   [str autorelease];
   NSZoneFree (NSDefaultMallocZone (), from);
@@ -348,6 +351,7 @@ newParsed(context *ctxt)
 	  ctxt->error = "invalid string";
 	  ctxt->index = start;
 	}
+      GWS_ALLOC(GWSAllocStrings, ctxt->index - start - 1);
       return s;
     }
   else if ('[' == c)
@@ -399,6 +403,7 @@ newParsed(context *ctxt)
       NSMutableDictionary	*d;
 
       d = [[NSMutableDictionary alloc] initWithCapacity: 100];
+      GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * 100);
       for (;;)
 	{
 	  id	k;
@@ -647,7 +652,13 @@ newParsed(context *ctxt)
   else if (YES == [o isKindOfClass: NSDataClass])
     {
       [ms appendString: @"\""];
-      [ms appendString: [self encodeBase64From: o]];
+      [self appendBase64From: o];
+      [ms appendString: @"\""];
+    }
+  else if (YES == [o isKindOfClass: [NSInputStream class]])
+    {
+      [ms appendString: @"\""];
+      [self appendBase64FromStream: o];
       [ms appendString: @"\""];
     }
   else if (YES == [o isKindOfClass: NSDateClass])
@@ -736,6 +747,7 @@ newParsed(context *ctxt)
   BOOL                  positional = YES;
 
   *container = [NSMutableDictionary dictionaryWithCapacity: 4];
+  GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * 4);
 
   o = [parameters objectForKey: GWSOrderKey];
   if (nil != o)
@@ -795,6 +807,7 @@ newParsed(context *ctxt)
       NSMutableDictionary       *e;
 
       e = [[NSMutableDictionary alloc] initWithCapacity: 3];
+      GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * 3);
       [*container setObject: e forKey: @"error"];
       [e release];
 
@@ -907,13 +920,15 @@ newParsed(context *ctxt)
                    order: (NSArray*)order
 {
   NSMutableString       *ms;
+  NSData		*data;
   id                    container;
 
+  GWS_ALLOC_BEGIN(self);
   [self reset];
 
   if (NO == [self fault] && [method length] == 0)
     {
-      return nil;
+      GWS_ALLOC_RETURN(self, nil, NSData*);
     }
 
   ms = [self mutableString];
@@ -926,7 +941,10 @@ newParsed(context *ctxt)
     }
   [self appendObject: container];
 
-  return [ms dataUsingEncoding: NSUTF8StringEncoding];
+  data = [ms dataUsingEncoding: NSUTF8StringEncoding];
+  GWS_ALLOC(GWSAllocBuffers, [data length]);
+  GWS_ALLOC_END(self);
+  return data;
 }
 
 - (NSData*) buildResponse: (NSString*)method
@@ -934,8 +952,10 @@ newParsed(context *ctxt)
                     order: (NSArray*)order;
 {
   NSMutableString       *ms;
+  NSData		*data;
   id                    container;
 
+  GWS_ALLOC_BEGIN(self);
   [self reset];
   ms = [self mutableString];
   [ms setString: @""];
@@ -985,7 +1005,10 @@ newParsed(context *ctxt)
     }
   [self appendObject: container];
 
-  return [ms dataUsingEncoding: NSUTF8StringEncoding];
+  data = [ms dataUsingEncoding: NSUTF8StringEncoding];
+  GWS_ALLOC(GWSAllocBuffers, [data length]);
+  GWS_ALLOC_END(self);
+  return data;
 }
 
 - (void) dealloc
@@ -996,162 +1019,63 @@ newParsed(context *ctxt)
 
 - (NSCalendarDate*) decodeDateTimeFrom: (NSString*)source
 {
-  int	                year;
-  int	                month;
-  int	                day;
-  int	                hour;
-  int	                minute;
-  int	                second;
-  int                   h;
-  int                   m;
-  int                   milli;
-  int                   l;
-  char                  c;
-  NSTimeZone            *tz = nil;
-  const char            *u;
-  NSCalendarDate        *d;
+  GWSDateTime	dt;
+  NSTimeZone	*tz;
 
   if (NO == [source isKindOfClass: [NSString class]])
     {
       return nil;
     }
-  u = [source UTF8String];
-  l = strlen(u);
-  if (29 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02d.%03d%c%02d:%02d",
-    &year, &month, &day, &hour, &minute, &second, &milli, &c, &h, &m) == 10
-    && h >= 0 && h < 24 && m >= 0 && m < 60 && ('-' == c || '+' == c))
-    {
-      tz = nil;
-    }
-  else if (28 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02d.%03d%c%02d%02d",
-    &year, &month, &day, &hour, &minute, &second, &milli, &c, &h, &m) == 10
-    && h >= 0 && h < 24 && m >= 0 && m < 60 && ('-' == c || '+' == c))
-    {
-      tz = nil;
-    }
-  else if (26 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02d.%03d%c%02d",
-    &year, &month, &day, &hour, &minute, &second, &milli, &c, &h) == 9
-    && h >= 0 && h < 24 && ('-' == c || '+' == c))
-    {
-      m = 0;
-      tz = nil;
-    }
-  else if (24 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
-    &year, &month, &day, &hour, &minute, &second, &milli) == 7)
-    {
-      h = m = 0;
-      c = 0;
-      tz = gmt;
-    }
-  else if (23 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02d.%03d",
-    &year, &month, &day, &hour, &minute, &second, &milli) == 7)
-    {
-      h = m = 0;
-      c = 0;
-      tz = [self timeZone];
-    }
-  else if (25 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02d%c%02d:%02d",
-    &year, &month, &day, &hour, &minute, &second, &c, &h, &m) == 9
-    && h >= 0 && h < 24 && m >= 0 && m < 60 && ('-' == c || '+' == c))
-    {
-      milli = 0;
-      tz = nil;
-    }
-  else if (24 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02d%c%02d%02d",
-    &year, &month, &day, &hour, &minute, &second, &c, &h, &m) == 9
-    && h >= 0 && h < 24 && m >= 0 && m < 60 && ('-' == c || '+' == c))
-    {
-      milli = 0;
-      tz = nil;
-    }
-  else if (22 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02d%c%02d",
-    &year, &month, &day, &hour, &minute, &second, &c, &h) == 8
-    && h >= 0 && h < 24 && ('-' == c || '+' == c))
-    {
-      milli = 0;
-      m = 0;
-      tz = nil;
-    }
-  else if (20 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02dZ",
-    &year, &month, &day, &hour, &minute, &second) == 6)
-    {
-      milli = 0;
-      h = m = 0;
-      c = 0;
-      tz = gmt;
-    }
-  else if (19 == l && sscanf(u, "%04d-%02d-%02dT%02d:%02d:%02d",
-    &year, &month, &day, &hour, &minute, &second) == 6)
-    {
-      milli = 0;
-      h = m = 0;
-      c = 0;
-      tz = [self timeZone];
-    }
-  else if (15 == l && sscanf(u, "%04d%02d%02dT%02d%02d%02d",
-    &year, &month, &day, &hour, &minute, &second) == 6)
-    {
-      milli = 0;
-      h = m = 0;
-      c = 0;
-      tz = [self timeZone];
-    }
-  else
-    {
-      return nil;       // Bad date/time format
-    }
-  if (nil == tz)
-    {
-      int       o = h * 60 + m;
-
-      if ('-' == c)
-        {
-          o = -o;
-        }
-      tz = [NSTimeZone timeZoneForSecondsFromGMT: o * 60];
-    }
-  d = [NSCalendarDate alloc];
-  d = [d initWithYear: year
-                month: month
-                  day: day
-                 hour: hour
-               minute: minute
-               second: second
-             timeZone: tz];
-  if (milli != 0)
-    {
-      NSTimeInterval	ti;
-
-      ti = milli;
-      ti /= 1000.0;
-      ti += [d timeIntervalSinceReferenceDate];
-      d = [d initWithTimeIntervalSinceReferenceDate: ti];
-    }
-  [d setTimeZone: tz];
-  return [d autorelease];
+  switch ([self _parseDateTime: source into: &dt])
+    {
+      case 0:
+	tz = [self timeZone];
+	break;
+      case 1:
+	/* A 'Z' suffix is our standard GMT, other offsets use a cached
+	 * timezone for the offset.
+	 */
+	tz = ('Z' == [source characterAtIndex: [source length] - 1])
+	  ? gmt : nil;
+	break;
+      default:
+	return nil;       // Bad date/time format
+    }
+  return [[self _newDateFrom: &dt timeZone: tz] autorelease];
 }
 
 - (NSString*) encodeDateTimeFrom: (NSDate*)source
 {
-  NSString      *s;
+  GWSDateTime	dt;
+  char		buf[40];
+  int		l;
 
   if (NO == [source isKindOfClass: [NSDate class]])
     {
-      s = nil;
-    }
-  else if (YES == useTimeZone)
-    {
-      s = [source descriptionWithCalendarFormat: @"%Y-%m-%dT%H:%M:%S.%F"
-                                       timeZone: [self timeZone]
-                                         locale: nil];
+      return nil;
     }
-  else
+  [self _breakDate: source
+	  timeZone: (YES == useTimeZone) ? [self timeZone] : gmt
+	      into: &dt];
+  l = snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%03d%s",
+    dt.year, dt.month, dt.day, dt.hour, dt.minute, dt.second, dt.milli,
+    (YES == useTimeZone) ? "" : "Z");
+  return [[[NSString alloc] initWithBytes: buf
+				   length: l
+				 encoding: NSASCIIStringEncoding] autorelease];
+}
+
+- (void) _configureFrom: (GWSCoder*)coder
+{
+  [super _configureFrom: coder];
+  if ([coder isKindOfClass: [GWSJSONCoder class]])
     {
-      s = [source descriptionWithCalendarFormat: @"%Y-%m-%dT%H:%M:%S.%FZ"
-                                       timeZone: gmt
-                                         locale: nil];
+      GWSJSONCoder      *c = (GWSJSONCoder*)coder;
+
+      _version = c->_version;
+      ASSIGN(_jsonID, c->_jsonID);
+      _jsonrpc = c->_jsonrpc;
     }
-  return s;
 }
 
 - (void) _jsonrpcFrom: (NSDictionary*)o to: (NSMutableDictionary*)result
@@ -1390,7 +1314,9 @@ newParsed(context *ctxt)
   NSAutoreleasePool     *pool;
   NSMutableDictionary   *result;
 
+  GWS_ALLOC_BEGIN(self);
   result = [NSMutableDictionary dictionaryWithCapacity: 3];
+  GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * 3);
 
   [self reset];
   pool = [NSAutoreleasePool new];
@@ -1489,6 +1415,7 @@ newParsed(context *ctxt)
 
   [self reset];
   [pool release];
+  GWS_ALLOC_END(self);
 
   return result;
 }
@@ -118,6 +118,7 @@
   m = [extensibility mutableCopy];
   [_extensibility release];
   _extensibility = m;
+  [_document _invalidate];
 }
 
 - (GWSElement*) tree
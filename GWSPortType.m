@@ -119,6 +119,7 @@
 - (void) removeOperationNamed: (NSString*)name
 {
   [_operations removeObjectForKey: name];
+  [_document _invalidate];
 }
 
 - (void) setDocumentation: (GWSElement*)documentation
@@ -44,6 +44,7 @@
 #import "GWSPortType.h"
 #import "GWSService.h"
 #import "GWSType.h"
+#import "WSSUsernameToken.h"
 
 #if !defined(GNUSTEP)
 //Let's add some very crude substitutions
@@ -60,11 +61,199 @@ typedef int NSInteger;
 #endif
 #endif
 
+/* Allocation profiling for the parse/encode paths is compiled in only if
+ * the library is built with GWS_ALLOC_STATS defined (eg. by passing
+ * ADDITIONAL_CPPFLAGS=-DGWS_ALLOC_STATS=1 to make).
+ * The GWS_ALLOC() macro counts an allocation (and an approximate size in
+ * bytes) for the current thread, and a coder brackets each message it
+ * encodes or decodes with GWS_ALLOC_BEGIN() and GWS_ALLOC_END() so that
+ * the counts for the message are added to its statistics.
+ * The bracket is an exception handler (so that a message abandoned by an
+ * exception is not counted and does not stop later ones being counted),
+ * so the two macros must be used in the same block, and the code between
+ * them must use GWS_ALLOC_RETURN() rather than return.
+ */
+enum {
+  GWSAllocElements = 0,
+  GWSAllocStrings,
+  GWSAllocDictionaries,
+  GWSAllocBuffers,
+  GWSAllocCategories
+};
+typedef struct {
+  uint64_t	count[GWSAllocCategories];
+  uint64_t	bytes[GWSAllocCategories];
+} GWSAllocCounts;
+
+#if	defined(GWS_ALLOC_STATS) && GWS_ALLOC_STATS
+extern __thread GWSAllocCounts	gwsAllocCounts;
+#define	GWS_ALLOC(C, N) \
+  (gwsAllocCounts.count[C]++, gwsAllocCounts.bytes[C] += (N))
+#define	GWS_ALLOC_BEGIN(X)	[(X) _allocBegin]; NS_DURING
+#define	GWS_ALLOC_END(X)	NS_HANDLER [(X) _allocAbandon]; \
+  [localException raise]; NS_ENDHANDLER [(X) _allocEnd]
+#define	GWS_ALLOC_RETURN(X, V, T) \
+  do { [(X) _allocEnd]; NS_VALUERETURN(V, T); } while (0)
+#else
+#define	GWS_ALLOC(C, N)
+#define	GWS_ALLOC_BEGIN(X)
+#define	GWS_ALLOC_END(X)
+#define	GWS_ALLOC_RETURN(X, V, T)	return (V)
+#endif
+
 @interface      GWSBinding (Private)
 - (id) _initWithName: (NSString*)name document: (GWSDocument*)document;
 - (void) _remove;
 @end
+/* Broken down date/time used by the coders when parsing and formatting
+ * ISO-8601 (and XMLRPC) date/time strings.
+ */
+typedef struct {
+  int	year;
+  int	month;
+  int	day;
+  int	hour;
+  int	minute;
+  int	second;
+  int	milli;
+  int	offset;		// Seconds from GMT
+} GWSDateTime;
+
+/* An incremental digest context for the SHA implementations used by
+ * WSSUsernameToken (large enough for any of them), which may be copied
+ * by assignment to reuse a partially computed digest (eg for HMAC keys).
+ */
+typedef struct {
+  GWSDigestAlgorithm	algorithm;
+  uint64_t		ctx[28];
+} GWSDigestContext;
+
+/* Returns the block size of the algorithm, or zero if an incremental
+ * digest context is not available for it.
+ */
+extern unsigned GWSDigestBlockSize(GWSDigestAlgorithm algorithm);
+/* Initialise a context to digest with algorithm.  Returns NO if an
+ * incremental digest context is not available for the algorithm.
+ */
+extern BOOL GWSDigestInit(GWSDigestContext *c, GWSDigestAlgorithm algorithm);
+/* Add length bytes to the data being digested.
+ */
+extern void GWSDigestUpdate(GWSDigestContext *c,
+  const void *bytes, NSUInteger length);
+/* Write the digest to output (which must have space for 64 bytes) and
+ * return its length.
+ */
+extern unsigned GWSDigestFinal(GWSDigestContext *c, uint8_t *output);
+
+/* Return data compressed in gzip format, or nil if compression failed
+ * (or the library was built without zlib).
+ */
+extern NSData *GWSGzip(NSData *data);
+/* Return data decompressed from gzip, zlib or raw deflate format, or nil
+ * if it could not be decompressed (or the library was built without zlib).
+ * Sets *tooBig if decompression stopped because it exceeded limit bytes.
+ */
+extern NSData *GWSInflate(NSData *data, NSUInteger limit, BOOL *tooBig);
+
+/* One extensibility element to be applied when setting up a service
+ * for an operation, with the extensibility object which handles it.
+ */
+typedef struct {
+  GWSElement		*element;
+  id			section;
+  GWSExtensibility	*extensibility;
+} GWSSetupStep;
+
+/* The setup for an operation on a port in a WSDL document, resolved by
+ * the document so that a service needs only a lookup to find everything
+ * it must apply for a call.  The steps are the extensibility elements of
+ * the port and binding (the first 'split' steps) followed by those of the
+ * operation binding and its input.
+ */
+@interface	GWSResolvedOperation : NSObject
+{
+@public
+  NSString		*operation;
+  GWSPort		*port;
+  GWSBinding		*binding;
+  NSArray		*order;		// parameterOrder from the portType
+  unsigned		split;
+  unsigned		count;
+  GWSSetupStep		*steps;
+}
+@end
+
+@interface      GWSCoder (Private)
+/* Discard the counts for a message started by -_allocBegin which was
+ * abandoned by an exception, once the outermost call is abandoned.
+ */
+- (void) _allocAbandon;
+/* Start counting allocations for a message (unless the current thread is
+ * already counting them for a message of this or another coder, in which
+ * case a nested call by the same coder just increases the nesting depth).
+ */
+- (void) _allocBegin;
+/* Finish counting allocations for a message started by -_allocBegin and
+ * add the counts to the receiver's statistics when the outermost call
+ * finishes.
+ */
+- (void) _allocEnd;
+/* Break down date into dt using the timezone tz (or the receiver's
+ * timezone if tz is nil), setting the offset to that of the timezone.
+ */
+- (void) _breakDate: (NSDate*)date
+	   timeZone: (NSTimeZone*)tz
+	       into: (GWSDateTime*)dt;
+/* Copy the configuration (but not the parse/build state or delegate)
+ * of another coder of the same class into the receiver.
+ */
+- (void) _configureFrom: (GWSCoder*)coder;
+/* Decode a base64 value from a message being parsed, using a temporary
+ * file if the receiver has been set up to do so for large values.
+ */
+- (NSData*) _decodeBase64Value: (NSString*)str;
+/* Return a new (retained) date built from dt in the timezone tz, or if tz
+ * is nil, in a timezone with the offset from dt.
+ */
+- (NSCalendarDate*) _newDateFrom: (GWSDateTime*)dt timeZone: (NSTimeZone*)tz;
+/* Parse an ISO-8601 date/time (the extended or basic formats, with optional
+ * fractional seconds and timezone offset) into dt.<br />
+ * Returns -1 if str is not a valid date/time, 0 if it has no timezone,
+ * and 1 if it has a timezone (whose offset is stored in dt).
+ */
+- (int) _parseDateTime: (NSString*)str into: (GWSDateTime*)dt;
+@end
+@interface      GWSElement (Private)
+/* Stop watching all the elements watched for the document.
+ */
++ (void) _unwatch: (GWSDocument*)document;
+/* Watch the receiver and its descendants so that changes to them are
+ * reported to the document by -_changed.
+ */
+- (void) _watchFor: (GWSDocument*)document;
+@end
 @interface      GWSDocument (Private)
+/* Count a change to an element watched for the receiver, so that its
+ * resolved operations are discarded before they are next used.
+ */
+- (void) _changed;
+/* Return the extensibility object for an element, using the document
+ * namespace for the element's prefix if it has no namespace itself.
+ */
+- (GWSExtensibility*) _extensibilityFor: (GWSElement*)element;
+/* Discard resolved operations after a change to the document (this is
+ * also done when elements used by resolved operations are changed).
+ */
+- (void) _invalidate;
+/* Return the resolved setup for an operation on a port.
+ */
+- (GWSResolvedOperation*) _resolved: (NSString*)operation port: (GWSPort*)port;
+/* Return the resolved setup for a method name (an operation name which is
+ * unique among the ports of the service, or portType.operation), or nil
+ * if the method can not be found.
+ */
+- (GWSResolvedOperation*) _resolvedMethod: (NSString*)method
+				  service: (GWSService*)service;
 - (NSString*) _validate: (GWSElement*)element in: (id)section;
 @end
 @interface      GWSMessage (Private)
@@ -82,18 +271,36 @@ typedef int NSInteger;
 - (void) _remove;
 @end
 @interface      GWSService (Private)
++ (void) _advanceClock: (NSTimeInterval)seconds;
 + (void) _run: (NSString*)host;
 - (void) _activate;
+- (void) _borrowCoder;
+- (void) _cached: (NSData*)data code: (int)code;
+- (void) _cacheFinish;
+- (BOOL) _cacheLookup;
 - (void) _clean;
 - (void) _completed;
 - (void) _completedIO;
 - (BOOL) _enqueue;
+- (BOOL) _initiate: (NSString*)method
+	parameters: (NSDictionary*)parameters
+	     order: (NSArray*)order
+	   timeout: (int)seconds
+       prioritised: (BOOL)urgent;
 - (id) _initWithName: (NSString*)name document: (GWSDocument*)document;
+- (BOOL) _mustPrepare;
+- (NSDictionary*) _ports;
+- (void) _prepare;
 - (void) _received;
+- (void) _receivedWork;
+- (void) _recordLatencies;
 - (void) _remove;
+- (void) _restoreCoder;
 - (void) _setProblem: (NSString*)s;
 - (NSString*) _setupFrom: (GWSElement*)element in: (id)section;
+- (void) _shared: (NSData*)data code: (int)code problem: (NSString*)problem;
 - (void) _start;
+- (BOOL) _submit;
 @end
 @interface      GWSType (Private)
 - (id) _initWithName: (NSString*)name document: (GWSDocument*)document;
@@ -26,6 +26,11 @@
 #import <Foundation/Foundation.h>
 #import "GWSPrivate.h"
 
+/* Binary data larger than this is base64 encoded directly into the
+ * output rather than via an intermediate string in the element tree.
+ */
+#define	STREAMDATA	65536
+
 NSString * const GWSSOAPBodyEncodingStyleKey
   = @"GWSSOAPBodyEncodingStyleKey";
 NSString * const GWSSOAPBodyEncodingStyleDocument
@@ -96,10 +101,166 @@ NSString * const GWSSOAPValueKey
 @interface      GWSSOAPCoder (Private)
 
 - (void) _createElementFor: (id)o named: (NSString*)name in: (GWSElement*)ctct;
+- (void) _decodeParameters: (NSArray*)children
+                      into: (NSMutableDictionary*)result;
 - (id) _simplify: (GWSElement*)elem;
 
 @end
 
+/* The dictionary returned by -parseMessage: when the coder is set to
+ * decode message bodies lazily.  All values are held in a normal
+ * mutable dictionary, but the parameters and order are only added to
+ * it (from the retained body elements) the first time they are needed.
+ */
+@interface      GWSSOAPLazyResult : NSMutableDictionary
+{
+  NSMutableDictionary   *_dict;
+  NSArray               *_children;
+  GWSSOAPCoder          *_coder;
+}
+- (void) _decode;
+- (void) _setChildren: (NSArray*)children coder: (GWSSOAPCoder*)coder;
+@end
+
+@implementation GWSSOAPLazyResult
+
+- (NSUInteger) count
+{
+  [self _decode];
+  return [_dict count];
+}
+
+- (void) dealloc
+{
+  [_children release];
+  [_coder release];
+  [_dict release];
+  [super dealloc];
+}
+
+- (void) _decode
+{
+  if (nil != _children)
+    {
+      NSArray           *children = _children;
+      GWSSOAPCoder      *coder = _coder;
+      NSAutoreleasePool *pool;
+
+      /* Clear the ivars first so that lookups performed by the coder
+       * delegate while decoding do not recurse.
+       */
+      _children = nil;
+      _coder = nil;
+      pool = [NSAutoreleasePool new];
+      NS_DURING
+        {
+          [coder _decodeParameters: children into: _dict];
+        }
+      NS_HANDLER
+        {
+          [_dict setObject: [localException description] forKey: GWSErrorKey];
+        }
+      NS_ENDHANDLER
+      [pool release];
+      [children release];
+      [coder release];
+    }
+}
+
+- (id) initWithCapacity: (NSUInteger)numItems
+{
+  if ((self = [super init]) != nil)
+    {
+      _dict = [[NSMutableDictionary alloc] initWithCapacity: numItems];
+    }
+  return self;
+}
+
+- (NSEnumerator*) keyEnumerator
+{
+  [self _decode];
+  return [_dict keyEnumerator];
+}
+
+- (id) objectForKey: (id)aKey
+{
+  if (nil != _children
+    && ([GWSParametersKey isEqual: aKey] || [GWSOrderKey isEqual: aKey]))
+    {
+      [self _decode];
+    }
+  return [_dict objectForKey: aKey];
+}
+
+- (void) removeObjectForKey: (id)aKey
+{
+  [self _decode];
+  [_dict removeObjectForKey: aKey];
+}
+
+- (void) setObject: (id)anObject forKey: (id)aKey
+{
+  if (nil != _children
+    && ([GWSParametersKey isEqual: aKey] || [GWSOrderKey isEqual: aKey]))
+    {
+      [self _decode];
+    }
+  [_dict setObject: anObject forKey: aKey];
+}
+
+- (void) _setChildren: (NSArray*)children coder: (GWSSOAPCoder*)coder
+{
+  ASSIGN(_children, children);
+  ASSIGN(_coder, coder);
+}
+
+@end
+
+/* An element whose base64 content is written straight into the coder's
+ * output when the element is serialised (from an NSInputStream or a large
+ * NSData object) rather than being stored as a string in the tree.
+ */
+@interface      GWSSOAPBase64Element : GWSElement
+{
+  id    _source;
+}
+- (void) _setSource: (id)source;
+@end
+
+@implementation GWSSOAPBase64Element
+
+- (void) dealloc
+{
+  [_source release];
+  [super dealloc];
+}
+
+- (void) encodeContentWith: (GWSCoder*)coder
+{
+  if ([_source isKindOfClass: [NSInputStream class]])
+    {
+      [coder appendBase64FromStream: _source];
+    }
+  else
+    {
+      [coder appendBase64From: _source];
+    }
+}
+
+- (BOOL) encodeStartWith: (GWSCoder*)coder collapse: (BOOL)flag
+{
+  /* We have no content in the tree, but must never be collapsed.
+   */
+  return [super encodeStartWith: coder collapse: NO];
+}
+
+- (void) _setSource: (id)source
+{
+  ASSIGN(_source, source);
+}
+
+@end
+
 @implementation	GWSSOAPCoder
 
 static NSCharacterSet	*illegal = nil;
@@ -180,10 +341,12 @@ newHeader(NSString *prefix, id o)
   NSString              *qualified;
   NSString		*use;
   NSMutableString       *ms;
+  NSData		*data;
   id			o;
   unsigned	        c;
   unsigned	        i;
 
+  GWS_ALLOC_BEGIN(self);
   [self reset];
   pool = [NSAutoreleasePool new];
 
@@ -238,7 +401,8 @@ newHeader(NSString *prefix, id o)
     {
       if ([method length] == 0)
 	{
-	  return nil;
+	  [pool release];
+	  GWS_ALLOC_RETURN(self, nil, NSData*);
 	}
       else
 	{
@@ -251,7 +415,8 @@ newHeader(NSString *prefix, id o)
 		{
 		  NSLog(@"Illegal character in method name '%@'", method);
 		}
-	      return nil;	// Bad method name.
+	      [pool release];
+	      GWS_ALLOC_RETURN(self, nil, NSData*);	// Bad method name.
 	    }
 	}
     }
@@ -587,7 +752,10 @@ newHeader(NSString *prefix, id o)
   [ms setString: @"<?xml version=\"1.0\" encoding=\"UTF-8\"?>"];
   [envelope encodeWith: self];
   [pool release];
-  return [ms dataUsingEncoding: NSUTF8StringEncoding];
+  data = [ms dataUsingEncoding: NSUTF8StringEncoding];
+  GWS_ALLOC(GWSAllocBuffers, [data length]);
+  GWS_ALLOC_END(self);
+  return data;
 }
 
 - (NSData*) buildResponse: (NSString*)method
@@ -602,8 +770,10 @@ newHeader(NSString *prefix, id o)
 
 - (NSString*) encodeDateTimeFrom: (NSDate*)source
 {
+  GWSDateTime	dt;
   NSTimeZone    *tz;
-  int           t;
+  char		buf[40];
+  int           l;
 
   if ([source isKindOfClass: [NSCalendarDate class]] == YES)
     {
@@ -613,14 +783,13 @@ newHeader(NSString *prefix, id o)
     {
       tz = [self timeZone];
     }
-  source = [NSCalendarDate dateWithTimeIntervalSinceReferenceDate:
-    [source timeIntervalSinceReferenceDate]];
-  [(NSCalendarDate*)source setTimeZone: tz];
-  t = [tz secondsFromGMTForDate: source];
-  if (t != 0)
+  [self _breakDate: source timeZone: tz into: &dt];
+  l = snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d",
+    dt.year, dt.month, dt.day, dt.hour, dt.minute, dt.second);
+  if (dt.offset != 0)
     {
       char      sign;
-      NSString  *fmt;
+      int	t = dt.offset;
 
       if (t < 0)
         {
@@ -632,15 +801,16 @@ newHeader(NSString *prefix, id o)
           sign = '+';
         }
       t /= 60;
-      fmt = [NSString stringWithFormat: @"%%Y-%%m-%%dT%%H:%%M:%%S%c%02d:%02d",
-        sign, t / 60, t % 60];
-      [(NSCalendarDate*)source setCalendarFormat: fmt];
+      l += snprintf(buf + l, sizeof(buf) - l, "%c%02d:%02d",
+	sign, t / 60, t % 60);
     }
   else
     {
-      [(NSCalendarDate*)source setCalendarFormat: @"%Y-%m-%dT%H:%M:%SZ"];
+      buf[l++] = 'Z';
     }
-  return [source description];
+  return [[[NSString alloc] initWithBytes: buf
+				   length: l
+				 encoding: NSASCIIStringEncoding] autorelease];
 }
 
 - (id) init
@@ -652,6 +822,11 @@ newHeader(NSString *prefix, id o)
   return self;
 }
 
+- (BOOL) lazyBody
+{
+  return _lazyBody;
+}
+
 - (NSString*) operationStyle
 {
   return _style;
@@ -661,25 +836,32 @@ newHeader(NSString *prefix, id o)
 {
   NSAutoreleasePool     *pool;
   NSMutableDictionary   *result;
+  GWSCoder              *parser;
 
-  result = [NSMutableDictionary dictionaryWithCapacity: 3];
+  GWS_ALLOC_BEGIN(self);
+  if (YES == _lazyBody)
+    {
+      result = [[[GWSSOAPLazyResult alloc] initWithCapacity: 4] autorelease];
+    }
+  else
+    {
+      result = [NSMutableDictionary dictionaryWithCapacity: 3];
+    }
+  GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * 4);
   pool = [NSAutoreleasePool new];
 
+  parser = [GWSCoder borrowCoder];
   NS_DURING
     {
-      GWSCoder                  *parser;
       NSEnumerator              *enumerator;
       GWSElement                *elem;
       GWSElement                *envelope;
       GWSElement                *header;
       GWSElement                *body;
-      NSMutableDictionary       *p;
-      NSMutableArray            *o;
       NSArray                   *children;
       unsigned                  c;
       unsigned                  i;
 
-      parser = [[GWSCoder new] autorelease];
       envelope = [parser parseXML: data];
       if (envelope == nil)
 	{
@@ -712,7 +894,12 @@ newHeader(NSString *prefix, id o)
           elem = [enumerator nextObject];
           if ([self delegate] != nil)
             {
-              [[self delegate] coder: self willDecode: header];
+              header = [[self delegate] coder: self willDecode: header];
+            }
+          if (YES == _lazyBody && header != nil)
+            {
+              [result setObject: [self _simplify: header]
+                         forKey: GWSSOAPMessageHeadersKey];
             }
         }
       if (elem == nil)
@@ -741,6 +928,7 @@ newHeader(NSString *prefix, id o)
           GWSElement            *fault = elem;
 
           f = [[NSMutableDictionary alloc] initWithCapacity: 4];
+          GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * 4);
           [result setObject: f forKey: GWSFaultKey];
           [f release];
 
@@ -802,8 +990,6 @@ newHeader(NSString *prefix, id o)
         }
       else
         {
-	  NSCountedSet	*cs;
-
           /* If the body contains a single element with no content,
            * we assume it is a method and its children are the
            * parameters.  Otherwise we assume that the parameters
@@ -818,62 +1004,33 @@ newHeader(NSString *prefix, id o)
               [result setObject: [elem name] forKey: GWSMethodKey];
               children = [elem children];
             }
-          cs = [[NSCountedSet alloc] initWithCapacity: c];
-          c = [children count];
-          for (i = 0; i < c; i++)
-	    {
-	      [cs addObject: [[children objectAtIndex: i] name]];
-	    }
-          p = [[NSMutableDictionary alloc] initWithCapacity: [cs count]];
-          [result setObject: p forKey: GWSParametersKey];
-          [p release];
-          o = [[NSMutableArray alloc] initWithCapacity: [cs count]];
-          [result setObject: o forKey: GWSOrderKey];
-          [o release];
-          c = [children count];
-          for (i = 0; i < c; i++)
+          if (YES == _lazyBody)
             {
-              id                arg;
-              NSString          *n;
-	      unsigned		rCount;
-
-              elem = [children objectAtIndex: i];
-              n = [elem name];
-	      if ((rCount = [cs countForObject: n]) == 1)
-		{
-		  [o addObject: n];
-		  arg = [[self delegate] decodeWithCoder: self
-						    item: elem
-						   named: n];
-		  if (arg == nil)
-		    {
-		      arg = [self _simplify: elem];
-		    }
-		  [p setObject: arg forKey: n];
-		}
-	      else
-		{
-		  NSMutableArray	*ma;
-
-		  ma = [p objectForKey: n];
-		  if (ma == nil)
-		    {
-		      ma = [[NSMutableArray alloc] initWithCapacity: rCount];
-		      [p setObject: ma forKey: n];
-		      [ma release];
-		      [o addObject: n];
-		    }
-		  arg = [[self delegate] decodeWithCoder: self
-						    item: elem
-						   named: n];
-		  if (arg == nil)
-		    {
-		      arg = [self _simplify: elem];
-		    }
-		  [ma addObject: arg];
-		}
+              if (YES == _pooled)
+                {
+                  GWSSOAPCoder  *c;
+
+                  /* A borrowed coder goes back to its pool (and may be
+                   * reused) before the body is decoded, so the result
+                   * gets its own coder with our settings and delegate.
+                   */
+                  c = [[self class] new];
+                  [c _configureFrom: self];
+                  [c setDelegate: [self delegate]];
+                  [(GWSSOAPLazyResult*)result _setChildren: children
+                                                     coder: c];
+                  [c release];
+                }
+              else
+                {
+                  [(GWSSOAPLazyResult*)result _setChildren: children
+                                                     coder: self];
+                }
+            }
+          else
+            {
+              [self _decodeParameters: children into: result];
             }
-	  [cs release];
         }
     }
   NS_HANDLER
@@ -881,11 +1038,18 @@ newHeader(NSString *prefix, id o)
       [result setObject: [localException description] forKey: GWSErrorKey];
     }
   NS_ENDHANDLER
+  [parser returnCoder];
   [pool release];
+  GWS_ALLOC_END(self);
 
   return result;
 }
 
+- (void) setLazyBody: (BOOL)flag
+{
+  _lazyBody = (flag ? YES : NO);
+}
+
 - (void) setOperationStyle: (NSString*)style
 {
   if (style == nil)
@@ -920,6 +1084,19 @@ newHeader(NSString *prefix, id o)
 
 @implementation GWSSOAPCoder (Private)
 
+- (void) _configureFrom: (GWSCoder*)coder
+{
+  [super _configureFrom: coder];
+  if ([coder isKindOfClass: [GWSSOAPCoder class]])
+    {
+      GWSSOAPCoder      *c = (GWSSOAPCoder*)coder;
+
+      _style = c->_style;
+      _useLiteral = c->_useLiteral;
+      _lazyBody = c->_lazyBody;
+    }
+}
+
 - (void) _createElementFor: (id)o
 		     named: (NSString*)name
 		        in: (GWSElement*)ctxt
@@ -930,6 +1107,7 @@ newHeader(NSString *prefix, id o)
   NSString      *x;     // xsi:type if any
   NSString      *c;     // Content if any
   NSString	*a;	// Array item name
+  id		source; // Streamed base64 content if any
   NSString	*nsURI = nil;
   NSString	*nsName = nil;
   BOOL          array = NO;
@@ -948,6 +1126,7 @@ newHeader(NSString *prefix, id o)
   x = nil;
   c = nil;
   a = nil;
+  source = nil;
   q = name;
 
   /* If this is a dictionary describing a single value, rather than a
@@ -1016,6 +1195,7 @@ newHeader(NSString *prefix, id o)
                   x = @"xsd:long";
                 }
               c = [NSString stringWithFormat: @"%ld", i];
+              GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * [c length]);
             }
           else
             {
@@ -1024,6 +1204,7 @@ newHeader(NSString *prefix, id o)
                   x = @"xsd:int";
                 }
               c = [NSString stringWithFormat: @"%ld", i];
+              GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * [c length]);
             }
         }
       else
@@ -1033,6 +1214,7 @@ newHeader(NSString *prefix, id o)
               x = @"xsd:double";
             }
           c = [NSString stringWithFormat: @"%f", [(NSNumber*)o doubleValue]];
+          GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * [c length]);
         }
     }
   else if (YES == [o isKindOfClass: [NSData class]])
@@ -1041,7 +1223,22 @@ newHeader(NSString *prefix, id o)
         {
           x = @"xsd:base64Binary";
         }
-      c = [self encodeBase64From: o];
+      if ([o length] > STREAMDATA)
+        {
+          source = o;	// Encode directly into output
+        }
+      else
+        {
+          c = [self encodeBase64From: o];
+        }
+    }
+  else if (YES == [o isKindOfClass: [NSInputStream class]])
+    {
+      if (NO == _useLiteral && x == nil)
+        {
+          x = @"xsd:base64Binary";
+        }
+      source = o;
     }
   else if (YES == [o isKindOfClass: [NSDate class]])
     {
@@ -1071,6 +1268,7 @@ newHeader(NSString *prefix, id o)
   if (nsName != nil)
     {
       q = [NSString stringWithFormat: @"%@:%@", nsName, name];
+      GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * [q length]);
     }
   if (nil == q)
     {
@@ -1080,10 +1278,22 @@ newHeader(NSString *prefix, id o)
     {
       name = [q substringFromIndex: NSMaxRange([q rangeOfString: @":"])];
     }
-  e = [[GWSElement alloc] initWithName: name
-			     namespace: nil
-			     qualified: q
-			    attributes: nil];
+  if (nil == source)
+    {
+      e = [GWSElement alloc];
+    }
+  else
+    {
+      e = [GWSSOAPBase64Element alloc];
+    }
+  e = [e initWithName: name
+	    namespace: nil
+	    qualified: q
+	   attributes: nil];
+  if (nil != source)
+    {
+      [(GWSSOAPBase64Element*)e _setSource: source];
+    }
   if (nsURI != nil)
     {
       [e setNamespace: nsURI forPrefix: @""];
@@ -1168,6 +1378,74 @@ newHeader(NSString *prefix, id o)
     }
 }
 
+- (void) _decodeParameters: (NSArray*)children
+                      into: (NSMutableDictionary*)result
+{
+  NSCountedSet	        *cs;
+  NSMutableDictionary   *p;
+  NSMutableArray        *o;
+  unsigned              c;
+  unsigned              i;
+
+  c = [children count];
+  cs = [[NSCountedSet alloc] initWithCapacity: c];
+  for (i = 0; i < c; i++)
+    {
+      [cs addObject: [[children objectAtIndex: i] name]];
+    }
+  p = [[NSMutableDictionary alloc] initWithCapacity: [cs count]];
+  GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * [cs count]);
+  [result setObject: p forKey: GWSParametersKey];
+  [p release];
+  o = [[NSMutableArray alloc] initWithCapacity: [cs count]];
+  [result setObject: o forKey: GWSOrderKey];
+  [o release];
+  for (i = 0; i < c; i++)
+    {
+      GWSElement        *elem;
+      id                arg;
+      NSString          *n;
+      unsigned		rCount;
+
+      elem = [children objectAtIndex: i];
+      n = [elem name];
+      if ((rCount = [cs countForObject: n]) == 1)
+        {
+          [o addObject: n];
+          arg = [[self delegate] decodeWithCoder: self
+                                            item: elem
+                                           named: n];
+          if (arg == nil)
+            {
+              arg = [self _simplify: elem];
+            }
+          [p setObject: arg forKey: n];
+        }
+      else
+        {
+          NSMutableArray	*ma;
+
+          ma = [p objectForKey: n];
+          if (ma == nil)
+            {
+              ma = [[NSMutableArray alloc] initWithCapacity: rCount];
+              [p setObject: ma forKey: n];
+              [ma release];
+              [o addObject: n];
+            }
+          arg = [[self delegate] decodeWithCoder: self
+                                            item: elem
+                                           named: n];
+          if (arg == nil)
+            {
+              arg = [self _simplify: elem];
+            }
+          [ma addObject: arg];
+        }
+    }
+  [cs release];
+}
+
 - (id) _simplify: (GWSElement*)elem
 {
   NSArray       *a;
@@ -1235,6 +1513,7 @@ newHeader(NSString *prefix, id o)
 	   * possibly arrays of elements.
 	   */
 	  md = [NSMutableDictionary dictionaryWithCapacity: [order count] + 1];
+	  GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * ([order count] + 1));
 	  c = [names count];
 	  for (i = 0; i < c; i++)
 	    {
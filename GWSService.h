@@ -110,6 +110,7 @@ extern "C" {
   id			_delegate;	// Not retained.
   NSTimeZone		*_tz;
   GWSCoder              *_coder;
+  GWSCoder              *_ownCoder;	// Set while _coder is borrowed
   NSString		*_HTTPMethod;
   NSString		*_SOAPAction;
   BOOL			_compact;
@@ -118,6 +119,7 @@ extern "C" {
   BOOL			_cancelled;	// Timeout occurred
   BOOL			_completedIO;	// Comms completed
   BOOL			_newAPI;
+  BOOL			_coderPooling;
   NSString		*_operation;
   GWSPort		*_port;
   NSMutableDictionary	*_parameters;
@@ -143,12 +145,165 @@ extern "C" {
     RPCParsing		// Parsing the response data
   } _stage;
   NSString		*_contentType;
+  uint64_t		_stamps[6];	// Times of RPC stages (microseconds)
+  NSData		*_cacheKey;	// Set while cacheable/coalesced RPC active
+  NSData		*_rawResponse;	// Response before delegate changes
+  NSTimeInterval	_cacheLife;	// Time to keep cached response for
+  NSUInteger		_compressAbove;	// Minimum request size to compress
+  BOOL			_acceptCompressed;
+  BOOL			_compressedRequest;
+  BOOL			_compressedResponse;
+  BOOL			_probe;		// Sent with circuit half open
+  uint64_t		_deadline;	// Absolute deadline (microseconds)
 }
 
 /** Returns a description of the current asynchronous service queues.
  */
 + (NSString*) description;
 
+/** Returns the latencies of the stages of asynchronous RPCs completed
+ * since the process started (or since +resetLatencies was called).<br />
+ * The result contains a 'Hosts' dictionary keyed on the remote host
+ * and an 'Operations' dictionary keyed on the operation name, each
+ * holding a dictionary for each stage of the RPC ...<br />
+ * 'Queue' the time spent queued waiting for a connection (excluding
+ * the time taken to build the request)<br />
+ * 'Build' the time taken to build the request<br />
+ * 'Network' the time from starting to send the request until the
+ * response was completely read<br />
+ * 'Parse' the time taken to parse the response<br />
+ * The dictionary for each stage contains 'Count', 'Mean', 'Max', 'P50',
+ * 'P90', 'P99' and 'P999' values, all times being in microseconds.
+ * Percentiles are accurate to within about six percent.
+ */
++ (NSDictionary*) latencies;
+
+/** Returns counters for the asynchronous RPC queues ... 'Active' and
+ * 'Queued' (the numbers of requests in progress and waiting), 'Hosts'
+ * (a dictionary containing 'Active', 'Queued', 'ServiceTime' and 'Circuit'
+ * for each remote host, 'ServiceTime' being a moving average of the
+ * microseconds taken to send a request and read and parse the response
+ * (reduced over time when no requests complete),
+ * and 'Circuit' the circuit breaker state: 0 for closed, 1 for open and
+ * 2 for half open),
+ * 'RejectedQMax' and 'RejectedPerHostQMax' (requests refused because
+ * the limits set by +setQMax: or +setPerHostQMax: were reached),
+ * 'RejectedDeadline' (queued requests failed because too little time
+ * was left before their deadline for them to complete),
+ * 'RejectedCircuit' (requests failed because the circuit breaker for
+ * the host was open),
+ * 'Timeouts', 'Cancellations', 'BytesSent', 'BytesReceived',
+ * 'Coalesced' (requests which used the result of an identical request
+ * already in progress), for the response cache 'CacheHits', 'CacheMisses'
+ * and 'CacheBytes' (the size of cached responses),
+ * and for the work thread pool 'WorkThreads' (the maximum number of
+ * threads), 'WorkBusy' (tasks being run) and 'WorkPending' (tasks
+ * waiting for a thread).<br />
+ * The counters are maintained atomically, so unlike +description this
+ * does not need to lock the queues.
+ */
++ (NSDictionary*) metrics;
+
+/** Returns the values from +metrics in the Prometheus text exposition
+ * format, with metric names prefixed by 'gwsservice_'.
+ */
++ (NSString*) metricsText;
+
+/** Discards the latencies recorded for asynchronous RPCs (see
+ * the +latencies method).
+ */
++ (void) resetLatencies;
+
+/** Sends a batch of RPCs, one for each service in the services array,
+ * using the method name and parameters at the same index in the methods
+ * and parameters arrays, and the parameter order at that index in the
+ * orders array (which may be nil).  NSNull may be used for missing
+ * parameters or orders.<br />
+ * This behaves like calling -sendRequest:parameters:order:timeout: for
+ * each service in turn, except that the request data of those services
+ * which must build it before their RPCs are queued (eg. when using
+ * +setCoalescing: or the response cache) is built in parallel by the
+ * calling thread and the work threads (see +setWorkThreads:), so a single
+ * thread can dispatch such requests at a much higher rate.  Only those
+ * requests are built in parallel by this method; the others are built
+ * after being queued (by the work threads, if any) just as they would be
+ * by -sendRequest:parameters:order:timeout:.  As usual responses are
+ * parsed by the work threads, and the -completedRPC: callback for each
+ * service is sent in the calling thread.<br />
+ * Returns an array of the services whose RPCs could not be started
+ * (empty if all were started).
+ */
++ (NSArray*) sendRequests: (NSArray*)services
+		  methods: (NSArray*)methods
+	       parameters: (NSArray*)parameters
+		   orders: (NSArray*)orders
+		  timeout: (int)seconds;
+
+/** Sets the maximum number of bytes of response data held in the cache
+ * used for RPCs whose delegate says they are cacheable (see the
+ * -webService:cacheLifetime: delegate method).  The least recently used
+ * responses are discarded when this limit is reached.<br />
+ * The default is zero, which disables caching (and setting the limit to
+ * zero discards any cached responses).
+ */
++ (void) setCacheLimit: (NSUInteger)bytes;
+
+/** Configures the per host circuit breaker, which stops requests being
+ * sent to a host which is failing so that they do not use up connections
+ * and queue space needed for other hosts.<br />
+ * The circuit for a host opens when at least count requests have been
+ * sent to it and the proportion which failed (with an error such as a
+ * timeout, connection failure or HTTP error status, but not a fault) has
+ * reached failureRate.  While the circuit is open, new requests to the
+ * host fail at once (-sendRequest:parameters:order:timeout: returns NO
+ * and the -result contains GWSErrorKey), and requests queued and ready
+ * to send when it opened are failed with GWSErrorKey.<br />
+ * After the cooldown period the circuit is half open, and up to probes
+ * requests are allowed through.  If one of them succeeds the circuit
+ * closes, and if one fails it opens again for another cooldown period.
+ * Requests cancelled by calling -timeout: are not counted as successes or
+ * failures (a cancelled probe just lets another probe through).
+ * <br />
+ * A failureRate of zero (the default) disables the circuit breaker.
+ */
++ (void) setCircuitBreaker: (double)failureRate
+		   minimum: (unsigned)count
+		  cooldown: (NSTimeInterval)seconds
+		    probes: (unsigned)probes;
+
+/** Sets whether RPCs are coalesced.  When this is enabled, the request
+ * data is built as soon as an RPC is sent (rather than by a work thread),
+ * and if an identical request (the same URL, HTTP method, headers and
+ * request data) is already queued or in progress, the new RPC is not
+ * queued but waits for that request to complete and then parses its
+ * response (using its own coder and delegate) or fails with its error.
+ * This prevents bursts of identical calls from using up the connections
+ * to a host.<br />
+ * The default is NO, since it is only safe for idempotent requests.
+ */
++ (void) setCoalescing: (BOOL)flag;
+
+/** Sets the name of an HTTP header used to tell the server how much time
+ * (in milliseconds) is left before the deadline of each request (the time
+ * at which it times out) when it is sent.<br />
+ * The default is nil (no header is sent).<br />
+ * NB. Regardless of this setting, a queued request is failed with an
+ * error rather than being sent if, after waiting in the queue, the time
+ * left before its deadline is less than the average time taken by
+ * requests to the same host.  A request whose timeout was shorter than
+ * that average when it was queued is sent anyway, and the average is
+ * reduced over time when no requests to the host complete.
+ */
++ (void) setDeadlineHeader: (NSString*)name;
+
+/** Sets the maximum size (in bytes) a compressed response may grow to when
+ * it is decompressed (see -setCompressResponses:).  A response which would
+ * be larger fails with GWSErrorKey rather than being parsed.<br />
+ * The default is zero, meaning that a response may grow to a hundred
+ * times its compressed size (or one megabyte if that is larger).
+ */
++ (void) setInflateLimit: (NSUInteger)bytes;
+
 /** Sets maximum active requests to a single host.  This is silently limited
  * to be no more than the value set by the +setPool: method.
  */
@@ -224,6 +379,12 @@ extern "C" {
  */
 - (GWSCoder*) coder;
 
+/** Returns YES if the receiver borrows pooled coders to build requests
+ * and parse responses, NO (the default) otherwise.
+ * See -setCoderPooling: for details.
+ */
+- (BOOL) coderPooling;
+
 /** Returns YES if debug is enabled, NO otherwise.  The default value of this
  * is obtained from the GWSDebug user default (or NO if no default
  * is set), but may also be adjusted by a call to the -setDebug: method.
@@ -348,6 +509,47 @@ extern "C" {
  */
 - (void) setCoder: (GWSCoder*)aCoder;
 
+/** Sets whether the receiver should use coders borrowed from a per-thread
+ * pool (see [GWSCoder+borrowCoder]) when preparing a request and when
+ * parsing the response to it.<br />
+ * When this is enabled, the coder set using -setCoder: acts as a template:
+ * for each stage a pooled coder of the same class is borrowed, given the
+ * settings of the template coder, used, and then returned to the pool
+ * (any settings changed while building the request are copied back to
+ * the template so that they are also used when parsing the response).<br />
+ * This avoids allocating new coder internals for every request when
+ * services or coders are created per request on busy paths.<br />
+ * NB. While a stage is in progress the -coder method returns the borrowed
+ * coder.  A SOAP coder with lazy body decoding enabled
+ * (see [GWSSOAPCoder-setLazyBody:]) gives the parsed result a private
+ * (unpooled) coder with the same settings and delegate, so the body is
+ * decoded correctly even though the borrowed coder has been returned to
+ * the pool (and perhaps reused) by the time the parameters are used.
+ */
+- (void) setCoderPooling: (BOOL)flag;
+
+/** Sets the size (in bytes) at or above which request data is sent
+ * compressed (with a Content-Encoding of gzip), if that makes it smaller.
+ * The compression is done when the request is built, by a work thread
+ * if there are any (see +setWorkThreads:).<br />
+ * The default is zero, meaning that requests are not compressed.
+ * Only set this for servers which accept compressed requests.<br />
+ * This has no effect if the library was built without zlib.
+ */
+- (void) setCompressRequests: (NSUInteger)threshold;
+
+/** Sets whether requests ask for a compressed response (by sending an
+ * Accept-Encoding header for gzip and deflate).  A compressed response
+ * is decompressed before parsing, by a work thread if there are any
+ * (see +setWorkThreads:), rather than by the thread doing the I/O.<br />
+ * The response is read in full before it is decompressed (it is not
+ * decompressed as it arrives), and its decompressed size is limited
+ * (see +setInflateLimit:).<br />
+ * The default is NO.<br />
+ * This has no effect if the library was built without zlib.
+ */
+- (void) setCompressResponses: (BOOL)flag;
+
 /**
  * Sets the value of the Content-Type header to be sent with a request.<br />
  * Setting a nil or empty string value reverts to the default of text/xml.
@@ -515,6 +717,25 @@ extern "C" {
             parameters: (NSDictionary*)parameters
                  order: (NSArray*)order;
 
+/** This method is called (if the response cache is enabled using the
+ * +setCacheLimit: method) when an RPC is sent, to ask the delegate
+ * whether the response to the method may be cached.  If the delegate
+ * returns a positive value, the request data is built at once (rather
+ * than by a work thread) and, if the response to an identical request
+ * (the same URL, HTTP method, headers and request data) is cached, that
+ * response is used without the request being queued.  If an identical
+ * request is in progress, the RPC waits for it to complete and parses
+ * its response.
+ * Otherwise the request is sent as usual and a successful response
+ * (one which is not a fault) is cached for the returned number of seconds.
+ * The response is cached as it was received (before any replacement by
+ * -webService:willHandleResponse:).
+ * <br />
+ * The default implementation returns zero (the response is not cached).
+ */
+- (NSTimeInterval) webService: (GWSService*)service
+		cacheLifetime: (NSString*)method;
+
 /** This method is used to inform the delegate of the encoded XML request
  * (a [GWSElement] instance) which will be sent to the remote system.<br />
  * The delegate may modify or replace this and must return the replacement
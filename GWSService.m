@@ -27,6 +27,13 @@
 #import "GWSPrivate.h"
 #import <Performance/GSThreadPool.h>
 
+#include "config.h"
+#include <string.h>
+#include <time.h>
+#if	USE_ZLIB == 1
+#include <zlib.h>
+#endif
+
 static NSRecursiveLock	*queueLock = nil;
 static unsigned perHostPool = 20;
 static unsigned perHostQMax = 200;
@@ -35,6 +42,15 @@ static unsigned	pool = 200;
 static unsigned	qMax = 2000;
 static unsigned	activeCount = 0;
 static GSThreadPool		*workThreads = nil;
+
+/* Circuit breaker settings (disabled if breakerRate is zero).
+ */
+static double	breakerRate = 0.0;
+static unsigned	breakerMinimum = 20;
+static uint64_t	breakerCooldown = 30000000;
+static unsigned	breakerProbes = 1;
+
+static BOOL circuitAllows(NSString *host, BOOL admit);
 static NSMutableDictionary	*active = nil;
 static NSMutableDictionary	*queues = nil;
 static NSMutableArray		*queued = nil;
@@ -98,6 +114,11 @@ available(NSString *host)
     {
       unsigned	inUse = [[active objectForKey: host] count];
 
+      if (breakerRate > 0.0 && NO == circuitAllows(host, NO))
+	{
+	  return NO;	// Circuit open (or probes already in progress).
+	}
+
       if (activeCount < shared)
 	{
 	  /* There are shared connections available ... we can have one
@@ -120,6 +141,708 @@ available(NSString *host)
   return NO;
 }
 
+/* The times at which an RPC reaches each stage are recorded in _stamps
+ * and, when the RPC completes, the time taken by each stage is added to
+ * latency histograms for the host and operation.
+ */
+enum {
+  StampQueued = 0,	// Request queued by -sendRequest:...
+  StampBuild,		// Start building request
+  StampBuilt,		// Request built
+  StampStarted,		// I/O started
+  StampLoaded,		// Response read
+  StampParsed		// Response parsed
+};
+
+enum {
+  LatencyQueue = 0,
+  LatencyBuild,
+  LatencyNetwork,
+  LatencyParse,
+  LatencyStages
+};
+
+static NSString	*latencyNames[LatencyStages]
+  = { @"Queue", @"Build", @"Network", @"Parse" };
+
+/* The histograms have buckets for each microsecond up to LATENCY_SUB and
+ * then LATENCY_SUB buckets for each power of two up to 2^40 microseconds
+ * (about twelve days), so each bucket covers about six percent of its
+ * value.  Counters are updated atomically, so recording needs no locking.
+ */
+#define	LATENCY_SUB	16
+#define	LATENCY_BUCKETS	(LATENCY_SUB * 37)
+
+typedef struct {
+  uint64_t	count;
+  uint64_t	total;
+  uint64_t	max;
+  uint64_t	buckets[LATENCY_BUCKETS];
+} Latency;
+
+@interface	GWSLatency : NSObject
+{
+@public
+  Latency	stages[LatencyStages];
+}
+@end
+@implementation	GWSLatency
+@end
+
+enum {
+  CircuitClosed = 0,	// Requests sent normally
+  CircuitOpen,		// Requests failed at once
+  CircuitHalfOpen	// Limited requests sent to probe the host
+};
+
+/* Counts of active and queued requests for a host, set while holding
+ * queueLock but read without locking, and a moving average of the time
+ * (in microseconds) taken to send a request and read and parse the
+ * response, used to estimate whether a queued request can complete
+ * before its deadline.  The estimate is halved for each ServiceDecay
+ * microseconds without a new sample, so that a period of slow responses
+ * does not leave it high when there are no requests to correct it.
+ * The circuit breaker state is also set while holding queueLock, and
+ * the other circuit breaker fields are only used while holding it.
+ */
+@interface	GWSHostStats : NSObject
+{
+@public
+  uint64_t	active;
+  uint64_t	queued;
+  uint64_t	serviceTime;
+  uint64_t	sampled;	// Time of the last service time sample
+  uint64_t	circuit;
+  unsigned	successes;
+  unsigned	failures;
+  unsigned	probes;
+  uint64_t	reopen;		// Time at which an open circuit half opens
+}
+@end
+@implementation	GWSHostStats
+@end
+
+/* The statistics for hosts and operations are held in immutable
+ * dictionaries which are replaced (while holding statsLock) when a
+ * new host or operation is seen, so that finding them needs only
+ * an atomic load of the current dictionary.  Entries are never
+ * removed (resetting them just zeros the counters) and replaced
+ * dictionaries are kept in statsOld since other threads may still be
+ * using them.
+ */
+static NSLock		*statsLock = nil;
+static NSDictionary	*latencyHosts = nil;
+static NSDictionary	*latencyOps = nil;
+static NSDictionary	*hostStats = nil;
+static NSMutableArray	*statsOld = nil;
+
+/* Counters for the metrics, updated atomically.  The totals of active
+ * and queued requests are copies of activeCount and [queued count]
+ * so that they can be read without taking queueLock.
+ */
+static uint64_t		statActive = 0;
+static uint64_t		statQueued = 0;
+static uint64_t		statRejectedQMax = 0;
+static uint64_t		statRejectedPerHostQMax = 0;
+static uint64_t		statRejectedDeadline = 0;
+static uint64_t		statRejectedCircuit = 0;
+static uint64_t		statTimeouts = 0;
+static uint64_t		statCancellations = 0;
+static uint64_t		statSent = 0;
+static uint64_t		statReceived = 0;
+static uint64_t		statWorkPending = 0;
+static uint64_t		statWorkBusy = 0;
+static uint64_t		statCacheHits = 0;
+static uint64_t		statCacheMisses = 0;
+static uint64_t		statCoalesced = 0;
+static uint64_t		statCacheBytes = 0;
+
+#define	STAT_ADD(X, N)	__atomic_fetch_add(&(X), (N), __ATOMIC_RELAXED)
+#define	STAT_SUB(X, N)	__atomic_fetch_sub(&(X), (N), __ATOMIC_RELAXED)
+#define	STAT_GET(X)	__atomic_load_n(&(X), __ATOMIC_RELAXED)
+#define	STAT_SET(X, N)	__atomic_store_n(&(X), (N), __ATOMIC_RELAXED)
+
+/* Requests are identified by a digest of the URL, HTTP method, headers
+ * and request data.  The response cache maps the digest of a cacheable
+ * RPC to an entry holding the response data, and entries are kept in a
+ * list in order of use, so that the least recently used can be discarded
+ * when statCacheBytes exceeds cacheLimit.
+ * The pending map holds an entry for each cacheable (or, if coalescing
+ * is enabled, any) RPC in progress, recording the service sending the
+ * request and any services waiting for the same response.
+ */
+@interface	GWSCacheEntry : NSObject
+{
+@public
+  NSData		*key;
+  NSData		*data;
+  NSTimeInterval	expires;
+  GWSService		*leader;	// Not retained
+  NSMutableArray	*waiters;
+  GWSCacheEntry		*newer;
+  GWSCacheEntry		*older;
+}
+@end
+@implementation	GWSCacheEntry
+- (void) dealloc
+{
+  [key release];
+  [data release];
+  [waiters release];
+  [super dealloc];
+}
+@end
+
+static NSLock			*cacheLock = nil;
+static NSMutableDictionary	*cache = nil;
+static NSMutableDictionary	*pending = nil;
+static GWSCacheEntry		*cacheNewest = nil;
+static GWSCacheEntry		*cacheOldest = nil;
+static NSUInteger		cacheLimit = 0;
+static NSUInteger		inflateLimit = 0;
+static BOOL			coalesce = NO;
+static NSString			*deadlineHeader = nil;
+
+static void
+keyString(GWSDigestContext *c, NSString *s)
+{
+  NSData	*d = [s dataUsingEncoding: NSUTF8StringEncoding];
+
+  GWSDigestUpdate(c, [d bytes], [d length]);
+  GWSDigestUpdate(c, "", 1);
+}
+
+static NSData*
+requestKey(NSURL *url, NSString *method, NSString *type, NSString *action,
+  NSDictionary *headers, NSData *body)
+{
+  GWSDigestContext	c;
+  uint8_t		out[64];
+  NSEnumerator		*e;
+  NSString		*k;
+  unsigned		len;
+
+  GWSDigestInit(&c, GWSDigestSHA2_256);
+  keyString(&c, [url absoluteString]);
+  keyString(&c, (nil == method) ? @"POST" : method);
+  keyString(&c, type);
+  keyString(&c, action);
+  e = [[[headers allKeys] sortedArrayUsingSelector: @selector(compare:)]
+    objectEnumerator];
+  while ((k = [e nextObject]) != nil)
+    {
+      keyString(&c, k);
+      keyString(&c, [headers objectForKey: k]);
+    }
+  GWSDigestUpdate(&c, [body bytes], [body length]);
+  len = GWSDigestFinal(&c, out);
+  return [NSData dataWithBytes: out length: len];
+}
+
+/* The following functions must be called with cacheLock locked.
+ */
+static void
+cacheUse(GWSCacheEntry *e)
+{
+  if (e != cacheNewest)
+    {
+      if (nil != e->newer)
+	{
+	  e->newer->older = e->older;
+	  if (nil == e->older)
+	    {
+	      cacheOldest = e->newer;
+	    }
+	  else
+	    {
+	      e->older->newer = e->newer;
+	    }
+	}
+      e->newer = nil;
+      e->older = cacheNewest;
+      if (nil == cacheNewest)
+	{
+	  cacheOldest = e;
+	}
+      else
+	{
+	  cacheNewest->newer = e;
+	}
+      cacheNewest = e;
+    }
+}
+
+static void
+cacheRemove(GWSCacheEntry *e)
+{
+  if (nil == e->older)
+    {
+      cacheOldest = e->newer;
+    }
+  else
+    {
+      e->older->newer = e->newer;
+    }
+  if (nil == e->newer)
+    {
+      cacheNewest = e->older;
+    }
+  else
+    {
+      e->newer->older = e->older;
+    }
+  STAT_SUB(statCacheBytes, [e->data length]);
+  [cache removeObjectForKey: e->key];
+}
+
+static void
+cacheTrim(void)
+{
+  while (nil != cacheOldest && STAT_GET(statCacheBytes) > cacheLimit)
+    {
+      cacheRemove(cacheOldest);
+    }
+}
+
+NSData*
+GWSGzip(NSData *data)
+{
+#if	USE_ZLIB == 1
+  NSMutableData	*out;
+  z_stream	z;
+  int		err;
+
+  memset(&z, 0, sizeof(z));
+  if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+    Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      return nil;
+    }
+  z.next_in = (Bytef*)[data bytes];
+  z.avail_in = [data length];
+  out = [NSMutableData dataWithLength: deflateBound(&z, z.avail_in)];
+  z.next_out = [out mutableBytes];
+  z.avail_out = [out length];
+  err = deflate(&z, Z_FINISH);
+  deflateEnd(&z);
+  if (err != Z_STREAM_END)
+    {
+      return nil;
+    }
+  [out setLength: z.total_out];
+  return out;
+#else
+  return nil;
+#endif
+}
+
+#if	USE_ZLIB == 1
+/* Inflate data in zlib/gzip format (or raw deflate format if bits is
+ * negative) into a buffer which is grown as needed up to limit bytes.
+ * If the data would inflate to more than that, sets *tooBig and returns nil.
+ */
+static NSData*
+inflateData(NSData *data, int bits, NSUInteger limit, BOOL *tooBig)
+{
+  NSMutableData	*out;
+  NSUInteger	used = 0;
+  NSUInteger	size;
+  z_stream	z;
+  int		err;
+
+  memset(&z, 0, sizeof(z));
+  if (inflateInit2(&z, bits) != Z_OK)
+    {
+      return nil;
+    }
+  z.next_in = (Bytef*)[data bytes];
+  z.avail_in = [data length];
+  size = [data length] * 4 + 1024;
+  out = [NSMutableData dataWithLength: (size > limit) ? limit : size];
+  do
+    {
+      if (used == [out length])
+	{
+	  if (used >= limit)
+	    {
+	      *tooBig = YES;
+	      break;
+	    }
+	  size = (used > limit / 2) ? limit : used * 2;
+	  [out setLength: size];
+	}
+      z.next_out = (Bytef*)[out mutableBytes] + used;
+      z.avail_out = [out length] - used;
+      err = inflate(&z, Z_NO_FLUSH);
+      used = [out length] - z.avail_out;
+    }
+  while (Z_OK == err);
+  inflateEnd(&z);
+  if (err != Z_STREAM_END)
+    {
+      return nil;
+    }
+  [out setLength: used];
+  return out;
+}
+#endif
+
+NSData*
+GWSInflate(NSData *data, NSUInteger limit, BOOL *tooBig)
+{
+  *tooBig = NO;
+#if	USE_ZLIB == 1
+  if (limit > 0)
+    {
+      NSData	*d = inflateData(data, 15 + 32, limit, tooBig);
+
+      if (nil == d && NO == *tooBig)
+	{
+	  d = inflateData(data, -15, limit, tooBig);	// Raw deflate
+	}
+      return d;
+    }
+#endif
+  return nil;
+}
+
+/* Return YES if a Content-Encoding header value is one we can decode.
+ */
+static BOOL
+isCompressed(NSString *encoding)
+{
+  encoding = [encoding lowercaseString];
+  if ([encoding isEqual: @"gzip"] || [encoding isEqual: @"x-gzip"]
+    || [encoding isEqual: @"deflate"])
+    {
+      return YES;
+    }
+  return NO;
+}
+
+/* An offset (in microseconds) added to the clock by +_advanceClock: so
+ * that the tests can let time pass for deadlines, latencies and the
+ * circuit breaker without waiting.
+ */
+static uint64_t	clockOffset = 0;
+
+static inline uint64_t
+usecNow(void)
+{
+#if	defined(__MINGW__)
+  return (uint64_t)([NSDate timeIntervalSinceReferenceDate] * 1000000.0)
+    + STAT_GET(clockOffset);
+#else
+  struct timespec	ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000
+    + STAT_GET(clockOffset);
+#endif
+}
+
+static inline unsigned
+latencyIndex(uint64_t usec)
+{
+  unsigned	e;
+  unsigned	i;
+
+  if (usec < LATENCY_SUB)
+    {
+      return (unsigned)usec;
+    }
+  e = 63 - __builtin_clzll(usec);	// Highest bit set (at least 4)
+  i = (e - 3) * LATENCY_SUB + (unsigned)((usec >> (e - 4)) & (LATENCY_SUB - 1));
+  if (i >= LATENCY_BUCKETS)
+    {
+      i = LATENCY_BUCKETS - 1;
+    }
+  return i;
+}
+
+/* Return the highest value which is counted in a bucket.
+ */
+static inline uint64_t
+latencyLimit(unsigned index)
+{
+  unsigned	e;
+
+  if (index < LATENCY_SUB)
+    {
+      return index;
+    }
+  e = index / LATENCY_SUB + 3;
+  return (((uint64_t)(LATENCY_SUB + index % LATENCY_SUB + 1)) << (e - 4)) - 1;
+}
+
+static void
+latencyAdd(Latency *l, uint64_t usec)
+{
+  uint64_t	old;
+
+  __atomic_fetch_add(&l->buckets[latencyIndex(usec)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&l->total, usec, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&l->count, 1, __ATOMIC_RELAXED);
+  old = __atomic_load_n(&l->max, __ATOMIC_RELAXED);
+  while (usec > old && !__atomic_compare_exchange_n(&l->max, &old, usec,
+    NO, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static NSDictionary*
+latencyInfo(Latency *l)
+{
+  static unsigned	perMille[4] = { 500, 900, 990, 999 };
+  static NSString	*keys[4] = { @"P50", @"P90", @"P99", @"P999" };
+  NSMutableDictionary	*d;
+  uint64_t		buckets[LATENCY_BUCKETS];
+  uint64_t		count = 0;
+  uint64_t		seen = 0;
+  unsigned		index;
+  unsigned		p = 0;
+
+  for (index = 0; index < LATENCY_BUCKETS; index++)
+    {
+      buckets[index] = __atomic_load_n(&l->buckets[index], __ATOMIC_RELAXED);
+      count += buckets[index];
+    }
+  d = [NSMutableDictionary dictionaryWithCapacity: 7];
+  [d setObject: [NSNumber numberWithUnsignedLongLong: count]
+	forKey: @"Count"];
+  [d setObject: [NSNumber numberWithUnsignedLongLong:
+    (count > 0 ? __atomic_load_n(&l->total, __ATOMIC_RELAXED) / count : 0)]
+	forKey: @"Mean"];
+  [d setObject: [NSNumber numberWithUnsignedLongLong:
+    __atomic_load_n(&l->max, __ATOMIC_RELAXED)]
+	forKey: @"Max"];
+  for (index = 0; index < LATENCY_BUCKETS && p < 4; index++)
+    {
+      seen += buckets[index];
+      /* The percentile is the value of the sample at the rank given by
+       * rounding up the fraction of the count (nearest rank method).
+       */
+      while (p < 4 && count > 0
+	&& seen >= (count * perMille[p] + 999) / 1000)
+	{
+	  [d setObject: [NSNumber numberWithUnsignedLongLong:
+	    latencyLimit(index)] forKey: keys[p]];
+	  p++;
+	}
+    }
+  while (p < 4)
+    {
+      [d setObject: [NSNumber numberWithUnsignedLongLong: 0] forKey: keys[p]];
+      p++;
+    }
+  return d;
+}
+
+/* Find the statistics for a key, adding a new instance of the class
+ * if necessary.
+ */
+static id
+statsFor(NSDictionary **map, NSString *key, Class c)
+{
+  id	s;
+
+  s = [__atomic_load_n(map, __ATOMIC_ACQUIRE) objectForKey: key];
+  if (nil == s)
+    {
+      [statsLock lock];
+      s = [*map objectForKey: key];
+      if (nil == s)
+	{
+	  NSMutableDictionary	*m = [*map mutableCopy];
+	  NSDictionary		*d;
+
+	  s = [c new];
+	  [m setObject: s forKey: key];
+	  [s release];
+	  d = [m copy];
+	  [m release];
+	  [statsOld addObject: *map];
+	  [*map release];
+	  __atomic_store_n(map, d, __ATOMIC_RELEASE);
+	}
+      [statsLock unlock];
+    }
+  return s;
+}
+
+/* Publish the active and queued counts for a host (and in total) for
+ * readers which do not lock.
+ * The global lock must be locked before this is called.
+ */
+static void
+publishCounts(NSString *host)
+{
+  if (nil != host)
+    {
+      GWSHostStats	*s = statsFor(&hostStats, host, [GWSHostStats class]);
+
+      STAT_SET(s->active, [[active objectForKey: host] count]);
+      STAT_SET(s->queued, [[queues objectForKey: host] count]);
+    }
+  STAT_SET(statActive, activeCount);
+  STAT_SET(statQueued, [queued count]);
+}
+
+/* Unless +setInflateLimit: was used, a compressed response may grow to
+ * InflateRatio times its size (and to at least InflateMinimum bytes).
+ */
+#define	InflateRatio	100
+#define	InflateMinimum	(1024 * 1024)
+
+/* The service time estimate for a host is halved for each ServiceDecay
+ * microseconds (ten seconds) since the last sample.
+ */
+#define	ServiceDecay	10000000
+
+/* Return the estimated time (in microseconds) to service a request
+ * using the host statistics, or zero if there is no estimate.
+ */
+static uint64_t
+estimateFor(GWSHostStats *s)
+{
+  uint64_t	now = usecNow();
+  uint64_t	sampled = STAT_GET(s->sampled);
+  uint64_t	age;
+
+  age = (now > sampled) ? (now - sampled) / ServiceDecay : 0;
+  return (age >= 64) ? 0 : STAT_GET(s->serviceTime) >> age;
+}
+
+/* Return the estimated time (in microseconds) to service a request to
+ * the host, or zero if there is no estimate yet.
+ */
+static uint64_t
+serviceTime(NSString *host)
+{
+  GWSHostStats	*s;
+
+  s = [__atomic_load_n(&hostStats, __ATOMIC_ACQUIRE) objectForKey: host];
+  return (nil == s) ? 0 : estimateFor(s);
+}
+
+/* Return YES if a request queued at the specified time with the given
+ * deadline has waited so long that it can no longer be expected to
+ * complete in time.  A request which could not have completed in time
+ * even when it was queued is sent anyway, since the estimate may be
+ * out of date and only completed requests can correct it.
+ */
+static inline BOOL
+tooLate(uint64_t deadline, uint64_t queuedAt, uint64_t now, uint64_t estimate)
+{
+  return (deadline < now + estimate && deadline >= queuedAt + estimate)
+    ? YES : NO;
+}
+
+/* Return YES if the circuit breaker for the host allows a request to be
+ * sent (or, if admit is YES, queued), moving an open circuit to the half
+ * open state once it has been open for long enough.  In the half open
+ * state only breakerProbes requests may be in progress (or queued).
+ * The global lock must be locked before this is called.
+ */
+static BOOL
+circuitAllows(NSString *host, BOOL admit)
+{
+  GWSHostStats	*s;
+  unsigned	used;
+
+  s = [__atomic_load_n(&hostStats, __ATOMIC_ACQUIRE) objectForKey: host];
+  if (nil == s || CircuitClosed == s->circuit)
+    {
+      return YES;
+    }
+  if (CircuitOpen == s->circuit)
+    {
+      if (usecNow() < s->reopen)
+	{
+	  return NO;
+	}
+      STAT_SET(s->circuit, CircuitHalfOpen);
+      s->probes = 0;
+    }
+  used = s->probes;
+  if (YES == admit)
+    {
+      used += [[queues objectForKey: host] count];
+    }
+  return (used < breakerProbes) ? YES : NO;
+}
+
+/* Record the outcome of a request which was sent to the host, opening or
+ * closing the circuit as necessary.  Failures are counted over roughly
+ * the last breakerMinimum to twice breakerMinimum requests.  A request
+ * cancelled by the client says nothing about the host, so it is not
+ * counted (but a cancelled probe frees its place for another probe).
+ * Returns YES if the circuit has just been opened.
+ * The global lock must be locked before this is called.
+ */
+static BOOL
+circuitRecord(NSString *host, BOOL failed, BOOL cancelled, BOOL probe)
+{
+  GWSHostStats	*s = statsFor(&hostStats, host, [GWSHostStats class]);
+  unsigned	total;
+
+  if (YES == probe)
+    {
+      if (s->probes > 0)
+	{
+	  s->probes--;
+	}
+      if (CircuitHalfOpen == s->circuit && NO == cancelled)
+	{
+	  if (YES == failed)
+	    {
+	      s->reopen = usecNow() + breakerCooldown;
+	      STAT_SET(s->circuit, CircuitOpen);
+	      return YES;
+	    }
+	  s->successes = s->failures = 0;
+	  STAT_SET(s->circuit, CircuitClosed);
+	}
+      return NO;
+    }
+  if (CircuitClosed != s->circuit || YES == cancelled)
+    {
+      return NO;	// Cancelled, or sent before the circuit opened.
+    }
+  if (YES == failed)
+    {
+      s->failures++;
+    }
+  else
+    {
+      s->successes++;
+    }
+  total = s->successes + s->failures;
+  if (total >= breakerMinimum && s->failures >= breakerRate * total)
+    {
+      s->successes = s->failures = 0;
+      s->reopen = usecNow() + breakerCooldown;
+      STAT_SET(s->circuit, CircuitOpen);
+      return YES;
+    }
+  if (total >= 2 * breakerMinimum)
+    {
+      s->successes /= 2;
+      s->failures /= 2;
+    }
+  return NO;
+}
+
+/* Escape a label value for the Prometheus text format.
+ */
+static NSString*
+promLabel(NSString *s)
+{
+  s = [s stringByReplacingOccurrencesOfString: @"\\" withString: @"\\\\"];
+  s = [s stringByReplacingOccurrencesOfString: @"\"" withString: @"\\\""];
+  s = [s stringByReplacingOccurrencesOfString: @"\n" withString: @"\\n"];
+  return s;
+}
+
 /* To support client side SSL certificate authentication we use the old
  * NSURLHandle stuff with GNUstep extensions.  We use the _connection
  * ivar to hold the handle in this case.
@@ -138,6 +861,11 @@ available(NSString *host)
 
 @implementation	GWSService (Private)
 
++ (void) _advanceClock: (NSTimeInterval)seconds
+{
+  STAT_ADD(clockOffset, (uint64_t)(seconds * 1000000.0));
+}
+
 + (void) _never: (NSTimer*)t
 {
   return;
@@ -146,6 +874,9 @@ available(NSString *host)
 + (void) _run: (NSString*)host
 {
   NSMutableArray	*a = nil;
+  NSMutableArray	*late = nil;
+  uint64_t		now = usecNow();
+  uint64_t		estimate = serviceTime(host);
   NSUInteger		index;
   NSUInteger		count;
 
@@ -161,7 +892,18 @@ available(NSString *host)
 	    {
 	      GWSService	*svc = [q objectAtIndex: index];
 
-	      if (svc->_request != nil)
+	      if (svc->_request != nil && YES == tooLate(svc->_deadline,
+		svc->_stamps[StampQueued], now, estimate))
+		{
+		  /* Not enough time left to complete ... fail it.
+		   */
+		  if (nil == late)
+		    {
+		      late = [[NSMutableArray alloc] initWithCapacity: 10];
+		    }
+		  [late addObject: svc];
+		}
+	      else if (svc->_request != nil)
 		{
 		  /* Found a service which is ready to send ...
 		   */
@@ -181,7 +923,21 @@ available(NSString *host)
 
 	  if (svc->_request != nil)
 	    {
-	      if (available([svc->_connectionURL host]) == YES)
+	      NSString	*h = [svc->_connectionURL host];
+
+	      if (YES == tooLate(svc->_deadline, svc->_stamps[StampQueued],
+		now, serviceTime(h)))
+		{
+		  if (nil == late)
+		    {
+		      late = [[NSMutableArray alloc] initWithCapacity: 10];
+		    }
+		  if ([late indexOfObjectIdenticalTo: svc] == NSNotFound)
+		    {
+		      [late addObject: svc];
+		    }
+		}
+	      else if (available(h) == YES)
 		{
 		  [svc _activate];
 		  if (nil == a)
@@ -193,7 +949,31 @@ available(NSString *host)
 	    }
 	}
     }
+  count = [late count];
+  for (index = 0; index < count; index++)
+    {
+      GWSService	*svc = [late objectAtIndex: index];
+      NSString		*h = [svc->_connectionURL host];
+
+      [[queues objectForKey: h] removeObjectIdenticalTo: svc];
+      [queued removeObjectIdenticalTo: svc];
+      publishCounts(h);
+    }
   [queueLock unlock];
+  for (index = 0; index < count; index++)
+    {
+      GWSService	*svc = [late objectAtIndex: index];
+
+      STAT_ADD(statRejectedDeadline, 1);
+      [svc->_lock lock];
+      if (nil == [svc->_result objectForKey: GWSErrorKey])
+	{
+	  [svc _setProblem: @"insufficient time left before deadline"];
+	}
+      [svc->_lock unlock];
+      [svc _completed];
+    }
+  [late release];
   count = [a count];
   if (count > 0)
     {
@@ -253,6 +1033,19 @@ available(NSString *host)
   [hostQueue addObject: self];
   activeCount++;
 
+  /* A request sent while the circuit is half open is a probe.
+   */
+  if (breakerRate > 0.0)
+    {
+      GWSHostStats	*s = statsFor(&hostStats, host, [GWSHostStats class]);
+
+      if (CircuitHalfOpen == s->circuit)
+	{
+	  s->probes++;
+	  _probe = YES;
+	}
+    }
+
   /* The next two lines will do nothing if the receiver was not
    * queued before activation.  We need them for the case where
    * we were queued and are now being activated.
@@ -261,6 +1054,7 @@ available(NSString *host)
    */
   [[queues objectForKey: host] removeObjectIdenticalTo: self];
   [queued removeObjectIdenticalTo: self];
+  publishCounts(host);
 }
 
 - (BOOL) _beginMethod: (NSString*)method 
@@ -298,104 +1092,227 @@ available(NSString *host)
     }
   else
     {
-      NSRange		r;
-      NSString		*portName;
-      NSEnumerator	*enumerator;
-      GWSElement	*elem;
-      GWSPortType	*portType;
-      GWSBinding	*binding;
-      GWSPort		*found;
+      GWSResolvedOperation	*r;
 
       /* As this is not a standalone service, we must set up information from
-       * the parsed WSDL document.
+       * the parsed WSDL document.  The document looks through the ports
+       * declared in this service for one with an operation uniquely matching
+       * the method (or matching port.operation) and caches the result.
        */
+      r = [_document _resolvedMethod: method service: self];
+      if (nil != r)
+	{
+	  _operation = [r->operation retain];
+	  _port = [r->port retain];
+	}
 
-      /* Look through the ports declared in this service for one with an
-       * operation uniquely matching the method.  Get details by looking up
-       * bindings, since we can't actually use a port/operation if there
-       * is no binding for it.
-       */
-      found = nil;
-      portName = nil;
-      enumerator = [_ports objectEnumerator];
-      while ((_port = [enumerator nextObject]) != nil)
-	{
-	  binding = [_port binding];
-	  portType = [binding type];
-	  if (portType != nil)
+      if (nil == _port)
+	{
+	  [self _clean];
+	  [self _setProblem: [NSString stringWithFormat:
+	    @"Unable to find unique operation or port.operation matching '%@'",
+	    method]];
+	  return NO;
+	}
+    }
+  if (operation != 0)
+    {
+      *operation = _operation;
+    }
+  if (port != 0)
+    {
+      *port = _port;
+    }
+  return YES;
+}
+
+/* If coder pooling is enabled, install a pooled coder configured like our
+ * own coder for the duration of a build or parse stage.  Our own coder is
+ * kept in _ownCoder until -_restoreCoder puts it back.
+ */
+- (void) _borrowCoder
+{
+  if (YES == _coderPooling && nil != _coder && nil == _ownCoder)
+    {
+      _ownCoder = _coder;
+      _coder = [[_ownCoder class] borrowCoder];
+      [_coder _configureFrom: _ownCoder];
+      [_coder setDelegate: self];
+    }
+}
+
+/* Use response data from the cache (or from an identical request) as
+ * if it had just been received from the remote system.
+ */
+- (void) _cached: (NSData*)data code: (int)code
+{
+  [_lock lock];
+  [_response release];
+  _response = [data mutableCopy];
+  _code = code;
+  _compressedResponse = NO;
+  _stage = RPCParsing;
+  _stamps[StampLoaded] = usecNow();
+  [_lock unlock];
+  if ([workThreads maxThreads] == 0)
+    {
+      [self performSelector: @selector(_received)
+		   onThread: _queueThread
+		 withObject: nil
+	      waitUntilDone: NO];
+    }
+  else
+    {
+      STAT_ADD(statWorkPending, 1);
+      [workThreads scheduleSelector: @selector(_receivedWork)
+			 onReceiver: self
+			 withObject: nil];
+    }
+}
+
+/* Called on completion of a cacheable or coalesced RPC.  If the receiver
+ * sent the request, a successful response to a cacheable RPC is cached
+ * and any services waiting for the same response are given the response
+ * data to parse for themselves (or the error if there was no response).
+ */
+- (void) _cacheFinish
+{
+  GWSCacheEntry	*e;
+  NSMutableArray	*waiters = nil;
+  NSData	*data;
+  NSString	*problem;
+
+  if (nil == _cacheKey)
+    {
+      return;
+    }
+  [cacheLock lock];
+  e = [pending objectForKey: _cacheKey];
+  if (nil != e)
+    {
+      if (e->leader == self)
+	{
+	  waiters = e->waiters;
+	  e->waiters = nil;
+	  e->leader = nil;
+	  if (_cacheLife > 0.0 && cacheLimit > 0
+	    && 200 == _code && [_rawResponse length] > 0
+	    && nil == [_result objectForKey: GWSErrorKey]
+	    && nil == [_result objectForKey: GWSFaultKey])
 	    {
-	      elem = [[portType operations] objectForKey: method];
-	      if (elem != nil)
+	      GWSCacheEntry	*old = [cache objectForKey: _cacheKey];
+
+	      if (nil != old)
 		{
-		  if (nil == portName)
-		    {
-		      portName = [portType name];	// matched
-		      found = _port;
-		    }
-		  else
-		    {
-		      found = nil;			// not unique
-		      _port = nil;
-		      break;
-		    }
+		  cacheRemove(old);
 		}
+	      e->data = [_rawResponse retain];
+	      e->expires = [NSDate timeIntervalSinceReferenceDate] + _cacheLife;
+	      [cache setObject: e forKey: _cacheKey];
+	      cacheUse(e);
+	      STAT_ADD(statCacheBytes, [e->data length]);
+	      cacheTrim();
 	    }
+	  [pending removeObjectForKey: _cacheKey];
+	}
+      else
+	{
+	  [e->waiters removeObjectIdenticalTo: self];
 	}
+    }
+  [cacheLock unlock];
+  [_cacheKey release];
+  _cacheKey = nil;
+  data = [_rawResponse autorelease];
+  _rawResponse = nil;
+
+  if (nil != waiters)
+    {
+      NSUInteger	count = [waiters count];
+      NSUInteger	index;
 
-      if (nil != found)
+      problem = [_result objectForKey: GWSErrorKey];
+      if (nil == problem && nil == data)
 	{
-	  _operation = [method copy];
-	  _port = [found retain];
+	  problem = @"identical request failed";
 	}
-      else if (1 == (r = [method rangeOfString: @"."]).length)
+      for (index = 0; index < count; index++)
 	{
-	  /* No unique operation ... but our method name uses dot
-	   * syntax to specify port and operation.
-	   */
-	  portName = [method substringToIndex: r.location];
-	  _operation = [method substringFromIndex: NSMaxRange(r)];
-	  [_operation retain];
-
-	  /* Look through the ports declared in this service for one matching
-	   * the port name and operation name.  Get details by looking up
-	   * bindings, since we can't actually use a port/operation if there
-	   * is no binding for it.
-	   */
-	  enumerator = [_ports objectEnumerator];
-	  while ((_port = [enumerator nextObject]) != nil)
-	    {
-	      binding = [_port binding];
-	      portType = [binding type];
-	      if (portType != nil)
-		{
-		  elem = [[portType operations] objectForKey: _operation];
-		  if (elem != nil && [portName isEqual: [portType name]])
-		    {
-		      break;	// matched
-		    }
-		}
-	    }
-	  [_port retain];
+	  [[waiters objectAtIndex: index] _shared: data
+					     code: _code
+					  problem: problem];
 	}
+      [waiters release];
+    }
+}
 
-      if (nil == _port)
+/* Look up the request in the response cache and among the requests in
+ * progress.  Returns YES if the RPC has been handled (using a cached
+ * response or by waiting for the result of an identical request), or NO
+ * if the request must be sent, in which case the receiver is recorded as
+ * sending it.
+ */
+- (BOOL) _cacheLookup
+{
+  GWSCacheEntry	*e;
+  NSData	*data = nil;
+  BOOL		waiting = NO;
+
+  _cacheKey = [requestKey(_connectionURL, _HTTPMethod, _contentType,
+    _SOAPAction, _headers, _request) retain];
+  [cacheLock lock];
+  if (_cacheLife > 0.0 && nil != (e = [cache objectForKey: _cacheKey]))
+    {
+      if (e->expires > [NSDate timeIntervalSinceReferenceDate])
 	{
-	  [self _clean];
-	  [self _setProblem: [NSString stringWithFormat:
-	    @"Unable to find unique operation or port.operation matching '%@'",
-	    method]];
-	  return NO;
+	  cacheUse(e);
+	  data = [e->data retain];
+	}
+      else
+	{
+	  cacheRemove(e);
+	}
+    }
+  if (nil == data)
+    {
+      e = [pending objectForKey: _cacheKey];
+      if (nil == e)
+	{
+	  e = [GWSCacheEntry new];
+	  e->key = [_cacheKey retain];
+	  e->leader = self;
+	  [pending setObject: e forKey: _cacheKey];
+	  [e release];
+	}
+      else
+	{
+	  if (nil == e->waiters)
+	    {
+	      e->waiters = [NSMutableArray new];
+	    }
+	  [e->waiters addObject: self];
+	  waiting = YES;
 	}
     }
-  if (operation != 0)
+  [cacheLock unlock];
+
+  if (nil != data)
     {
-      *operation = _operation;
+      STAT_ADD(statCacheHits, 1);
+      [self _cached: data code: 200];
+      [data release];
+      return YES;
     }
-  if (port != 0)
+  if (YES == waiting)
     {
-      *port = _port;
+      STAT_ADD(statCoalesced, 1);
+      return YES;
     }
-  return YES;
+  if (_cacheLife > 0.0)
+    {
+      STAT_ADD(statCacheMisses, 1);
+    }
+  return NO;
 }
 
 - (void) _clean
@@ -418,6 +1335,8 @@ available(NSString *host)
   _port = nil;
   [_request release];
   _request = nil;
+  [_cacheKey release];
+  _cacheKey = nil;
 }
 
 - (void) _completed
@@ -443,10 +1362,20 @@ available(NSString *host)
     {
       NSString		*host;
       NSMutableArray	*a;
+      NSMutableArray	*tripped = nil;
+      NSString		*problem;
       NSUInteger	index;
+      BOOL		cancelled;
+      BOOL		failed;
 
       [_timer invalidate];
       _timer = nil;
+      problem = [_result objectForKey: GWSErrorKey];
+      cancelled = ([problem isEqual: @"cancelled"]
+	|| (YES == _cancelled && NO == [problem isEqual: @"timed out"]));
+      failed = (nil != problem && NO == cancelled);
+      [self _recordLatencies];
+      [self _cacheFinish];
       if ([self debug] == YES)
 	{
 	  if (_request != nil)
@@ -486,8 +1415,44 @@ available(NSString *host)
 	{
 	  [a removeObjectAtIndex: index];
 	  activeCount--;
+	  if ((breakerRate > 0.0 || YES == _probe)
+	    && YES == circuitRecord(host, failed, cancelled, _probe))
+	    {
+	      NSMutableArray	*q = [queues objectForKey: host];
+
+	      /* The circuit has opened ... fail the queued requests which
+	       * are ready to send, to free their queue space.
+	       */
+	      tripped = [NSMutableArray arrayWithCapacity: [q count]];
+	      for (index = 0; index < [q count]; index++)
+		{
+		  GWSService	*svc = [q objectAtIndex: index];
+
+		  if (nil != svc->_request)
+		    {
+		      [tripped addObject: svc];
+		    }
+		}
+	      [q removeObjectsInArray: tripped];
+	      [queued removeObjectsInArray: tripped];
+	    }
+	  _probe = NO;
 	}
+      publishCounts(host);
       [queueLock unlock];
+      for (index = 0; index < [tripped count]; index++)
+	{
+	  GWSService	*svc = [tripped objectAtIndex: index];
+
+	  STAT_ADD(statRejectedCircuit, 1);
+	  [svc->_lock lock];
+	  if (nil == [svc->_result objectForKey: GWSErrorKey])
+	    {
+	      [svc _setProblem: @"circuit open"];
+	    }
+	  [svc->_lock unlock];
+	  [svc _completed];
+	}
       [GWSService _run: host];	// start any queued requests for host
 
       if ([_delegate respondsToSelector: @selector(completedRPC:)])
@@ -520,6 +1485,18 @@ available(NSString *host)
       NSInteger		used;
 
       [queueLock lock];
+      if (breakerRate > 0.0 && NO == circuitAllows(host, YES))
+	{
+	  /* The host is failing, so we fail at once rather than using
+	   * queue space.
+	   */
+	  STAT_ADD(statRejectedCircuit, 1);
+	  [_lock lock];
+	  [self _setProblem: @"circuit open"];
+	  [_lock unlock];
+	  [queueLock unlock];
+	  return NO;
+	}
       result = YES;
       hostQueue = [queues objectForKey: host];
       used = (NSInteger)[hostQueue count];
@@ -535,6 +1512,17 @@ available(NSString *host)
 	{
 	  result = YES;	// Reserved space for this host was not filled.
 	}
+      if (NO == result)
+	{
+	  if ([queued count] >= qMax)
+	    {
+	      STAT_ADD(statRejectedQMax, 1);
+	    }
+	  else
+	    {
+	      STAT_ADD(statRejectedPerHostQMax, 1);
+	    }
+	}
       if (YES == result)
 	{
 	  if (hostQueue == nil)
@@ -578,12 +1566,83 @@ available(NSString *host)
 	      [queued addObject: self];
 	    }
 	  _stage = RPCQueued;
+	  publishCounts(host);
 	}
       [queueLock unlock];
     }
   return result;
 }
 
+/* Set up the receiver to perform an RPC.  Returns NO if an RPC is
+ * already in progress.
+ */
+- (BOOL) _initiate: (NSString*)method
+	parameters: (NSDictionary*)parameters
+	     order: (NSArray*)order
+	   timeout: (int)seconds
+       prioritised: (BOOL)urgent
+{
+  if (nil != _timeout)
+    {
+      NSLog(@"[%@-%@] request already in progress",
+        NSStringFromClass([self class]),
+	@"sendRequest:parameters:order:timeout:prioritised:");
+      return NO;
+    }
+  if (_result != nil)
+    {
+      [_result release];
+      _result = nil;
+    }
+  if (_response != nil)
+    {
+      [_response release];
+      _response = nil;
+    }
+  _prioritised = urgent;
+
+  _cancelled = NO;
+  _completedIO = NO;
+  _code = 0;
+  _stage = RPCIdle;
+  memset(_stamps, 0, sizeof(_stamps));
+  _stamps[StampQueued] = usecNow();
+  if (seconds < 1)
+    {
+      seconds = 1;
+    }
+  _timeout = [[NSDate alloc] initWithTimeIntervalSinceNow: seconds];
+  _deadline = _stamps[StampQueued] + (uint64_t)seconds * 1000000;
+
+  /* Make a note of which thread queued the request.
+   */
+  _queueThread = [[NSThread currentThread] retain];
+
+  /* The timer runs in the thread which queued the request ...
+   * so the loop for that thread needs to be run in order to
+   * deal with timeouts of queued operations.
+   */
+  _timer = [NSTimer
+    scheduledTimerWithTimeInterval: [_timeout timeIntervalSinceNow]
+    target: self
+    selector: @selector(timeout:)
+    userInfo: nil
+    repeats: NO];
+
+  _prepMethod = [method copy]; 
+  _prepParameters = [parameters copy]; 
+  _prepOrder = [order copy]; 
+
+  _cacheLife = 0.0;
+  if (cacheLimit > 0
+    && [_delegate respondsToSelector: @selector(webService:cacheLifetime:)])
+    {
+      _cacheLife = [_delegate webService: self cacheLifetime: method];
+    }
+
+  return YES;
+}
+
 - (id) _initWithName: (NSString*)name document: (GWSDocument*)document
 {
   if ((self = [super init]) != nil)
@@ -669,6 +1728,18 @@ available(NSString *host)
   return self;
 }
 
+/* Returns YES if the request data must be built before the RPC can
+ * be submitted.
+ */
+- (BOOL) _mustPrepare
+{
+  if (nil == _connectionURL || _cacheLife > 0.0 || YES == coalesce)
+    {
+      return YES;
+    }
+  return NO;
+}
+
 /* Method to be run from thread pool in order to prepare request data
  * to be sent.
  */
@@ -687,6 +1758,7 @@ available(NSString *host)
     }
 
   [_lock lock];
+  _stamps[StampBuild] = usecNow();
   stage = _stage;
   _stage = RPCPreparing;
   pm = _prepMethod;
@@ -695,6 +1767,7 @@ available(NSString *host)
   _prepParameters = nil;
   po = _prepOrder;
   _prepOrder = nil;
+  [self _borrowCoder];
   NS_DURING
     {
       if (_parameters != nil)
@@ -736,6 +1809,8 @@ available(NSString *host)
       req = nil;
     }
   NS_ENDHANDLER
+  [self _restoreCoder];
+  _stamps[StampBuilt] = usecNow();
   [_lock unlock];
 
   [pm release];
@@ -748,6 +1823,20 @@ available(NSString *host)
     {
       req = empty;
     }
+  /* Compress the request if it's big enough for that to be worthwhile
+   * (and compression actually makes it smaller).
+   */
+  _compressedRequest = NO;
+  if (_compressAbove > 0 && [req length] >= _compressAbove)
+    {
+      NSData	*z = GWSGzip(req);
+
+      if (nil != z && [z length] < [req length])
+	{
+	  req = z;
+	  _compressedRequest = YES;
+	}
+    }
   /* We must use a lock around the changes we actually make so that a
    * call to _run: in another thread won't pick this one up prematurely.
    */
@@ -759,11 +1848,19 @@ available(NSString *host)
 
 - (void) _prepareAndRun
 {
+  STAT_SUB(statWorkPending, 1);
+  STAT_ADD(statWorkBusy, 1);
   [self _prepare];
 
   /* Make sure that this is de-queued and run if possible.
    */
   [GWSService _run: [_connectionURL host]];
+  STAT_SUB(statWorkBusy, 1);
+}
+
+- (NSDictionary*) _ports
+{
+  return _ports;
 }
 
 - (void) _received
@@ -773,6 +1870,53 @@ available(NSString *host)
       return;   // Already failed (eg timeout part way through reading).
     }
 
+  if (YES == _compressedResponse && [_response length] > 0)
+    {
+      NSUInteger	limit = inflateLimit;
+      NSData		*d;
+      BOOL		tooBig;
+
+      /* The whole response has been read before it is decompressed, so
+       * we limit the size it may grow to rather than risk running out
+       * of memory decompressing a hostile response.
+       */
+      if (0 == limit)
+	{
+	  limit = [_response length] * InflateRatio;
+	  if (limit < InflateMinimum)
+	    {
+	      limit = InflateMinimum;
+	    }
+	}
+      d = GWSInflate(_response, limit, &tooBig);
+
+      /* If the data can't be decompressed we leave it as it is, since
+       * the URL loading system may have decoded it already.
+       */
+      if (nil != d)
+	{
+	  [_response release];
+	  _response = [d mutableCopy];
+	}
+      _compressedResponse = NO;
+      if (YES == tooBig)
+	{
+	  [self _setProblem: @"decompressed response too large"];
+	  _stamps[StampParsed] = usecNow();
+	  [self _completed];
+	  return;
+	}
+    }
+
+  /* A cacheable or coalesced response is kept as received, so that
+   * a delegate altering the data before parsing does not alter what
+   * is given to other requests.
+   */
+  if (nil != _cacheKey && nil == _rawResponse)
+    {
+      _rawResponse = [_response copy];
+    }
+
   if (_code != 200 && [_coder isKindOfClass: [GWSXMLRPCCoder class]] == YES)
     {
       NSString	*str;
@@ -802,6 +1946,7 @@ available(NSString *host)
        * unless we had a 204 response (some services may accept an empty
        * response, even though xmlrpc and soap do not).
        */
+      [self _borrowCoder];
       NS_DURING
 	{
           NSMutableDictionary   *res = nil;
@@ -841,16 +1986,109 @@ available(NSString *host)
 							   count: 1];
 	}
       NS_ENDHANDLER
+      [self _restoreCoder];
     }
+  _stamps[StampParsed] = usecNow();
 
   [self _completed];
 }
 
+/* Method to be run from thread pool in order to parse the response.
+ */
+- (void) _receivedWork
+{
+  STAT_SUB(statWorkPending, 1);
+  STAT_ADD(statWorkBusy, 1);
+  [self _received];
+  STAT_SUB(statWorkBusy, 1);
+}
+
+- (void) _recordLatencies
+{
+  static const int	starts[LatencyStages]
+    = { StampQueued, StampBuild, StampStarted, StampLoaded };
+  static const int	ends[LatencyStages]
+    = { StampStarted, StampBuilt, StampLoaded, StampParsed };
+  BOOL		done[LatencyStages];
+  uint64_t	t[LatencyStages];
+  GWSLatency	*l;
+  unsigned	i;
+
+  for (i = 0; i < LatencyStages; i++)
+    {
+      done[i] = (_stamps[starts[i]] > 0 && _stamps[ends[i]] > 0);
+      t[i] = (YES == done[i]) ? _stamps[ends[i]] - _stamps[starts[i]] : 0;
+    }
+  /* Requests are built while queued, so don't count that as waiting.
+   */
+  if (t[LatencyQueue] > t[LatencyBuild])
+    {
+      t[LatencyQueue] -= t[LatencyBuild];
+    }
+  else
+    {
+      t[LatencyQueue] = 0;
+    }
+
+  if (nil != [_connectionURL host] && YES == done[LatencyNetwork])
+    {
+      GWSHostStats	*s;
+      uint64_t		sample = t[LatencyNetwork] + t[LatencyParse];
+      uint64_t		old;
+
+      /* Update the moving average service time for the host.
+       */
+      s = statsFor(&hostStats, [_connectionURL host], [GWSHostStats class]);
+      old = estimateFor(s);
+      STAT_SET(s->serviceTime, (0 == old) ? sample : old - old/8 + sample/8);
+      STAT_SET(s->sampled, usecNow());
+    }
+  if (nil != [_connectionURL host])
+    {
+      l = statsFor(&latencyHosts, [_connectionURL host], [GWSLatency class]);
+      for (i = 0; i < LatencyStages; i++)
+	{
+	  if (YES == done[i])
+	    {
+	      latencyAdd(&l->stages[i], t[i]);
+	    }
+	}
+    }
+  if (nil != _operation)
+    {
+      l = statsFor(&latencyOps, _operation, [GWSLatency class]);
+      for (i = 0; i < LatencyStages; i++)
+	{
+	  if (YES == done[i])
+	    {
+	      latencyAdd(&l->stages[i], t[i]);
+	    }
+	}
+    }
+  memset(_stamps, 0, sizeof(_stamps));
+}
+
 - (void) _remove
 {
   _document = nil;
 }
 
+/* Put back our own coder after -_borrowCoder, keeping any settings made
+ * to the borrowed coder and returning the borrowed coder to the pool.
+ */
+- (void) _restoreCoder
+{
+  if (nil != _ownCoder)
+    {
+      GWSCoder  *borrowed = _coder;
+
+      _coder = _ownCoder;
+      _ownCoder = nil;
+      [_coder _configureFrom: borrowed];
+      [borrowed returnCoder];
+    }
+}
+
 - (void) _setProblem: (NSString*)s
 {
   if (_result == nil)
@@ -862,37 +2100,46 @@ available(NSString *host)
 
 - (NSString*) _setupFrom: (GWSElement*)element in: (id)section
 {
-  NSString	*n;
+  GWSExtensibility	*e = [_document _extensibilityFor: element];
 
-  n = [element namespace];
-  if ([n length] == 0)
+  if (e != nil)
     {
-      /* No namespace recorded directly in the element ... 
-       * See if the document has a namespace for the element's prefix.
-       */
-      n = [element prefix];
-      if (n == nil)
-	{
-	  n = @"";
-	}
-      n = [_document namespaceForPrefix: n];
+      return [e validate: element for: _document in: section setup: self];
     }
-  if (n != nil)
-    {
-      GWSExtensibility	*e = [_document extensibilityForNamespace: n];
+  return nil;
+}
 
-      if (e != nil)
-	{
-	  return [e validate: element for: _document in: section setup: self];
-	}
+/* Complete the RPC using the outcome of an identical request the receiver
+ * was waiting for.  The response data is parsed by the receiver (with its
+ * own coder and delegate) so that it gets a result of its own, and if
+ * there was no response the receiver fails with the same problem.
+ */
+- (void) _shared: (NSData*)data code: (int)code problem: (NSString*)problem
+{
+  [_lock lock];
+  if (nil == _queueThread || nil != _result)
+    {
+      [_lock unlock];
+      return;	// Completed (timed out or cancelled) while waiting.
     }
-  return nil;
+  if (nil == problem)
+    {
+      [_lock unlock];
+      [self _cached: data code: code];
+      return;
+    }
+  [self _setProblem: problem];
+  _stamps[StampParsed] = usecNow();
+  [_lock unlock];
+  [self _completed];
 }
 
 - (void) _start
 {
   NSData        *toSend;
   NSString      *method;
+  NSString      *budgetHeader;
+  NSString      *budget = nil;
 
   [_lock lock];
   if (YES == _cancelled)
@@ -903,16 +2150,32 @@ available(NSString *host)
       return;
     }
   _stage = RPCActive;
+  _stamps[StampStarted] = usecNow();
   toSend = [_request retain];
+  STAT_ADD(statSent, [toSend length]);
   if (nil == (method = [_HTTPMethod retain]))
     {
       method = @"POST";
     }
   [_lock unlock];
 
+  /* Tell the server how long it has (in milliseconds) if wanted.
+   */
+  [queueLock lock];
+  budgetHeader = [deadlineHeader retain];
+  [queueLock unlock];
+  if (nil != budgetHeader)
+    {
+      uint64_t	t = usecNow();
+
+      budget = [NSString stringWithFormat: @"%llu",
+	(unsigned long long)((_deadline > t) ? (_deadline - t) / 1000 : 0)];
+    }
+
   /* Now we initiate the asynchronous I/O process.
    */
   _code = 0;
+  _compressedResponse = NO;
   if (YES == _newAPI && nil == _clientCertificate 
 #if	defined(GNUSTEP)
 /* GNUstep has better debugging with NSURLHandle than NSURLConnection
@@ -936,6 +2199,19 @@ available(NSString *host)
         {
           [request setValue: _contentType forHTTPHeaderField: @"Content-Type"];
         }
+      if (YES == _compressedRequest)
+	{
+	  [request setValue: @"gzip" forHTTPHeaderField: @"Content-Encoding"];
+	}
+      if (YES == _acceptCompressed)
+	{
+	  [request setValue: @"gzip, deflate"
+	 forHTTPHeaderField: @"Accept-Encoding"];
+	}
+      if (nil != budget)
+	{
+	  [request setValue: budget forHTTPHeaderField: budgetHeader];
+	}
       if (_SOAPAction != nil)
 	{
 	  [request setValue: _SOAPAction forHTTPHeaderField: @"SOAPAction"];
@@ -1010,27 +2286,140 @@ available(NSString *host)
         {
           [handle writeProperty: _contentType forKey: @"Content-Type"];
         }
+      if (YES == _compressedRequest)
+	{
+	  [handle writeProperty: @"gzip" forKey: @"Content-Encoding"];
+	}
+      if (YES == _acceptCompressed)
+	{
+	  [handle writeProperty: @"gzip, deflate" forKey: @"Accept-Encoding"];
+	}
+      if (nil != budget)
+	{
+	  [handle writeProperty: budget forKey: budgetHeader];
+	}
       if ([_headers count] > 0)
 	{
 	  NSEnumerator	*e = [_headers keyEnumerator];
 	  NSString	*k;
 
-	  while ((k = [e nextObject]) != nil)
-	    {
-	      NSString	*v = [_headers objectForKey: k];
+	  while ((k = [e nextObject]) != nil)
+	    {
+	      NSString	*v = [_headers objectForKey: k];
+
+	      [handle writeProperty: v forKey: k];
+	    }
+	}
+      [handle writeData: toSend];
+      [handle loadInBackground];
+#endif
+    }
+  NSAssert(nil != toSend, NSInternalInconsistencyException);
+  [budgetHeader release];
+  [method release];
+  [toSend release];
+}
+
+
+/* Submit an RPC set up by -_initiate:parameters:order:timeout:prioritised:
+ * (and whose request data has been built if -_mustPrepare said it must
+ * be) for sending.  Returns NO if it could not be queued.
+ */
+- (BOOL) _submit
+{
+  if ((_cacheLife > 0.0 || YES == coalesce)
+    && nil != _connectionURL && [_request length] > 0
+    && YES == [self _cacheLookup])
+    {
+      return YES;	// Handled using a cached or shared response.
+    }
+
+  if (NO == [self _enqueue])
+    {
+      _stage = RPCIdle;
+      [_timer invalidate];
+      _timer = nil;
+      [self _cacheFinish];
+      [self _clean];
+      return NO;        // Too many enqueued requests in process
+    }
+
+  if (nil == _request)
+    {
+      /* Get the request data built ... either asynchronously in another
+       * thread or synchronously in this one if threading is not enabled.
+       * At the end of the -_prepareAndRun method the sending of the request
+       * is automatically started if possible.
+       */
+      STAT_ADD(statWorkPending, 1);
+      [workThreads scheduleSelector: @selector(_prepareAndRun)
+			 onReceiver: self
+			 withObject: nil];
+    }
+  else
+    {
+      /* Make sure that this is de-queued and run if possible.
+       */
+      [GWSService _run: [_connectionURL host]];
+    }
+  return YES;
+}
+
+@end
 
-	      [handle writeProperty: v forKey: k];
-	    }
+/* The request data for a batch of RPCs is built by the thread sending
+ * the batch together with work threads, each taking the next service
+ * from the array until none are left.
+ */
+@interface	GWSBatch : NSObject
+{
+@public
+  NSArray	*services;
+  NSUInteger	count;
+  NSUInteger	next;
+  NSUInteger	done;
+  NSCondition	*condition;
+}
+- (void) run;
+- (void) runWork;
+@end
+
+@implementation	GWSBatch
+- (void) dealloc
+{
+  [services release];
+  [condition release];
+  [super dealloc];
+}
+
+- (void) run
+{
+  NSUInteger	index;
+
+  while ((index = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)) < count)
+    {
+      NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+      [[services objectAtIndex: index] _prepare];
+      [arp release];
+      [condition lock];
+      if (++done == count)
+	{
+	  [condition signal];
 	}
-      [handle writeData: toSend];
-      [handle loadInBackground];
-#endif
+      [condition unlock];
     }
-  NSAssert(nil != toSend, NSInternalInconsistencyException);
-  [method release];
-  [toSend release];
 }
 
+/* Method to be run from thread pool to help build the batch.
+ */
+- (void) runWork
+{
+  STAT_SUB(statWorkPending, 1);
+  STAT_ADD(statWorkBusy, 1);
+  [self run];
+  STAT_SUB(statWorkBusy, 1);
+}
 @end
 
 
@@ -1052,6 +2441,14 @@ available(NSString *host)
       workThreads = [GSThreadPool new];
       [workThreads setThreads: 0];
       [workThreads setOperations: pool * 2];
+      statsLock = [NSLock new];
+      latencyHosts = [NSDictionary new];
+      latencyOps = [NSDictionary new];
+      hostStats = [NSDictionary new];
+      statsOld = [NSMutableArray new];
+      cacheLock = [NSLock new];
+      cache = [NSMutableDictionary new];
+      pending = [NSMutableDictionary new];
     }
 }
 
@@ -1089,6 +2486,319 @@ available(NSString *host)
   return result;
 }
 
++ (NSDictionary*) latencies
+{
+  NSMutableDictionary	*result;
+  NSDictionary		*maps[2];
+  NSString		*names[2];
+  unsigned		i;
+
+  maps[0] = __atomic_load_n(&latencyHosts, __ATOMIC_ACQUIRE);
+  names[0] = @"Hosts";
+  maps[1] = __atomic_load_n(&latencyOps, __ATOMIC_ACQUIRE);
+  names[1] = @"Operations";
+  result = [NSMutableDictionary dictionaryWithCapacity: 2];
+  for (i = 0; i < 2; i++)
+    {
+      NSMutableDictionary	*m;
+      NSEnumerator		*e;
+      NSString			*k;
+
+      m = [NSMutableDictionary dictionaryWithCapacity: [maps[i] count]];
+      e = [maps[i] keyEnumerator];
+      while ((k = [e nextObject]) != nil)
+	{
+	  GWSLatency		*l = [maps[i] objectForKey: k];
+	  NSMutableDictionary	*d;
+	  unsigned		s;
+
+	  d = [NSMutableDictionary dictionaryWithCapacity: LatencyStages];
+	  for (s = 0; s < LatencyStages; s++)
+	    {
+	      [d setObject: latencyInfo(&l->stages[s])
+		    forKey: latencyNames[s]];
+	    }
+	  [m setObject: d forKey: k];
+	}
+      [result setObject: m forKey: names[i]];
+    }
+  return result;
+}
+
++ (NSDictionary*) metrics
+{
+  NSMutableDictionary	*result;
+  NSMutableDictionary	*hosts;
+  NSDictionary		*map;
+  NSEnumerator		*e;
+  NSString		*k;
+
+  map = __atomic_load_n(&hostStats, __ATOMIC_ACQUIRE);
+  hosts = [NSMutableDictionary dictionaryWithCapacity: [map count]];
+  e = [map keyEnumerator];
+  while ((k = [e nextObject]) != nil)
+    {
+      GWSHostStats	*s = [map objectForKey: k];
+
+      [hosts setObject: [NSDictionary dictionaryWithObjectsAndKeys:
+	[NSNumber numberWithUnsignedLongLong: STAT_GET(s->active)], @"Active",
+	[NSNumber numberWithUnsignedLongLong: STAT_GET(s->queued)], @"Queued",
+	[NSNumber numberWithUnsignedLongLong: estimateFor(s)],
+	@"ServiceTime",
+	[NSNumber numberWithUnsignedLongLong: STAT_GET(s->circuit)],
+	@"Circuit",
+	nil] forKey: k];
+    }
+
+  result = [NSMutableDictionary dictionaryWithCapacity: 16];
+  [result setObject: hosts forKey: @"Hosts"];
+#define	SET(X, K)	[result setObject: \
+  [NSNumber numberWithUnsignedLongLong: (X)] forKey: K]
+  SET(STAT_GET(statActive), @"Active");
+  SET(STAT_GET(statQueued), @"Queued");
+  SET(STAT_GET(statRejectedQMax), @"RejectedQMax");
+  SET(STAT_GET(statRejectedPerHostQMax), @"RejectedPerHostQMax");
+  SET(STAT_GET(statRejectedDeadline), @"RejectedDeadline");
+  SET(STAT_GET(statRejectedCircuit), @"RejectedCircuit");
+  SET(STAT_GET(statTimeouts), @"Timeouts");
+  SET(STAT_GET(statCancellations), @"Cancellations");
+  SET(STAT_GET(statSent), @"BytesSent");
+  SET(STAT_GET(statReceived), @"BytesReceived");
+  SET([workThreads maxThreads], @"WorkThreads");
+  SET(STAT_GET(statWorkBusy), @"WorkBusy");
+  SET(STAT_GET(statWorkPending), @"WorkPending");
+  SET(STAT_GET(statCacheHits), @"CacheHits");
+  SET(STAT_GET(statCacheMisses), @"CacheMisses");
+  SET(STAT_GET(statCoalesced), @"Coalesced");
+  SET(STAT_GET(statCacheBytes), @"CacheBytes");
+#undef	SET
+  return result;
+}
+
++ (NSString*) metricsText
+{
+  NSMutableString	*s = [NSMutableString stringWithCapacity: 2048];
+  NSDictionary		*m = [self metrics];
+  NSDictionary		*hosts = [m objectForKey: @"Hosts"];
+  NSEnumerator		*e;
+  NSString		*k;
+
+#define	METRIC(N, T, K)	[s appendFormat: @"# TYPE gwsservice_%@ %@\n" \
+  @"gwsservice_%@ %@\n", N, T, N, [m objectForKey: K]]
+  METRIC(@"active", @"gauge", @"Active");
+  METRIC(@"queued", @"gauge", @"Queued");
+  [s appendString: @"# TYPE gwsservice_host_active gauge\n"];
+  e = [hosts keyEnumerator];
+  while ((k = [e nextObject]) != nil)
+    {
+      [s appendFormat: @"gwsservice_host_active{host=\"%@\"} %@\n",
+	promLabel(k), [[hosts objectForKey: k] objectForKey: @"Active"]];
+    }
+  [s appendString: @"# TYPE gwsservice_host_queued gauge\n"];
+  e = [hosts keyEnumerator];
+  while ((k = [e nextObject]) != nil)
+    {
+      [s appendFormat: @"gwsservice_host_queued{host=\"%@\"} %@\n",
+	promLabel(k), [[hosts objectForKey: k] objectForKey: @"Queued"]];
+    }
+  [s appendString: @"# TYPE gwsservice_host_circuit gauge\n"];
+  e = [hosts keyEnumerator];
+  while ((k = [e nextObject]) != nil)
+    {
+      [s appendFormat: @"gwsservice_host_circuit{host=\"%@\"} %@\n",
+	promLabel(k), [[hosts objectForKey: k] objectForKey: @"Circuit"]];
+    }
+  [s appendFormat: @"# TYPE gwsservice_rejected_total counter\n"
+    @"gwsservice_rejected_total{reason=\"qmax\"} %@\n"
+    @"gwsservice_rejected_total{reason=\"perhostqmax\"} %@\n"
+    @"gwsservice_rejected_total{reason=\"deadline\"} %@\n"
+    @"gwsservice_rejected_total{reason=\"circuit\"} %@\n",
+    [m objectForKey: @"RejectedQMax"],
+    [m objectForKey: @"RejectedPerHostQMax"],
+    [m objectForKey: @"RejectedDeadline"],
+    [m objectForKey: @"RejectedCircuit"]];
+  METRIC(@"timeouts_total", @"counter", @"Timeouts");
+  METRIC(@"cancellations_total", @"counter", @"Cancellations");
+  METRIC(@"sent_bytes_total", @"counter", @"BytesSent");
+  METRIC(@"received_bytes_total", @"counter", @"BytesReceived");
+  METRIC(@"work_threads", @"gauge", @"WorkThreads");
+  METRIC(@"work_busy", @"gauge", @"WorkBusy");
+  METRIC(@"work_pending", @"gauge", @"WorkPending");
+  METRIC(@"cache_hits_total", @"counter", @"CacheHits");
+  METRIC(@"cache_misses_total", @"counter", @"CacheMisses");
+  METRIC(@"coalesced_total", @"counter", @"Coalesced");
+  METRIC(@"cache_bytes", @"gauge", @"CacheBytes");
+#undef	METRIC
+  return s;
+}
+
++ (void) resetLatencies
+{
+  NSDictionary	*maps[2];
+  unsigned	i;
+
+  maps[0] = __atomic_load_n(&latencyHosts, __ATOMIC_ACQUIRE);
+  maps[1] = __atomic_load_n(&latencyOps, __ATOMIC_ACQUIRE);
+  for (i = 0; i < 2; i++)
+    {
+      NSEnumerator	*e = [maps[i] objectEnumerator];
+      GWSLatency	*l;
+
+      while ((l = [e nextObject]) != nil)
+	{
+	  uint64_t	*p = (uint64_t*)l->stages;
+	  NSUInteger	c = sizeof(l->stages) / sizeof(uint64_t);
+
+	  while (c-- > 0)
+	    {
+	      __atomic_store_n(&p[c], 0, __ATOMIC_RELAXED);
+	    }
+	}
+    }
+}
+
++ (NSArray*) sendRequests: (NSArray*)services
+		  methods: (NSArray*)methods
+	       parameters: (NSArray*)parameters
+		   orders: (NSArray*)orders
+		  timeout: (int)seconds
+{
+  NSUInteger		count = [services count];
+  NSMutableArray	*started;
+  NSMutableArray	*failed;
+  NSMutableArray	*build;
+  NSUInteger		index;
+
+  if ([methods count] != count || [parameters count] != count
+    || (nil != orders && [orders count] != count))
+    {
+      [NSException raise: NSInvalidArgumentException
+		  format: @"Batch arrays differ in size"];
+    }
+  started = [NSMutableArray arrayWithCapacity: count];
+  failed = [NSMutableArray arrayWithCapacity: count];
+  build = [NSMutableArray arrayWithCapacity: count];
+  for (index = 0; index < count; index++)
+    {
+      GWSService	*svc = [services objectAtIndex: index];
+      NSDictionary	*p = [parameters objectAtIndex: index];
+      NSArray		*o = [orders objectAtIndex: index];
+
+      if ((id)p == (id)[NSNull null])
+	{
+	  p = nil;
+	}
+      if ((id)o == (id)[NSNull null])
+	{
+	  o = nil;
+	}
+      if (YES == [svc _initiate: [methods objectAtIndex: index]
+		     parameters: p
+			  order: o
+			timeout: seconds
+		    prioritised: NO])
+	{
+	  [started addObject: svc];
+	  if (YES == [svc _mustPrepare])
+	    {
+	      [build addObject: svc];
+	    }
+	}
+      else
+	{
+	  [failed addObject: svc];
+	}
+    }
+
+  /* Build any request data needed before submitting the RPCs,
+   * spreading the work across the work threads.
+   */
+  if ([build count] > 0)
+    {
+      GWSBatch		*batch = [GWSBatch new];
+      NSUInteger	helpers = [workThreads maxThreads];
+
+      batch->services = [build copy];
+      batch->count = [build count];
+      batch->condition = [NSCondition new];
+      if (helpers >= batch->count)
+	{
+	  helpers = batch->count - 1;
+	}
+      while (helpers-- > 0)
+	{
+	  STAT_ADD(statWorkPending, 1);
+	  [workThreads scheduleSelector: @selector(runWork)
+			     onReceiver: batch
+			     withObject: nil];
+	}
+      [batch run];
+      [batch->condition lock];
+      while (batch->done < batch->count)
+	{
+	  [batch->condition wait];
+	}
+      [batch->condition unlock];
+      [batch release];
+    }
+
+  count = [started count];
+  for (index = 0; index < count; index++)
+    {
+      GWSService	*svc = [started objectAtIndex: index];
+
+      if (NO == [svc _submit])
+	{
+	  [failed addObject: svc];
+	}
+    }
+  return failed;
+}
+
++ (void) setCacheLimit: (NSUInteger)bytes
+{
+  [cacheLock lock];
+  cacheLimit = bytes;
+  cacheTrim();
+  [cacheLock unlock];
+}
+
++ (void) setCircuitBreaker: (double)failureRate
+		   minimum: (unsigned)count
+		  cooldown: (NSTimeInterval)seconds
+		    probes: (unsigned)probes
+{
+  [queueLock lock];
+  breakerRate = (failureRate > 1.0) ? 1.0 : failureRate;
+  breakerMinimum = (count < 1) ? 1 : count;
+  breakerCooldown = (seconds > 0.0) ? (uint64_t)(seconds * 1000000.0) : 0;
+  breakerProbes = (probes < 1) ? 1 : probes;
+  [queueLock unlock];
+}
+
++ (void) setCoalescing: (BOOL)flag
+{
+  coalesce = flag;
+}
+
++ (void) setDeadlineHeader: (NSString*)name
+{
+  if ([name length] == 0)
+    {
+      name = nil;
+    }
+  name = [name copy];
+  [queueLock lock];
+  [deadlineHeader release];
+  deadlineHeader = name;
+  [queueLock unlock];
+}
+
++ (void) setInflateLimit: (NSUInteger)bytes
+{
+  inflateLimit = bytes;
+}
+
 + (void) setPerHostPool: (unsigned)max
 {
   [queueLock lock];
@@ -1228,111 +2938,61 @@ available(NSString *host)
    */
   if (_port != nil)
     {
-      NSEnumerator	*enumerator;
-      GWSElement	*elem;
-      GWSElement	*operation;
-      GWSBinding	*binding;
-      GWSPortType	*portType;
-      NSString		*problem;
-      NSArray		*order;
-
-      /* Handle extensibility for port ...
-       * With SOAP this supplies the URL that we should send to.
-       */
-      enumerator = [[_port extensibility] objectEnumerator];
-      while ((elem = [enumerator nextObject]) != nil)
-	{
-	  problem = [self _setupFrom: elem in: _port];
-	  if (problem != nil)
-	    {
-	      [self _clean];
-	      [self _setProblem: problem];
-	      return nil;
-	    }
-	}
+      GWSResolvedOperation	*r;
+      NSString			*problem;
+      unsigned			i;
 
-      /* Handle SOAP binding ... this supplies the encoding style and
-       * transport that we should used.
+      /* The document holds the resolved setup for the operation on the
+       * port ... the extensibility for the port (with SOAP this supplies
+       * the URL that we should send to) and binding (the encoding style
+       * and transport that we should use), the parameter ordering from
+       * the abstract operation in the portType, and the extensibility
+       * for the specific operation binding and its input.
        */
-      binding = [_port binding];
-      enumerator = [[binding extensibility] objectEnumerator];
-      while ((elem = [enumerator nextObject]) != nil)
+      r = [_document _resolved: _operation port: _port];
+      for (i = 0; i <= r->count; i++)
 	{
-	  problem = [self _setupFrom: elem in: binding];
-	  if (problem != nil)
+	  if (i == r->split && [r->order count] > 0)
 	    {
-	      [self _clean];
-	      [self _setProblem: problem];
-	      return nil;
-	    }
-	}
+	      NSMutableArray	*m = [r->order mutableCopy];
+	      unsigned		c = [m count];
 
-      /* Now look at operation specific parameter ordering defined in
-       * the abstract operation in the portType. 
-       */
-      portType = [binding type];
-      operation = [[portType operations] objectForKey: _operation];
-      order = [[[operation attributes] objectForKey: @"parameterOrder"]
-	componentsSeparatedByString: @" "];
-      if ([order count] > 0)
-	{
-	  NSMutableArray	*m = [order mutableCopy];
-	  unsigned		c = [m count];
-
-	  while (c-- > 0)
-	    {
-	      NSString	*s = [order objectAtIndex: c];
+	      while (c-- > 0)
+		{
+		  NSString	*s = [m objectAtIndex: c];
 
-	      if ([_parameters objectForKey: s] == nil)
+		  if ([_parameters objectForKey: s] == nil)
+		    {
+		      /* Item is not present in parameters dictionary so
+		       * presumably it' an output parameter rather than
+		       * an input parameter ad we can ignore it.
+		       */
+		      [m removeObjectAtIndex: c];
+		    }
+		}
+	      if ([m count] > 0)
 		{
-		  /* Item is not present in parameters dictionary so
-		   * presumably it' an output parameter rather than
-		   * an input parameter ad we can ignore it.
+		  /* Add the ordering information to the parameters
+		   * dictionary so that the coder will be able to use it.
 		   */
-		  [m removeObjectAtIndex: c];
+		  [_parameters setObject: m forKey: GWSOrderKey];
 		}
+	      [m release];
 	    }
-	  if ([m count] > 0)
+	  if (i == r->count)
 	    {
-	      /* Add the ordering information to the parameters dictionary
-	       * so that the coder will be able to use it.
-	       */
-	      [_parameters setObject: m forKey: GWSOrderKey];
+	      break;
 	    }
-	  [m release];
-	}
-
-      /* Next we can examine the specific operation binding information.
-       */
-      elem = [binding operationWithName: _operation create: NO];
-      elem = [elem firstChild];
-      while (elem != nil
-	&& [[elem name] isEqualToString: @"input"] == NO
-	&& [[elem name] isEqualToString: @"output"] == NO)
-	{
-	  problem = [self _setupFrom: elem in: binding];
+	  problem = [r->steps[i].extensibility validate: r->steps[i].element
+						    for: _document
+						     in: r->steps[i].section
+						  setup: self];
 	  if (problem != nil)
 	    {
 	      [self _clean];
 	      [self _setProblem: problem];
 	      return nil;
 	    }
-	  elem = [elem sibling];
-	}
-      if ([[elem name] isEqualToString: @"input"] == YES)
-	{
-	  elem = [elem firstChild];
-	  while (elem != nil)
-	    {
-	      problem = [self _setupFrom: elem in: binding];
-	      if (problem != nil)
-		{
-		  [self _clean];
-		  [self _setProblem: problem];
-		  return nil;
-		}
-	      elem = [elem sibling];
-	    }
 	}
     }
 
@@ -1379,6 +3039,11 @@ available(NSString *host)
   return element;
 }
 
+- (BOOL) coderPooling
+{
+  return _coderPooling;
+}
+
 - (BOOL) compact
 {
   return _compact;
@@ -1390,6 +3055,8 @@ available(NSString *host)
   [self _clean];
   [_coder release];
   _coder = nil;
+  [_ownCoder release];
+  _ownCoder = nil;
   [_tz release];
   [_result release];
   if (_connection)
@@ -1397,6 +3064,7 @@ available(NSString *host)
       [_connection release];
     }
   [_response release];
+  [_rawResponse release];
   [_connectionURL release];
   [_documentation release];
   [_extensibility release];
@@ -1406,6 +3074,7 @@ available(NSString *host)
   [_name release];
   [_headers release];
   [_extra release];
+  [_cacheKey release];
   [_lock release];
   [super dealloc];
 }
@@ -1535,89 +3204,26 @@ available(NSString *host)
              timeout: (int)seconds
 	 prioritised: (BOOL)urgent
 {
-  if (nil != _timeout)
+  if (NO == [self _initiate: method
+		 parameters: parameters
+		      order: order
+		    timeout: seconds
+		prioritised: urgent])
     {
-      NSLog(@"[%@-%@] request already in progress",
-        NSStringFromClass([self class]), NSStringFromSelector(_cmd));
       return NO;
     }
-  if (_result != nil)
-    {
-      [_result release];
-      _result = nil;
-    }
-  if (_response != nil)
-    {
-      [_response release];
-      _response = nil;
-    }
-  _prioritised = urgent;
-
-  _cancelled = NO;
-  _completedIO = NO;
-  _stage = RPCIdle;
-  if (seconds < 1)
-    {
-      seconds = 1;
-    }
-  _timeout = [[NSDate alloc] initWithTimeIntervalSinceNow: seconds];
-
-  /* Make a note of which thread queued the request.
-   */
-  _queueThread = [[NSThread currentThread] retain];
-
-  /* The timer runs in the thread which queued the request ...
-   * so the loop for that thread needs to be run in order to
-   * deal with timeouts of queued operations.
-   */
-  _timer = [NSTimer
-    scheduledTimerWithTimeInterval: [_timeout timeIntervalSinceNow]
-    target: self
-    selector: @selector(timeout:)
-    userInfo: nil
-    repeats: NO];
-
-  _prepMethod = [method copy]; 
-  _prepParameters = [parameters copy]; 
-  _prepOrder = [order copy]; 
-  
-  if (nil == _connectionURL)
+  if (YES == [self _mustPrepare])
     {
       /* We have nowhere to connect to ... so try building the request in
        * case the build process is also going to set the connection URL.
        * We have to do that now since we can't queue the request until we
        * know where it's going.
+       * If the response may be cached or shared, we need the request data
+       * to look for it before queueing.
        */
       [self _prepare];
     }
-
-  if (NO == [self _enqueue])
-    {
-      _stage = RPCIdle;
-      [_timer invalidate];
-      _timer = nil;
-      [self _clean];
-      return NO;        // Too many enqueued requests in process
-    }
-
-  if (nil == _request)
-    {
-      /* Get the request data built ... either asynchronously in another
-       * thread or synchronously in this one if threading is not enabled.
-       * At the end of the -_prepareAndRun method the sending of the request
-       * is automatically started if possible.
-       */
-      [workThreads scheduleSelector: @selector(_prepareAndRun)
-			 onReceiver: self
-			 withObject: nil];
-    }
-  else
-    {
-      /* Make sure that this is de-queued and run if possible.
-       */
-      [GWSService _run: [_connectionURL host]];
-    }
-  return YES;
+  return [self _submit];
 }
 
 - (void) setCoder: (GWSCoder*)aCoder
@@ -1637,16 +3243,48 @@ available(NSString *host)
           [old setDelegate: nil];
 	}
       _coder = [aCoder retain];
+      if (nil != _ownCoder)
+	{
+	  /* The old coder was borrowed from the pool, so we hand it back
+	   * and discard our own coder which it was standing in for.
+	   */
+	  [old returnCoder];
+	  old = _ownCoder;
+	  _ownCoder = nil;
+	  if ([old delegate] == (id)self)
+	    {
+	      [old setDelegate: nil];
+	    }
+	}
       [old release];
       [_coder setDelegate: self];
     }
 }
 
+- (void) setCoderPooling: (BOOL)flag
+{
+  _coderPooling = (flag ? YES : NO);
+}
+
 - (void) setCompact: (BOOL)flag
 {
   _compact = flag;
 }
 
+- (void) setCompressRequests: (NSUInteger)threshold
+{
+#if	USE_ZLIB == 1
+  _compressAbove = threshold;
+#endif
+}
+
+- (void) setCompressResponses: (BOOL)flag
+{
+#if	USE_ZLIB == 1
+  _acceptCompressed = (flag ? YES : NO);
+#endif
+}
+
 - (void) setContentType: (NSString*)cType
 {
   if ([cType length] == 0)
@@ -1858,6 +3496,7 @@ available(NSString *host)
       notYetActive = NO;
       [queued removeObjectAtIndex: index];
       [[queues objectForKey: host] removeObjectIdenticalTo: self];
+      publishCounts(host);
     }
   [queueLock unlock];
 
@@ -1870,7 +3509,12 @@ available(NSString *host)
       if (t == _timer)
         {
           [self _setProblem: @"timed out"];
+	  STAT_ADD(statTimeouts, 1);
         }
+      else
+	{
+	  STAT_ADD(statCancellations, 1);
+	}
     }
   else
     {
@@ -1984,7 +3628,18 @@ didReceiveAuthenticationChallenge: (NSURLAuthenticationChallenge*)challenge
 - (void) connection: (NSURLConnection*)connection
  didReceiveResponse: (NSURLResponse*)response 
 {
+  NSDictionary	*headers = [(NSHTTPURLResponse*)response allHeaderFields];
+  NSEnumerator	*e = [headers keyEnumerator];
+  NSString	*k;
+
   _code = [(NSHTTPURLResponse*)response statusCode];
+  while ((k = [e nextObject]) != nil)
+    {
+      if ([k caseInsensitiveCompare: @"Content-Encoding"] == NSOrderedSame)
+	{
+	  _compressedResponse = isCompressed([headers objectForKey: k]);
+	}
+    }
 }
 
 - (NSCachedURLResponse*) connection: (NSURLConnection*)connection
@@ -2030,8 +3685,10 @@ didReceiveAuthenticationChallenge: (NSURLAuthenticationChallenge*)challenge
   [_lock lock];
   [self _completedIO];
   _stage = RPCParsing;
+  _stamps[StampLoaded] = usecNow();
   [_lock unlock];
 
+  STAT_ADD(statReceived, [_response length]);
   if ([_response length] == 0)	// No response received
     {
       [_response release];
@@ -2047,7 +3704,8 @@ didReceiveAuthenticationChallenge: (NSURLAuthenticationChallenge*)challenge
     }
   else
     {
-      [workThreads scheduleSelector: @selector(_received)
+      STAT_ADD(statWorkPending, 1);
+      [workThreads scheduleSelector: @selector(_receivedWork)
 			 onReceiver: self
 			 withObject: nil];
     }
@@ -2081,6 +3739,11 @@ didReceiveAuthenticationChallenge: (NSURLAuthenticationChallenge*)challenge
 {
   return nil;
 }
+- (NSTimeInterval) webService: (GWSService*)service
+		cacheLifetime: (NSString*)method
+{
+  return 0.0;
+}
 - (GWSElement*) webService: (GWSService*)service
 		 didEncode: (GWSElement*)element
 {
@@ -2180,10 +3843,14 @@ didReceiveAuthenticationChallenge: (NSURLAuthenticationChallenge*)challenge
   [_lock lock];
   [self _completedIO];
   _stage = RPCParsing;
+  _stamps[StampLoaded] = usecNow();
   [handle removeClient: (id<NSURLHandleClient>)self];
   [_response release];
   _response = [[handle availableResourceData] mutableCopy];
   _code = [[handle propertyForKey: NSHTTPPropertyStatusCodeKey] intValue];
+  _compressedResponse = isCompressed([handle
+    propertyForKeyIfAvailable: @"Content-Encoding"]);
+  STAT_ADD(statReceived, [_response length]);
   [_lock unlock];
   if ([workThreads maxThreads] == 0
     && [NSThread currentThread] != _queueThread)
@@ -2195,7 +3862,8 @@ didReceiveAuthenticationChallenge: (NSURLAuthenticationChallenge*)challenge
     }
   else
     {
-      [workThreads scheduleSelector: @selector(_received)
+      STAT_ADD(statWorkPending, 1);
+      [workThreads scheduleSelector: @selector(_receivedWork)
 			 onReceiver: self
 			 withObject: nil];
     }
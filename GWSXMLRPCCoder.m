@@ -64,7 +64,9 @@ static id               boolY;
 {
   GWSElement		*container;
   NSMutableString       *ms;
+  NSData		*data;
 
+  GWS_ALLOC_BEGIN(self);
   [self reset];
   container = [GWSElement new];
 
@@ -120,7 +122,7 @@ static id               boolY;
       if ([method length] == 0)
 	{
 	  [container release];
-	  return nil;
+	  GWS_ALLOC_RETURN(self, nil, NSData*);
 	}
       else
 	{
@@ -143,7 +145,7 @@ static id               boolY;
 	  if (r.length > 0)
 	    {
 	      [container release];
-	      return nil;	// Bad method name.
+	      GWS_ALLOC_RETURN(self, nil, NSData*);	// Bad method name.
 	    }
 	}
       [ms appendString: @"<methodCall>"];
@@ -202,7 +204,10 @@ static id               boolY;
     }
   [container remove];
   [container release];
-  return [ms dataUsingEncoding: NSUTF8StringEncoding];
+  data = [ms dataUsingEncoding: NSUTF8StringEncoding];
+  GWS_ALLOC(GWSAllocBuffers, [data length]);
+  GWS_ALLOC_END(self);
+  return data;
 }
 
 - (NSData*) buildResponse: (NSString*)method
@@ -211,7 +216,9 @@ static id               boolY;
 {
   GWSElement		*container;
   NSMutableString       *ms;
-  
+  NSData		*data;
+
+  GWS_ALLOC_BEGIN(self);
   [self reset];
 
   container = [GWSElement new];
@@ -313,17 +320,24 @@ static id               boolY;
   [ms appendString: @"</methodResponse>"];
   [container remove];
   [container release];
-  return [ms dataUsingEncoding: NSUTF8StringEncoding];
+  data = [ms dataUsingEncoding: NSUTF8StringEncoding];
+  GWS_ALLOC(GWSAllocBuffers, [data length]);
+  GWS_ALLOC_END(self);
+  return data;
 }
 
 - (NSString*) encodeDateTimeFrom: (NSDate*)source
 {
-  NSString	*s;
-
-  s = [source descriptionWithCalendarFormat: @"%Y%m%dT%H:%M:%S"
-                                   timeZone: [self timeZone]
-                                     locale: nil];
-  return s;
+  GWSDateTime	dt;
+  char		buf[32];
+  int		l;
+
+  [self _breakDate: source timeZone: nil into: &dt];
+  l = snprintf(buf, sizeof(buf), "%04d%02d%02dT%02d:%02d:%02d",
+    dt.year, dt.month, dt.day, dt.hour, dt.minute, dt.second);
+  return [[[NSString alloc] initWithBytes: buf
+				   length: l
+				 encoding: NSASCIIStringEncoding] autorelease];
 }
 
 - (id) _newParsedValue: (GWSElement*)elem
@@ -341,6 +355,7 @@ static id               boolY;
   if (c == 0)
     {
       s = [[elem content] copy];
+      GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * [s length]);
       return s;
     }
   if (c != 1)
@@ -360,6 +375,7 @@ static id               boolY;
                       format: @"xml element inside %@", name];
         }
       s = [[elem content] copy];
+      GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * [s length]);
       return s;
     }
 
@@ -432,18 +448,13 @@ static id               boolY;
 	  [NSException raise: NSInvalidArgumentException
 		      format: @"missing %@ value", name];
 	}
-      return [[self decodeBase64From: s] retain];
+      return [[self _decodeBase64Value: s] retain];
     }
 
   if ([name isEqualToString: @"dateTime.iso8601"])
     {
-      const char	*u;
-      int		year;
-      int		month;
-      int		day;
-      int		hour;
-      int		minute;
-      int		second;
+      GWSDateTime	dt;
+      int		zone;
 
       if (_strictParsing && nil != [elem firstChild])
         {
@@ -456,20 +467,14 @@ static id               boolY;
 	  [NSException raise: NSInvalidArgumentException
 		      format: @"missing %@ value", name];
 	}
-      u = [s UTF8String];
-      if (sscanf(u, "%04d%02d%02dT%02d:%02d:%02d",
-        &year, &month, &day, &hour, &minute, &second) != 6)
+      zone = [self _parseDateTime: s into: &dt];
+      if (zone < 0)
 	{
 	  [NSException raise: NSInvalidArgumentException
 		      format: @"bad date/time format '%@'", s];
 	}
-      return [[NSCalendarDate alloc] initWithYear: year
-                                            month: month
-                                              day: day
-                                             hour: hour
-                                           minute: minute
-                                           second: second 
-                                         timeZone: [self timeZone]]; 
+      return [self _newDateFrom: &dt
+		       timeZone: (0 == zone) ? [self timeZone] : nil];
     }
 
   if ([name isEqualToString: @"struct"])
@@ -483,6 +488,7 @@ static id               boolY;
         }
       c = [elem countChildren];
       m = [NSMutableDictionary dictionaryWithCapacity: c];
+      GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * c);
       elem = [elem firstChild];
       while (elem != nil)
         {
@@ -575,7 +581,9 @@ static id               boolY;
   GWSElement            *elem;
   NSString              *name;
 
+  GWS_ALLOC_BEGIN(self);
   result = [NSMutableDictionary dictionaryWithCapacity: 3];
+  GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * 3);
 
   [self reset];
   pool = [NSAutoreleasePool new];
@@ -615,6 +623,7 @@ static id               boolY;
               if (_strictParsing) [self _checkElement: elem];
 
               params = [NSMutableDictionary dictionaryWithCapacity: c];
+              GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id) * c);
               order = [NSMutableArray arrayWithCapacity: c];
 
               for (i = 0; i < c; i++)
@@ -635,6 +644,7 @@ static id               boolY;
                   if (_strictParsing) [self _checkElement: elem];
 
                   name = [NSString stringWithFormat: @"Arg%u", i];
+                  GWS_ALLOC(GWSAllocStrings, sizeof(unichar) * [name length]);
                   o = [[self delegate] decodeWithCoder: self
                                                   item: [elem firstChild]
                                                  named: name];
@@ -692,6 +702,7 @@ static id               boolY;
                                              named: @"Result"];
 
               params = [NSMutableDictionary dictionaryWithCapacity: 1];
+              GWS_ALLOC(GWSAllocDictionaries, 2 * sizeof(id));
               if (o == nil)
                 {
                   o = [self _newParsedValue: [elem firstChild]];
@@ -737,6 +748,7 @@ static id               boolY;
 
   [self reset];
   [pool release];
+  GWS_ALLOC_END(self);
 
   return result;
 }
@@ -754,6 +766,15 @@ static id               boolY;
 
 @implementation GWSXMLRPCCoder (Private)
 
+- (void) _configureFrom: (GWSCoder*)coder
+{
+  [super _configureFrom: coder];
+  if ([coder isKindOfClass: [GWSXMLRPCCoder class]])
+    {
+      _strictParsing = ((GWSXMLRPCCoder*)coder)->_strictParsing;
+    }
+}
+
 - (void) _appendObject: (id)o
 {
   NSMutableString       *ms = [self mutableString];
@@ -803,7 +824,15 @@ static id               boolY;
     {
       [self nl];
       [ms appendString: @"<base64>"];
-      [ms appendString: [self encodeBase64From: o]];
+      [self appendBase64From: o];
+      [self nl];
+      [ms appendString: @"</base64>"];
+    }
+  else if (YES == [o isKindOfClass: [NSInputStream class]])
+    {
+      [self nl];
+      [ms appendString: @"<base64>"];
+      [self appendBase64FromStream: o];
       [self nl];
       [ms appendString: @"</base64>"];
     }
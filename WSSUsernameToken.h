@@ -111,6 +111,40 @@ typedef enum {
 			  withNonce: (NSString**)nonce
                           algorithm: (GWSDigestAlgorithm)algorithm;
 
+/** Generates base64 encoded hash digests for a batch of passwords, in the
+ * same way as the +digestHashForPassword:andTimestamp:withNonce:algorithm:
+ * method does for a single password, and returns them in an array.<br />
+ * The timestamps and nonces arrays (if supplied) must have one element per
+ * password.  If the timestamps array is nil then the current timestamp
+ * is used for all passwords and an array of timestamps is returned, and
+ * if the nonces array is nil then new nonces are generated and returned.
+ * <br />
+ * The digests are produced by the
+ * +digestsForPasswords:andTimestamps:withNonces:algorithm: method, and
+ * each is then encoded as a string ready for use in a header.
+ */
++ (NSArray*) digestHashesForPasswords: (NSArray*)passwords
+			andTimestamps: (NSArray**)dates
+			   withNonces: (NSArray**)nonces
+			    algorithm: (GWSDigestAlgorithm)algorithm;
+
+/** Generates the raw hash digests for a batch of passwords, handling the
+ * timestamps and nonces arrays exactly as the
+ * +digestHashesForPasswords:andTimestamps:withNonces:algorithm: method
+ * does, and returns the digests one after another in a single data
+ * object.<br />
+ * Every digest is the output size of the algorithm (eg. 20 bytes for
+ * SHA1 or 32 bytes for SHA2_256), so the digest for the password at
+ * index N starts at N * [data length] / [passwords count].<br />
+ * This is the most efficient way to generate many digests, as the random
+ * data for nonces is obtained in one go, timestamps are formatted once,
+ * and no objects are created per digest.
+ */
++ (NSData*) digestsForPasswords: (NSArray*)passwords
+		  andTimestamps: (NSArray**)dates
+		     withNonces: (NSArray**)nonces
+		      algorithm: (GWSDigestAlgorithm)algorithm;
+
 /** Adds a representation of the receiver to the specified SOAP header
  * and returns the modified header.  If the header is nil, this simply
  * returns a representation of the receiver which can then be added to
@@ -35,9 +35,21 @@
 #include <nettle/sha3.h>
 #endif
 
+/* Allow use of the x86 SHA extensions (selected at runtime) for digests.
+ */
+#if	defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define	HAVE_SHA_NI	1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 static NSTimeZone	*gmt = nil;
 static GWSCoder		*coder = nil;
 
+static unsigned
+digestBytes(GWSDigestAlgorithm algorithm,
+  const uint8_t *bytes, unsigned length, uint8_t *output);
+
 @implementation	WSSUsernameToken
 
 + (NSString*) digestHashForPassword: (NSString*)password
@@ -146,6 +158,216 @@ static GWSCoder		*coder = nil;
   return [coder encodeBase64From: hash];
 }
 
++ (NSArray*) digestHashesForPasswords: (NSArray*)passwords
+			andTimestamps: (NSArray**)dates
+			   withNonces: (NSArray**)nonces
+			    algorithm: (GWSDigestAlgorithm)algorithm
+{
+  NSData		*digests;
+  const uint8_t		*bytes;
+  NSMutableArray	*result;
+  NSUInteger		count;
+  NSUInteger		size;
+  NSUInteger		i;
+
+  digests = [self digestsForPasswords: passwords
+			andTimestamps: dates
+			   withNonces: nonces
+			    algorithm: algorithm];
+  count = [passwords count];
+  if (0 == count)
+    {
+      return [NSArray array];
+    }
+  bytes = (const uint8_t*)[digests bytes];
+  size = [digests length] / count;
+  result = [NSMutableArray arrayWithCapacity: count];
+  for (i = 0; i < count; i++)
+    {
+      char	buf[88];
+      unsigned	len;
+
+      len = [coder encodeBase64From: bytes + size * i length: size into: buf];
+      [result addObject: [[[NSString alloc] initWithBytes: buf
+						   length: len
+						 encoding: NSASCIIStringEncoding]
+	autorelease]];
+    }
+  return result;
+}
+
++ (NSData*) digestsForPasswords: (NSArray*)passwords
+		  andTimestamps: (NSArray**)dates
+		     withNonces: (NSArray**)nonces
+		      algorithm: (GWSDigestAlgorithm)algorithm
+{
+  NSUInteger		count = [passwords count];
+  NSArray		*d = (0 == dates) ? nil : (id)*dates;
+  NSArray		*n = (0 == nonces) ? nil : (id)*nonces;
+  NSMutableData		*result = nil;
+  id			*objects;
+  uint8_t		*nonceBytes;
+  uint8_t		*input;
+  unsigned		inputSize;
+  id			lastDate = nil;
+  char			when[21];
+  NSUInteger		i;
+
+  if ((nil != d && [d count] != count) || (nil != n && [n count] != count))
+    {
+      [NSException raise: NSInvalidArgumentException
+		  format: @"Timestamps/nonces do not match passwords"];
+    }
+  if (0 == count)
+    {
+      return [NSData data];
+    }
+
+  /* All the nonces are held in one buffer, so if we need to generate
+   * them we can get all the random data in one go.
+   */
+  objects = (id*)NSZoneMalloc(NSDefaultMallocZone(), sizeof(id) * count);
+  nonceBytes = (uint8_t*)NSZoneMalloc(NSDefaultMallocZone(), 16 * count);
+  inputSize = 256;
+  input = (uint8_t*)NSZoneMalloc(NSDefaultMallocZone(), inputSize);
+  NS_DURING
+    {
+      if (nil == d)
+	{
+	  NSCalendarDate	*now = [NSCalendarDate date];
+
+	  [now setTimeZone: gmt];
+	  [now setCalendarFormat: @"%Y-%m-%dT%H:%M:%SZ"];
+	  for (i = 0; i < count; i++)
+	    {
+	      objects[i] = now;
+	    }
+	  d = [NSArray arrayWithObjects: objects count: count];
+	  if (0 != dates)
+	    {
+	      *dates = d;
+	    }
+	}
+
+      if (nil == n)
+	{
+	  [GWSHash salt: nonceBytes size: 16 * count];
+	  for (i = 0; i < count; i++)
+	    {
+	      char	buf[24];
+
+	      [coder encodeBase64From: nonceBytes + 16 * i
+			       length: 16
+				 into: buf];
+	      objects[i] = [[[NSString alloc] initWithBytes: buf
+						     length: 24
+						   encoding: NSASCIIStringEncoding]
+		autorelease];
+	    }
+	  n = [NSArray arrayWithObjects: objects count: count];
+	  if (0 != nonces)
+	    {
+	      *nonces = n;
+	    }
+	}
+      else
+	{
+	  for (i = 0; i < count; i++)
+	    {
+	      NSData	*nd = [coder decodeBase64From: [n objectAtIndex: i]];
+
+	      if ([nd length] != 16)
+		{
+		  [NSException raise: NSInvalidArgumentException
+			      format: @"Nonce does not decode to 16 bytes"];
+		}
+	      memcpy(nonceBytes + 16 * i, [nd bytes], 16);
+	    }
+	}
+
+      for (i = 0; i < count; i++)
+	{
+	  NSString	*password = [passwords objectAtIndex: i];
+	  id		date = [d objectAtIndex: i];
+	  uint8_t	digest[64];
+	  unsigned	plen;
+	  unsigned	len;
+
+	  /* Timestamps are usually shared, so we only format when the
+	   * date differs from the one for the previous password.
+	   */
+	  if (date != lastDate)
+	    {
+	      if ([date isKindOfClass: [NSDate class]])
+		{
+		  GWSDateTime	dt;
+
+		  [coder _breakDate: date timeZone: gmt into: &dt];
+		  snprintf(when, sizeof(when), "%04d-%02d-%02dT%02d:%02d:%02dZ",
+		    dt.year, dt.month, dt.day, dt.hour, dt.minute, dt.second);
+		}
+	      else
+		{
+		  const char	*s = [[date description] UTF8String];
+		  unsigned int	year, month, day, hour, minute, second;
+
+		  if (strlen(s) != 20 || s[4] != '-' || s[7] != '-'
+		    || s[10] != 'T' || s[13] != ':' || s[16] != ':'
+		    || s[19] != 'Z' || sscanf(s, "%u-%u-%uT%u:%u:%uZ",
+		    &year, &month, &day, &hour, &minute, &second) != 6)
+		    {
+		      [NSException raise: NSInvalidArgumentException
+				  format: @"Bad timestamp (%@) argument", date];
+		    }
+		  memcpy(when, s, 21);
+		}
+	      lastDate = date;
+	    }
+
+	  /* Build nonce + timestamp + password in the reusable buffer.
+	   */
+	  plen = [password lengthOfBytesUsingEncoding: NSUTF8StringEncoding];
+	  if (36 + plen + 1 > inputSize)
+	    {
+	      inputSize = 36 + plen + 1;
+	      input = NSZoneRealloc(NSDefaultMallocZone(), input, inputSize);
+	    }
+	  memcpy(input, nonceBytes + 16 * i, 16);
+	  memcpy(input + 16, when, 20);
+	  [password getCString: (char*)input + 36
+		     maxLength: plen + 1
+		      encoding: NSUTF8StringEncoding];
+
+	  len = digestBytes(algorithm, input, 36 + plen, digest);
+	  if (0 == len)
+	    {
+	      [NSException raise: NSInvalidArgumentException
+			  format: @"Uknown/unsupported hash algorithm requested"];
+	    }
+	  /* The digests all have the same size, so the output can be
+	   * allocated once we know the size of the first.
+	   */
+	  if (nil == result)
+	    {
+	      result = [NSMutableData dataWithLength: len * count];
+	    }
+	  memcpy((uint8_t*)[result mutableBytes] + len * i, digest, len);
+	}
+    }
+  NS_HANDLER
+    {
+      NSZoneFree(NSDefaultMallocZone(), input);
+      NSZoneFree(NSDefaultMallocZone(), nonceBytes);
+      NSZoneFree(NSDefaultMallocZone(), objects);
+      [localException raise];
+    }
+  NS_ENDHANDLER
+  NSZoneFree(NSDefaultMallocZone(), input);
+  NSZoneFree(NSDefaultMallocZone(), nonceBytes);
+  NSZoneFree(NSDefaultMallocZone(), objects);
+  return result;
+}
+
 + (void) initialize
 {
   if (gmt == nil)
@@ -155,21 +377,125 @@ static GWSCoder		*coder = nil;
     }
 }
 
-- (GWSElement*) addToHeader: (GWSElement*)header
+/* Build a template UsernameToken element for the prefixes in use.
+ * The start of each element (and the whole of the username element) is
+ * serialised in advance, so that each request only needs to copy the
+ * template and fill in the password digest, nonce and timestamp.
+ */
+- (GWSElement*) _templateWithPrefix: (NSString*)prefix
+			    uPrefix: (NSString*)uPrefix
+			  namespace: (NSString*)ns
+			 uNamespace: (NSString*)uns
 {
-  GWSElement	*security;
+  GWSSOAPCoder	*c;
   GWSElement	*token;
   GWSElement	*elem;
-  NSString	*prefix;
-  NSString	*uPrefix;
-  NSString	*ns;
-  NSString	*uns;
   NSString	*cName;
   NSString	*nName;
   NSString	*tName;
   NSString	*uName;
   NSString	*pName;
 
+  if ([uPrefix isEqualToString: @"wsu"] == YES)
+    {
+      cName = @"wsu:Created";
+    }
+  else
+    {
+      cName = [NSString stringWithFormat: @"%@:Created", uPrefix];
+    }
+
+  if ([prefix isEqualToString: @"wsse"] == YES)
+    {
+      nName = @"wsse:Nonce";
+      tName = @"wsse:UsernameToken";
+      uName = @"wsse:Username";
+      pName = @"wsse:Password";
+    }
+  else
+    {
+      nName = [NSString stringWithFormat: @"%@:Nonce", prefix];
+      tName = [NSString stringWithFormat: @"%@:UsernameToken", prefix];
+      uName = [NSString stringWithFormat: @"%@:Username", prefix];
+      pName = [NSString stringWithFormat: @"%@:Password", prefix];
+    }
+
+  token = [[GWSElement alloc] initWithName: @"UsernameToken"
+				 namespace: ns
+				 qualified: tName
+				attributes: nil];
+
+  elem = [[GWSElement alloc] initWithName: @"Username"
+				namespace: ns
+				qualified: uName
+			       attributes: nil];
+  [token addChild: elem];
+  [elem release];
+  [elem addContent: _name];
+
+  if (_ttl > 0)
+    {
+      NSMutableDictionary	*attr;
+
+      attr = [[NSMutableDictionary alloc] initWithCapacity: 1];
+      [attr setObject: @"#PasswordDigest" forKey: @"Type"];
+      elem = [[GWSElement alloc] initWithName: @"Password"
+				    namespace: ns
+				    qualified: pName
+				   attributes: attr];
+      [attr release];
+      [token addChild: elem];
+      [elem release];
+
+      elem = [[GWSElement alloc] initWithName: @"Nonce"
+				    namespace: ns
+				    qualified: nName
+				   attributes: nil];
+      [token addChild: elem];
+      [elem release];
+
+      elem = [[GWSElement alloc] initWithName: @"Created"
+				    namespace: uns
+				    qualified: cName
+				   attributes: nil];
+      [token addChild: elem];
+      [elem release];
+    }
+  else
+    {
+      elem = [[GWSElement alloc] initWithName: @"Password"
+				    namespace: ns
+				    qualified: pName
+				   attributes: nil];
+      [elem addContent: _password];
+      [token addChild: elem];
+      [elem release];
+    }
+
+  /* Encoding the template caches the start of each element, and the
+   * username never changes, so we can store it as a literal value.
+   * A pooled coder is used, so we don't create one for each template.
+   */
+  c = [GWSSOAPCoder borrowCoder];
+  [c setPermitAllUnicode: NO];
+  [token encodeWith: c];
+  elem = [token firstChild];
+  [elem setLiteralValue: [NSString stringWithFormat: @"<%@>%@</%@>",
+    uName, [c escapeXMLFrom: _name], uName]];
+  [c returnCoder];
+  return [token autorelease];
+}
+
+- (GWSElement*) addToHeader: (GWSElement*)header
+{
+  GWSElement	*security;
+  GWSElement	*token;
+  GWSElement	*tmpl;
+  NSString	*prefix;
+  NSString	*uPrefix;
+  NSString	*ns;
+  NSString	*uns;
+
   uPrefix = nil;
   ns = @"http://docs.oasis-open.org/wss/2004/01/"
     @"oasis-200401-wss-wssecurity-secext-1.0.xsd";
@@ -260,51 +586,44 @@ static GWSCoder		*coder = nil;
 	  [security release];
 	}
     }
-    
-  if ([uPrefix isEqualToString: @"wsu"] == YES)
+  else if (_ttl > 0)
     {
-      cName = @"wsu:Created";
-    }
-  else
-    {
-      cName = [NSString stringWithFormat: @"%@:Created", uPrefix];
+      /* Use the utility namespace prefix already in scope for the
+       * existing security element, or declare our default one there.
+       */
+      uPrefix = [security prefixForNamespace: uns];
+      if ([uPrefix length] == 0)
+	{
+	  uPrefix = @"wsu";
+          [security setNamespace: uns forPrefix: @"wsu"];
+	}
     }
-
   prefix = [security prefix];
-  if ([prefix isEqualToString: @"wsse"] == YES)
-    {
-      nName = @"wsse:Nonce";
-      tName = @"wsse:UsernameToken";
-      uName = @"wsse:Username";
-      pName = @"wsse:Password";
-    }
-  else
+
+  /* Reuse the template from the last request if the prefixes match,
+   * otherwise build (and keep) a new one.
+   */
+  tmpl = (GWSElement*)_reserved;
+  if (nil == tmpl || NO == [prefix isEqualToString: [tmpl prefix]]
+    || (_ttl > 0 && NO == [uPrefix isEqualToString:
+      [[tmpl lastChild] prefix]]))
     {
-      nName = [NSString stringWithFormat: @"%@:Nonce", prefix];
-      tName = [NSString stringWithFormat: @"%@:UsernameToken", prefix];
-      uName = [NSString stringWithFormat: @"%@:Username", prefix];
-      pName = [NSString stringWithFormat: @"%@:password", prefix];
+      [tmpl release];
+      tmpl = [[self _templateWithPrefix: prefix
+				    uPrefix: uPrefix
+				  namespace: ns
+				 uNamespace: uns] retain];
+      _reserved = (void*)tmpl;
     }
 
-  token = [[GWSElement alloc] initWithName: @"UsernameToken"
-				 namespace: ns
-				 qualified: tName
-				attributes: nil];
+  token = [tmpl mutableCopy];
   [security addChild: token];
   [token release];
 
-  elem = [[GWSElement alloc] initWithName: @"Username"
-				namespace: ns
-				qualified: uName
-			       attributes: nil];
-  [token addChild: elem];
-  [elem release];
-  [elem addContent: _name];
-
   if (_ttl > 0)
     {
-      NSMutableDictionary	*attr;
-      NSString			*hash;
+      GWSElement	*elem;
+      NSString		*hash;
       
       [_created release];
       _created = nil;
@@ -317,42 +636,12 @@ static GWSCoder		*coder = nil;
       [_created retain];
       [_nonce retain];
 
-      attr = [[NSMutableDictionary alloc] initWithCapacity: 1];
-      [attr setObject: @"#PasswordDigest" forKey: @"Type"];
-      elem = [[GWSElement alloc] initWithName: @"Password"
-				    namespace: ns
-				    qualified: pName
-				   attributes: attr];
-      [attr release];
-      [elem addContent: hash];
-      [token addChild: elem];
-      [elem release];
-
-      elem = [[GWSElement alloc] initWithName: @"Nonce"
-				    namespace: ns
-				    qualified: nName
-				   attributes: nil];
-      [elem addContent: _nonce];
-      [token addChild: elem];
-      [elem release];
-
-      elem = [[GWSElement alloc] initWithName: @"Created"
-				    namespace: uns
-				    qualified: cName
-				   attributes: nil];
-      [elem addContent: [_created description]];
-      [token addChild: elem];
-      [elem release];
-    }
-  else
-    {
-      elem = [[GWSElement alloc] initWithName: @"Password"
-				    namespace: ns
-				    qualified: pName
-				   attributes: nil];
-      [elem addContent: _password];
-      [token addChild: elem];
-      [elem release];
+      elem = [[token firstChild] sibling];
+      [elem setContent: hash];
+      elem = [elem sibling];
+      [elem setContent: _nonce];
+      elem = [elem sibling];
+      [elem setContent: [_created description]];
     }
 
   return header;
@@ -369,6 +658,7 @@ static GWSCoder		*coder = nil;
   [_password release];
   [_created release];
   [_nonce release];
+  [(GWSElement*)_reserved release];
   [super dealloc];
 }
 
@@ -605,6 +895,268 @@ AddBlock(Ctxt *ctx, const uint8_t data[64])
   ctx->E += E;
 }
 
+/* The block functions for SHA-1 and SHA-256 are selected at runtime, so
+ * that the x86 SHA extensions are used where the processor has them.
+ */
+#if     !USE_NETTLE
+static const uint32_t	K256[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+#endif
+
+static void
+AddBlocks(Ctxt *ctx, const uint8_t *data, uint32_t blocks)
+{
+  while (blocks-- > 0)
+    {
+      AddBlock(ctx, data);
+      data += 64;
+    }
+}
+
+#if     !USE_NETTLE
+#define	ROR(X,N)	(((X) >> (N)) | ((X) << (32 - (N))))
+
+static void
+AddBlocks256(uint32_t state[8], const uint8_t *data, uint32_t blocks)
+{
+  while (blocks-- > 0)
+    {
+      uint32_t	W[64];
+      uint32_t	a, b, c, d, e, f, g, h;
+      int	i;
+
+      for (i = 0; i < 16; i++)
+	{
+	  W[i] = GetWord(data + i * 4);
+	}
+      for (i = 16; i < 64; i++)
+	{
+	  uint32_t	s0;
+	  uint32_t	s1;
+
+	  s0 = ROR(W[i-15], 7) ^ ROR(W[i-15], 18) ^ (W[i-15] >> 3);
+	  s1 = ROR(W[i-2], 17) ^ ROR(W[i-2], 19) ^ (W[i-2] >> 10);
+	  W[i] = W[i-16] + s0 + W[i-7] + s1;
+	}
+      a = state[0];
+      b = state[1];
+      c = state[2];
+      d = state[3];
+      e = state[4];
+      f = state[5];
+      g = state[6];
+      h = state[7];
+      for (i = 0; i < 64; i++)
+	{
+	  uint32_t	t1;
+	  uint32_t	t2;
+
+	  t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25))
+	    + (g ^ (e & (f ^ g))) + K256[i] + W[i];
+	  t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22))
+	    + ((a & b) | (c & (a | b)));
+	  h = g;
+	  g = f;
+	  f = e;
+	  e = d + t1;
+	  d = c;
+	  c = b;
+	  b = a;
+	  a = t1 + t2;
+	}
+      state[0] += a;
+      state[1] += b;
+      state[2] += c;
+      state[3] += d;
+      state[4] += e;
+      state[5] += f;
+      state[6] += g;
+      state[7] += h;
+      data += 64;
+    }
+}
+
+#undef	ROR
+#endif
+
+#if	HAVE_SHA_NI
+
+/* Four SHA-1 rounds using the message words in W[N & 3], which are first
+ * computed from the preceding sixteen words.
+ */
+#define	SHA1NI(N, F) \
+  if (N >= 4) \
+    { \
+      W[N & 3] = _mm_sha1msg2_epu32(_mm_xor_si128( \
+	_mm_sha1msg1_epu32(W[N & 3], W[(N + 1) & 3]), W[(N + 2) & 3]), \
+	W[(N + 3) & 3]); \
+    } \
+  E = (0 == N) ? _mm_add_epi32(E0, W[0]) : _mm_sha1nexte_epu32(P, W[N & 3]); \
+  P = ABCD; \
+  ABCD = _mm_sha1rnds4_epu32(ABCD, E, F);
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+AddBlocksNI(Ctxt *ctx, const uint8_t *data, uint32_t blocks)
+{
+  const __m128i	MASK = _mm_set_epi64x(0x0001020304050607ULL,
+    0x08090a0b0c0d0e0fULL);
+  __m128i	ABCD;
+  __m128i	ABCD_SAVE;
+  __m128i	E0;
+  __m128i	E0_SAVE;
+  __m128i	E;
+  __m128i	P;
+  __m128i	W[4];
+  int		i;
+
+  ABCD = _mm_set_epi32(ctx->A, ctx->B, ctx->C, ctx->D);
+  E0 = _mm_set_epi32(ctx->E, 0, 0, 0);
+  while (blocks-- > 0)
+    {
+      ABCD_SAVE = ABCD;
+      E0_SAVE = E0;
+      for (i = 0; i < 4; i++)
+	{
+	  W[i] = _mm_shuffle_epi8(
+	    _mm_loadu_si128((const __m128i*)(data + i * 16)), MASK);
+	}
+      SHA1NI(0, 0) SHA1NI(1, 0) SHA1NI(2, 0) SHA1NI(3, 0) SHA1NI(4, 0)
+      SHA1NI(5, 1) SHA1NI(6, 1) SHA1NI(7, 1) SHA1NI(8, 1) SHA1NI(9, 1)
+      SHA1NI(10, 2) SHA1NI(11, 2) SHA1NI(12, 2) SHA1NI(13, 2) SHA1NI(14, 2)
+      SHA1NI(15, 3) SHA1NI(16, 3) SHA1NI(17, 3) SHA1NI(18, 3) SHA1NI(19, 3)
+      E0 = _mm_sha1nexte_epu32(P, E0_SAVE);
+      ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+      data += 64;
+    }
+  ctx->A = _mm_extract_epi32(ABCD, 3);
+  ctx->B = _mm_extract_epi32(ABCD, 2);
+  ctx->C = _mm_extract_epi32(ABCD, 1);
+  ctx->D = _mm_extract_epi32(ABCD, 0);
+  ctx->E = _mm_extract_epi32(E0, 3);
+}
+
+#undef	SHA1NI
+
+#if     !USE_NETTLE
+/* Four SHA-256 rounds using the message words in W[N & 3], which are
+ * first computed from the preceding sixteen words.
+ */
+#define	SHA256NI(N) \
+  if (N >= 4) \
+    { \
+      W[N & 3] = _mm_sha256msg2_epu32(_mm_add_epi32( \
+	_mm_sha256msg1_epu32(W[N & 3], W[(N + 1) & 3]), \
+	_mm_alignr_epi8(W[(N + 3) & 3], W[(N + 2) & 3], 4)), W[(N + 3) & 3]); \
+    } \
+  M = _mm_add_epi32(W[N & 3], _mm_loadu_si128((const __m128i*)(K256 + N * 4))); \
+  S1 = _mm_sha256rnds2_epu32(S1, S0, M); \
+  S0 = _mm_sha256rnds2_epu32(S0, S1, _mm_shuffle_epi32(M, 0x0E));
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+AddBlocks256NI(uint32_t state[8], const uint8_t *data, uint32_t blocks)
+{
+  const __m128i	MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+    0x0405060700010203ULL);
+  __m128i	S0;		// ABEF
+  __m128i	S1;		// CDGH
+  __m128i	S0_SAVE;
+  __m128i	S1_SAVE;
+  __m128i	M;
+  __m128i	W[4];
+  int		i;
+
+  S0 = _mm_set_epi32(state[0], state[1], state[4], state[5]);
+  S1 = _mm_set_epi32(state[2], state[3], state[6], state[7]);
+  while (blocks-- > 0)
+    {
+      S0_SAVE = S0;
+      S1_SAVE = S1;
+      for (i = 0; i < 4; i++)
+	{
+	  W[i] = _mm_shuffle_epi8(
+	    _mm_loadu_si128((const __m128i*)(data + i * 16)), MASK);
+	}
+      SHA256NI(0) SHA256NI(1) SHA256NI(2) SHA256NI(3)
+      SHA256NI(4) SHA256NI(5) SHA256NI(6) SHA256NI(7)
+      SHA256NI(8) SHA256NI(9) SHA256NI(10) SHA256NI(11)
+      SHA256NI(12) SHA256NI(13) SHA256NI(14) SHA256NI(15)
+      S0 = _mm_add_epi32(S0, S0_SAVE);
+      S1 = _mm_add_epi32(S1, S1_SAVE);
+      data += 64;
+    }
+  state[0] = _mm_extract_epi32(S0, 3);
+  state[1] = _mm_extract_epi32(S0, 2);
+  state[4] = _mm_extract_epi32(S0, 1);
+  state[5] = _mm_extract_epi32(S0, 0);
+  state[2] = _mm_extract_epi32(S1, 3);
+  state[3] = _mm_extract_epi32(S1, 2);
+  state[6] = _mm_extract_epi32(S1, 1);
+  state[7] = _mm_extract_epi32(S1, 0);
+}
+
+#undef	SHA256NI
+#endif
+
+static BOOL
+haveSHANI(void)
+{
+  unsigned	a, b, c, d;
+
+  if (0 == __get_cpuid(1, &a, &b, &c, &d)
+    || 0 == (c & bit_SSE4_1) || 0 == (c & bit_SSSE3))
+    {
+      return NO;
+    }
+  if (0 == __get_cpuid_count(7, 0, &a, &b, &c, &d) || 0 == (b & (1 << 29)))
+    {
+      return NO;
+    }
+  return YES;
+}
+
+#endif	/* HAVE_SHA_NI */
+
+static void	(*SHA1Blocks)(Ctxt*, const uint8_t*, uint32_t) = 0;
+#if     !USE_NETTLE
+static void	(*SHA256Blocks)(uint32_t*, const uint8_t*, uint32_t) = 0;
+#endif
+
+static void
+SelectBlocks(void)
+{
+  SHA1Blocks = AddBlocks;
+#if     !USE_NETTLE
+  SHA256Blocks = AddBlocks256;
+#endif
+#if	HAVE_SHA_NI
+  if (YES == haveSHANI())
+    {
+      SHA1Blocks = AddBlocksNI;
+#if     !USE_NETTLE
+      SHA256Blocks = AddBlocks256NI;
+#endif
+    }
+#endif
+}
+
 static void
 AddBytes(Ctxt *ctx, const uint8_t *input, uint32_t length)
 {
@@ -625,17 +1177,17 @@ AddBytes(Ctxt *ctx, const uint8_t *input, uint32_t length)
       if (left > 0 && length >= fill)
         {
           memcpy(ctx->T + left, input, fill);
-          AddBlock(ctx, ctx->T);
+          (*SHA1Blocks)(ctx, ctx->T, 1);
           input += fill;
           length -= fill;
           left = 0;
         }
 
-      while (length >= 64)
+      if (length >= 64)
         {
-          AddBlock(ctx, input);
-          input += 64;
-          length -= 64;
+          (*SHA1Blocks)(ctx, input, length / 64);
+          input += length & ~0x3F;
+          length &= 0x3F;
         }
 
       if (length > 0)
@@ -686,11 +1238,251 @@ Digest(Ctxt *ctx, uint8_t output[20])
 }
 
 
+#if     !USE_NETTLE
+typedef struct
+{
+  uint32_t S[8];
+  uint32_t L;           // Low order byte count
+  uint32_t H;           // High order byte count
+  uint8_t T[64];        // Temporary buffer
+} Ctxt256;
+
+static void
+Initialize256(Ctxt256 *ctx)
+{
+  ctx->L = 0;
+  ctx->H = 0;
+  ctx->S[0] = 0x6a09e667;
+  ctx->S[1] = 0xbb67ae85;
+  ctx->S[2] = 0x3c6ef372;
+  ctx->S[3] = 0xa54ff53a;
+  ctx->S[4] = 0x510e527f;
+  ctx->S[5] = 0x9b05688c;
+  ctx->S[6] = 0x1f83d9ab;
+  ctx->S[7] = 0x5be0cd19;
+}
+
+static void
+AddBytes256(Ctxt256 *ctx, const uint8_t *input, uint32_t length)
+{
+  if (length > 0)
+    {
+      uint32_t  fill;
+      uint32_t  left;
+
+      left = ctx->L & 0x3F;
+      fill = 64 - left;
+
+      ctx->L += length;
+      if (ctx->L < length)
+        {
+          ctx->H++;
+        }
+
+      if (left > 0 && length >= fill)
+        {
+          memcpy(ctx->T + left, input, fill);
+          (*SHA256Blocks)(ctx->S, ctx->T, 1);
+          input += fill;
+          length -= fill;
+          left = 0;
+        }
+
+      if (length >= 64)
+        {
+          (*SHA256Blocks)(ctx->S, input, length / 64);
+          input += length & ~0x3F;
+          length &= 0x3F;
+        }
+
+      if (length > 0)
+        {
+          memcpy(ctx->T + left, input, length);
+        }
+    }
+}
+
+static void
+Digest256(Ctxt256 *ctx, uint8_t output[32])
+{
+  uint8_t	padding[72];
+  uint32_t	last;
+  uint32_t	padn;
+  int		i;
+
+  /* Pad with a single set bit and zeros to eight bytes short of the
+   * block length, then add the length of the data in *bits* in big
+   * endian order.
+   */
+  last = ctx->L & 0x3F;
+  padn = (last < 56) ? (56 - last) : (120 - last);
+  memset(padding, 0, padn);
+  padding[0] = 0x80;
+  PutWord((ctx->L >> 29) | (ctx->H << 3), padding + padn);
+  PutWord(ctx->L << 3, padding + padn + 4);
+  AddBytes256(ctx, padding, padn + 8);
+
+  for (i = 0; i < 8; i++)
+    {
+      PutWord(ctx->S[i], output + i * 4);
+    }
+}
+#endif
+
+typedef union {
+  Ctxt			sha1;
+#if     USE_NETTLE
+  struct sha256_ctx	sha256;
+  struct sha512_ctx	sha512;
+#else
+  Ctxt256		sha256;
+#endif
+} DigestCtxt;
+
+/* Make sure the union fits in the public context structure.
+ */
+typedef char	digestCtxtSizeCheck[(sizeof(DigestCtxt)
+  <= sizeof(((GWSDigestContext*)0)->ctx)) ? 1 : -1];
+
+unsigned
+GWSDigestBlockSize(GWSDigestAlgorithm algorithm)
+{
+  switch (algorithm)
+    {
+      case GWSDigestSHA1: return 64;
+      case GWSDigestSHA2_256: return 64;
+#if     USE_NETTLE
+      case GWSDigestSHA2_512: return 128;
+#endif
+      default: return 0;
+    }
+}
+
+BOOL
+GWSDigestInit(GWSDigestContext *c, GWSDigestAlgorithm algorithm)
+{
+  DigestCtxt	*d = (DigestCtxt*)c->ctx;
+
+  if (0 == SHA1Blocks)
+    {
+      SelectBlocks();
+    }
+  c->algorithm = algorithm;
+  switch (algorithm)
+    {
+      case GWSDigestSHA1:
+	Initialize(&d->sha1);
+	return YES;
+#if     USE_NETTLE
+      case GWSDigestSHA2_256:
+	sha256_init(&d->sha256);
+	return YES;
+      case GWSDigestSHA2_512:
+	sha512_init(&d->sha512);
+	return YES;
+#else
+      case GWSDigestSHA2_256:
+	Initialize256(&d->sha256);
+	return YES;
+#endif
+      default:
+	return NO;
+    }
+}
+
+void
+GWSDigestUpdate(GWSDigestContext *c, const void *bytes, NSUInteger length)
+{
+  DigestCtxt	*d = (DigestCtxt*)c->ctx;
+  const uint8_t	*b = (const uint8_t*)bytes;
+
+  while (length > 0)
+    {
+      uint32_t	n = (length > 0x40000000) ? 0x40000000 : (uint32_t)length;
+
+      switch (c->algorithm)
+	{
+	  case GWSDigestSHA1: AddBytes(&d->sha1, b, n); break;
+#if     USE_NETTLE
+	  case GWSDigestSHA2_256: sha256_update(&d->sha256, n, b); break;
+	  case GWSDigestSHA2_512: sha512_update(&d->sha512, n, b); break;
+#else
+	  case GWSDigestSHA2_256: AddBytes256(&d->sha256, b, n); break;
+#endif
+	  default: break;
+	}
+      b += n;
+      length -= n;
+    }
+}
+
+unsigned
+GWSDigestFinal(GWSDigestContext *c, uint8_t *output)
+{
+  DigestCtxt	*d = (DigestCtxt*)c->ctx;
+
+  switch (c->algorithm)
+    {
+      case GWSDigestSHA1:
+	Digest(&d->sha1, output);
+	return 20;
+#if     USE_NETTLE
+      case GWSDigestSHA2_256:
+	sha256_digest(&d->sha256, 32, output);
+	return 32;
+      case GWSDigestSHA2_512:
+	sha512_digest(&d->sha512, 64, output);
+	return 64;
+#else
+      case GWSDigestSHA2_256:
+	Digest256(&d->sha256, output);
+	return 32;
+#endif
+      default:
+	return 0;
+    }
+}
+
+/* Produce a digest of the bytes in the output buffer (which must have
+ * space for 64 bytes) and return its length, or zero if the algorithm is
+ * not supported.  This avoids creating any objects for the common cases.
+ */
+static unsigned
+digestBytes(GWSDigestAlgorithm algorithm,
+  const uint8_t *bytes, unsigned length, uint8_t *output)
+{
+  GWSDigestContext	ctx;
+  NSData		*data;
+  NSData		*hash;
+
+  if (YES == GWSDigestInit(&ctx, algorithm))
+    {
+      GWSDigestUpdate(&ctx, bytes, length);
+      return GWSDigestFinal(&ctx, output);
+    }
+  data = [[NSData alloc] initWithBytesNoCopy: (void*)bytes
+				      length: length
+				freeWhenDone: NO];
+  switch (algorithm)
+    {
+      case GWSDigestSHA3_256: hash = [data SHA3_256]; break;
+      case GWSDigestSHA3_512: hash = [data SHA3_512]; break;
+      default: hash = nil; break;
+    }
+  [data release];
+  memcpy(output, [hash bytes], [hash length]);
+  return [hash length];
+}
+
 - (NSData*) SHA1
 {
   Ctxt		ctx;
   uint8_t	output[20];
 
+  if (0 == SHA1Blocks)
+    {
+      SelectBlocks();
+    }
   Initialize(&ctx);
   AddBytes(&ctx, [self bytes], [self length]);
   Digest(&ctx, output);
@@ -745,7 +1537,17 @@ Digest(Ctxt *ctx, uint8_t output[20])
 #else
 - (NSData*) SHA2_256
 {
-  return nil;
+  Ctxt256	ctx;
+  uint8_t	output[32];
+
+  if (0 == SHA256Blocks)
+    {
+      SelectBlocks();
+    }
+  Initialize256(&ctx);
+  AddBytes256(&ctx, [self bytes], [self length]);
+  Digest256(&ctx, output);
+  return [NSData dataWithBytes: output length: 32];
 }
 - (NSData*) SHA2_512
 {
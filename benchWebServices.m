@@ -0,0 +1,877 @@
+/**
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   Date:	October 2026
+
+   This file is part of the WebServices package.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA.
+
+   */
+
+#import	<Foundation/Foundation.h>
+#import	"GWSPrivate.h"
+#import	"GWSHash.h"
+#import	"WSSUsernameToken.h"
+#import	"testServer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double
+now(void)
+{
+#if	defined(__MINGW__)
+  return [NSDate timeIntervalSinceReferenceDate];
+#else
+  struct timespec	ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+}
+
+/* Return the total number of objects allocated so far (if the base
+ * library can count them) so that we can report allocations per message.
+ */
+static unsigned long long
+allocations(void)
+{
+  unsigned long long	total = 0;
+#if	defined(GNUSTEP)
+  const Class		*classes = GSDebugAllocationClassList();
+
+  while (classes != 0 && *classes != 0)
+    {
+      total += GSDebugAllocationTotal(*classes++);
+    }
+#endif
+  return total;
+}
+
+static int
+compareDoubles(const void *a, const void *b)
+{
+  double	x = *(const double*)a;
+  double	y = *(const double*)b;
+
+  return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+/* Return the value at the given fraction of the sorted samples, using
+ * the nearest rank (the fraction of the count rounded up, at least one).
+ */
+static double
+percentile(double *samples, unsigned count, double fraction)
+{
+  unsigned	rank;
+
+  if (0 == count)
+    {
+      return 0.0;
+    }
+  rank = (unsigned)ceil(fraction * count);
+  if (rank < 1)
+    {
+      rank = 1;
+    }
+  if (rank > count)
+    {
+      rank = count;
+    }
+  return samples[rank - 1];
+}
+
+/* Generate parameters of the requested shape containing size values.
+ * Flat is a dictionary of strings and numbers, Array is a single
+ * array of small structures, and Nested is a tree of dictionaries
+ * with four branches at each level.
+ */
+static id
+nested(unsigned *remaining, unsigned depth)
+{
+  NSMutableDictionary	*d = [NSMutableDictionary dictionaryWithCapacity: 4];
+  unsigned		i;
+
+  for (i = 0; i < 4 && *remaining > 0; i++)
+    {
+      NSString	*k = [NSString stringWithFormat: @"n%u", i];
+
+      if (depth > 0 && *remaining > 4)
+	{
+	  [d setObject: nested(remaining, depth - 1) forKey: k];
+	}
+      else
+	{
+	  [d setObject: [NSString stringWithFormat: @"leaf value %u",
+	    (*remaining)--] forKey: k];
+	}
+    }
+  return d;
+}
+
+static NSMutableDictionary*
+payload(NSString *shape, unsigned size)
+{
+  NSMutableDictionary	*p;
+  unsigned		i;
+
+  p = [NSMutableDictionary dictionaryWithCapacity: size + 1];
+  if ([shape caseInsensitiveCompare: @"Array"] == NSOrderedSame)
+    {
+      NSMutableArray	*a = [NSMutableArray arrayWithCapacity: size];
+
+      for (i = 0; i < size; i++)
+	{
+	  [a addObject: [NSDictionary dictionaryWithObjectsAndKeys:
+	    [NSString stringWithFormat: @"item %u", i], @"name",
+	    [NSNumber numberWithUnsignedInt: i], @"id",
+	    nil]];
+	}
+      [p setObject: a forKey: @"items"];
+    }
+  else if ([shape caseInsensitiveCompare: @"Nested"] == NSOrderedSame)
+    {
+      unsigned	remaining = size;
+      unsigned	depth = 0;
+
+      for (i = size; i > 4; i /= 4)
+	{
+	  depth++;
+	}
+      [p setObject: nested(&remaining, depth) forKey: @"tree"];
+    }
+  else
+    {
+      for (i = 0; i < size; i++)
+	{
+	  NSString	*k = [NSString stringWithFormat: @"k%04u", i];
+
+	  if (i % 2)
+	    {
+	      [p setObject: [NSNumber numberWithUnsignedInt: i] forKey: k];
+	    }
+	  else
+	    {
+	      [p setObject: [NSString stringWithFormat: @"value <%u> & more",
+		i] forKey: k];
+	    }
+	}
+    }
+  [p setObject: [[p allKeys] sortedArrayUsingSelector: @selector(compare:)]
+	forKey: GWSOrderKey];
+  return p;
+}
+
+/* Report the rate for a measurement.  The data rate and allocations per
+ * message are only reported if they were measured (are non-zero).
+ */
+static void
+report(NSString *name, unsigned count, double elapsed,
+  unsigned long long bytes, unsigned long long allocs)
+{
+  GSPrintf(stdout, @"%-28@ %8u msgs %10.0f msgs/s",
+    name, count, count / elapsed);
+  if (bytes > 0)
+    {
+      GSPrintf(stdout, @" %9.2f MB/s", bytes / elapsed / 1000000.0);
+    }
+  if (allocs > 0)
+    {
+      GSPrintf(stdout, @" %9.1f allocs/msg", (double)allocs / count);
+    }
+  GSPrintf(stdout, @"\n");
+}
+
+/* Report the allocations the coder made for the last message it handled
+ * (available only if the library was built with GWS_ALLOC_STATS).
+ */
+static void
+profile(GWSCoder *coder)
+{
+  NSDictionary	*d = [[coder allocationStatistics] objectForKey: @"Last"];
+
+  if (nil != d)
+    {
+      GSPrintf(stdout, @"%28@ %@ elements, %@ strings, %@ dictionaries,"
+	@" %@ buffers (%@ bytes)\n", @"",
+	[d objectForKey: @"Elements"], [d objectForKey: @"Strings"],
+	[d objectForKey: @"Dictionaries"], [d objectForKey: @"Buffers"],
+	[d objectForKey: @"BuffersBytes"]);
+    }
+}
+
+static void
+benchCoders(NSUserDefaults *defs)
+{
+  NSString		*shape = [defs stringForKey: @"Shape"];
+  unsigned		size = [defs integerForKey: @"Size"];
+  unsigned		iterations = [defs integerForKey: @"Iterations"];
+  NSMutableDictionary	*params;
+  NSArray		*classes;
+  NSData		*soap = nil;
+  unsigned		c;
+
+  if (nil == shape) shape = @"Flat";
+  if (0 == size) size = 100;
+  if (0 == iterations) iterations = 1000;
+  params = payload(shape, size);
+  GSPrintf(stdout, @"Coders ... shape %@, size %u, %u iterations\n",
+    shape, size, iterations);
+
+  classes = [NSArray arrayWithObjects: [GWSSOAPCoder class],
+    [GWSXMLRPCCoder class], [GWSJSONCoder class], nil];
+  for (c = 0; c < [classes count]; c++)
+    {
+      Class			cls = [classes objectAtIndex: c];
+      GWSCoder			*coder = [cls coder];
+      NSData			*data;
+      unsigned long long	allocs;
+      double			start;
+      unsigned			i;
+
+      data = [coder buildRequest: @"bench" parameters: params order: nil];
+      if (nil == data)
+	{
+	  GSPrintf(stdout, @"%@ failed to encode\n", cls);
+	  continue;
+	}
+      if (cls == [GWSSOAPCoder class])
+	{
+	  soap = data;
+	}
+
+      allocs = allocations();
+      start = now();
+      for (i = 0; i < iterations; i++)
+	{
+	  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+	  [coder buildRequest: @"bench" parameters: params order: nil];
+	  [arp release];
+	}
+      report([NSString stringWithFormat: @"%@ encode", cls],
+	iterations, now() - start, (unsigned long long)[data length]
+	* iterations, allocations() - allocs);
+      profile(coder);
+
+      allocs = allocations();
+      start = now();
+      for (i = 0; i < iterations; i++)
+	{
+	  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+	  [coder parseMessage: data];
+	  [arp release];
+	}
+      report([NSString stringWithFormat: @"%@ decode", cls],
+	iterations, now() - start, (unsigned long long)[data length]
+	* iterations, allocations() - allocs);
+      profile(coder);
+    }
+
+  if (nil != soap)
+    {
+      GWSCoder			*coder = [GWSCoder coder];
+      unsigned long long	allocs;
+      double			start;
+      unsigned			i;
+
+      allocs = allocations();
+      start = now();
+      for (i = 0; i < iterations; i++)
+	{
+	  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+	  [coder parseXML: soap];
+	  [arp release];
+	}
+      report(@"GWSCoder parseXML:", iterations, now() - start,
+	(unsigned long long)[soap length] * iterations,
+	allocations() - allocs);
+    }
+}
+
+static void
+benchHash(NSUserDefaults *defs)
+{
+  static NSString	*digests[] = { @"SHA1", @"SHA2_256", @"SHA2_512",
+    @"SHA3_256", @"SHA3_512" };
+  static unsigned	sizes[] = { 64, 1024, 64 * 1024, 1024 * 1024 };
+  static unsigned	jsonSizes[] = { 1024, 64 * 1024, 1024 * 1024,
+    50 * 1024 * 1024 };
+  unsigned		iterations = [defs integerForKey: @"Iterations"];
+  NSMutableData		*big = [NSMutableData dataWithLength: 1024 * 1024];
+  NSData		*small;
+  NSData		*key;
+  GWSHMACKey		*hk;
+  NSArray		*algorithms;
+  NSMutableArray	*passwords;
+  NSMutableDictionary	*params;
+  double		start;
+  unsigned		a;
+  unsigned		i;
+
+  if (0 == iterations) iterations = 1000;
+  GSPrintf(stdout, @"Hashes ... %u iterations\n", iterations);
+  [GWSHash salt: [big mutableBytes] size: [big length]];
+  small = [big subdataWithRange: NSMakeRange(0, 256)];
+  key = [big subdataWithRange: NSMakeRange(256, 32)];
+
+  algorithms = [NSArray arrayWithObjects: @"SHA", @"SHA-256", nil];
+  for (a = 0; a < [algorithms count]; a++)
+    {
+      NSString	*alg = [algorithms objectAtIndex: a];
+
+      start = now();
+      for (i = 0; i < iterations / 10 + 1; i++)
+	{
+	  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+	  [GWSHash computeDigest: alg from: big];
+	  [arp release];
+	}
+      report([NSString stringWithFormat: @"%@ digest 1MB", alg],
+	iterations / 10 + 1, now() - start,
+	(unsigned long long)[big length] * (iterations / 10 + 1), 0);
+
+      start = now();
+      for (i = 0; i < iterations * 10; i++)
+	{
+	  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+	  [GWSHash computeDigest: alg from: small];
+	  [arp release];
+	}
+      report([NSString stringWithFormat: @"%@ digest 256B", alg],
+	iterations * 10, now() - start,
+	(unsigned long long)[small length] * iterations * 10, 0);
+
+      start = now();
+      for (i = 0; i < iterations * 10; i++)
+	{
+	  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+	  [GWSHash computeHMAC: alg from: small key: key];
+	  [arp release];
+	}
+      report([NSString stringWithFormat: @"%@ HMAC data key", alg],
+	iterations * 10, now() - start,
+	(unsigned long long)[small length] * iterations * 10, 0);
+
+      hk = [GWSHMACKey keyWithAlgorithm: alg key: key];
+      start = now();
+      for (i = 0; i < iterations * 10; i++)
+	{
+	  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+	  [hk computeHMACFrom: small];
+	  [arp release];
+	}
+      report([NSString stringWithFormat: @"%@ HMAC GWSHMACKey", alg],
+	iterations * 10, now() - start,
+	(unsigned long long)[small length] * iterations * 10, 0);
+    }
+
+  /* Time the NSData digest methods (which use the SHA extensions where
+   * the CPU has them) over a range of input sizes, keeping the amount
+   * of data hashed about the same for each size.
+   */
+  for (a = 0; a < sizeof(digests) / sizeof(*digests); a++)
+    {
+      SEL	sel = NSSelectorFromString(digests[a]);
+      unsigned	s;
+
+      if (nil == [small performSelector: sel])
+	{
+	  GSPrintf(stdout, @"%-28@ not available\n", digests[a]);
+	  continue;
+	}
+      for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++)
+	{
+	  NSData	*d = [big subdataWithRange: NSMakeRange(0, sizes[s])];
+	  unsigned	count;
+
+	  count = (unsigned)(((unsigned long long)iterations * 64 * 1024)
+	    / sizes[s]);
+	  if (0 == count) count = 1;
+	  start = now();
+	  for (i = 0; i < count; i++)
+	    {
+	      NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+	      [d performSelector: sel];
+	      [arp release];
+	    }
+	  report([NSString stringWithFormat: @"%@ %uB", digests[a], sizes[s]],
+	    count, now() - start, (unsigned long long)sizes[s] * count, 0);
+	}
+    }
+
+  /* Hash parameters whose JSON text ranges from about 1KB to 50MB,
+   * keeping the amount of data hashed about the same for each size.
+   */
+  for (a = 0; a < sizeof(jsonSizes) / sizeof(*jsonSizes); a++)
+    {
+      NSAutoreleasePool		*outer = [NSAutoreleasePool new];
+      unsigned long long	bytes;
+      unsigned			count;
+
+      params = payload(@"Flat", jsonSizes[a] / 30);
+      bytes = [[params JSONText] length];
+      count = (unsigned)(((unsigned long long)iterations * 64 * 1024) / bytes);
+      if (0 == count) count = 1;
+      start = now();
+      for (i = 0; i < count; i++)
+	{
+	  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+	  [GWSHash hashWithAlgorithm: @"SHA-256"
+			      method: @"bench"
+			  parameters: params
+			       order: nil
+			       extra: @"secret"
+			      asHMAC: NO];
+	  [arp release];
+	}
+      report([NSString stringWithFormat: @"GWSHash parameters %lluKB",
+	bytes / 1024], count, now() - start, bytes * count, 0);
+      [outer release];
+    }
+
+  passwords = [NSMutableArray arrayWithCapacity: iterations];
+  for (i = 0; i < iterations; i++)
+    {
+      [passwords addObject: [NSString stringWithFormat: @"password%u", i]];
+    }
+  start = now();
+  for (i = 0; i < iterations; i++)
+    {
+      NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+      NSCalendarDate	*date = nil;
+      NSString		*nonce = nil;
+
+      [WSSUsernameToken digestHashForPassword: [passwords objectAtIndex: i]
+				 andTimestamp: &date
+				    withNonce: &nonce];
+      [arp release];
+    }
+  report(@"UsernameToken digest", iterations, now() - start, 0, 0);
+  start = now();
+  [WSSUsernameToken digestHashesForPasswords: passwords
+			       andTimestamps: 0
+				  withNonces: 0
+				   algorithm: GWSDigestSHA1];
+  report(@"UsernameToken batch", iterations, now() - start, 0, 0);
+  start = now();
+  [WSSUsernameToken digestsForPasswords: passwords
+			  andTimestamps: 0
+			     withNonces: 0
+			      algorithm: GWSDigestSHA1];
+  report(@"UsernameToken batch data", iterations, now() - start, 0, 0);
+}
+
+static void
+benchWSDL(NSUserDefaults *defs)
+{
+  NSString		*file = [defs stringForKey: @"WSDL"];
+  NSString		*sName = [defs stringForKey: @"Service"];
+  NSString		*method = [defs stringForKey: @"Method"];
+  NSString		*snap;
+  unsigned		iterations = [defs integerForKey: @"Iterations"];
+  NSDictionary		*params;
+  GWSDocument		*document;
+  GWSService		*service;
+  double		start;
+  unsigned		i;
+
+  if (nil == file)
+    {
+      GSPrintf(stdout, @"WSDL ... skipped (no -WSDL file given)\n");
+      return;
+    }
+  if (0 == iterations) iterations = 1000;
+  GSPrintf(stdout, @"WSDL ... %@, %u iterations\n", file, iterations);
+
+  start = now();
+  for (i = 0; i < iterations / 10 + 1; i++)
+    {
+      NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+      [[[GWSDocument alloc] initWithContentsOfFile: file] release];
+      [arp release];
+    }
+  report(@"GWSDocument parse", iterations / 10 + 1, now() - start, 0, 0);
+
+  snap = [NSTemporaryDirectory() stringByAppendingPathComponent:
+    [NSString stringWithFormat: @"benchWebServices%d.snapshot",
+    [[NSProcessInfo processInfo] processIdentifier]]];
+  [[[GWSDocument alloc] initWithContentsOfFile: file snapshot: snap] release];
+  start = now();
+  for (i = 0; i < iterations / 10 + 1; i++)
+    {
+      NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+      [[[GWSDocument alloc] initWithContentsOfFile: file snapshot: snap]
+	release];
+      [arp release];
+    }
+  report(@"GWSDocument snapshot", iterations / 10 + 1, now() - start, 0, 0);
+  [[NSFileManager defaultManager] removeFileAtPath: snap handler: nil];
+
+  if (nil == sName || nil == method)
+    {
+      return;
+    }
+  document = [[[GWSDocument alloc] initWithContentsOfFile: file] autorelease];
+  service = [document serviceWithName: sName create: NO];
+  params = [NSDictionary dictionaryWithContentsOfFile:
+    [defs stringForKey: @"Parameters"]];
+  if (nil == params)
+    {
+      params = [NSDictionary dictionary];
+    }
+  start = now();
+  for (i = 0; i < iterations; i++)
+    {
+      NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+
+      [service buildRequest: method parameters: params order: nil];
+      [arp release];
+    }
+  report([NSString stringWithFormat: @"%@ buildRequest", method],
+    iterations, now() - start, 0, 0);
+}
+
+#if	!defined(__MINGW__)
+
+/* Each client keeps one RPC in progress until the required number of
+ * requests have been sent, recording the latency of each.  A request
+ * which fails to start is counted as done (and failed) at once, so
+ * busy is the number of clients with an RPC in progress.
+ */
+static double		*latencies = 0;
+static unsigned		sent = 0;
+static unsigned		done = 0;
+static unsigned		failed = 0;
+static unsigned		wanted = 0;
+static unsigned		busy = 0;
+
+@interface	BenchClient : NSObject
+{
+  GWSService		*service;
+  NSDictionary		*params;
+  double		start;
+}
+- (id) initWithURL: (NSString*)url
+	parameters: (NSDictionary*)p
+	  compress: (BOOL)compress;
+- (void) send;
+@end
+
+@implementation	BenchClient
+- (void) completedRPC: (GWSService*)sender
+{
+  if ([[sender result] objectForKey: GWSErrorKey] != nil)
+    {
+      failed++;
+    }
+  latencies[done++] = now() - start;
+  busy--;
+  [self send];
+}
+
+- (void) dealloc
+{
+  [service setDelegate: nil];
+  [service release];
+  [params release];
+  [super dealloc];
+}
+
+- (id) initWithURL: (NSString*)url
+	parameters: (NSDictionary*)p
+	  compress: (BOOL)compress
+{
+  if ((self = [super init]) != nil)
+    {
+      service = [GWSService new];
+      [service setURL: url];
+      [service setCoder: [GWSXMLRPCCoder coder]];
+      [service setDelegate: self];
+      if (YES == compress)
+	{
+	  [service setCompressRequests: 1024];
+	  [service setCompressResponses: YES];
+	}
+      params = [p retain];
+    }
+  return self;
+}
+
+- (void) send
+{
+  while (sent < wanted)
+    {
+      sent++;
+      start = now();
+      if (YES == [service sendRequest: @"bench"
+			   parameters: params
+				order: nil
+			      timeout: 30])
+	{
+	  busy++;
+	  return;
+	}
+      failed++;
+      latencies[done++] = now() - start;
+    }
+}
+@end
+
+/* Send the requests using the given number of clients (each with one
+ * RPC in progress at a time) and report the request rate and latencies.
+ */
+static void
+runClients(NSString *label, NSString *url, NSDictionary *params,
+  unsigned concurrency, unsigned requests, BOOL compress)
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSMutableArray	*clients;
+  double		elapsed;
+  unsigned		i;
+
+  [GWSService setPool: concurrency + 1];
+  [GWSService setPerHostPool: concurrency];
+  [GWSService setPerHostQMax: concurrency * 2];
+  [GWSService setQMax: concurrency * 2];
+  latencies = malloc(sizeof(double) * requests);
+  sent = done = failed = busy = 0;
+  wanted = requests;
+  clients = [NSMutableArray arrayWithCapacity: concurrency];
+  for (i = 0; i < concurrency; i++)
+    {
+      BenchClient	*c = [[BenchClient alloc] initWithURL: url
+					       parameters: params
+						 compress: compress];
+
+      [clients addObject: c];
+      [c release];
+    }
+  elapsed = now();
+  [clients makeObjectsPerformSelector: @selector(send)];
+  while (done < wanted && busy > 0)
+    {
+      NSAutoreleasePool	*inner = [NSAutoreleasePool new];
+
+      [[NSRunLoop currentRunLoop] runMode: NSDefaultRunLoopMode
+			       beforeDate: [NSDate dateWithTimeIntervalSinceNow: 0.1]];
+      [inner release];
+    }
+  elapsed = now() - elapsed;
+  qsort(latencies, done, sizeof(double), compareDoubles);
+  GSPrintf(stdout, @"%@ %4u %8.0f req/s  p50 %.3fms  p90 %.3fms"
+    @"  p99 %.3fms  p999 %.3fms  max %.3fms  failed %u\n",
+    label, concurrency, done / elapsed,
+    percentile(latencies, done, 0.5) * 1000.0,
+    percentile(latencies, done, 0.9) * 1000.0,
+    percentile(latencies, done, 0.99) * 1000.0,
+    percentile(latencies, done, 0.999) * 1000.0,
+    percentile(latencies, done, 1.0) * 1000.0, failed);
+  free(latencies);
+  latencies = 0;
+  [arp release];
+}
+
+static void
+benchService(NSUserDefaults *defs)
+{
+  NSString		*shape = [defs stringForKey: @"Shape"];
+  unsigned		size = [defs integerForKey: @"Size"];
+  unsigned		requests = [defs integerForKey: @"Requests"];
+  NSString		*levels = [defs stringForKey: @"Concurrency"];
+  NSEnumerator		*e;
+  NSString		*level;
+  NSMutableDictionary	*params;
+  NSData		*body;
+  NSString		*url;
+  int			port;
+
+  if (nil == shape) shape = @"Flat";
+  if (0 == size) size = 100;
+  if (0 == requests) requests = 2000;
+  if (nil == levels) levels = @"1,8,32";
+  params = payload(shape, size);
+  body = [[GWSXMLRPCCoder coder] buildResponse: @"bench"
+				    parameters: params
+					 order: nil];
+  if (0 == (port = testServerStart(body)))
+    {
+      GSPrintf(stdout, @"Service ... unable to start loopback server\n");
+      return;
+    }
+  url = [NSString stringWithFormat: @"http://127.0.0.1:%d/", port];
+  GSPrintf(stdout, @"Service ... shape %@, size %u, %u requests to %@\n",
+    shape, size, requests, url);
+
+  e = [[levels componentsSeparatedByString: @","] objectEnumerator];
+  while ((level = [e nextObject]) != nil)
+    {
+      unsigned	concurrency = [level intValue];
+
+      if (concurrency > 0)
+	{
+	  runClients(@"concurrency", url, params, concurrency, requests, NO);
+	}
+    }
+}
+
+/* Compare end-to-end latency with and without compression for large
+ * payloads, over a loopback server simulating a link of limited
+ * bandwidth (per connection).
+ */
+static void
+benchCompression(NSUserDefaults *defs)
+{
+  NSString		*shape = [defs stringForKey: @"Shape"];
+  unsigned		size = [defs integerForKey: @"Size"];
+  unsigned		requests = [defs integerForKey: @"Requests"];
+  unsigned		rate = [defs integerForKey: @"Bandwidth"];
+  NSString		*levels = [defs stringForKey: @"Concurrency"];
+  NSEnumerator		*e;
+  NSString		*level;
+  NSMutableDictionary	*params;
+  NSData		*req;
+  NSData		*body;
+  NSString		*url;
+  int			port;
+
+  if (nil == shape) shape = @"Array";
+  if (0 == size) size = 5000;
+  if (0 == requests) requests = 200;
+  if (0 == rate) rate = 1000000;
+  if (nil == levels) levels = @"1,8";
+  params = payload(shape, size);
+  req = [[GWSXMLRPCCoder coder] buildRequest: @"bench"
+				  parameters: params
+				       order: nil];
+  body = [[GWSXMLRPCCoder coder] buildResponse: @"bench"
+				    parameters: params
+					 order: nil];
+  if (nil == GWSGzip(body))
+    {
+      GSPrintf(stdout, @"Compression ... not available (no zlib)\n");
+      return;
+    }
+  testServerSetBandwidth(rate);
+  if (0 == (port = testServerStart(body)))
+    {
+      GSPrintf(stdout, @"Compression ... unable to start loopback server\n");
+      testServerSetBandwidth(0);
+      return;
+    }
+  url = [NSString stringWithFormat: @"http://127.0.0.1:%d/", port];
+  GSPrintf(stdout, @"Compression ... shape %@, size %u, %u requests to %@"
+    @" at %u bytes/s\n", shape, size, requests, url, rate);
+  GSPrintf(stdout, @"request %u bytes (%u gzipped)"
+    @"  response %u bytes (%u gzipped)\n",
+    (unsigned)[req length], (unsigned)[GWSGzip(req) length],
+    (unsigned)[body length], (unsigned)[GWSGzip(body) length]);
+
+  e = [[levels componentsSeparatedByString: @","] objectEnumerator];
+  while ((level = [e nextObject]) != nil)
+    {
+      unsigned	concurrency = [level intValue];
+
+      if (concurrency > 0)
+	{
+	  runClients(@"plain      ", url, params, concurrency, requests, NO);
+	  runClients(@"compressed ", url, params, concurrency, requests, YES);
+	}
+    }
+  testServerSetBandwidth(0);
+}
+
+#else
+
+static void
+benchService(NSUserDefaults *defs)
+{
+  GSPrintf(stdout, @"Service ... not supported on this platform\n");
+}
+
+static void
+benchCompression(NSUserDefaults *defs)
+{
+  GSPrintf(stdout, @"Compression ... not supported on this platform\n");
+}
+
+#endif
+
+int
+main()
+{
+  NSAutoreleasePool     *pool;
+  NSUserDefaults	*defs;
+  NSString		*mode;
+
+  pool = [NSAutoreleasePool new];
+  defs = [NSUserDefaults standardUserDefaults];
+  mode = [defs stringForKey: @"Mode"];
+  if (nil == mode)
+    {
+      GSPrintf(stderr, @"Usage ... benchWebServices -Mode name\n");
+      GSPrintf(stderr, @"  where name is Coders, Hash, WSDL, Service,"
+	@" Compression or All\n");
+      GSPrintf(stderr, @"	-Iterations count (messages per measurement)\n");
+      GSPrintf(stderr, @"	-Size count (values in generated payloads)\n");
+      GSPrintf(stderr, @"	-Shape Flat, Array or Nested (payload shape)\n");
+      GSPrintf(stderr, @"	-Requests count (per concurrency level)\n");
+      GSPrintf(stderr, @"	-Concurrency list (eg. 1,8,32)\n");
+      GSPrintf(stderr, @"	-Bandwidth bytes per second (for Compression)\n");
+      GSPrintf(stderr, @"	-WSDL filename -Service name -Method name\n");
+      GSPrintf(stderr, @"	-Parameters filename (property list)\n");
+      [pool release];
+      return 1;
+    }
+#if	defined(GNUSTEP)
+  GSDebugAllocationActive(YES);
+#endif
+
+  if ([mode isEqual: @"Coders"] || [mode isEqual: @"All"])
+    {
+      benchCoders(defs);
+    }
+  if ([mode isEqual: @"Hash"] || [mode isEqual: @"All"])
+    {
+      benchHash(defs);
+    }
+  if ([mode isEqual: @"WSDL"] || [mode isEqual: @"All"])
+    {
+      benchWSDL(defs);
+    }
+  if ([mode isEqual: @"Service"] || [mode isEqual: @"All"])
+    {
+      benchService(defs);
+    }
+  if ([mode isEqual: @"Compression"] || [mode isEqual: @"All"])
+    {
+      benchCompression(defs);
+    }
+
+  [pool release];
+  return 0;
+}
@@ -25,9 +25,23 @@
 
 #import	<Foundation/Foundation.h>
 #import	"GWSPrivate.h"
+#import	"GWSHash.h"
+#import	"WSSUsernameToken.h"
 
 static NSString *emo = @"😀😁😂🤣😃😄😅😆😉😊😋😎😍😘😗😙😚☺️🙂🤗🤩🤔🤨😐";
 
+/* An object which can not be encoded.
+ */
+@interface      GWSTestRaiser : NSObject
+@end
+@implementation GWSTestRaiser
+- (NSString*) description
+{
+  [NSException raise: NSGenericException format: @"not encodable"];
+  return nil;
+}
+@end
+
 int
 main()
 {
@@ -47,8 +61,13 @@ main()
       GWSCoder          *xml;
       GWSSOAPCoder      *soap;
       GWSElement        *elem;
+      GWSHash           *hash;
       NSCalendarDate    *now;
       NSCalendarDate    *dec;
+      NSData            *bin;
+      NSDictionary      *eager;
+      NSDictionary      *lazy;
+      NSDictionary      *params;
       NSString          *str;
 
       xml = [[GWSCoder new] autorelease];
@@ -68,6 +87,210 @@ main()
           return 1;
         }
 
+      bin = [@"hello world!!" dataUsingEncoding: NSASCIIStringEncoding];
+      if (NO == [[xml encodeBase64From: bin] isEqual: @"aGVsbG8gd29ybGQhIQ=="]
+        || NO == [[xml decodeBase64From: @"aGVsbG8g\nd29ybGQhIQ=="]
+        isEqual: bin]
+        || NO == [[xml decodeHexBinaryFrom: [xml encodeHexBinaryFrom: bin]]
+        isEqual: bin]
+        || nil != [xml decodeHexBinaryFrom: @"0a1"])
+        {
+          GSPrintf(stderr, @"Base64/hexBinary coding failure\n");
+          [pool release];
+          return 1;
+        }
+
+      str = [xml encodeBase64From: bin];
+      [xml reset];
+      {
+        NSInputStream   *s = [NSInputStream inputStreamWithData: bin];
+        BOOL            raised = NO;
+
+        [xml appendBase64FromStream: s];
+        if (NO == [[xml mutableString] isEqual: str])
+          {
+            GSPrintf(stderr, @"Base64 stream encoding failure %@\n",
+              [xml mutableString]);
+            [pool release];
+            return 1;
+          }
+        [xml reset];
+        NS_DURING
+          [xml appendBase64FromStream: s];
+        NS_HANDLER
+          raised = YES;
+        NS_ENDHANDLER
+        [xml reset];
+        if (NO == raised)
+          {
+            GSPrintf(stderr, @"Base64 stream reuse not rejected\n");
+            [pool release];
+            return 1;
+          }
+      }
+      file = [NSTemporaryDirectory()
+        stringByAppendingPathComponent: @"testGWSBase64"];
+      if (NO == [[xml decodeBase64From: str toFile: file] isEqual: bin])
+        {
+          GSPrintf(stderr, @"Base64 file decoding failure\n");
+          [[NSFileManager defaultManager] removeFileAtPath: file handler: nil];
+          [pool release];
+          return 1;
+        }
+      [[NSFileManager defaultManager] removeFileAtPath: file handler: nil];
+
+      {
+        NSFileManager   *mgr = [NSFileManager defaultManager];
+        NSString        *target;
+        NSData          *got;
+        BOOL            ok;
+
+        /* A symbolic link at the destination must be replaced rather
+         * than written through.
+         */
+        target = [file stringByAppendingString: @"Target"];
+        [mgr createFileAtPath: target contents: [NSData data] attributes: nil];
+        [mgr createSymbolicLinkAtPath: file pathContent: target];
+        got = [xml decodeBase64From: str toFile: file];
+        ok = ([got isEqual: bin]
+          && 0 == [[mgr contentsAtPath: target] length]
+          && nil == [mgr pathContentOfSymbolicLinkAtPath: file]);
+        [mgr removeFileAtPath: file handler: nil];
+        [mgr removeFileAtPath: target handler: nil];
+        if (NO == ok)
+          {
+            GSPrintf(stderr, @"Base64 file followed a link\n");
+            [pool release];
+            return 1;
+          }
+      }
+
+      {
+        NSFileManager   *mgr = [NSFileManager defaultManager];
+        NSString        *dir;
+        NSData          *got;
+        NSUInteger      left;
+
+        /* A value which fails to decode must not leave a file behind.
+         */
+        dir = [NSTemporaryDirectory()
+          stringByAppendingPathComponent: @"testGWSBase64Dir"];
+        [mgr createDirectoryAtPath: dir attributes: nil];
+        [xml setBase64FileThreshold: 4 directory: dir];
+        got = [xml _decodeBase64Value: [NSString stringWithUTF8String:
+          "QUJD\xc3\xa9REVG"]];
+        [xml setBase64FileThreshold: 0 directory: nil];
+        left = [[mgr directoryContentsAtPath: dir] count];
+        [mgr removeFileAtPath: dir handler: nil];
+        if (0 != left)
+          {
+            GSPrintf(stderr, @"Base64 file left after failure %@\n", got);
+            [pool release];
+            return 1;
+          }
+      }
+
+      if (NO == [[xml encodeHexBinaryFrom: [bin SHA1]]
+        isEqual: @"13CCCF0A41DE644625FAAD47EB59D388BC50E6C0"]
+        || NO == [[xml encodeHexBinaryFrom: [bin SHA2_256]] isEqual:
+        @"8380C4C6720E0D5CE4789BF72DF03A6E1B3ED80891F3ADBE8833C760399B8E91"])
+        {
+          GSPrintf(stderr, @"Digest failure\n");
+          [pool release];
+          return 1;
+        }
+
+      {
+        NSString        *n = @"AAECAwQFBgcICQoLDA0ODw==";
+        NSString        *t = @"2026-10-18T12:00:00Z";
+        NSArray         *nonces = [NSArray arrayWithObjects: n, n, nil];
+        NSArray         *times = [NSArray arrayWithObjects: t, t, nil];
+        NSArray         *hashes;
+        NSCalendarDate  *when;
+
+        hashes = [WSSUsernameToken
+          digestHashesForPasswords: [NSArray arrayWithObjects:
+            @"secret", @"other", nil]
+          andTimestamps: &times
+          withNonces: &nonces
+          algorithm: GWSDigestSHA2_256];
+        when = [[[NSCalendarDate alloc] initWithYear: 2026
+                                               month: 10
+                                                 day: 18
+                                                hour: 12
+                                              minute: 0
+                                              second: 0
+                                            timeZone:
+          [NSTimeZone timeZoneForSecondsFromGMT: 0]] autorelease];
+        if ([hashes count] != 2
+          || NO == [[hashes objectAtIndex: 1] isEqual:
+            [WSSUsernameToken digestHashForPassword: @"other"
+                                       andTimestamp: &when
+                                          withNonce: &n
+                                          algorithm: GWSDigestSHA2_256]])
+          {
+            GSPrintf(stderr, @"Batch digest failure\n");
+            [pool release];
+            return 1;
+          }
+        bin = [WSSUsernameToken
+          digestsForPasswords: [NSArray arrayWithObjects:
+            @"secret", @"other", nil]
+          andTimestamps: &times
+          withNonces: &nonces
+          algorithm: GWSDigestSHA2_256];
+        if ([bin length] != 64 || NO == [[hashes objectAtIndex: 1] isEqual:
+          [xml encodeBase64From: [bin subdataWithRange:
+            NSMakeRange(32, 32)]]])
+          {
+            GSPrintf(stderr, @"Batch digest data failure\n");
+            [pool release];
+            return 1;
+          }
+      }
+
+      {
+        WSSUsernameToken        *wss;
+        GWSElement              *t1;
+        GWSElement              *t2;
+
+        wss = [[[WSSUsernameToken alloc] initWithName: @"a&b"
+                                             password: @"secret"
+                                           timeToLive: 60] autorelease];
+        t1 = [[wss tree] firstChild];
+        t2 = [[wss tree] firstChild];
+        if ([t1 countChildren] != 4 || [t2 countChildren] != 4
+          || NO == [[[t1 firstChild] content] isEqual: @"a&b"]
+          || NO == [[[t2 lastChild] qualified] isEqual: @"wsu:Created"]
+          || YES == [[[t1 childAtIndex: 2] content]
+            isEqual: [[t2 childAtIndex: 2] content]])
+          {
+            GSPrintf(stderr, @"Username token template failure\n");
+            [pool release];
+            return 1;
+          }
+        /* Add a second token to the existing Security element, which
+         * uses a prefix other than the default.
+         */
+        t1 = [[[GWSElement alloc] initWithName: @"Security"
+          namespace: @"http://docs.oasis-open.org/wss/2004/01/"
+          @"oasis-200401-wss-wssecurity-secext-1.0.xsd"
+          qualified: @"s:Security" attributes: nil] autorelease];
+        [t1 setNamespace: [t1 namespace] forPrefix: @"s"];
+        t2 = [[[GWSElement alloc] initWithName: @"Header" namespace: nil
+          qualified: @"Header" attributes: nil] autorelease];
+        [t2 addChild: t1];
+        [wss addToHeader: t2];
+        t1 = [t1 firstChild];
+        if (NO == [[[t1 childAtIndex: 1] qualified] isEqual: @"s:Password"]
+          || NO == [[[t1 lastChild] qualified] isEqual: @"wsu:Created"])
+          {
+            GSPrintf(stderr, @"Username token prefix failure\n");
+            [pool release];
+            return 1;
+          }
+      }
+
       soap = [[GWSSOAPCoder new] autorelease];
       now = [NSCalendarDate date];
 
@@ -91,6 +314,503 @@ main()
           return 1;
         }
 
+      dec = [soap parseXSI: @"xsd:dateTime"
+                    string: @"2020-02-29T12:34:56.5+05:30"];
+      now = [soap parseXSI: @"xsd:dateTime"
+                    string: @"20200229T070456.500Z"];
+      if (nil == dec || NO == [dec isEqualToDate: now]
+        || NO == [[soap encodeDateTimeFrom: dec]
+        isEqual: @"2020-02-29T12:34:56+05:30"])
+        {
+          GSPrintf(stderr, @"Date parsing failure %@ %@\n", dec, now);
+          [pool release];
+          return 1;
+        }
+
+      dec = [soap parseXSI: @"xsd:dateTime" string: @"2020-1-5T1:2:3Z"];
+      now = [soap parseXSI: @"xsd:dateTime" string: @"2020-01-05T01:02:03Z"];
+      if (nil == dec || NO == [dec isEqualToDate: now]
+        || nil != [soap parseXSI: @"xsd:dateTime" string: @"2020-1-5T1:2Z"])
+        {
+          GSPrintf(stderr, @"Date single digit failure %@ %@\n", dec, now);
+          [pool release];
+          return 1;
+        }
+
+      {
+        GWSDateTime     dt;
+
+        /* Only midnight may be written as hour 24, and a negative year
+         * is not the same as a positive one.
+         */
+        dec = [soap parseXSI: @"xsd:dateTime" string: @"2020-01-04T24:00:00Z"];
+        now = [soap parseXSI: @"xsd:dateTime" string: @"2020-01-05T00:00:00Z"];
+        if (nil == dec || NO == [dec isEqualToDate: now]
+          || nil != [soap parseXSI: @"xsd:dateTime"
+                            string: @"2020-01-04T24:00:01Z"]
+          || nil != [soap parseXSI: @"xsd:dateTime"
+                            string: @"2020-01-04T24:01:00Z"]
+          || nil != [soap parseXSI: @"xsd:dateTime"
+                            string: @"2020-01-04T24:00:00.0001Z"]
+          || 1 != [soap _parseDateTime: @"-0044-03-15T12:00:00Z" into: &dt]
+          || -44 != dt.year || 3 != dt.month || 15 != dt.day)
+          {
+            GSPrintf(stderr, @"Date range failure %@ %@\n", dec, now);
+            [pool release];
+            return 1;
+          }
+      }
+
+      {
+        GWSDateTime     dt;
+        int             i;
+
+        /* Every millisecond must survive parsing and breaking down again,
+         * however the fraction is represented in the time interval.
+         */
+        for (i = 0; i < 1000; i++)
+          {
+            str = [NSString stringWithFormat:
+              @"2026-10-18T12:34:56.%03dZ", i];
+            dec = [soap parseXSI: @"xsd:dateTime" string: str];
+            [soap _breakDate: dec
+                    timeZone: [NSTimeZone timeZoneForSecondsFromGMT: 0]
+                        into: &dt];
+            if (dt.milli != i || dt.second != 56 || dt.minute != 34)
+              {
+                GSPrintf(stderr, @"Date milliseconds failure %@ %d.%03d\n",
+                  str, dt.second, dt.milli);
+                [pool release];
+                return 1;
+              }
+          }
+      }
+
+      str = @"<Envelope><Header><Token>abc</Token></Header>"
+        @"<Body><get><a>1</a><b>2</b><b>3</b></get></Body></Envelope>";
+      [soap setLazyBody: YES];
+      lazy = [soap parseMessage: [str dataUsingEncoding: NSUTF8StringEncoding]];
+      [soap setLazyBody: NO];
+      eager = [soap parseMessage: [str dataUsingEncoding: NSUTF8StringEncoding]];
+      if (NO == [[[lazy objectForKey: GWSSOAPMessageHeadersKey]
+        objectForKey: @"Token"] isEqual: @"abc"]
+        || NO == [[lazy objectForKey: GWSMethodKey] isEqual: @"get"])
+        {
+          GSPrintf(stderr, @"Lazy header decoding failure %@\n", lazy);
+          [pool release];
+          return 1;
+        }
+      if (NO == [[lazy objectForKey: GWSParametersKey]
+        isEqual: [eager objectForKey: GWSParametersKey]]
+        || NO == [[lazy objectForKey: GWSOrderKey]
+        isEqual: [eager objectForKey: GWSOrderKey]])
+        {
+          GSPrintf(stderr, @"Lazy body decoding failure %@ %@\n", lazy, eager);
+          [pool release];
+          return 1;
+        }
+
+      soap = [GWSSOAPCoder borrowCoder];
+      [soap returnCoder];
+      if (soap != [GWSSOAPCoder borrowCoder]
+        || NO == [[soap mutableString] isEqual: @""])
+        {
+          GSPrintf(stderr, @"Coder pool failure\n");
+          [pool release];
+          return 1;
+        }
+      [soap returnCoder];
+
+      soap = [GWSSOAPCoder borrowCoder];
+      [soap setLazyBody: YES];
+      lazy = [soap parseMessage: [str dataUsingEncoding: NSUTF8StringEncoding]];
+      [soap returnCoder];
+      soap = [GWSSOAPCoder borrowCoder];
+      [soap parseMessage: [@"<Envelope><Body><put><z>9</z></put></Body>"
+        @"</Envelope>" dataUsingEncoding: NSUTF8StringEncoding]];
+      [soap returnCoder];
+      if (NO == [[lazy objectForKey: GWSParametersKey]
+        isEqual: [eager objectForKey: GWSParametersKey]])
+        {
+          GSPrintf(stderr, @"Pooled lazy decoding failure %@\n", lazy);
+          [pool release];
+          return 1;
+        }
+
+      params = [NSDictionary dictionaryWithObjectsAndKeys:
+        @"x\001\"", @"a",
+        [NSArray arrayWithObjects: [NSNumber numberWithInt: 3],
+        [NSNumber numberWithDouble: 2.5], nil], @"b",
+        [NSString stringWithUTF8String: "\xc3\xa9\xf0\x9f\x98\x80"], @"c",
+        nil];
+      params = [NSDictionary dictionaryWithObjectsAndKeys:
+        @"m", GWSMethodKey, params, GWSParametersKey, nil];
+      hash = [GWSHash hashWithAlgorithm: @"SHA"
+                                 method: @"m"
+                             parameters: params
+                                  order: nil
+                                  extra: @"secret"
+                                 asHMAC: NO];
+      if (NO == [[hash hashValue]
+        isEqual: @"1d9460a5e9307344adee7729dbc9c81443cb0aa8"]
+        || NO == [hash verifyWithParameters: params
+                                      order: nil
+                                      extra: @"secret"
+                                     asHMAC: NO
+                                  excluding: nil])
+        {
+          GSPrintf(stderr, @"Hash failure %@\n", hash);
+          [pool release];
+          return 1;
+        }
+      [GWSHash setCanonicalCacheLimit: 10];
+      hash = [GWSHash hashWithAlgorithm: @"SHA"
+                                 method: @"m"
+                             parameters: params
+                                  order: nil
+                                  extra: @"secret"
+                                 asHMAC: NO];
+      hash = [GWSHash hashWithAlgorithm: @"SHA"
+                                 method: @"m"
+                             parameters: params
+                                  order: nil
+                                  extra: @"secret"
+                                 asHMAC: NO];
+      [GWSHash setCanonicalCacheLimit: 0];
+      if (NO == [[hash hashValue]
+        isEqual: @"1d9460a5e9307344adee7729dbc9c81443cb0aa8"])
+        {
+          GSPrintf(stderr, @"Cached hash failure %@\n", hash);
+          [pool release];
+          return 1;
+        }
+
+      {
+        NSMutableArray  *a = [NSMutableArray array];
+        NSArray         *inner;
+        NSDictionary    *p1;
+        NSDictionary    *p2;
+        NSString        *h1;
+        NSString        *h2;
+        int             i;
+
+        /* Nested objects larger than the sink buffer must give the same
+         * hashes whether serialised or copied from the cache, including
+         * when an inner object is cached within a different outer one.
+         */
+        for (i = 0; i < 1000; i++)
+          {
+            [a addObject: [NSString stringWithFormat: @"value %d", i]];
+          }
+        inner = [NSArray arrayWithObjects: [[a copy] autorelease],
+          [NSDictionary dictionaryWithObject: @"y" forKey: @"x"], nil];
+        p1 = [NSDictionary dictionaryWithObjectsAndKeys: @"m", GWSMethodKey,
+          [NSDictionary dictionaryWithObject: inner forKey: @"i"],
+          GWSParametersKey, nil];
+        p2 = [NSDictionary dictionaryWithObjectsAndKeys: @"m", GWSMethodKey,
+          [NSDictionary dictionaryWithObjectsAndKeys: inner, @"i",
+          @"z", @"j", nil], GWSParametersKey, nil];
+        h1 = [[GWSHash hashWithAlgorithm: @"SHA" method: @"m"
+          parameters: p1 order: nil extra: nil asHMAC: NO] hashValue];
+        h2 = [[GWSHash hashWithAlgorithm: @"SHA" method: @"m"
+          parameters: p2 order: nil extra: nil asHMAC: NO] hashValue];
+        [GWSHash setCanonicalCacheLimit: 10];
+        for (i = 0; i < 2; i++)
+          {
+            if (NO == [h1 isEqual: [[GWSHash hashWithAlgorithm: @"SHA"
+              method: @"m" parameters: p1 order: nil extra: nil asHMAC: NO]
+              hashValue]]
+              || NO == [h2 isEqual: [[GWSHash hashWithAlgorithm: @"SHA"
+              method: @"m" parameters: p2 order: nil extra: nil asHMAC: NO]
+              hashValue]])
+              {
+                [GWSHash setCanonicalCacheLimit: 0];
+                GSPrintf(stderr, @"Nested cached hash failure\n");
+                [pool release];
+                return 1;
+              }
+          }
+        [GWSHash setCanonicalCacheLimit: 0];
+      }
+      hash = [GWSHash hashWithAlgorithm: @"SHA"
+                                 method: @"m"
+                             parameters: [NSDictionary dictionaryWithObject: @"v"
+        forKey: [NSNumber numberWithInt: 1]]
+                                  order: nil
+                                  extra: @"secret"
+                                 asHMAC: NO];
+      if (nil != hash)
+        {
+          GSPrintf(stderr, @"Unserialisable parameters hashed %@\n", hash);
+          [pool release];
+          return 1;
+        }
+
+      {
+        uint8_t         s1[40];
+        uint8_t         s2[40];
+
+        [GWSHash salt: s1 size: sizeof(s1)];
+        [GWSHash salt: s2 size: sizeof(s2)];
+        if (0 == memcmp(s1, s2, sizeof(s1)))
+          {
+            GSPrintf(stderr, @"Salt generation failure\n");
+            [pool release];
+            return 1;
+          }
+        hash = [GWSHash hashWithAlgorithm: @"SSHA"
+                                   method: @"m"
+                               parameters: params
+                                    order: nil
+                                    extra: @"secret"
+                                   asHMAC: NO];
+        if ([[hash salt] length] != 64
+          || NO == [[hash salt] isEqual: [[hash salt] lowercaseString]])
+          {
+            GSPrintf(stderr, @"Salt encoding failure %@\n", hash);
+            [pool release];
+            return 1;
+          }
+      }
+
+      {
+        NSData          *k = [@"key" dataUsingEncoding: NSASCIIStringEncoding];
+        GWSHMACKey      *hk;
+        GWSHash         *h2;
+
+        hk = [GWSHMACKey keyWithAlgorithm: @"SHA-256" key: k];
+        bin = [@"The quick brown fox jumps over the lazy dog"
+          dataUsingEncoding: NSASCIIStringEncoding];
+        hash = [GWSHash hashWithAlgorithm: @"SHA-256"
+                                   method: @"m"
+                               parameters: params
+                                    order: nil
+                                    extra: k
+                                   asHMAC: YES];
+        h2 = [GWSHash hashWithAlgorithm: @"SHA-256"
+                                 method: @"m"
+                             parameters: params
+                                  order: nil
+                                  extra: hk
+                                 asHMAC: YES];
+        if (NO == [[xml encodeHexBinaryFrom: [hk computeHMACFrom: bin]]
+          isEqual: @"F7BC83F430538424B13298E6AA6FB143"
+          @"EF4D59A14946175997479DBC2D1A3CD8"]
+          || NO == [[hash hashValue] isEqual: [h2 hashValue]])
+          {
+            GSPrintf(stderr, @"HMAC key failure\n");
+            [pool release];
+            return 1;
+          }
+
+        /* Parameters too large to serialise in one buffer are passed to
+         * the digest in parts, with the same result for either key form.
+         */
+        str = [@"" stringByPaddingToLength: 10000
+                                withString: @"0123456789"
+                           startingAtIndex: 0];
+        hash = [GWSHash hashWithAlgorithm: @"SHA-256"
+                                   method: @"m"
+                               parameters: [NSDictionary
+          dictionaryWithObject: str forKey: @"big"]
+                                    order: nil
+                                    extra: k
+                                   asHMAC: YES];
+        h2 = [GWSHash hashWithAlgorithm: @"SHA-256"
+                                 method: @"m"
+                             parameters: [NSDictionary
+          dictionaryWithObject: str forKey: @"big"]
+                                  order: nil
+                                  extra: hk
+                                 asHMAC: YES];
+        if (NO == [[hash hashValue] isEqual: [h2 hashValue]]
+          || [[hash hashValue] length] != 64)
+          {
+            GSPrintf(stderr, @"HMAC large parameter failure\n");
+            [pool release];
+            return 1;
+          }
+      }
+
+      {
+        NSData          *src;
+        NSData          *old;
+        NSData          *snap;
+        GWSDocument     *d;
+
+        src = [@"<?xml version=\"1.0\"?>"
+          @"<definitions xmlns=\"http://schemas.xmlsoap.org/wsdl/\""
+          @" xmlns:soap=\"http://schemas.xmlsoap.org/wsdl/soap/\""
+          @" xmlns:tns=\"urn:t\" targetNamespace=\"urn:t\" name=\"T\">"
+          @"<portType name=\"TP\"><operation name=\"op\"/></portType>"
+          @"<binding name=\"TB\" type=\"tns:TP\">"
+          @"<soap:binding style=\"document\""
+          @" transport=\"http://schemas.xmlsoap.org/soap/http\"/>"
+          @"<operation name=\"op\"/></binding>"
+          @"<service name=\"TS\"><port name=\"TPort\" binding=\"tns:TB\">"
+          @"<soap:address location=\"http://localhost/t\"/></port>"
+          @"</service></definitions>" dataUsingEncoding: NSUTF8StringEncoding];
+        old = [src subdataWithRange: NSMakeRange(0, [src length] - 1)];
+        snap = [GWSDocument snapshotWithData: src];
+        d = [[[GWSDocument alloc] initWithSnapshot: snap source: src]
+          autorelease];
+        if (nil == d
+          || NO == [[d prefixForNamespace: @"urn:t"] isEqual: @"tns"]
+          || nil == [[d bindingWithName: @"TB" create: NO] type]
+          || nil == [[d serviceWithName: @"TS" create: NO]
+            buildRequest: @"op" parameters: nil order: nil]
+          || nil != [[[GWSDocument alloc] initWithSnapshot: snap
+            source: old] autorelease]
+          || nil != [[[GWSDocument alloc] initWithSnapshot:
+            [snap subdataWithRange: NSMakeRange(0, [snap length] - 4)]
+            source: nil] autorelease])
+          {
+            GSPrintf(stderr, @"WSDL snapshot failure\n");
+            [pool release];
+            return 1;
+          }
+      }
+
+      {
+        GWSExtensibility        *x = [[GWSExtensibility new] autorelease];
+        GWSExtensibility        *soap;
+
+        soap = [GWSDocument extensibilityForNamespace:
+          @"http://schemas.xmlsoap.org/wsdl/soap/"];
+        [GWSDocument registerExtensibility: x forNamespace: @"urn:x"];
+        if ([GWSDocument extensibilityForNamespace: @"urn:x"] != x
+          || [GWSDocument extensibilityForNamespace:
+          @"http://schemas.xmlsoap.org/wsdl/soap/"] != soap || nil == soap)
+          {
+            GSPrintf(stderr, @"Extensibility registration failure\n");
+            [pool release];
+            return 1;
+          }
+        [GWSDocument registerExtensibility: nil forNamespace: @"urn:x"];
+        if ([GWSDocument extensibilityForNamespace: @"urn:x"] != nil)
+          {
+            GSPrintf(stderr, @"Extensibility removal failure\n");
+            [pool release];
+            return 1;
+          }
+      }
+
+      {
+        GWSCoder        *c = [GWSXMLRPCCoder coder];
+        NSDictionary    *s;
+        NSData          *d;
+
+        d = [c buildRequest: @"test"
+                 parameters: [NSDictionary dictionaryWithObject: @"value"
+                                                         forKey: @"key"]
+                      order: nil];
+        [c parseMessage: d];
+        s = [c allocationStatistics];
+#if     defined(GWS_ALLOC_STATS) && GWS_ALLOC_STATS
+        if ([[s objectForKey: @"Messages"] intValue] != 2
+          || [[s objectForKey: @"Elements"] intValue] == 0
+          || [[s objectForKey: @"BuffersBytes"] intValue] < [d length]
+          || [[[s objectForKey: @"Last"] objectForKey: @"Dictionaries"]
+          intValue] == 0)
+#else
+        if (nil != s)
+#endif
+          {
+            GSPrintf(stderr, @"Allocation statistics failure %@\n", s);
+            [pool release];
+            return 1;
+          }
+
+        /* A message abandoned by an exception must not stop the next
+         * one being counted, with exactly one element per element parsed.
+         */
+        NS_DURING
+          [c buildRequest: @"test"
+               parameters: [NSDictionary dictionaryWithObject:
+                 [[GWSTestRaiser new] autorelease] forKey: @"key"]
+                    order: nil];
+        NS_HANDLER
+        NS_ENDHANDLER
+        d = [@"<a><b/><c>x</c></a>" dataUsingEncoding: NSUTF8StringEncoding];
+        [c parseXML: d];
+        s = [c allocationStatistics];
+#if     defined(GWS_ALLOC_STATS) && GWS_ALLOC_STATS
+        if ([[s objectForKey: @"Messages"] intValue] != 3
+          || [[[s objectForKey: @"Last"] objectForKey: @"Elements"]
+          intValue] != 3)
+#else
+        if (nil != s)
+#endif
+          {
+            GSPrintf(stderr, @"Allocation nesting failure %@\n", s);
+            [pool release];
+            return 1;
+          }
+      }
+
+      {
+        GWSDocument             *doc;
+        GWSDocument             *other;
+        GWSResolvedOperation    *r;
+        GWSService              *svc;
+        GWSElement              *e;
+        BOOL                    ok;
+
+        doc = [[GWSDocument new] autorelease];
+        str = @"<wsdl:definitions name=\"T\" targetNamespace=\"urn:t\""
+          @" xmlns:wsdl=\"http://schemas.xmlsoap.org/wsdl/\""
+          @" xmlns:soap=\"http://schemas.xmlsoap.org/wsdl/soap/\""
+          @" xmlns:t=\"urn:t\"><wsdl:message name=\"m\"/>"
+          @"<wsdl:portType name=\"PT\"><wsdl:operation name=\"op\">"
+          @"<wsdl:input message=\"t:m\"/></wsdl:operation></wsdl:portType>"
+          @"<wsdl:binding name=\"B\" type=\"t:PT\"><soap:binding"
+          @" style=\"document\""
+          @" transport=\"http://schemas.xmlsoap.org/soap/http\"/>"
+          @"<wsdl:operation name=\"op\"><soap:operation soapAction=\"a\"/>"
+          @"<wsdl:input><soap:body use=\"literal\"/></wsdl:input>"
+          @"</wsdl:operation></wsdl:binding><wsdl:service name=\"S\">"
+          @"<wsdl:port name=\"P\" binding=\"t:B\"><soap:address"
+          @" location=\"http://localhost/\"/></wsdl:port></wsdl:service>"
+          @"</wsdl:definitions>";
+        ok = (nil == [doc prefixForNamespace: @"urn:t"]
+          && [[doc qualify: @"x"] isEqual: @"x"]);
+        doc = [[[GWSDocument alloc] initWithData:
+          [str dataUsingEncoding: NSUTF8StringEncoding]] autorelease];
+        svc = [doc serviceWithName: @"S" create: NO];
+        r = [[doc _resolvedMethod: @"op" service: svc] retain];
+        if (nil == r || r != [doc _resolvedMethod: @"op" service: svc]
+          || NO == [[doc prefixForNamespace: @"urn:t"] isEqual: @"t"]
+          || NO == [[doc qualify: @"x"] isEqual: @"wsdl:x"])
+          {
+            ok = NO;
+          }
+        other = [[[GWSDocument alloc] initWithData:
+          [str dataUsingEncoding: NSUTF8StringEncoding]] autorelease];
+        [other _resolvedMethod: @"op"
+                       service: [other serviceWithName: @"S" create: NO]];
+        e = [[other bindingWithName: @"B" create: NO] operationWithName: @"op"
+                                                                 create: NO];
+        [[e firstChild] setAttribute: @"b" forKey: @"soapAction"];
+        if (r != [doc _resolvedMethod: @"op" service: svc])
+          {
+            ok = NO;    // Discarded after another document changed.
+          }
+        e = [[doc bindingWithName: @"B" create: NO] operationWithName: @"op"
+                                                               create: NO];
+        [[e firstChild] setAttribute: @"b" forKey: @"soapAction"];
+        if (r == [doc _resolvedMethod: @"op" service: svc])
+          {
+            ok = NO;    // Not discarded after the operation changed.
+          }
+        [r release];
+        if (NO == ok)
+          {
+            GSPrintf(stderr, @"Document lookup failure\n");
+            [pool release];
+            return 1;
+          }
+      }
+
       GSPrintf(stdout, @"Internal tests OK\n");
       [pool release];
       return 0;
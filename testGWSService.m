@@ -0,0 +1,580 @@
+/** 
+   Copyright (C) 2026 Free Software Foundation, Inc.
+   
+   Date:	October 2026
+   
+   This file is part of the WebServices package.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+   
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+   
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA.
+
+   */ 
+
+#import	<Foundation/Foundation.h>
+#import	"GWSPrivate.h"
+#import	"testServer.h"
+
+#if     !defined(__MINGW__)
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Return a URL on the loopback host to which connections are refused.
+ */
+static NSString*
+refusedServer()
+{
+  struct sockaddr_in    addr;
+  socklen_t             len = sizeof(addr);
+  int                   sock;
+
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (sock < 0
+    || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0
+    || getsockname(sock, (struct sockaddr*)&addr, &len) < 0)
+    {
+      return nil;
+    }
+  close(sock);
+  return [NSString stringWithFormat: @"http://127.0.0.1:%d/",
+    ntohs(addr.sin_port)];
+}
+
+/* The test services record their completion in an array.
+ */
+static NSMutableArray   *completed = nil;
+
+@interface      GWSTestDelegate : NSObject
+@end
+@implementation GWSTestDelegate
+- (void) completedRPC: (GWSService*)sender
+{
+  [completed addObject: sender];
+}
+@end
+
+/* A delegate which makes responses cacheable, optionally replacing the
+ * response data before it is parsed.
+ */
+@interface      GWSTestCacher : GWSTestDelegate
+{
+@public
+  NSData        *replacement;
+}
+@end
+@implementation GWSTestCacher
+- (NSTimeInterval) webService: (GWSService*)service
+                cacheLifetime: (NSString*)method
+{
+  return 60.0;
+}
+- (NSData*) webService: (GWSService*)sender willHandleResponse: (NSData*)data
+{
+  return (nil == replacement) ? data : replacement;
+}
+@end
+
+/* Return a new service for the URL, using the XMLRPC coder.
+ */
+static GWSService*
+testService(NSString *url)
+{
+  static GWSTestDelegate        *delegate = nil;
+  GWSService                    *svc = [[GWSService new] autorelease];
+
+  if (nil == delegate)
+    {
+      delegate = [GWSTestDelegate new];
+      completed = [NSMutableArray new];
+    }
+  [svc setURL: url];
+  [svc setCoder: [GWSXMLRPCCoder coder]];
+  [svc setDelegate: delegate];
+  return svc;
+}
+
+/* Return the circuit breaker state reported for the loopback host.
+ */
+static int
+circuit()
+{
+  return [[[[[GWSService metrics] objectForKey: @"Hosts"]
+    objectForKey: @"127.0.0.1"] objectForKey: @"Circuit"] intValue];
+}
+
+/* Run the run loop until the server has read the given number of
+ * requests, or until the time limit is reached.
+ */
+static void
+waitForRequests(unsigned count, NSTimeInterval limit)
+{
+  NSDate        *when = [NSDate dateWithTimeIntervalSinceNow: limit];
+
+  while (testServerRequests() < count && [when timeIntervalSinceNow] > 0)
+    {
+      NSAutoreleasePool *arp = [NSAutoreleasePool new];
+
+      [[NSRunLoop currentRunLoop] runMode: NSDefaultRunLoopMode
+        beforeDate: [NSDate dateWithTimeIntervalSinceNow: 0.01]];
+      [arp release];
+    }
+}
+
+/* Run the run loop until each service in the array has completed its
+ * RPC, or until the time limit is reached.
+ */
+static void
+waitFor(NSArray *services, NSTimeInterval limit)
+{
+  NSDate        *when = [NSDate dateWithTimeIntervalSinceNow: limit];
+
+  while ([when timeIntervalSinceNow] > 0)
+    {
+      NSAutoreleasePool *arp = [NSAutoreleasePool new];
+      NSUInteger        count = [services count];
+      BOOL              done = YES;
+
+      while (YES == done && count-- > 0)
+        {
+          if (NSNotFound == [completed
+            indexOfObjectIdenticalTo: [services objectAtIndex: count]])
+            {
+              done = NO;
+            }
+        }
+      if (YES == done)
+        {
+          [arp release];
+          return;
+        }
+      [[NSRunLoop currentRunLoop] runMode: NSDefaultRunLoopMode
+        beforeDate: [NSDate dateWithTimeIntervalSinceNow: 0.05]];
+      [arp release];
+    }
+}
+#endif
+
+int
+main()
+{
+  NSAutoreleasePool     *pool;
+#if     !defined(__MINGW__)
+  NSString              *url;
+  int                   port;
+#endif
+
+  pool = [NSAutoreleasePool new];
+
+  if (nil == [[GWSService metrics] objectForKey: @"RejectedQMax"]
+    || 0 == [[GWSService metricsText]
+    rangeOfString: @"\ngwsservice_active 0\n"].length)
+    {
+      GSPrintf(stderr, @"Service metrics failure %@\n",
+        [GWSService metricsText]);
+      [pool release];
+      return 1;
+    }
+
+  [GWSService setDeadlineHeader: @"X-Request-Budget"];
+  if (nil == [[GWSService metrics] objectForKey: @"RejectedDeadline"]
+    || 0 == [[GWSService metricsText]
+    rangeOfString: @"{reason=\"deadline\"} 0\n"].length)
+    {
+      GSPrintf(stderr, @"Service deadline metrics failure %@\n",
+        [GWSService metricsText]);
+      [pool release];
+      return 1;
+    }
+  [GWSService setDeadlineHeader: nil];
+
+#if     !defined(__MINGW__)
+  port = testServerStart([[GWSXMLRPCCoder coder] buildResponse: @"test"
+    parameters: [NSDictionary dictionaryWithObject: @"value"
+                                            forKey: @"key"]
+    order: nil]);
+  url = [NSString stringWithFormat: @"http://127.0.0.1:%d/", port];
+  if (0 == port)
+    {
+      GSPrintf(stderr, @"Unable to start loopback server\n");
+      [pool release];
+      return 1;
+    }
+  else
+    {
+      GWSService    *a = testService(url);
+      GWSService    *b = testService(url);
+      GWSService    *c = testService(url);
+      GWSService    *d = testService(url);
+      unsigned      sent = testServerRequests();
+
+      /* Once the average service time exceeds the timeout, a request
+       * whose timeout was always too short must still be sent (so it
+       * times out rather than being rejected), but one which waited
+       * in the queue until it could no longer complete is failed.
+       * The server holds each response while the clock is advanced,
+       * so the service time is what the test says it is.
+       */
+      [GWSService setPerHostPool: 1];
+      testServerHold(YES);
+      [a sendRequest: @"test" parameters: nil order: nil timeout: 10];
+      waitForRequests(sent + 1, 10.0);
+      [GWSService _advanceClock: 1.5];
+      testServerHold(NO);
+      waitFor([NSArray arrayWithObject: a], 10.0);
+      testServerHold(YES);
+      [b sendRequest: @"test" parameters: nil order: nil timeout: 1];
+      waitFor([NSArray arrayWithObject: b], 10.0);
+      [c sendRequest: @"test" parameters: nil order: nil timeout: 10];
+      [d sendRequest: @"test" parameters: nil order: nil timeout: 2];
+      waitForRequests(sent + 3, 10.0);
+      [GWSService _advanceClock: 1.0];
+      testServerHold(NO);
+      waitFor([NSArray arrayWithObjects: c, d, nil], 10.0);
+      [GWSService setPerHostPool: 20];
+      if (nil != [[a result] objectForKey: GWSErrorKey]
+        || NO == [[[b result] objectForKey: GWSErrorKey]
+          isEqual: @"timed out"]
+        || nil != [[c result] objectForKey: GWSErrorKey]
+        || NO == [[[d result] objectForKey: GWSErrorKey]
+          isEqual: @"insufficient time left before deadline"])
+        {
+          GSPrintf(stderr, @"Service deadline failure %@ %@ %@ %@\n",
+            [a result], [b result], [c result], [d result]);
+          [pool release];
+          return 1;
+        }
+    }
+
+  {
+    GWSService      *a = testService(url);
+    NSDictionary    *n;
+    unsigned        max;
+    unsigned        sent;
+
+    /* With a single sample of known latency, every percentile must
+     * be that of the sample (the upper limit of its bucket).
+     */
+    [GWSService resetLatencies];
+    sent = testServerRequests();
+    testServerHold(YES);
+    [a sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    waitForRequests(sent + 1, 10.0);
+    [GWSService _advanceClock: 0.2];
+    testServerHold(NO);
+    waitFor([NSArray arrayWithObject: a], 10.0);
+    n = [[[[GWSService latencies] objectForKey: @"Hosts"]
+      objectForKey: @"127.0.0.1"] objectForKey: @"Network"];
+    max = [[n objectForKey: @"Max"] unsignedIntValue];
+    if ([[n objectForKey: @"Count"] intValue] != 1 || max < 200000
+      || [[n objectForKey: @"P50"] unsignedIntValue] < max
+      || [[n objectForKey: @"P50"] unsignedIntValue] > max + max / 16
+      || NO == [[n objectForKey: @"P50"]
+        isEqual: [n objectForKey: @"P999"]])
+      {
+        GSPrintf(stderr, @"Service latency percentile failure %@\n", n);
+        [pool release];
+        return 1;
+      }
+  }
+
+  {
+    GWSService      *a = testService(url);
+    GWSService      *b = testService(url);
+    GWSTestCacher   *altering = [[GWSTestCacher new] autorelease];
+    GWSTestCacher   *plain = [[GWSTestCacher new] autorelease];
+    NSData          *alt;
+    NSDictionary    *p[2];
+    unsigned        sent[2];
+
+    /* The response is cached as received, so a delegate replacing
+     * the data it parses does not change what a later request gets.
+     */
+    alt = [[GWSXMLRPCCoder coder] buildResponse: @"test"
+      parameters: [NSDictionary dictionaryWithObject: @"altered"
+                                              forKey: @"key"]
+      order: nil];
+    altering->replacement = alt;
+    [a setDelegate: altering];
+    [b setDelegate: plain];
+    [GWSService setCacheLimit: 1024 * 1024];
+    [a sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    waitFor([NSArray arrayWithObject: a], 10.0);
+    sent[0] = testServerRequests();
+    [b sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    waitFor([NSArray arrayWithObject: b], 10.0);
+    sent[1] = testServerRequests();
+    [GWSService setCacheLimit: 0];
+    p[0] = [[[GWSXMLRPCCoder coder] parseMessage: alt]
+      objectForKey: GWSParametersKey];
+    p[1] = [[[GWSXMLRPCCoder coder] parseMessage:
+      [[GWSXMLRPCCoder coder] buildResponse: @"test"
+        parameters: [NSDictionary dictionaryWithObject: @"value"
+                                                forKey: @"key"]
+        order: nil]] objectForKey: GWSParametersKey];
+    if (sent[0] != sent[1]
+      || NO == [[[a result] objectForKey: GWSParametersKey] isEqual: p[0]]
+      || NO == [[[b result] objectForKey: GWSParametersKey] isEqual: p[1]])
+      {
+        GSPrintf(stderr, @"Service raw response cache failure %@ %@\n",
+          [a result], [b result]);
+        [pool release];
+        return 1;
+      }
+  }
+
+  {
+    GWSService      *a = testService(url);
+    GWSService      *b = testService(url);
+    GWSService      *c = testService(url);
+    GWSTestCacher   *altering = [[GWSTestCacher new] autorelease];
+    NSData          *alt;
+    NSDictionary    *p[2];
+    unsigned        sent;
+    int             shared;
+
+    /* Identical requests sent while the first is in progress are not
+     * sent, but each parses the response for itself (with its own
+     * delegate) so that results are not shared between them.
+     */
+    alt = [[GWSXMLRPCCoder coder] buildResponse: @"test"
+      parameters: [NSDictionary dictionaryWithObject: @"altered"
+                                              forKey: @"key"]
+      order: nil];
+    altering->replacement = alt;
+    [c setDelegate: altering];
+    [GWSService setCoalescing: YES];
+    sent = testServerRequests();
+    shared = [[[GWSService metrics] objectForKey: @"Coalesced"] intValue];
+    testServerHold(YES);
+    [a sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    [b sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    [c sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    waitForRequests(sent + 1, 10.0);
+    testServerHold(NO);
+    waitFor([NSArray arrayWithObjects: a, b, c, nil], 10.0);
+    [GWSService setCoalescing: NO];
+    sent = testServerRequests() - sent;
+    shared = [[[GWSService metrics] objectForKey: @"Coalesced"] intValue]
+      - shared;
+    p[0] = [[a result] objectForKey: GWSParametersKey];
+    p[1] = [[b result] objectForKey: GWSParametersKey];
+    if (sent != 1 || shared != 2 || nil == p[0] || p[0] == p[1]
+      || [[p[0] allValues] lastObject] == [[p[1] allValues] lastObject]
+      || NO == [p[0] isEqual: p[1]]
+      || NO == [[[c result] objectForKey: GWSParametersKey] isEqual:
+        [[[GWSXMLRPCCoder coder] parseMessage: alt]
+        objectForKey: GWSParametersKey]])
+      {
+        GSPrintf(stderr, @"Service coalescing failure %u %d %@ %@ %@\n",
+          sent, shared, [a result], [b result], [c result]);
+        [pool release];
+        return 1;
+      }
+  }
+
+  {
+    NSString        *bad = refusedServer();
+    GWSService      *a = testService(bad);
+    GWSService      *b = testService(bad);
+    GWSService      *c = testService(url);
+    GWSService      *d = testService(url);
+    GWSService      *e = testService(bad);
+    GWSService      *f = testService(url);
+    int             state[4];
+    unsigned        count;
+    BOOL            sent;
+
+    /* Failures open the circuit, then after the cooldown a cancelled
+     * probe leaves it half open and lets another probe through, a
+     * failed probe opens it again, and a successful one closes it.
+     * The clock is advanced past the cooldown rather than waiting.
+     */
+    [GWSService setCircuitBreaker: 0.5 minimum: 2 cooldown: 1 probes: 1];
+    [a sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    waitFor([NSArray arrayWithObject: a], 10.0);
+    [b sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    waitFor([NSArray arrayWithObject: b], 10.0);
+    state[0] = circuit();
+    sent = [d sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    [GWSService _advanceClock: 1.2];
+    count = testServerRequests();
+    testServerHold(YES);
+    [c sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    waitForRequests(count + 1, 10.0);
+    [c timeout: nil];
+    waitFor([NSArray arrayWithObject: c], 10.0);
+    testServerHold(NO);
+    state[1] = circuit();
+    [e sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    waitFor([NSArray arrayWithObject: e], 10.0);
+    state[2] = circuit();
+    [GWSService _advanceClock: 1.2];
+    [f sendRequest: @"test" parameters: nil order: nil timeout: 10];
+    waitFor([NSArray arrayWithObject: f], 10.0);
+    state[3] = circuit();
+    [GWSService setCircuitBreaker: 0.0 minimum: 0 cooldown: 0 probes: 0];
+    if (nil == bad || state[0] != 1 || YES == sent
+      || NO == [[[d result] objectForKey: GWSErrorKey]
+        isEqual: @"circuit open"]
+      || state[1] != 2 || state[2] != 1 || state[3] != 0
+      || nil != [[f result] objectForKey: GWSErrorKey])
+      {
+        GSPrintf(stderr, @"Service circuit failure %d %d %d %d %@\n",
+          state[0], state[1], state[2], state[3], [f result]);
+        [pool release];
+        return 1;
+      }
+  }
+
+  {
+    NSMutableArray  *services = [NSMutableArray array];
+    NSMutableArray  *methods = [NSMutableArray array];
+    NSMutableArray  *params = [NSMutableArray array];
+    NSArray         *failed;
+    NSUInteger      i;
+    BOOL            ok = YES;
+
+    /* With coalescing the requests of a batch must be built before
+     * they are queued, so they are built in parallel by the work
+     * threads, but each service must get its own request and complete.
+     */
+    for (i = 0; i < 8; i++)
+      {
+        GWSService  *svc = testService(url);
+
+        [svc setDebug: YES];
+        [services addObject: svc];
+        [methods addObject: @"test"];
+        [params addObject: [NSDictionary dictionaryWithObject:
+          [NSNumber numberWithInt: i] forKey: @"n"]];
+      }
+    [GWSService setWorkThreads: 4];
+    [GWSService setCoalescing: YES];
+    failed = [GWSService sendRequests: services
+                              methods: methods
+                           parameters: params
+                               orders: nil
+                              timeout: 10];
+    waitFor(services, 10.0);
+    [GWSService setCoalescing: NO];
+    [GWSService setWorkThreads: 0];
+    for (i = 0; i < 8 && YES == ok; i++)
+      {
+        GWSService  *svc = [services objectAtIndex: i];
+        NSData      *req;
+        id          n;
+
+        req = [[svc result] objectForKey: GWSRequestDataKey];
+        n = [[[[GWSXMLRPCCoder coder] parseMessage: req]
+          objectForKey: GWSParametersKey] objectForKey: @"Arg0"];
+        if (NSNotFound == [completed indexOfObjectIdenticalTo: svc]
+          || nil != [[svc result] objectForKey: GWSErrorKey]
+          || NO == [n isEqual: [NSNumber numberWithInt: i]])
+          {
+            ok = NO;
+          }
+      }
+    if ([failed count] != 0 || NO == ok)
+      {
+        GSPrintf(stderr, @"Batch build failure %@ %@\n", failed,
+          [[services objectAtIndex: i - 1] result]);
+        [pool release];
+        return 1;
+      }
+  }
+#endif
+
+  [GWSService setCircuitBreaker: 0.5 minimum: 10 cooldown: 5 probes: 1];
+  if (nil == [[GWSService metrics] objectForKey: @"RejectedCircuit"]
+    || 0 == [[GWSService metricsText]
+    rangeOfString: @"{reason=\"circuit\"} 0\n"].length)
+    {
+      GSPrintf(stderr, @"Service circuit metrics failure %@\n",
+        [GWSService metricsText]);
+      [pool release];
+      return 1;
+    }
+  [GWSService setCircuitBreaker: 0.0 minimum: 0 cooldown: 0 probes: 0];
+
+  [GWSService setCacheLimit: 1024 * 1024];
+  if (0 != [[[GWSService metrics] objectForKey: @"CacheBytes"] intValue]
+    || nil == [[GWSService metrics] objectForKey: @"Coalesced"]
+    || 0 == [[GWSService metricsText]
+    rangeOfString: @"\ngwsservice_cache_hits_total 0\n"].length)
+    {
+      GSPrintf(stderr, @"Service cache metrics failure %@\n",
+        [GWSService metricsText]);
+      [pool release];
+      return 1;
+    }
+  [GWSService setCacheLimit: 0];
+
+  {
+    NSMutableData   *d = [NSMutableData data];
+    NSData          *z;
+    BOOL            big[3];
+    int             i;
+
+    for (i = 0; i < 1000; i++)
+      {
+        [d appendBytes: "<value><i4>42</i4></value>" length: 26];
+      }
+    z = GWSGzip(d);
+    if (nil != z && ([z length] >= [d length]
+      || NO == [GWSInflate(z, [d length], &big[0]) isEqual: d]
+      || nil != GWSInflate([z subdataWithRange: NSMakeRange(0, 20)],
+        [d length], &big[1])
+      || nil != GWSInflate(z, [d length] - 1, &big[2])
+      || YES == big[0] || YES == big[1] || NO == big[2]))
+      {
+        GSPrintf(stderr, @"Compression failure\n");
+        [pool release];
+        return 1;
+      }
+  }
+
+  {
+    NSArray         *a = [NSArray arrayWithObject: @"x"];
+    BOOL            raised = NO;
+
+    NS_DURING
+      [GWSService sendRequests: [NSArray array]
+                       methods: a
+                    parameters: a
+                        orders: nil
+                       timeout: 10];
+    NS_HANDLER
+      raised = YES;
+    NS_ENDHANDLER
+    if (NO == raised || [[GWSService sendRequests: [NSArray array]
+                                          methods: [NSArray array]
+                                       parameters: [NSArray array]
+                                           orders: nil
+                                          timeout: 10] count] != 0)
+      {
+        GSPrintf(stderr, @"Batch submission failure\n");
+        [pool release];
+        return 1;
+      }
+  }
+
+  GSPrintf(stdout, @"Service tests OK\n");
+  [pool release];
+  return 0;
+}
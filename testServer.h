@@ -0,0 +1,54 @@
+/**
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   Date:	October 2026
+
+   This file is part of the WebServices package.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA.
+
+   */
+
+#import	<Foundation/Foundation.h>
+
+/* A minimal loopback HTTP/1.1 server used by the test and benchmark
+ * tools (it is not part of the library).
+ */
+#if	!defined(__MINGW__)
+
+/* Start a server which answers every request with the body (compressed
+ * if the client accepts that and compression is available) and return
+ * the port it is listening on, or zero on failure.  Starting another
+ * server replaces the response of any already running.
+ */
+extern int	testServerStart(NSData *body);
+
+/* Simulate a link of the given number of bytes per second (per
+ * connection) by sleeping for the time each request body and response
+ * would take to transfer.  Zero (the default) means no simulation.
+ */
+extern void	testServerSetBandwidth(unsigned bytesPerSecond);
+
+/* While flag is YES, requests are read (and counted) but the responses
+ * are held back until the server is released by passing NO, so that a
+ * test can decide how long each request is in progress.
+ */
+extern void	testServerHold(BOOL flag);
+
+/* Return the number of requests the servers have read.
+ */
+extern unsigned	testServerRequests(void);
+
+#endif
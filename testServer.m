@@ -0,0 +1,234 @@
+/**
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   Date:	October 2026
+
+   This file is part of the WebServices package.
+
+   This is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111 USA.
+
+   */
+
+#import	"GWSPrivate.h"
+#import	"testServer.h"
+
+#if	!defined(__MINGW__)
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* The server has a thread per connection, which reads each request
+ * (discarding the body) and sends back the canned response.
+ */
+static NSData		*cannedResponse = nil;
+static NSData		*cannedCompressed = nil;
+static unsigned		bandwidth = 0;
+static unsigned		requests = 0;
+static pthread_mutex_t	holdLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	holdCond = PTHREAD_COND_INITIALIZER;
+static BOOL		holding = NO;
+
+static void
+throttle(size_t bytes)
+{
+  if (bandwidth > 0)
+    {
+      usleep((useconds_t)(bytes * 1000000.0 / bandwidth));
+    }
+}
+
+static void*
+serveConnection(void *arg)
+{
+  int		fd = (int)(intptr_t)arg;
+  char		buf[65536];
+  size_t	used = 0;
+
+  for (;;)
+    {
+      char	*end;
+      char	*cl;
+      size_t	header;
+      size_t	body = 0;
+      NSData	*response = cannedResponse;
+      ssize_t	r;
+
+      buf[used] = '\0';
+      while ((end = strstr(buf, "\r\n\r\n")) == 0)
+	{
+	  if (used >= sizeof(buf) - 1
+	    || (r = read(fd, buf + used, sizeof(buf) - 1 - used)) <= 0)
+	    {
+	      close(fd);
+	      return 0;
+	    }
+	  used += r;
+	  buf[used] = '\0';
+	}
+      header = end + 4 - buf;
+      *end = '\0';
+      for (cl = strstr(buf, "\r\n"); cl != 0; cl = strstr(cl + 2, "\r\n"))
+	{
+	  if (strncasecmp(cl + 2, "Content-Length:", 15) == 0)
+	    {
+	      body = strtoul(cl + 17, 0, 10);
+	    }
+	  else if (strncasecmp(cl + 2, "Accept-Encoding:", 16) == 0
+	    && nil != cannedCompressed)
+	    {
+	      char	*eol = strstr(cl + 2, "\r\n");
+	      char	*p;
+
+	      for (p = cl + 18; p != eol && *p != '\0'; p++)
+		{
+		  if (strncasecmp(p, "gzip", 4) == 0)
+		    {
+		      response = cannedCompressed;
+		      break;
+		    }
+		}
+	    }
+	}
+      throttle(body);
+      /* Discard the body, then keep any data from the next request.
+       */
+      while (used - header < body)
+	{
+	  body -= used - header;
+	  used = header = 0;
+	  if ((r = read(fd, buf, sizeof(buf) - 1)) <= 0)
+	    {
+	      close(fd);
+	      return 0;
+	    }
+	  used = r;
+	}
+      header += body;
+      memmove(buf, buf + header, used - header);
+      used -= header;
+      __sync_fetch_and_add(&requests, 1);
+      pthread_mutex_lock(&holdLock);
+      while (YES == holding)
+	{
+	  pthread_cond_wait(&holdCond, &holdLock);
+	}
+      pthread_mutex_unlock(&holdLock);
+      throttle([response length]);
+      if (write(fd, [response bytes], [response length]) < 0)
+	{
+	  close(fd);
+	  return 0;
+	}
+    }
+}
+
+static void*
+serveListener(void *arg)
+{
+  int	sock = (int)(intptr_t)arg;
+  int	fd;
+
+  while ((fd = accept(sock, 0, 0)) >= 0)
+    {
+      pthread_t	t;
+
+      if (pthread_create(&t, 0, serveConnection, (void*)(intptr_t)fd) == 0)
+	{
+	  pthread_detach(t);
+	}
+      else
+	{
+	  close(fd);
+	}
+    }
+  return 0;
+}
+
+int
+testServerStart(NSData *body)
+{
+  struct sockaddr_in	addr;
+  socklen_t		len = sizeof(addr);
+  NSMutableData		*d;
+  NSData		*z;
+  pthread_t		t;
+  int			sock;
+
+  signal(SIGPIPE, SIG_IGN);
+  d = [NSMutableData data];
+  [d appendData: [[NSString stringWithFormat: @"HTTP/1.1 200 OK\r\n"
+    @"Content-Type: text/xml\r\nContent-Length: %u\r\n\r\n",
+    (unsigned)[body length]] dataUsingEncoding: NSASCIIStringEncoding]];
+  [d appendData: body];
+  [cannedResponse release];
+  cannedResponse = [d copy];
+  [cannedCompressed release];
+  cannedCompressed = nil;
+  if (nil != (z = GWSGzip(body)))
+    {
+      d = [NSMutableData data];
+      [d appendData: [[NSString stringWithFormat: @"HTTP/1.1 200 OK\r\n"
+	@"Content-Type: text/xml\r\nContent-Encoding: gzip\r\n"
+	@"Content-Length: %u\r\n\r\n",
+	(unsigned)[z length]] dataUsingEncoding: NSASCIIStringEncoding]];
+      [d appendData: z];
+      cannedCompressed = [d copy];
+    }
+
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (sock < 0
+    || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0
+    || listen(sock, 1024) < 0
+    || getsockname(sock, (struct sockaddr*)&addr, &len) < 0
+    || pthread_create(&t, 0, serveListener, (void*)(intptr_t)sock) != 0)
+    {
+      return 0;
+    }
+  pthread_detach(t);
+  return ntohs(addr.sin_port);
+}
+
+void
+testServerSetBandwidth(unsigned bytesPerSecond)
+{
+  bandwidth = bytesPerSecond;
+}
+
+void
+testServerHold(BOOL flag)
+{
+  pthread_mutex_lock(&holdLock);
+  holding = flag;
+  pthread_cond_broadcast(&holdCond);
+  pthread_mutex_unlock(&holdLock);
+}
+
+unsigned
+testServerRequests(void)
+{
+  return __sync_fetch_and_add(&requests, 0);
+}
+
+#endif